@@ -0,0 +1,427 @@
+/** ----------------------------------------------------------------------------------
+ * File: alloc_check.c
+ * Description: Allocation check of the host side of the playback pipeline, built with
+ *              `make host` so it runs on x86 as well as on the Pi; `make alloc-check` runs it
+ *              on the bar clips in videos/.
+ *              Each file goes through the same stages as in the A/V sync check: demuxing onto
+ *              the timeline, the packet FIFOs, the player's audio decoding stage into the PCM
+ *              ring and its submit stage, and video decoding in software, with stand-ins for the
+ *              renderers. The
+ *              allocation counting of the ALLOC_DEBUG build is linked in and every stage is
+ *              counted as the pipeline thread it stands for.
+ *              The stages run as fast as they can, so the phases follow the media rather than
+ *              the wall clock: the steady state begins once a fifth of the clip was presented,
+ *              at half of it the demuxer seeks back to the start like rpi_mp_seek does and
+ *              switches the audio track, and the steady state begins again a fifth into the
+ *              clip. The check fails if our code allocated in the steady state, or if audio did
+ *              not go on after the track switch.
+ * ----------------------------------------------------------------------------------- */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "rpi_mp.h"
+#include "rpi_mp_alloc_debug.h"
+#include "rpi_mp_timeline.h"
+#include "rpi_mp_packet_buffer.h"
+#include "rpi_mp_pcm_ring.h"
+#include "rpi_mp_audio_decode.h"
+#include "rpi_mp_audio_submit.h"
+#include "rpi_mp_soft_video.h"
+#include "rpi_mp_utils.h"
+
+#define FIFO_SIZE         (1024 * 1024 * 5)
+#define FIFO_SLEEPY_TIME  1000
+#define RING_MS           200
+#define SEEK_TIMEOUT_US   (10 * 1000000LL)
+
+static AVFormatContext * fmt_ctx;
+static AVCodecContext  * audio_ctx;
+static AVCodecContext  * track_ctx;    /* the audio track switched to */
+static int               video_idx, audio_idx;
+static timeline          packet_timeline;
+static packet_buffer     video_fifo, audio_fifo;
+static pcm_ring          ring;
+static audio_decoder     decoder;
+static audio_submit      submit;
+static soft_video        video;
+static int               done_reading;
+static int               audio_errors;
+static uint64_t          switched_frames;
+static pthread_mutex_t   track_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// where the phases change, in microseconds from the start of the clip
+static int64_t           start_time, steady_at, seek_at;
+static int               phase, seek_requested, seeked, steady_states;
+static pthread_mutex_t   phase_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ *	Called by the stand-ins for everything they present, moves the phases along.
+ *	Frames and audio still in flight from before the seek are later than seek_at and don't count.
+ */
+static void presented (int64_t pts)
+{
+	int64_t t;
+
+	if (pts == AV_NOPTS_VALUE)
+		return;
+	t = pts - start_time;
+	pthread_mutex_lock (&phase_mutex);
+	if ((phase == ALLOC_STARTUP && t >= steady_at) || (phase == ALLOC_SEEK && t >= steady_at && t < seek_at))
+	{
+		phase = ALLOC_STEADY;
+		steady_states ++;
+		alloc_debug_phase (ALLOC_STEADY);
+	}
+	else if (phase == ALLOC_STEADY && !seeked && t >= seek_at)
+		__atomic_store_n (&seek_requested, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock (&phase_mutex);
+}
+
+
+static void* decode_video (void* arg)
+{
+	AVPacket packet;
+	int      finished;
+
+	alloc_debug_thread (THREAD_VIDEO);
+	for (;;)
+	{
+		finished = __atomic_load_n (&done_reading, __ATOMIC_ACQUIRE);
+		if (pop_packet (&video_fifo, &packet) != 0)
+		{
+			if (finished)
+				break;
+			usleep (FIFO_SLEEPY_TIME);
+			continue;
+		}
+		soft_video_decode (&video, &packet);
+		av_packet_unref (&packet);
+	}
+	av_init_packet (&packet);
+	packet.data = NULL;
+	packet.size = 0;
+	soft_video_decode (&video, &packet);
+	soft_video_finish (&video);
+	return NULL;
+}
+
+
+static void* show_video (void* arg)
+{
+	int64_t pts;
+
+	alloc_debug_thread (THREAD_VIDEO_RENDER);
+	while (soft_video_acquire (&video, &pts) != NULL)
+	{
+		presented (pts);
+		soft_video_release (&video);
+	}
+	return NULL;
+}
+
+
+/**
+ *	FIFO to the player's decoding stage, which writes into the PCM ring.
+ */
+static void* decode_audio (void* arg)
+{
+	AVPacket packet, pending;
+	int      finished;
+
+	alloc_debug_thread (THREAD_AUDIO);
+	for (;;)
+	{
+		finished = __atomic_load_n (&done_reading, __ATOMIC_ACQUIRE);
+		if (pop_packet (&audio_fifo, &packet) != 0)
+		{
+			if (finished)
+				break;
+			usleep (FIFO_SLEEPY_TIME);
+			continue;
+		}
+		// between packets the stage goes on with the track switched to, the old one is closed
+		pthread_mutex_lock (&track_mutex);
+		if (track_ctx && decoder.codec_ctx != track_ctx)
+		{
+			audio_decoder_switch (&decoder, track_ctx);
+			avcodec_close (audio_ctx);
+			switched_frames = decoder.frames;
+		}
+		pthread_mutex_unlock (&track_mutex);
+		pending = packet;
+		if (audio_decode_packet (&decoder, &pending, &ring) < 0)
+			audio_errors ++;
+		av_packet_unref (&packet);
+	}
+	pcm_ring_finish (&ring);
+	return NULL;
+}
+
+
+/**
+ *	The player's submit stage, with a stand-in for the renderer.
+ */
+static void* submit_audio (void* arg)
+{
+	uint8_t* buffer;
+	int64_t  pts;
+
+	alloc_debug_thread (THREAD_AUDIO_SUBMIT);
+	buffer = (uint8_t*) malloc (submit.chunk);
+	while (buffer && audio_submit_wait (&submit, NULL) > 0)
+	{
+		if (audio_submit_take (&submit, buffer, &pts) > 0)
+			presented (pts);
+	}
+	free (buffer);
+	return NULL;
+}
+
+
+/**
+ *	Opens the audio track to switch to and hands it to the decoding stage, as rpi_mp_set_tracks
+ *	does. The clips have a single audio track, a decoder of its own for it stands in for another.
+ */
+static void switch_audio_track ()
+{
+	AVCodec       * codec = avcodec_find_decoder (audio_ctx->codec_id);
+	AVCodecContext* ctx   = avcodec_alloc_context3 (codec);
+
+	if (!ctx || avcodec_copy_context (ctx, audio_ctx) != 0 || avcodec_open2 (ctx, codec, NULL) < 0)
+	{
+		fprintf (stderr, "Could not open the audio track to switch to\n");
+		avcodec_free_context (&ctx);
+		audio_errors ++;
+		return;
+	}
+	pthread_mutex_lock (&track_mutex);
+	track_ctx = ctx;
+	pthread_mutex_unlock (&track_mutex);
+}
+
+
+/**
+ *	Drops what is buffered and starts over at the beginning of the clip, as rpi_mp_seek does.
+ */
+static void seek_to_start ()
+{
+	pthread_mutex_lock (&phase_mutex);
+	phase  = ALLOC_SEEK;
+	seeked = 1;
+	alloc_debug_phase (ALLOC_SEEK);
+	pthread_mutex_unlock (&phase_mutex);
+	flush_buffer (&video_fifo);
+	flush_buffer (&audio_fifo);
+	if (audio_ctx)
+	{
+		pcm_ring_flush (&ring);
+		switch_audio_track ();
+	}
+	if (video.codec_ctx)
+		soft_video_flush (&video);
+	if (av_seek_frame (fmt_ctx, -1, fmt_ctx->start_time != AV_NOPTS_VALUE ? fmt_ctx->start_time : 0, AVSEEK_FLAG_BACKWARD) < 0)
+		fprintf (stderr, "Could not seek to the start\n");
+	timeline_reset (&packet_timeline);
+	__atomic_store_n (&seek_requested, 0, __ATOMIC_RELEASE);
+}
+
+
+static void close_file ()
+{
+	if (audio_ctx)
+	{
+		destroy_audio_decoder (&decoder);
+		avcodec_close (audio_ctx);
+		avcodec_free_context (&track_ctx);
+		destroy_pcm_ring (&ring);
+	}
+	if (video.codec_ctx)
+		close_soft_video (&video);
+	destroy_packet_buffer (&video_fifo);
+	destroy_packet_buffer (&audio_fifo);
+	destroy_timeline (&packet_timeline);
+	avformat_close_input (&fmt_ctx);
+	audio_ctx = NULL;
+}
+
+
+/**
+ *	Plays a file through the pipeline with a seek in the middle.
+ *	Returns 0 if the steady state did not allocate, 1 on error, 2 if it did.
+ */
+static int check_file (const char* file)
+{
+	pthread_t      threads[4];
+	AVPacket       packet;
+	AVCodec      * codec;
+	packet_buffer* fifo;
+	int64_t        eof_at = 0;
+	int            i, n_threads = 0, frame_size, reading = 1, dropped, switched;
+	uint64_t       steady;
+
+	alloc_debug_reset ();
+	alloc_debug_phase (ALLOC_OPEN);
+	fmt_ctx        = NULL;
+	done_reading   = 0;
+	seek_requested = 0;
+	seeked         = 0;
+	steady_states  = 0;
+	audio_errors   = 0;
+	phase          = ALLOC_OPEN;
+	memset (&video, 0x0, sizeof (soft_video));
+	if (avformat_open_input (&fmt_ctx, file, NULL, NULL) < 0 || avformat_find_stream_info (fmt_ctx, NULL) < 0)
+	{
+		fprintf (stderr, "Could not open %s\n", file);
+		return 1;
+	}
+	if (fmt_ctx->duration <= 0)
+	{
+		fprintf (stderr, "%s has no duration to place the phases in\n", file);
+		avformat_close_input (&fmt_ctx);
+		return 1;
+	}
+	start_time = fmt_ctx->start_time != AV_NOPTS_VALUE ? fmt_ctx->start_time : 0;
+	steady_at  = fmt_ctx->duration / 5;
+	seek_at    = fmt_ctx->duration / 2;
+	video_idx  = av_find_best_stream (fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+	audio_idx  = av_find_best_stream (fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+	init_timeline (&packet_timeline, fmt_ctx);
+	init_packet_buffer (&video_fifo, FIFO_SIZE);
+	init_packet_buffer (&audio_fifo, FIFO_SIZE);
+
+	if (video_idx >= 0)
+	{
+		if (open_soft_video (&video, fmt_ctx->streams[video_idx], 0, NULL) != 0)
+		{
+			close_file ();
+			return 1;
+		}
+		video.time_base = AV_TIME_BASE_Q;
+	}
+	if (audio_idx >= 0)
+	{
+		audio_ctx = fmt_ctx->streams[audio_idx]->codec;
+		if (!(codec = avcodec_find_decoder (audio_ctx->codec_id)) || avcodec_open2 (audio_ctx, codec, NULL) < 0)
+		{
+			fprintf (stderr, "Could not open the %s decoder\n", avcodec_get_name (audio_ctx->codec_id));
+			audio_ctx = NULL;
+			close_file ();
+			return 1;
+		}
+		// allocated while opening, as in the player
+		frame_size = audio_ctx->frame_size > 0 ? audio_ctx->frame_size : audio_ctx->sample_rate / 50;
+		if (init_audio_submit (&submit, &ring, audio_ctx->sample_rate, audio_ctx->channels, RING_MS, frame_size * audio_ctx->channels * 2) != 0)
+		{
+			avcodec_close (audio_ctx);
+			audio_ctx = NULL;
+			close_file ();
+			return 1;
+		}
+		if (init_audio_decoder (&decoder, audio_ctx) != 0)
+		{
+			destroy_pcm_ring (&ring);
+			avcodec_close (audio_ctx);
+			audio_ctx = NULL;
+			close_file ();
+			return 1;
+		}
+	}
+	for (i = 0; i < (int) fmt_ctx->nb_streams; i ++)
+		fmt_ctx->streams[i]->discard = i == video_idx || i == audio_idx ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+
+	phase = ALLOC_STARTUP;
+	alloc_debug_phase (ALLOC_STARTUP);
+	if (video_idx >= 0)
+	{
+		pthread_create (&threads[n_threads ++], NULL, decode_video, NULL);
+		pthread_create (&threads[n_threads ++], NULL, show_video, NULL);
+	}
+	if (audio_idx >= 0)
+	{
+		pthread_create (&threads[n_threads ++], NULL, decode_audio, NULL);
+		pthread_create (&threads[n_threads ++], NULL, submit_audio, NULL);
+	}
+
+	for (;;)
+	{
+		if (__atomic_load_n (&seek_requested, __ATOMIC_ACQUIRE))
+		{
+			seek_to_start ();
+			reading = 1;
+		}
+		if (!reading)
+		{
+			// the whole clip is buffered, wait for the stand-ins to get to the seek
+			if (seeked || monotonic_us () - eof_at > SEEK_TIMEOUT_US)
+				break;
+			usleep (FIFO_SLEEPY_TIME);
+			continue;
+		}
+		if (av_read_frame (fmt_ctx, &packet) < 0)
+		{
+			reading = 0;
+			eof_at  = monotonic_us ();
+			continue;
+		}
+		if (packet.stream_index != video_idx && packet.stream_index != audio_idx)
+		{
+			av_packet_unref (&packet);
+			continue;
+		}
+		timeline_packet (&packet_timeline, fmt_ctx, &packet);
+		fifo    = packet.stream_index == video_idx ? &video_fifo : &audio_fifo;
+		dropped = 0;
+		while (!dropped && push_packet (fifo, packet) != 0)
+		{
+			// a packet from before the seek
+			if ((dropped = __atomic_load_n (&seek_requested, __ATOMIC_ACQUIRE)))
+				av_packet_unref (&packet);
+			else
+				usleep (FIFO_SLEEPY_TIME);
+		}
+	}
+	__atomic_store_n (&done_reading, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < n_threads; i ++)
+		pthread_join (threads[i], NULL);
+
+	alloc_debug_phase (ALLOC_CLOSE);
+	// decoded with the track switched to, without errors
+	switched = !track_ctx || (decoder.codec_ctx == track_ctx && decoder.frames > switched_frames && audio_errors == 0);
+	close_file ();
+	printf ("%s:\n", file);
+	steady = alloc_debug_report ();
+	if (steady_states < 2)
+	{
+		fprintf (stderr, "%s: the steady state was reached %d times instead of before and after the seek\n", file, steady_states);
+		return 1;
+	}
+	if (!switched)
+	{
+		fprintf (stderr, "%s: audio did not go on after the track switch, %d decoding errors\n", file, audio_errors);
+		return 1;
+	}
+	return steady > 0 ? 2 : 0;
+}
+
+
+int main (int argc, char** argv)
+{
+	int i, ret = 0;
+
+	if (argc < 2)
+	{
+		printf ("Usage: \n%s <file> [file ...]\n", argv[0]);
+		return 1;
+	}
+	alloc_debug_thread (THREAD_DEMUX);
+	alloc_debug_warmup (0);
+	av_register_all ();
+	av_log_set_level (AV_LOG_ERROR);
+	for (i = 1; i < argc; i ++)
+		ret |= check_file (argv[i]);
+	printf ("%s\n", ret & 2 ? "STEADY STATE ALLOCATES" : ret ? "errors" : "no allocations in the steady state");
+	return ret & 2 ? 2 : ret;
+}
@@ -0,0 +1,90 @@
+/** ----------------------------------------------------------------------------------
+ * File: audio_tap_bench.c
+ * Description: Cost of the audio analysis tap, built with `make host` so it runs on x86 as
+ *              well as on the Pi. Feeds a synthetic signal (a 1 kHz sine at -6 dBFS on the
+ *              first channel, noise at -20 dBFS on the others) through the tap in MP3 sized
+ *              frames as fast as it can, and reports the CPU time of writing and analysing as
+ *              a share of one core at real time. The budget on a Pi Zero is 2%.
+ * ----------------------------------------------------------------------------------- */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <libavutil/avutil.h>
+#include "rpi_mp.h"
+#include "rpi_mp_audio_tap.h"
+
+#define FRAME_SAMPLES 1152
+#define BUDGET        2.0
+
+static audio_tap tap;
+
+
+static int64_t thread_cpu_us ()
+{
+	struct timespec t;
+	clock_gettime (CLOCK_THREAD_CPUTIME_ID, &t);
+	return (int64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+
+int main (int argc, char** argv)
+{
+	int      seconds     = argc > 1 ? atoi (argv[1]) : 600;
+	int      sample_rate = argc > 2 ? atoi (argv[2]) : 48000;
+	int      channels    = argc > 3 ? atoi (argv[3]) : 2;
+	int64_t  total       = (int64_t) seconds * sample_rate, done, write_us = 0, analyse_us = 0, start;
+	int16_t* frame;
+	double   share;
+	int      i, ch, band = 0;
+	rpi_mp_audio_analysis analysis;
+
+	if (seconds <= 0 || sample_rate <= 0 || channels < 1 || channels > AUDIO_TAP_CHANNELS)
+	{
+		printf ("Usage: \n%s [seconds] [sample rate] [channels (1-%d)]\n", argv[0], AUDIO_TAP_CHANNELS);
+		return 1;
+	}
+	if (init_audio_tap (&tap, channels, sample_rate) != 0 || !(frame = (int16_t*) malloc (FRAME_SAMPLES * channels * sizeof (int16_t))))
+	{
+		fprintf (stderr, "Could not allocate the tap\n");
+		return 1;
+	}
+
+	for (done = 0; done < total; done += FRAME_SAMPLES)
+	{
+		for (i = 0; i < FRAME_SAMPLES; i ++)
+		{
+			frame[i * channels] = (int16_t) (16384.0 * sin (2.0 * M_PI * 1000.0 * (done + i) / sample_rate));
+			for (ch = 1; ch < channels; ch ++)
+				frame[i * channels + ch] = (int16_t) ((rand () % 6554) - 3277);
+		}
+		start = thread_cpu_us ();
+		audio_tap_write (&tap, frame, FRAME_SAMPLES, done * AV_TIME_BASE / sample_rate);
+		write_us += thread_cpu_us () - start;
+
+		start = thread_cpu_us ();
+		while (audio_tap_analyse (&tap))
+			;
+		analyse_us += thread_cpu_us () - start;
+	}
+
+	if (audio_tap_result (&tap, INT64_MAX, &analysis) != 0)
+	{
+		fprintf (stderr, "No analysis\n");
+		return 1;
+	}
+	for (i = 1; i < AUDIO_SPECTRUM_BANDS; i ++)
+		if (analysis.spectrum[i] > analysis.spectrum[band])
+			band = i;
+
+	share = 100.0 * (write_us + analyse_us) / ((double) total * 1000000 / sample_rate);
+	printf ("%d s of %d Hz, %d channels: %llu windows, %llu skipped\n", seconds, sample_rate, channels, tap.windows, tap.skipped);
+	printf ("write   %8.3f us per frame\n", (double) write_us / (total / FRAME_SAMPLES));
+	printf ("analyse %8.3f us per window\n", (double) analyse_us / (tap.windows ? tap.windows : 1));
+	printf ("last window: peak %.3f rms %.3f on channel 0, loudest band %d at %.1f dBFS\n",
+	        analysis.peak[0], analysis.rms[0], band, analysis.spectrum[band]);
+	printf ("%.3f%% of a core at real time, %s the %.0f%% budget\n", share, share <= BUDGET ? "within" : "OVER", BUDGET);
+	free (frame);
+	destroy_audio_tap (&tap);
+	return share <= BUDGET ? 0 : 2;
+}
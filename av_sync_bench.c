@@ -0,0 +1,546 @@
+/** ----------------------------------------------------------------------------------
+ * File: av_sync_bench.c
+ * Description: Headless A/V sync check, built with `make host` so it runs on x86 as well as
+ *              on the Pi; `make sync-check` runs it on the bar clips in videos/.
+ *              Each file goes through the host side of the playback pipeline: demuxing onto
+ *              the timeline, the packet FIFOs, the player's audio decoding stage into the PCM
+ *              ring and its submit stage taking a frame at a time, and video decoding in
+ *              software. Stand-ins take the place of the renderers and the OMX clock. Every audio buffer and video frame
+ *              is recorded with the timestamp the pipeline gave it and the one the container
+ *              gave it.
+ *              The stand-in clock starts at the earliest timestamp and follows the audio, like
+ *              the OMX clock with an audio reference: audio buffers are heard back to back and a
+ *              frame is shown at the first vsync at which the clock has reached it. The offset of
+ *              a frame is the time it is shown minus the time the sound of the same instant of
+ *              the container is heard, positive when the picture is late. Offsets, frame jitter
+ *              and the startup skew are reported per file and display refresh rate, and the
+ *              check fails if an offset exceeds the limit.
+ * ----------------------------------------------------------------------------------- */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+#include "rpi_mp_timeline.h"
+#include "rpi_mp_packet_buffer.h"
+#include "rpi_mp_pcm_ring.h"
+#include "rpi_mp_audio_decode.h"
+#include "rpi_mp_audio_submit.h"
+#include "rpi_mp_soft_video.h"
+#include "rpi_mp_utils.h"
+
+#define MAX_OFFSET_MS     40      /* ITU-R BT.1359 finds 45 ms of audio lead detectable */
+#define FIFO_SIZE         (1024 * 1024 * 5)
+#define FIFO_SLEEPY_TIME  1000
+#define RING_MS           200
+
+static const int refresh_rates[] = { 50, 60 };
+
+/**
+ *	A buffer or frame as it would be presented: the timestamp of the pipeline, that of the
+ *	container and how long it lasts, all in microseconds.
+ */
+typedef struct
+{
+	int64_t pts;
+	int64_t truth;
+	int64_t duration;
+} presentation;
+
+typedef struct
+{
+	presentation * items;
+	size_t         n;
+	size_t         size;
+} record;
+
+static AVFormatContext * fmt_ctx;
+static AVCodecContext  * audio_ctx;
+static int               video_idx, audio_idx;
+static timeline          packet_timeline;
+static packet_buffer     video_fifo, audio_fifo;
+static pcm_ring          ring;
+static audio_decoder     decoder;
+static audio_submit      submit;
+static soft_video        video;
+static int               done_reading;
+static record            audio_record, video_record;
+
+// the container's time of byte positions in the PCM ring, the truth the ring's own marks are checked against
+static pcm_mark        * truth_marks;
+static size_t            n_truth_marks, truth_marks_size;
+static pthread_mutex_t   truth_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void record_add (record* r, int64_t pts, int64_t truth, int64_t duration)
+{
+	presentation* items;
+
+	if (r->n == r->size)
+	{
+		if (!(items = (presentation*) realloc (r->items, (r->size ? r->size * 2 : 1024) * sizeof (presentation))))
+			return;
+		r->items = items;
+		r->size  = r->size ? r->size * 2 : 1024;
+	}
+	r->items[r->n].pts      = pts;
+	r->items[r->n].truth    = truth;
+	r->items[r->n].duration = duration;
+	r->n ++;
+}
+
+
+static void add_truth_mark (uint64_t position, int64_t truth)
+{
+	pcm_mark* marks;
+
+	pthread_mutex_lock (&truth_mutex);
+	if (n_truth_marks == truth_marks_size)
+	{
+		if (!(marks = (pcm_mark*) realloc (truth_marks, (truth_marks_size ? truth_marks_size * 2 : 1024) * sizeof (pcm_mark))))
+		{
+			pthread_mutex_unlock (&truth_mutex);
+			return;
+		}
+		truth_marks      = marks;
+		truth_marks_size = truth_marks_size ? truth_marks_size * 2 : 1024;
+	}
+	truth_marks[n_truth_marks].position = position;
+	truth_marks[n_truth_marks].pts      = truth;
+	n_truth_marks ++;
+	pthread_mutex_unlock (&truth_mutex);
+}
+
+
+static int64_t truth_at (uint64_t position)
+{
+	int64_t truth = AV_NOPTS_VALUE;
+	size_t  i;
+
+	pthread_mutex_lock (&truth_mutex);
+	for (i = n_truth_marks; i > 0; i --)
+		if (truth_marks[i - 1].position <= position)
+		{
+			if (truth_marks[i - 1].pts != AV_NOPTS_VALUE)
+				truth = truth_marks[i - 1].pts + (int64_t) (position - truth_marks[i - 1].position) * AV_TIME_BASE / ring.bytes_per_second;
+			break;
+		}
+	pthread_mutex_unlock (&truth_mutex);
+	return truth;
+}
+
+
+/**
+ *	Video decoding thread: FIFO to the software decoder, like the player's.
+ */
+static void* decode_video (void* arg)
+{
+	AVPacket packet;
+	int      finished;
+
+	for (;;)
+	{
+		// everything was pushed before done_reading was set, so an empty FIFO after it is the end
+		finished = __atomic_load_n (&done_reading, __ATOMIC_ACQUIRE);
+		if (pop_packet (&video_fifo, &packet) != 0)
+		{
+			if (finished)
+				break;
+			usleep (FIFO_SLEEPY_TIME);
+			continue;
+		}
+		soft_video_decode (&video, &packet);
+		av_packet_unref (&packet);
+	}
+	av_init_packet (&packet);
+	packet.data = NULL;
+	packet.size = 0;
+	soft_video_decode (&video, &packet);
+	soft_video_finish (&video);
+	return NULL;
+}
+
+
+/**
+ *	Stand-in for the video renderer: records the frames in presentation order.
+ *	The container's timestamp came through the decoder as the packet position.
+ */
+static void* show_video (void* arg)
+{
+	AVFrame* frame;
+	int64_t  pts;
+
+	while ((frame = soft_video_acquire (&video, &pts)) != NULL)
+	{
+		if (pts != AV_NOPTS_VALUE && av_frame_get_pkt_pos (frame) != AV_NOPTS_VALUE)
+			record_add (&video_record, pts, av_frame_get_pkt_pos (frame), 0);
+		soft_video_release (&video);
+	}
+	return NULL;
+}
+
+
+/**
+ *	Where the decoding stage is in the ring and in the container's time.
+ */
+typedef struct
+{
+	uint64_t written;
+	int64_t  truth;
+} truth_track;
+
+/**
+ *	Sees every frame the decoding stage writes, marks the container's time of its position.
+ */
+static void track_truth (void* opaque, const int16_t* samples, int frames, int64_t pts)
+{
+	truth_track* track = (truth_track*) opaque;
+
+	add_truth_mark (track->written, track->truth);
+	track->written += (uint64_t) frames * audio_ctx->channels * 2;
+	if (track->truth != AV_NOPTS_VALUE)
+		track->truth += (int64_t) frames * AV_TIME_BASE / audio_ctx->sample_rate;
+}
+
+
+/**
+ *	Audio decoding thread: FIFO to the player's decoding stage, which writes into the PCM ring.
+ */
+static void* decode_audio (void* arg)
+{
+	AVPacket    packet, pending;
+	truth_track track = { 0, AV_NOPTS_VALUE };
+	int         finished;
+
+	decoder.tap        = track_truth;
+	decoder.tap_opaque = &track;
+	for (;;)
+	{
+		finished = __atomic_load_n (&done_reading, __ATOMIC_ACQUIRE);
+		if (pop_packet (&audio_fifo, &packet) != 0)
+		{
+			if (finished)
+				break;
+			usleep (FIFO_SLEEPY_TIME);
+			continue;
+		}
+		track.truth = packet.pos;
+		pending     = packet;
+		audio_decode_packet (&decoder, &pending, &ring);
+		av_packet_unref (&packet);
+	}
+	pcm_ring_finish (&ring);
+	return NULL;
+}
+
+
+/**
+ *	Audio submit thread: the player's submit stage, with a stand-in for the renderer.
+ */
+static void* submit_audio (void* arg)
+{
+	uint8_t* buffer = (uint8_t*) malloc (submit.chunk);
+	int64_t  pts;
+	size_t   n;
+
+	while (buffer && audio_submit_wait (&submit, NULL) > 0)
+	{
+		if ((n = audio_submit_take (&submit, buffer, &pts)) == 0)
+			continue;
+		record_add (&audio_record, pts, truth_at (submit.taken - n), (int64_t) n * AV_TIME_BASE / ring.bytes_per_second);
+	}
+	free (buffer);
+	return NULL;
+}
+
+
+static int compare_int64 (const void* a, const void* b)
+{
+	int64_t x = *(const int64_t*) a, y = *(const int64_t*) b;
+	return x < y ? -1 : x > y;
+}
+
+
+/**
+ *	Index of the last item whose field is at or before t, -1 if there is none.
+ */
+static long find_before (const record* r, int64_t t, int truth)
+{
+	long lo = 0, hi = (long) r->n - 1, mid, found = -1;
+
+	while (lo <= hi)
+	{
+		mid = (lo + hi) / 2;
+		if ((truth ? r->items[mid].truth : r->items[mid].pts) <= t)
+		{
+			found = mid;
+			lo    = mid + 1;
+		}
+		else
+			hi = mid - 1;
+	}
+	return found;
+}
+
+
+/**
+ *	Replays the records against the stand-in clock and a display refreshing at refresh Hz.
+ *	Returns 0 if the file is in sync, 2 if not.
+ */
+static int analyse (const char* file, double fps, int refresh, int64_t limit)
+{
+	const record* a = &audio_record;
+	const record* v = &video_record;
+	int64_t* heard_at  = (int64_t*) malloc ((a->n + 1) * sizeof (int64_t));
+	int64_t* shown_at  = (int64_t*) malloc ((v->n + 1) * sizeof (int64_t));
+	int64_t* offsets   = (int64_t*) malloc ((v->n + 1) * sizeof (int64_t));
+	int64_t  start, w, t, prev_shown = 0, prev_truth = 0, skew = 0, max_jitter = 0, max_abs = 0;
+	double   jitter = 0.0, mean = 0.0;
+	size_t   k, n_offsets = 0, n_shown = 0, n_dropped = 0;
+	long     i;
+	int      fail, audio = a->n && a->items[0].pts != AV_NOPTS_VALUE;
+
+	if (!heard_at || !shown_at || !offsets || v->n == 0)
+	{
+		printf ("%s: no video frames\n", file);
+		free (heard_at);
+		free (shown_at);
+		free (offsets);
+		return v->n == 0 ? 0 : 1;
+	}
+	// the clock waits for the earliest start time of both
+	start = v->items[0].pts;
+	if (audio && a->items[0].pts < start)
+		start = a->items[0].pts;
+	// audio plays back to back from the moment the clock reaches the first buffer
+	for (k = 0; audio && k < a->n; k ++)
+		heard_at[k] = k == 0 ? a->items[0].pts - start : heard_at[k - 1] + a->items[k - 1].duration;
+
+	// a frame is shown at the first vsync at which the clock has reached it
+	for (k = 0; k < v->n; k ++)
+	{
+		t = v->items[k].pts;
+		i = audio ? find_before (a, t, 0) : -1;
+		if (i < 0)
+			w = t - start;
+		else
+		{
+			// the clock runs on from the buffer that plays, and jumps when the next one starts
+			w = heard_at[i] + t - a->items[i].pts;
+			if ((size_t) i + 1 < a->n && w > heard_at[i + 1])
+				w = heard_at[i + 1];
+		}
+		shown_at[k] = (w * refresh + AV_TIME_BASE - 1) / AV_TIME_BASE * AV_TIME_BASE / refresh;
+	}
+	// of the frames due at the same vsync only the last one is seen
+	for (k = 0; k < v->n; k ++)
+	{
+		if (k + 1 < v->n && shown_at[k + 1] <= shown_at[k])
+		{
+			n_dropped ++;
+			continue;
+		}
+		if (n_shown ++ == 0 && audio)
+			skew = shown_at[k] - heard_at[0] - (v->items[k].truth - a->items[0].truth);
+		else if (n_shown > 1)
+		{
+			t = shown_at[k] - prev_shown - (v->items[k].truth - prev_truth);
+			jitter += (double) t * t;
+			if (llabs (t) > max_jitter)
+				max_jitter = llabs (t);
+		}
+		prev_shown = shown_at[k];
+		prev_truth = v->items[k].truth;
+
+		// when the sound of the same instant is heard
+		if (!audio || (i = find_before (a, v->items[k].truth, 1)) < 0 || a->items[i].truth == AV_NOPTS_VALUE ||
+		    v->items[k].truth - a->items[i].truth > a->items[i].duration)
+			continue;
+		offsets[n_offsets] = shown_at[k] - (heard_at[i] + v->items[k].truth - a->items[i].truth);
+		mean += offsets[n_offsets];
+		if (llabs (offsets[n_offsets]) > max_abs)
+			max_abs = llabs (offsets[n_offsets]);
+		n_offsets ++;
+	}
+
+	printf ("%s (%.2f fps) on %d Hz: %zu frames shown, %zu dropped", file, fps, refresh, n_shown, n_dropped);
+	if (n_shown > 1)
+		printf (", jitter %.1f ms rms (max %.1f ms)", sqrt (jitter / (n_shown - 1)) / 1000, max_jitter / 1000.0);
+	fail = max_abs > limit || llabs (skew) > limit;
+	if (n_offsets)
+	{
+		qsort (offsets, n_offsets, sizeof (int64_t), compare_int64);
+		printf ("\n  A/V offset over %zu frames: mean %.1f ms, min %.1f, p5 %.1f, median %.1f, p95 %.1f, max %.1f ms; "
+		        "startup skew %.1f ms: %s\n", n_offsets, mean / n_offsets / 1000,
+		        offsets[0] / 1000.0, offsets[n_offsets * 5 / 100] / 1000.0, offsets[n_offsets / 2] / 1000.0,
+		        offsets[n_offsets * 95 / 100] / 1000.0, offsets[n_offsets - 1] / 1000.0, skew / 1000.0,
+		        fail ? "FAIL" : "ok");
+	}
+	else
+		printf (", no audio to compare with\n");
+	free (heard_at);
+	free (shown_at);
+	free (offsets);
+	return fail ? 2 : 0;
+}
+
+
+static void close_file ()
+{
+	if (audio_ctx)
+	{
+		destroy_audio_decoder (&decoder);
+		avcodec_close (audio_ctx);
+		destroy_pcm_ring (&ring);
+	}
+	if (video.codec_ctx)
+		close_soft_video (&video);
+	destroy_packet_buffer (&video_fifo);
+	destroy_packet_buffer (&audio_fifo);
+	destroy_timeline (&packet_timeline);
+	avformat_close_input (&fmt_ctx);
+	free (audio_record.items);
+	free (video_record.items);
+	free (truth_marks);
+	memset (&audio_record, 0x0, sizeof (record));
+	memset (&video_record, 0x0, sizeof (record));
+	truth_marks   = NULL;
+	n_truth_marks = truth_marks_size = 0;
+	audio_ctx     = NULL;
+}
+
+
+/**
+ *	Plays a file through the pipeline and checks it at every refresh rate.
+ *	Returns 0 if it is in sync, 1 on error, 2 if it is out of sync.
+ */
+static int check_file (const char* file, int64_t limit)
+{
+	pthread_t     threads[4];
+	AVPacket      packet;
+	AVStream    * stream;
+	AVCodec     * codec;
+	packet_buffer* fifo;
+	int64_t       raw;
+	double        fps;
+	int           i, n_threads = 0, frame_size, ret = 0;
+
+	fmt_ctx      = NULL;
+	done_reading = 0;
+	memset (&video, 0x0, sizeof (soft_video));
+	if (avformat_open_input (&fmt_ctx, file, NULL, NULL) < 0 || avformat_find_stream_info (fmt_ctx, NULL) < 0)
+	{
+		fprintf (stderr, "Could not open %s\n", file);
+		return 1;
+	}
+	video_idx = av_find_best_stream (fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+	audio_idx = av_find_best_stream (fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+	init_timeline (&packet_timeline, fmt_ctx);
+	init_packet_buffer (&video_fifo, FIFO_SIZE);
+	init_packet_buffer (&audio_fifo, FIFO_SIZE);
+
+	if (video_idx >= 0)
+	{
+		// no clock, so nothing is dropped for being late; packets arrive in microseconds
+		if (open_soft_video (&video, fmt_ctx->streams[video_idx], 0, NULL) != 0)
+		{
+			close_file ();
+			return 1;
+		}
+		video.time_base = AV_TIME_BASE_Q;
+	}
+	if (audio_idx >= 0)
+	{
+		audio_ctx = fmt_ctx->streams[audio_idx]->codec;
+		if (!(codec = avcodec_find_decoder (audio_ctx->codec_id)) || avcodec_open2 (audio_ctx, codec, NULL) < 0)
+		{
+			fprintf (stderr, "Could not open the %s decoder\n", avcodec_get_name (audio_ctx->codec_id));
+			audio_ctx = NULL;
+			close_file ();
+			return 1;
+		}
+		// a renderer buffer holds a codec frame, as in the player
+		frame_size = audio_ctx->frame_size > 0 ? audio_ctx->frame_size : audio_ctx->sample_rate / 50;
+		if (init_audio_submit (&submit, &ring, audio_ctx->sample_rate, audio_ctx->channels, RING_MS, frame_size * audio_ctx->channels * 2) != 0)
+		{
+			avcodec_close (audio_ctx);
+			audio_ctx = NULL;
+			close_file ();
+			return 1;
+		}
+		if (init_audio_decoder (&decoder, audio_ctx) != 0)
+		{
+			destroy_pcm_ring (&ring);
+			avcodec_close (audio_ctx);
+			audio_ctx = NULL;
+			close_file ();
+			return 1;
+		}
+	}
+	for (i = 0; i < (int) fmt_ctx->nb_streams; i ++)
+		fmt_ctx->streams[i]->discard = i == video_idx || i == audio_idx ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+
+	if (video_idx >= 0)
+	{
+		pthread_create (&threads[n_threads ++], NULL, decode_video, NULL);
+		pthread_create (&threads[n_threads ++], NULL, show_video, NULL);
+	}
+	if (audio_idx >= 0)
+	{
+		pthread_create (&threads[n_threads ++], NULL, decode_audio, NULL);
+		pthread_create (&threads[n_threads ++], NULL, submit_audio, NULL);
+	}
+
+	while (av_read_frame (fmt_ctx, &packet) >= 0)
+	{
+		if (packet.stream_index != video_idx && packet.stream_index != audio_idx)
+		{
+			av_packet_unref (&packet);
+			continue;
+		}
+		// the container's own timestamp travels along in the packet position
+		stream     = fmt_ctx->streams[packet.stream_index];
+		raw        = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+		packet.pos = raw != AV_NOPTS_VALUE ? av_rescale_q (raw, stream->time_base, AV_TIME_BASE_Q) : AV_NOPTS_VALUE;
+		timeline_packet (&packet_timeline, fmt_ctx, &packet);
+		fifo = packet.stream_index == video_idx ? &video_fifo : &audio_fifo;
+		while (push_packet (fifo, packet) != 0)
+			usleep (FIFO_SLEEPY_TIME);
+	}
+	__atomic_store_n (&done_reading, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < n_threads; i ++)
+		pthread_join (threads[i], NULL);
+
+	stream = video_idx >= 0 ? fmt_ctx->streams[video_idx] : NULL;
+	fps    = stream && stream->avg_frame_rate.den ? av_q2d (stream->avg_frame_rate) : 0.0;
+	printf ("%s: %zu frames, %zu audio buffers\n", file, video_record.n, audio_record.n);
+	for (i = 0; i < (int) (sizeof (refresh_rates) / sizeof (refresh_rates[0])); i ++)
+		ret |= analyse (file, fps, refresh_rates[i], limit);
+	close_file ();
+	return ret;
+}
+
+
+int main (int argc, char** argv)
+{
+	int64_t limit = MAX_OFFSET_MS * 1000;
+	int     first = 1, i, ret = 0;
+
+	if (argc > 2 && strcmp (argv[1], "-t") == 0)
+	{
+		limit = atoi (argv[2]) * 1000;
+		first = 3;
+	}
+	if (first >= argc || limit <= 0)
+	{
+		printf ("Usage: \n%s [-t max offset in ms, default %d] <file> [file ...]\n", argv[0], MAX_OFFSET_MS);
+		return 1;
+	}
+	av_register_all ();
+	av_log_set_level (AV_LOG_ERROR);
+	for (i = first; i < argc; i ++)
+		ret |= check_file (argv[i], limit);
+	printf ("%s\n", ret & 2 ? "OUT OF SYNC" : ret ? "errors" : "all in sync");
+	return ret & 2 ? 2 : ret;
+}
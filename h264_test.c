@@ -0,0 +1,349 @@
+/** ----------------------------------------------------------------------------------
+ * File: h264_test.c
+ * Description: Unit test of the H.264 access unit classifier, built with `make host` so it
+ *              runs on x86 as well as on the Pi. Classifies hand built access units, in both
+ *              length-prefixed and Annex B form, and checks the class of each. Given files,
+ *              also classifies every video packet and checks it against the keyframe flag of
+ *              the demuxer: keyframes must be restart points and the first frame an IDR.
+ * ----------------------------------------------------------------------------------- */
+#include <stdio.h>
+#include <string.h>
+#include <libavformat/avformat.h>
+#include "rpi_mp_h264.h"
+
+#define MAX_AU 256
+#define NAL_HEADER(ref_idc, type) ((ref_idc) << 5 | (type))
+
+static const char* class_names[] = { "unknown", "non-reference", "reference", "recovery", "idr" };
+
+/**
+ *	Writes the payload of a NAL unit bit by bit, inserting emulation prevention bytes.
+ */
+typedef struct
+{
+	uint8_t * data;
+	int       size;
+	int       zeros;
+	uint32_t  bits;
+	int       n_bits;
+}
+nal_writer;
+
+/**
+ *	An access unit under construction.
+ */
+typedef struct
+{
+	uint8_t data[MAX_AU];
+	int     size;
+	int     length_size;  // 0 for Annex B
+	int     nal_start;
+}
+access_unit;
+
+static int failures = 0;
+
+
+static void put_byte (nal_writer* w, uint8_t byte)
+{
+	if (w->zeros >= 2 && byte <= 3)
+	{
+		w->data[w->size ++] = 3;
+		w->zeros = 0;
+	}
+	w->data[w->size ++] = byte;
+	w->zeros = byte == 0 ? w->zeros + 1 : 0;
+}
+
+static void put_bits (nal_writer* w, uint32_t value, int n)
+{
+	while (n -- > 0)
+	{
+		w->bits = w->bits << 1 | ((value >> n) & 1);
+		if (++ w->n_bits == 8)
+		{
+			put_byte (w, w->bits);
+			w->bits   = 0;
+			w->n_bits = 0;
+		}
+	}
+}
+
+static void put_ue (nal_writer* w, uint32_t value)
+{
+	int n = 0;
+	while ((value + 1) >> (n + 1))
+		n ++;
+	put_bits (w, 0, n);
+	put_bits (w, value + 1, n + 1);
+}
+
+/**
+ *	rbsp_trailing_bits, then byte alignment.
+ */
+static void put_trailing (nal_writer* w)
+{
+	put_bits (w, 1, 1);
+	while (w->n_bits)
+		put_bits (w, 0, 1);
+}
+
+static void au_init (access_unit* au, int length_size)
+{
+	memset (au, 0x0, sizeof (access_unit));
+	au->length_size = length_size;
+}
+
+/**
+ *	Starts a NAL unit with the given header and returns a writer for its payload.
+ */
+static nal_writer au_nal (access_unit* au, uint8_t header)
+{
+	nal_writer w;
+	memset (&w, 0x0, sizeof (w));
+	if (au->length_size)
+		au->size += au->length_size;
+	else
+	{
+		// the first NAL unit of an access unit gets a 4-byte start code, the others 3 bytes
+		if (au->size == 0)
+			au->data[au->size ++] = 0;
+		au->data[au->size ++] = 0;
+		au->data[au->size ++] = 0;
+		au->data[au->size ++] = 1;
+	}
+	au->nal_start = au->size;
+	au->data[au->size ++] = header;
+	w.data = au->data + au->size;
+	return w;
+}
+
+static void au_end_nal (access_unit* au, nal_writer* w)
+{
+	int i, length;
+	put_trailing (w);
+	au->size += w->size;
+	length    = au->size - au->nal_start;
+	for (i = 0; i < au->length_size; i ++)
+		au->data[au->nal_start - 1 - i] = length >> (8 * i);
+}
+
+static void add_slice (access_unit* au, int ref_idc, int type, int first_mb, int slice_type)
+{
+	nal_writer w = au_nal (au, NAL_HEADER (ref_idc, type));
+	put_ue (&w, first_mb);
+	put_ue (&w, slice_type);
+	put_ue (&w, 0);  // pic_parameter_set_id
+	put_bits (&w, 0x5a, 8);
+	au_end_nal (au, &w);
+}
+
+static void add_sei (access_unit* au, int type, const uint8_t* payload, int size)
+{
+	nal_writer w = au_nal (au, NAL_HEADER (0, 6));
+	int        i;
+	put_bits (&w, type, 8);
+	put_bits (&w, size, 8);
+	for (i = 0; i < size; i ++)
+		put_bits (&w, payload[i], 8);
+	au_end_nal (au, &w);
+}
+
+static void add_parameter_sets (access_unit* au)
+{
+	nal_writer w = au_nal (au, NAL_HEADER (3, 7));
+	put_bits (&w, 0x4d401f, 24);
+	au_end_nal (au, &w);
+	w = au_nal (au, NAL_HEADER (3, 8));
+	put_ue (&w, 0);
+	au_end_nal (au, &w);
+}
+
+static void expect (const char* name, const access_unit* au, enum h264_frame_class expected)
+{
+	enum h264_frame_class got = h264_classify (au->data, au->size, au->length_size);
+	if (got != expected)
+	{
+		printf ("FAIL %-40s %-13s expected %s\n", name, class_names[got], class_names[expected]);
+		failures ++;
+	}
+	else
+		printf ("ok   %-40s %s\n", name, class_names[got]);
+}
+
+/**
+ *	Builds the same access units with each NAL unit framing and checks their class.
+ */
+static void test_framing (int length_size)
+{
+	static const uint8_t recovery[] = { 0x84 };
+	static const uint8_t user_data[20] = { 0 };
+	access_unit au;
+	char        name[64], framing[16];
+
+	if (length_size)
+		snprintf (framing, sizeof (framing), "length %d", length_size);
+	else
+		snprintf (framing, sizeof (framing), "annex b");
+
+	au_init (&au, length_size);
+	add_parameter_sets (&au);
+	add_slice (&au, 3, 5, 0, 7);
+	snprintf (name, sizeof (name), "%s: sps pps idr", framing);
+	expect (name, &au, H264_FRAME_IDR);
+
+	au_init (&au, length_size);
+	add_slice (&au, 2, 1, 0, 5);
+	snprintf (name, sizeof (name), "%s: p slice", framing);
+	expect (name, &au, H264_FRAME_REFERENCE);
+
+	au_init (&au, length_size);
+	add_slice (&au, 0, 1, 0, 6);
+	snprintf (name, sizeof (name), "%s: non-reference b slice", framing);
+	expect (name, &au, H264_FRAME_NON_REFERENCE);
+
+	au_init (&au, length_size);
+	add_slice (&au, 2, 1, 0, 2);
+	add_slice (&au, 2, 1, 120, 2);
+	snprintf (name, sizeof (name), "%s: two i slices without idr", framing);
+	expect (name, &au, H264_FRAME_RECOVERY);
+
+	au_init (&au, length_size);
+	add_slice (&au, 2, 1, 0, 2);
+	add_slice (&au, 2, 1, 120, 0);
+	snprintf (name, sizeof (name), "%s: i and p slice", framing);
+	expect (name, &au, H264_FRAME_REFERENCE);
+
+	au_init (&au, length_size);
+	add_sei (&au, 6, recovery, sizeof (recovery));
+	add_slice (&au, 2, 1, 0, 5);
+	snprintf (name, sizeof (name), "%s: recovery point sei, p slice", framing);
+	expect (name, &au, H264_FRAME_RECOVERY);
+
+	// the zeros of the user data need emulation prevention, which must not shift the next message
+	au_init (&au, length_size);
+	{
+		nal_writer w = au_nal (&au, NAL_HEADER (0, 6));
+		int        i;
+		put_bits (&w, 5, 8);
+		put_bits (&w, sizeof (user_data), 8);
+		for (i = 0; i < (int) sizeof (user_data); i ++)
+			put_bits (&w, user_data[i], 8);
+		put_bits (&w, 6, 8);
+		put_bits (&w, 1, 8);
+		put_bits (&w, recovery[0], 8);
+		au_end_nal (&au, &w);
+	}
+	add_slice (&au, 2, 1, 0, 5);
+	snprintf (name, sizeof (name), "%s: escaped user data, recovery", framing);
+	expect (name, &au, H264_FRAME_RECOVERY);
+
+	au_init (&au, length_size);
+	add_sei (&au, 5, user_data, sizeof (user_data));
+	add_slice (&au, 2, 1, 0, 5);
+	snprintf (name, sizeof (name), "%s: user data sei, p slice", framing);
+	expect (name, &au, H264_FRAME_REFERENCE);
+
+	// first_mb_in_slice long enough for its zeros to be escaped
+	au_init (&au, length_size);
+	add_slice (&au, 2, 1, (1 << 23) - 1, 7);
+	snprintf (name, sizeof (name), "%s: escaped slice header", framing);
+	expect (name, &au, H264_FRAME_RECOVERY);
+
+	au_init (&au, length_size);
+	add_parameter_sets (&au);
+	snprintf (name, sizeof (name), "%s: parameter sets only", framing);
+	expect (name, &au, H264_FRAME_UNKNOWN);
+}
+
+/**
+ *	Lengths that don't fit the access unit, including ones with the top bit set.
+ */
+static void test_bad_lengths ()
+{
+	static const uint8_t huge[]      = { 0xff, 0xff, 0xff, 0xf0, 0x65, 0x88 };
+	static const uint8_t long_nal[]  = { 0x00, 0x00, 0x00, 0x10, 0x65, 0x88 };
+	static const uint8_t truncated[] = { 0x00, 0x00, 0x00 };
+	static const uint8_t after_idr[] = { 0x00, 0x00, 0x00, 0x02, 0x65, 0x88, 0x80, 0x00, 0x00, 0x00, 0x41 };
+	access_unit au;
+
+	au_init (&au, 4);
+	memcpy (au.data, huge, sizeof (huge));
+	au.size = sizeof (huge);
+	expect ("length 4: top bit set", &au, H264_FRAME_UNKNOWN);
+	memcpy (au.data, long_nal, sizeof (long_nal));
+	au.size = sizeof (long_nal);
+	expect ("length 4: longer than the access unit", &au, H264_FRAME_UNKNOWN);
+	memcpy (au.data, truncated, sizeof (truncated));
+	au.size = sizeof (truncated);
+	expect ("length 4: truncated prefix", &au, H264_FRAME_UNKNOWN);
+	memcpy (au.data, after_idr, sizeof (after_idr));
+	au.size = sizeof (after_idr);
+	expect ("length 4: garbage after an idr", &au, H264_FRAME_IDR);
+}
+
+/**
+ *	Classifies the video packets of a file against the keyframe flags of the demuxer.
+ */
+static void test_file (const char* file)
+{
+	AVFormatContext* ctx = NULL;
+	AVPacket         packet;
+	int              stream, length_size, first = 1;
+	unsigned         counts[5] = { 0 }, bad_keyframes = 0;
+
+	if (avformat_open_input (&ctx, file, NULL, NULL) < 0 || avformat_find_stream_info (ctx, NULL) < 0 ||
+	    (stream = av_find_best_stream (ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0)) < 0 ||
+	    ctx->streams[stream]->codec->codec_id != AV_CODEC_ID_H264)
+	{
+		printf ("FAIL %s: no H.264 video\n", file);
+		failures ++;
+		avformat_close_input (&ctx);
+		return;
+	}
+	length_size = h264_nal_length_size (ctx->streams[stream]->codec->extradata, ctx->streams[stream]->codec->extradata_size);
+
+	av_init_packet (&packet);
+	while (av_read_frame (ctx, &packet) >= 0)
+	{
+		if (packet.stream_index == stream)
+		{
+			enum h264_frame_class frame = h264_classify (packet.data, packet.size, length_size);
+			counts[frame] ++;
+			if (first && frame != H264_FRAME_IDR)
+			{
+				printf ("FAIL %s: first frame is %s\n", file, class_names[frame]);
+				failures ++;
+			}
+			if (packet.flags & AV_PKT_FLAG_KEY && frame != H264_FRAME_IDR && frame != H264_FRAME_RECOVERY)
+				bad_keyframes ++;
+			first = 0;
+		}
+		av_packet_unref (&packet);
+	}
+	printf ("%s %s: %u idr, %u recovery, %u reference, %u non-reference, %u unknown, %u keyframes not restart points\n",
+	        bad_keyframes || counts[H264_FRAME_UNKNOWN] ? "FAIL" : "ok  ", file, counts[H264_FRAME_IDR],
+	        counts[H264_FRAME_RECOVERY], counts[H264_FRAME_REFERENCE], counts[H264_FRAME_NON_REFERENCE],
+	        counts[H264_FRAME_UNKNOWN], bad_keyframes);
+	if (bad_keyframes || counts[H264_FRAME_UNKNOWN])
+		failures ++;
+	avformat_close_input (&ctx);
+}
+
+
+int main (int argc, char** argv)
+{
+	int i;
+
+	test_framing (4);
+	test_framing (2);
+	test_framing (0);
+	test_bad_lengths ();
+
+	av_register_all ();
+	for (i = 1; i < argc; i ++)
+		test_file (argv[i]);
+
+	printf ("%d failures\n", failures);
+	return failures > 0;
+}
@@ -3,6 +3,7 @@
  * Description: Public interface to mediaplayer.
  * ----------------------------------------------------------------------------------- */
 #include <stdint.h>
+#include <stddef.h>
 #include <pthread.h>
 
 #define BUFFER_COUNT 3
@@ -12,6 +13,14 @@ enum _flags
 {
 	RENDER_VIDEO_TO_TEXTURE = 0x1,
 	ANALOG_AUDIO            = 0x2,
+	SUBTITLES               = 0x4,
+	AUDIO_PASSTHROUGH       = 0x8,  /* send AC3/E-AC3/DTS to the HDMI sink undecoded if it supports them */
+	RENDER_VIDEO_TO_I420    = 0x10, /* hand out planar YUV frames through rpi_mp_yuv_frame_lock instead of displaying them */
+	RENDER_VIDEO_TO_NV12    = 0x20, /* same with the chroma planes interleaved */
+	LOOP                    = 0x40, /* start over at the end without stopping, timestamps keep counting up */
+	LOW_LATENCY_AUDIO       = 0x80, /* keep decoded audio queued to the latency target and start the clock with the audio */
+	LIVE                    = 0x100, /* camera or multicast source (RTSP, UDP): probe little, don't buffer and hold the live latency target */
+	FOLLOW                  = 0x200, /* file that is still being downloaded (fragmented MP4, TS): wait at its end until it is complete */
 }
 rpi_mp_open_flags;
 
@@ -36,6 +45,47 @@ void rpi_mp_deinit () ;
  */
 int rpi_mp_open (const char* /* file */, int* /* width */, int* /* height */, int64_t* /* duration */, int /* flags */) ;
 
+/**
+ *  Media that is not read from a file: either a memory span (data and length) or read callbacks.
+ *  The span, or whatever opaque points to, has to stay valid until playback has ended.
+ */
+typedef struct
+{
+	const uint8_t* data;                                            /* memory span, used instead of the callbacks if set */
+	size_t         length;
+	void*          opaque;                                          /* passed to the callbacks */
+	int            (*read) (void* opaque, uint8_t* buf, int size);  /* bytes read, 0 at the end, negative on error */
+	int64_t        (*seek) (void* opaque, int64_t offset, int whence); /* SEEK_SET/CUR/END, new position or negative; NULL if not seekable */
+	int64_t        (*size) (void* opaque);                          /* total size in bytes or negative if unknown; may be NULL */
+	int            buffer_size;                                     /* read buffer in bytes, 0 for the default of 64 KiB */
+}
+rpi_mp_io;
+
+/**
+ *  Opens media from memory or read callbacks, otherwise like rpi_mp_open.
+ *  The name is only a hint for format probing (e.g. by extension) and may be NULL.
+ *  A memory span is not buffered a second time, the demuxer reads packets straight from it.
+ *  That is the only copy of the span before the decoder input buffers: libavformat always reads
+ *  into packets of its own, and those packets skip the packet pool.
+ */
+int rpi_mp_open_io (const rpi_mp_io* /* io */, const char* /* name */, int* /* width */, int* /* height */, int64_t* /* duration */, int /* flags */) ;
+
+/**
+ *  Opens the best of several renditions (encodings) of the same asset this board decodes in real time.
+ *  Decode speed is probed once per codec, size and frame rate and stored in $RPI_MP_CACHE
+ *  (default ~/.cache/rpi_mp_renditions). If video frames keep being dropped during playback
+ *  the player switches to the next lower rendition at the following keyframe; audio plays on if
+ *  the renditions carry the same audio. Texture output keeps its textures and only switches to a
+ *  rendition that fits into them.
+ *  Width and height are those of the first rendition played.
+ */
+int rpi_mp_open_renditions (const char* /* files */[], int /* count */, int* /* width */, int* /* height */, int64_t* /* duration */, int /* flags */) ;
+
+/**
+ *  Index of the rendition playing, counted from the one picked at open, -1 if not opened with rpi_mp_open_renditions.
+ */
+int rpi_mp_current_rendition (const char** /* file */) ;
+
 /**
  *  If rendering to a texture this function needs to be called to setup.
  *  Input parameters are a pointer to the EGL Render Buffer and pointers that are set
@@ -65,9 +115,32 @@ void rpi_mp_pause () ;
 
 /**
  *	Returns the current time in seconds for playback.
+ *	With LOOP it is the position within the clip, rpi_mp_media_time_us keeps counting across passes.
  */
 uint64_t rpi_mp_current_time () ;
 
+/**
+ *	Returns the current media time in microseconds.
+ *	Interpolated from periodic samples of the hardware clock, cheap enough to call every frame.
+ */
+int64_t rpi_mp_media_time_us () ;
+
+/**
+ *  How well the interpolated media time tracks the hardware clock.
+ */
+typedef struct
+{
+	int      period_us;          /* sampling period of the hardware clock */
+	uint64_t samples;            /* samples taken */
+	int64_t  error_us;           /* difference between interpolated and sampled time at the last sample */
+	int64_t  max_error_us;       /* largest such difference */
+	int64_t  round_trip_us;      /* duration of the last read of the hardware clock */
+	int64_t  max_round_trip_us;  /* longest read, the sampling instant is uncertain by half of it */
+}
+rpi_mp_clock_stats;
+
+void rpi_mp_media_clock_stats (rpi_mp_clock_stats* /* stats */) ;
+
 /**
  *	Seeks to the specified position (in seconds) in the media.
  */
@@ -78,3 +151,574 @@ int	rpi_mp_seek (int64_t /* position */) ;
  *  Returns non-zero if there is none.
  */
 int rpi_mp_metadata (const char* /* key */, char** /* title */) ;
+
+typedef enum
+{
+	TRACK_VIDEO,
+	TRACK_AUDIO,
+	TRACK_SUBTITLE,
+}
+rpi_mp_track_type;
+
+/**
+ *  A stream of the opened media. Cover art and data streams are not listed.
+ *  Strings are empty if the container does not say.
+ */
+typedef struct
+{
+	int               index;        /* stream index, what rpi_mp_select_track takes */
+	rpi_mp_track_type type;
+	int               selected;     /* being played */
+	int               is_default;   /* flagged as default by the container */
+	char              codec[16];
+	char              language[8];  /* ISO 639 code, e.g. "eng" */
+	char              title[64];
+	int               width;        /* video only */
+	int               height;
+	int               sample_rate;  /* audio only */
+	int               channels;
+}
+rpi_mp_track;
+
+/**
+ *  Lists up to max tracks of the opened media in stream order.
+ *  Returns the number of tracks there are, which may be more than max.
+ */
+int rpi_mp_tracks (rpi_mp_track* /* tracks */, int /* max */) ;
+
+/**
+ *  Switches the audio or subtitle track, also during playback; -1 turns subtitles off.
+ *  The switch happens on the demuxing thread before the next packet is read. Only the path of the
+ *  switched track is flushed, and the demuxer goes back to the current position so the new track
+ *  starts right away instead of after what is queued already. Streams that are not played are not
+ *  read at all.
+ *  An audio track has to have the same sample rate and channels as the one playing (and the same
+ *  codec with AUDIO_PASSTHROUGH or hardware decoded DTS); subtitles need the SUBTITLES flag.
+ *  Returns 0 if the switch was accepted, non-zero otherwise.
+ */
+int rpi_mp_select_track (rpi_mp_track_type /* type */, int /* index */) ;
+
+/**
+ *  A scaled down RGB24 image of a single keyframe.
+ */
+typedef struct
+{
+	int64_t   timestamp;   /* requested position in microseconds */
+	int64_t   pts;         /* position of the decoded keyframe in microseconds */
+	int       width;
+	int       height;
+	int       stride;
+	uint8_t * rgb;         /* NULL if the keyframe could not be decoded */
+}
+rpi_mp_thumbnail;
+
+/**
+ *  Generates thumbnails for a list of positions (in microseconds) in the given file.
+ *  Only the keyframe at or before each position is decoded, on a small pool of low priority
+ *  worker threads, so this is meant to be called from a background thread of the application.
+ *  If height is 0 it is derived from width and the aspect ratio of the video.
+ *  If the file is the one currently opened for playback its keyframe index is reused.
+ *  The rgb buffers are owned by the caller and released with rpi_mp_free_thumbnails.
+ *	Returns the number of thumbnails that were generated, negative on error.
+ */
+int rpi_mp_thumbnails (const char* /* file */, const int64_t* /* timestamps */, int /* count */,
+                       int /* width */, int /* height */, rpi_mp_thumbnail* /* thumbnails */) ;
+
+/**
+ *  Generates thumbnails every interval microseconds over the whole duration of the file.
+ *  The array is allocated and its length returned in count.
+ *	Returns the number of thumbnails that were generated, negative on error.
+ */
+int rpi_mp_thumbnails_interval (const char* /* file */, int64_t /* interval */, int /* width */, int /* height */,
+                                rpi_mp_thumbnail** /* thumbnails */, int* /* count */) ;
+
+/**
+ *  Frees the rgb buffers of count thumbnails (not the array itself).
+ */
+void rpi_mp_free_thumbnails (rpi_mp_thumbnail* /* thumbnails */, int /* count */) ;
+
+/**
+ *  What a media library shows about a file, read from the container without decoding it.
+ *  Strings are empty if unknown, tags are cut to fit.
+ */
+typedef struct
+{
+	const char* path;
+	int         status;          /* 0 if the file was read, non-zero if it is not media FFmpeg can open */
+	int         cached;          /* taken from the scan cache without opening the file */
+	int64_t     duration;        /* microseconds, -1 if unknown */
+	int64_t     bit_rate;        /* bits per second, 0 if unknown */
+	int         width;           /* 0 if there is no video, cover art does not count */
+	int         height;
+	float       fps;
+	int         sample_rate;     /* 0 if there is no audio */
+	int         channels;
+	char        format[32];      /* demuxer, e.g. "matroska,webm" */
+	char        video_codec[16];
+	char        audio_codec[16];
+	char        title[64];
+	char        artist[64];
+	char        album[64];
+	char        date[16];
+}
+rpi_mp_media_info;
+
+/**
+ *  Reads the media info of count files on a pool of low priority threads (0 for one per core).
+ *  Probing stops after the first megabyte or second of each file and never touches OMX, so this
+ *  can run during playback and does not need rpi_mp_init.
+ *  Results are kept in $RPI_MP_CACHE (default ~/.cache/rpi_mp_media) by device, inode, size and
+ *  modification time; files that have not changed since an earlier scan are not opened again.
+ *  infos[i] describes paths[i] and points to it.
+ *  Returns the number of files that were read, negative on error.
+ */
+int rpi_mp_scan (const char* /* paths */[], int /* count */, int /* threads */, rpi_mp_media_info* /* infos */) ;
+
+/**
+ *  Scans every file below a directory, hidden ones excepted, like rpi_mp_scan.
+ *  The array is allocated and sorted by path; free it with rpi_mp_free_scan.
+ *  Returns the number of files that were read, negative on error.
+ */
+int rpi_mp_scan_directory (const char* /* directory */, int /* threads */, rpi_mp_media_info** /* infos */, int* /* count */) ;
+
+/**
+ *  Frees an array returned by rpi_mp_scan_directory, including the paths.
+ */
+void rpi_mp_free_scan (rpi_mp_media_info* /* infos */, int /* count */) ;
+
+/**
+ *  The subtitle that is currently shown, as a non-premultiplied RGBA image
+ *  positioned in video coordinates.
+ */
+typedef struct
+{
+	int             x;
+	int             y;
+	int             width;
+	int             height;
+	int             stride;
+	const uint8_t * rgba;
+	uint32_t        sequence;  /* changes whenever the subtitle changes */
+}
+rpi_mp_subtitle_overlay;
+
+/**
+ *  Sets the font (and pixel size, 0 for automatic) used for text subtitles.
+ *  Needs to be called before rpi_mp_open to have an effect.
+ *  Returns 0 on success.
+ */
+int rpi_mp_subtitle_font (const char* /* path */, int /* size */) ;
+
+/**
+ *  If the media was opened with the SUBTITLES flag and is rendered to a texture, the application
+ *  draws the subtitles itself. Locks the current subtitle overlay and fills in its description;
+ *  the pixels stay valid until rpi_mp_subtitle_unlock, which must always be called.
+ *  Compare sequence with the previous call to only upload the overlay when it changed.
+ *  Returns 0 if a subtitle is visible, non-zero otherwise.
+ *  When not rendering to a texture, subtitles are shown on a dispmanx layer above the video.
+ */
+int rpi_mp_subtitle_lock (rpi_mp_subtitle_overlay* /* overlay */) ;
+
+/**
+ *  Releases the overlay locked by rpi_mp_subtitle_lock.
+ */
+void rpi_mp_subtitle_unlock () ;
+
+/**
+ *  A decoded frame in YUV 4:2:0 (8 bit, 1.5 bytes per pixel).
+ *  The planes may be padded: rows are strides[i] bytes apart and only width (or width / 2) are used.
+ */
+typedef struct
+{
+	const uint8_t * planes[3];   /* Y, U, V; for NV12 Y, interleaved UV and NULL */
+	int             strides[3];
+	int             width;
+	int             height;
+	int             nv12;
+	int64_t         pts;         /* microseconds */
+}
+rpi_mp_yuv_frame;
+
+/**
+ *  If the media was opened with RENDER_VIDEO_TO_I420 or RENDER_VIDEO_TO_NV12, locks the newest frame that
+ *  is due for presentation, waiting up to timeout_ms for one. Older frames that were never locked are skipped.
+ *  The planes stay valid until rpi_mp_yuv_frame_unlock or until playback ends. Only one frame can be locked.
+ *  Returns 0 if a frame was locked, non-zero otherwise.
+ */
+int rpi_mp_yuv_frame_lock (rpi_mp_yuv_frame* /* frame */, int /* timeout_ms */) ;
+
+/**
+ *  Hands the frame locked by rpi_mp_yuv_frame_lock back to the decoder.
+ */
+void rpi_mp_yuv_frame_unlock () ;
+
+/**
+ *  If rendering to a texture, a second set of BUFFER_COUNT EGLImages for a clip faded into, see
+ *  rpi_mp_transition_prepare. The two sets take turns: after a crossfade the clip faded into plays on
+ *  in the set it was faded in with. Needs to be called before rpi_mp_transition_prepare.
+ */
+void rpi_mp_setup_transition_buffer (void* []	/* egl_images */,
+                                     int*		/* current_texture */) ;
+
+/**
+ *  The set of textures to draw the clip playing from: 0 for those of rpi_mp_setup_render_buffer, 1 for
+ *  those of rpi_mp_setup_transition_buffer. Changes with the first frame of a clip faded into, once it
+ *  plays on by itself.
+ */
+int rpi_mp_texture_set () ;
+
+/**
+ *  Pre-rolls the clip to play next, for a crossfade from the clip playing with RENDER_VIDEO_TO_TEXTURE.
+ *  The next clip gets a hardware decoder chain of its own on the same clock, which renders into the set
+ *  of textures the clip playing does not use; its packets are demuxed ahead and, if its audio has the
+ *  sample rate and channels of the current audio decoded in software, so is its audio. The video decoder
+ *  has to keep up with both streams during the crossfade, frames_skipped of the stats tells if it did not.
+ *  A prepared clip that was not faded into follows with a cut when the current one ends.
+ *  Returns 0 on success, non-zero if it could not be opened, the hardware can't decode its video, the
+ *  output is not a texture or rpi_mp_setup_transition_buffer was not called.
+ */
+int rpi_mp_transition_prepare (const char* /* file */) ;
+
+/**
+ *  Starts the crossfade into the prepared clip, which starts playing now. Over duration_ms the blend factor
+ *  of its frames goes from 0 to 1 and its audio, if it was decoded, is mixed with the same ramp; otherwise
+ *  the current audio only fades out. At the end the decoder chain of the next clip becomes the pipeline's
+ *  and the one of the current clip is closed, nothing is reopened. The next clip plays on with its audio if
+ *  it was mixed, without audio otherwise; subtitles end with the clip they belong to.
+ *  Returns 0 on success, non-zero if no clip was prepared or a crossfade is already running.
+ */
+int rpi_mp_transition_start (int /* duration_ms */) ;
+
+/**
+ *  Drops the prepared clip, or the clip being faded into; the current clip plays on. Does nothing once
+ *  the crossfade reached its end.
+ */
+void rpi_mp_transition_cancel () ;
+
+/**
+ *  The texture of the clip faded into to draw over the clip playing, with the blend factor as alpha.
+ */
+typedef struct
+{
+	int   texture_set;   /* as rpi_mp_texture_set */
+	int   texture;       /* index of the texture in that set */
+	float blend;         /* 0 at the start of the crossfade, 1 at its end and until the next clip plays on by itself */
+	int   fresh;         /* a different frame than the one locked before */
+}
+rpi_mp_transition_frame;
+
+/**
+ *  Locks the newest texture the decoder of the next clip filled, from the start of the crossfade until the
+ *  next clip plays on by itself, so it is not handed over meanwhile. Only one frame can be locked.
+ *  Returns 0 if a frame was locked, non-zero if no crossfade is running or nothing was decoded yet.
+ */
+int rpi_mp_transition_frame_lock (rpi_mp_transition_frame* /* frame */) ;
+
+/**
+ *  Hands the frame locked by rpi_mp_transition_frame_lock back.
+ */
+void rpi_mp_transition_frame_unlock () ;
+
+/**
+ *  Cost of the overlap of two clips, from the start of the crossfade until the next clip plays on by itself.
+ */
+typedef struct
+{
+	int64_t  duration_us;      /* crossfade as asked for */
+	int64_t  overlap_us;       /* so far, or in total once the pipeline took over */
+	int64_t  handover_us;      /* of that, closing the chain of the clip faded out and taking the next one over */
+	uint64_t frames_decoded;   /* textures filled by the decoder of the next clip */
+	uint64_t frames_shown;     /* locked as fresh */
+	uint64_t frames_skipped;   /* filled but replaced by a newer one before they were locked */
+	double   decoder_load;     /* time spent decoding the next clip's audio in software over the overlap, in cores */
+	double   cpu_load;         /* CPU time of the whole process over the overlap, in cores */
+	size_t   rss_start;        /* resident memory of the process when the crossfade started, in bytes */
+	size_t   rss_peak;         /* highest resident memory during the overlap */
+	int      audio_mixed;      /* the next clip's audio was mixed in */
+	int      running;          /* the overlap has not ended yet */
+}
+rpi_mp_overlap_stats;
+
+/**
+ *  Reports the cost of the running crossfade, or of the last one.
+ *  Returns 0 on success, non-zero if there was none.
+ */
+int rpi_mp_transition_stats (rpi_mp_overlap_stats* /* stats */) ;
+
+/**
+ *  Sets the maximum number of bytes the demuxed packet pool may hold (default 24 MiB).
+ *  Packets that don't fit keep the buffer allocated by the demuxer. Pooled packets are copied
+ *  once out of that buffer, so 0 (no pooling) saves a copy per packet where heap growth is no concern.
+ */
+void rpi_mp_packet_pool_size (size_t /* max_size */) ;
+
+/**
+ *  Reports the bytes currently held by the packet pool, the most it ever held and
+ *  the number of packets that could not be taken from it.
+ */
+void rpi_mp_packet_pool_stats (size_t* /* size */, size_t* /* peak */, unsigned* /* unpooled */) ;
+
+/**
+ *  Input buffer configuration of an OMX component and how long feeding it had to wait.
+ */
+typedef struct
+{
+	int      buffer_size;    /* size of each input buffer in bytes */
+	int      buffer_count;   /* number of input buffers */
+	uint64_t buffers;        /* buffers taken from the component */
+	uint64_t wait_us;        /* total time spent waiting for a free buffer */
+	uint64_t max_wait_us;    /* longest single wait */
+	uint64_t split_packets;  /* packets that needed more than one buffer */
+}
+rpi_mp_buffer_stats;
+
+/**
+ *  Reports the input buffer statistics of the video decoder and audio renderer since the media was opened.
+ *  Either pointer may be NULL.
+ */
+void rpi_mp_input_buffer_stats (rpi_mp_buffer_stats* /* video */, rpi_mp_buffer_stats* /* audio */) ;
+
+/**
+ *  Where the software audio path spends its time. Decoding and handing PCM to the renderer run in
+ *  separate threads joined by a ring; long ring_full_us means the renderer is the bottleneck,
+ *  long ring_empty_us means decoding is.
+ */
+typedef struct
+{
+	uint64_t frames;          /* frames decoded */
+	uint64_t decode_us;       /* time spent decoding and converting frames */
+	uint64_t ring_full_us;    /* decode stage waiting for room in the ring */
+	uint64_t ring_empty_us;   /* submit stage waiting for a full buffer of samples */
+	uint64_t render_wait_us;  /* submit stage waiting for a free renderer buffer */
+	size_t   ring_size;       /* capacity of the ring in bytes */
+	size_t   ring_peak;       /* highest fill of the ring in bytes */
+}
+rpi_mp_audio_pipeline_stats;
+
+/**
+ *  Sets how much decoded audio LOW_LATENCY_AUDIO keeps queued in front of the speaker, in milliseconds
+ *  (default 40). Renderer buffers are filled with a quarter of it at a time and no more is handed to the
+ *  renderer while it holds the target. Needs to be called before rpi_mp_open to have an effect.
+ *  Applies to audio decoded in software; passthrough and hardware decoded audio only start the clock early.
+ */
+void rpi_mp_audio_latency_target (int /* ms */) ;
+
+/**
+ *  Where audio is between decoding and the speaker.
+ */
+typedef struct
+{
+	int64_t target_us;   /* latency target, 0 without LOW_LATENCY_AUDIO */
+	int64_t ring_us;     /* decoded audio waiting for the renderer */
+	int64_t render_us;   /* audio the renderer holds that has not been played, as it reports */
+	int64_t total_us;    /* from leaving the decoder to being heard */
+	int64_t startup_us;  /* from rpi_mp_start until the first audio went to the renderer, -1 if none yet */
+}
+rpi_mp_audio_latency;
+
+/**
+ *  Reports the current audio output latency.
+ *  Returns 0 on success, non-zero if no audio is being rendered.
+ */
+int rpi_mp_audio_output_latency (rpi_mp_audio_latency* /* latency */) ;
+
+/**
+ *  Sets the latency LIVE holds, in milliseconds (default 200): how long a packet waits in the player
+ *  from being received to being shown. The clock runs free from the first packet instead of waiting
+ *  for all streams to start, and whenever the player falls further behind than the target by more
+ *  than a tolerance, it jumps ahead and drops what is late by then. Needs to be called before
+ *  rpi_mp_open to have an effect.
+ */
+void rpi_mp_live_latency_target (int /* ms */) ;
+
+/**
+ *  Latency of a LIVE source.
+ */
+typedef struct
+{
+	int64_t  target_us;
+	int64_t  buffered_us;         /* newest packet received minus the media time shown, i.e. waiting in the player */
+	int64_t  max_buffered_us;
+	int64_t  glass_to_glass_us;   /* from capture to display by the wall clock times the source sends (RTCP sender
+	                                 reports), -1 if it sends none; only as good as the sync of both wall clocks */
+	uint64_t catch_ups;           /* times the clock jumped back to the target */
+	int64_t  skipped_us;          /* media time skipped by jumping ahead */
+}
+rpi_mp_live_stats;
+
+/**
+ *  Reports the latency of a LIVE source.
+ *  Returns 0 on success, non-zero if the media was not opened with LIVE.
+ */
+int rpi_mp_live_latency (rpi_mp_live_stats* /* stats */) ;
+
+/**
+ *  How a file opened with FOLLOW is known to be complete: a marker file named like it with the suffix appended
+ *  appears (default ".done", NULL for none), or it does not grow for timeout_ms (default 30000, 0 to only wait
+ *  for the marker). Until then playback waits for more data at the end instead of stopping there.
+ *  A download that stalls for longer than the timeout can't be told from one that finished: playback ends
+ *  at what was downloaded as if that were the end of the file, and rpi_mp_follow_stats reports timed_out.
+ *  Pass 0 to wait for the marker as long as it takes.
+ *  Needs to be called before rpi_mp_open to have an effect.
+ */
+void rpi_mp_follow_settings (const char* /* marker_suffix */, int /* timeout_ms */) ;
+
+/**
+ *  Progress of the download of a file opened with FOLLOW.
+ */
+typedef struct
+{
+	int64_t  size;        /* bytes in the file now */
+	int64_t  read;        /* bytes the demuxer has read */
+	int64_t  ahead_us;    /* media time downloaded ahead of what is playing: demuxed and not played yet, plus the bytes
+	                         not demuxed at the byte rate of those that were; negative if playback caught up */
+	uint64_t waits;       /* times the demuxer got to the end of what was downloaded and waited */
+	int64_t  wait_us;     /* time it spent waiting */
+	int      waiting;     /* it is waiting now */
+	int      complete;    /* the download is complete, its end is the end of playback */
+	int      timed_out;   /* complete only because the file stopped growing for the timeout, the download may have stalled */
+}
+rpi_mp_download_stats;
+
+/**
+ *  Reports how far the download of a file opened with FOLLOW is.
+ *  Returns 0 on success, non-zero if the media was not opened with FOLLOW.
+ */
+int rpi_mp_follow_stats (rpi_mp_download_stats* /* stats */) ;
+
+#define AUDIO_TAP_CHANNELS   8
+#define AUDIO_SPECTRUM_BANDS 32
+
+/**
+ *  Levels and spectrum of a window of the decoded audio, for VU meters and spectrum bars.
+ */
+typedef struct
+{
+	int64_t pts;                             /* media time of the first sample in microseconds, on the scale of rpi_mp_media_time_us */
+	int64_t duration;
+	int     channels;
+	float   peak[AUDIO_TAP_CHANNELS];        /* of full scale, 0 to 1 */
+	float   rms[AUDIO_TAP_CHANNELS];
+	float   spectrum[AUDIO_SPECTRUM_BANDS];  /* dBFS of the channels mixed down, in bands spaced logarithmically from
+	                                            20 Hz to 20 kHz (or half the sample rate); a full scale sine reads 0 */
+}
+rpi_mp_audio_analysis;
+
+/**
+ *  Turns the analysis of the decoded audio on or off. It runs on a low priority thread of its own
+ *  and the audio path never waits for it. Only audio decoded in software can be analysed, not
+ *  passthrough or hardware decoded audio.
+ *  Needs to be called before rpi_mp_open to have an effect.
+ */
+void rpi_mp_audio_tap (int /* enable */) ;
+
+/**
+ *  The analysis of the audio that is being heard now, i.e. the latest window the clock has reached.
+ *  Returns 0 on success, non-zero if there is none (yet).
+ */
+int rpi_mp_audio_levels (rpi_mp_audio_analysis* /* analysis */) ;
+
+/**
+ *  Reports how many windows were analysed, how many were skipped because the analysis fell behind,
+ *  and the CPU time of the analysis thread in microseconds.
+ */
+void rpi_mp_audio_tap_stats (uint64_t* /* windows */, uint64_t* /* skipped */, uint64_t* /* cpu_us */) ;
+
+/**
+ *  Reports the audio pipeline statistics since the media was opened.
+ *  All zero if the audio is not decoded in software.
+ */
+void rpi_mp_audio_stats (rpi_mp_audio_pipeline_stats* /* stats */) ;
+
+/**
+ *  Video packets dropped before decoding because they were late against the media clock.
+ *  Non-reference frames go first; if that does not catch up, everything up to the next frame
+ *  decoding restarts at: an IDR or intra frame, or a recovery point.
+ */
+typedef struct
+{
+	uint64_t late;               /* packets that arrived at the decoder after their presentation time */
+	uint64_t non_reference;      /* non-reference frames dropped */
+	uint64_t skipped;            /* frames dropped while skipping to the next restart point */
+	uint64_t skips;              /* times playback skipped to the next restart point */
+	int64_t  max_lateness_us;    /* latest packet seen */
+}
+rpi_mp_drop_stats;
+
+void rpi_mp_video_drop_stats (rpi_mp_drop_stats* /* stats */) ;
+
+/**
+ *  Threads of the playback pipeline.
+ */
+typedef enum
+{
+	THREAD_DEMUX,         /* the thread that calls rpi_mp_start, for the time playback runs */
+	THREAD_VIDEO,         /* feeds the video decoder, or decodes in software */
+	THREAD_VIDEO_RENDER,  /* presents software decoded frames */
+	THREAD_AUDIO,         /* decodes audio or feeds the audio decoder */
+	THREAD_AUDIO_SUBMIT,  /* hands decoded PCM to the audio renderer */
+	THREAD_SUBTITLE,
+	THREAD_CLOCK,         /* samples the media clock */
+	THREAD_NEXT_VIDEO,    /* feeds the video decoder of the clip faded in during a crossfade */
+	PIPELINE_THREADS
+}
+rpi_mp_thread;
+
+typedef struct
+{
+	int      policy;    /* SCHED_OTHER, SCHED_FIFO or SCHED_RR */
+	int      priority;  /* 1 to 99 for SCHED_FIFO and SCHED_RR, the nice value (-20 to 19) for SCHED_OTHER */
+	uint32_t cpus;      /* cores the thread may run on, bit 0 for core 0; 0 for any */
+}
+rpi_mp_thread_policy;
+
+/**
+ *  Sets the scheduling policy, priority and CPU affinity of a pipeline thread, NULL to leave the
+ *  thread as it is created (the default). Takes effect when the thread next starts, i.e. with the
+ *  next rpi_mp_start. SCHED_FIFO, SCHED_RR and negative nice values need CAP_SYS_NICE or a matching
+ *  RLIMIT_RTPRIO / RLIMIT_NICE; if the thread is not allowed it says so and runs as it would have.
+ *  Returns 0 on success, non-zero if the policy is invalid.
+ */
+int rpi_mp_set_thread_policy (rpi_mp_thread /* thread */, const rpi_mp_thread_policy* /* policy */) ;
+
+/**
+ *  Locks all memory of the process, present and future, so buffers are never paged out (mlockall),
+ *  or unlocks it again. Needs CAP_IPC_LOCK or a large enough RLIMIT_MEMLOCK.
+ *  Returns 0 on success.
+ */
+int rpi_mp_lock_memory (int /* lock */) ;
+
+#define LATENCY_BUCKETS 16
+
+/**
+ *  How late a thread woke up from its timed waits, e.g. the polls of an empty packet FIFO.
+ *  Bucket 0 counts wakeups within a microsecond, bucket i those late by 2^(i-1) up to 2^i
+ *  microseconds, the last bucket everything later than that.
+ */
+typedef struct
+{
+	uint64_t wakeups;
+	uint64_t buckets[LATENCY_BUCKETS];
+	uint64_t total_us;
+	uint64_t max_us;
+}
+rpi_mp_latency_histogram;
+
+/**
+ *  Reports the wakeup latency of a pipeline thread since the media was opened.
+ */
+void rpi_mp_thread_latency (rpi_mp_thread /* thread */, rpi_mp_latency_histogram* /* histogram */) ;
+
+/**
+ *  Serves metrics for monitoring on a Unix domain socket: Prometheus text, or JSON if the request contains
+ *  "json". HTTP requests get an HTTP response, e.g. curl --unix-socket <path> http://localhost/metrics.
+ *  Covers demuxing, decoding, FIFOs, OMX buffer waits, dropped frames, the media clock and process CPU and memory.
+ *  Statistics of the media itself start over with every rpi_mp_open. Can be called before rpi_mp_init.
+ *  Returns 0 on success.
+ */
+int rpi_mp_metrics_start (const char* /* socket_path */) ;
+
+/**
+ *  Stops serving metrics and removes the socket.
+ */
+void rpi_mp_metrics_stop () ;
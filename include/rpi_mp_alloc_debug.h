@@ -0,0 +1,97 @@
+#include <stdint.h>
+
+/**
+ *	Allocation counting, for the debug build (make ALLOC_DEBUG=1, or ALLOC_DEBUG=strict to abort at
+ *	the first allocation the steady state must not make).
+ *	malloc and its relatives and av_malloc are interposed and every allocation is counted for the
+ *	pipeline thread that made it and the phase playback is in. Allocations made inside FFmpeg or the
+ *	firmware libraries are counted apart from those of our own code, told apart by the caller's
+ *	address: a decoder allocates a few bytes of buffer references for every frame, which we can't
+ *	help, but the per-frame path of the player must not allocate at all once it is warmed up.
+ *	Allocations of our code in the steady state are reported with a backtrace as they happen.
+ *	Without ALLOC_DEBUG the calls compile to nothing.
+ *	The threads are identified by the rpi_mp_thread values of the public header.
+ */
+
+enum alloc_phases
+{
+	ALLOC_OPEN,
+	ALLOC_STARTUP,
+	ALLOC_STEADY,
+	ALLOC_SEEK,
+	ALLOC_CLOSE,
+	ALLOC_PHASES
+};
+
+/**
+ *	Start-up and seeking turn into the steady state this long after they began, in microseconds:
+ *	the pools and scratch buffers have grown to the working set by then.
+ */
+#define ALLOC_WARMUP_US 3000000
+
+/**
+ *	Steady state allocations of our code reported with a backtrace, per run.
+ */
+#define ALLOC_TRACES    8
+
+
+#ifdef ALLOC_DEBUG
+
+/**
+ *	Allocations of the calling thread are counted for this pipeline thread from now on.
+ *
+ *	@param int thread
+ *		an rpi_mp_thread, PIPELINE_THREADS for a thread that is not part of the pipeline
+ */
+void alloc_debug_thread ( int thread ) ;
+
+/**
+ *	Playback entered a phase. ALLOC_STARTUP and ALLOC_SEEK turn into ALLOC_STEADY after the
+ *	warm-up, or when ALLOC_STEADY is entered explicitly.
+ */
+void alloc_debug_phase ( int phase ) ;
+
+/**
+ *	Sets how long start-up and seeking last, ALLOC_WARMUP_US unless set.
+ *
+ *	@param int64_t us
+ *		0 to only enter ALLOC_STEADY explicitly, for callers that follow the media instead of the
+ *		wall clock
+ */
+void alloc_debug_warmup ( int64_t us ) ;
+
+/**
+ *	Allocations counted so far.
+ *
+ *	@param int phase
+ *	@param int thread
+ *		an rpi_mp_thread, or PIPELINE_THREADS for the threads that are not part of the pipeline
+ *	@param int ours
+ *		non-zero for those of our own code, zero for those made inside the libraries
+ *	@param uint64_t * count
+ *	@param uint64_t * bytes
+ */
+void alloc_debug_counts ( int phase, int thread, int ours, uint64_t * count, uint64_t * bytes ) ;
+
+/**
+ *	Prints the counts per phase and thread.
+ *
+ *	@return uint64_t count
+ *		allocations of our code in the steady state, which should be none
+ */
+uint64_t alloc_debug_report ( void ) ;
+
+/**
+ *	Clears the counts and goes back to ALLOC_OPEN.
+ */
+void alloc_debug_reset ( void ) ;
+
+#else
+
+#define alloc_debug_thread(thread)
+#define alloc_debug_phase(phase)
+#define alloc_debug_warmup(us)
+#define alloc_debug_report() ((void) 0)
+#define alloc_debug_reset()
+
+#endif
@@ -0,0 +1,76 @@
+#include <stdint.h>
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+
+/**
+ *	Called with every decoded frame before it goes into the ring, e.g. for the analysis tap.
+ *
+ *	@param void * opaque
+ *	@param const int16_t * samples
+ *		interleaved
+ *	@param int frames
+ *	@param int64_t pts
+ *		timestamp of the first sample in microseconds, AV_NOPTS_VALUE if unknown
+ */
+typedef void (* audio_frame_cb) ( void * opaque, const int16_t * samples, int frames, int64_t pts ) ;
+
+/**
+ *	Decoding stage of the software audio path: decodes packets with libavcodec, interleaves planar
+ *	samples, converts floating point ones to 16 bits and writes the frames into the PCM ring the
+ *	submit stage reads. The player, the next clip of a crossfade and the host checks decode with it.
+ *	One thread decodes. Needs the header of the PCM ring to be included first.
+ */
+typedef struct
+{
+	AVCodecContext * codec_ctx;
+	AVFrame        * frame;
+	uint8_t        * scratch;      /* interleaved or converted samples */
+	int              scratch_size;
+	audio_frame_cb   tap;          /* NULL for none */
+	void           * tap_opaque;
+	uint64_t         frames;
+	uint64_t         decode_us;    /* decoding and converting */
+} audio_decoder ;
+
+
+/**
+ *	Sets the stage up for an opened codec.
+ *	Allocates a frame and the scratch buffer for a codec frame, so decoding does not allocate once
+ *	it runs. Don't forget to call destroy_audio_decoder!
+ *
+ *	@param audio_decoder * decoder
+ *	@param AVCodecContext * codec_ctx
+ *		opened, stays owned by the caller
+ *	@return int ret
+ *		0 on success, non-zero on failure
+ */
+int init_audio_decoder ( audio_decoder * decoder, AVCodecContext * codec_ctx ) ;
+
+/**
+ *	Frees the frame and the scratch buffer, the codec is left open.
+ */
+void destroy_audio_decoder ( audio_decoder * decoder ) ;
+
+/**
+ *	Goes on with another opened codec of the same format, e.g. after an audio track switch.
+ *	Call it between packets, from the decoding thread or while it is known not to decode. The
+ *	scratch buffer is kept and grows if the new stream has longer frames, the counts go on.
+ *
+ *	@param audio_decoder * decoder
+ *	@param AVCodecContext * codec_ctx
+ *		opened, stays owned by the caller; the previous one is no longer used and can be closed
+ */
+void audio_decoder_switch ( audio_decoder * decoder, AVCodecContext * codec_ctx ) ;
+
+/**
+ *	Decodes a packet and writes its frames into the ring, waiting while the ring is full.
+ *	The data and size of the packet are consumed.
+ *
+ *	@param audio_decoder * decoder
+ *	@param AVPacket * packet
+ *	@param pcm_ring * ring
+ *	@return int ret
+ *		0 on success, negative if the decoder rejected the packet, positive if out of memory or the
+ *		ring was aborted
+ */
+int audio_decode_packet ( audio_decoder * decoder, AVPacket * packet, pcm_ring * ring ) ;
@@ -0,0 +1,58 @@
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ *	Submit stage of the software audio path: takes the PCM the decoding stage wrote into the ring a
+ *	renderer buffer at a time and keeps track of the media time the audio handed on ends at. The
+ *	player hands every chunk to the audio renderer, the host checks to their stand-ins.
+ *	One thread submits. Needs the header of the PCM ring to be included first.
+ */
+typedef struct
+{
+	pcm_ring * ring;
+	size_t     chunk;   /* bytes of a renderer buffer */
+	int64_t    end;     /* where the audio taken so far ends, AV_NOPTS_VALUE before the first timestamp */
+	uint64_t   taken;   /* bytes */
+} audio_submit ;
+
+
+/**
+ *	Sizes the ring between the stages for ring_ms of audio, but at least two chunks since the
+ *	stage waits for whole ones, and initializes it. Don't forget to call destroy_pcm_ring!
+ *
+ *	@param audio_submit * submit
+ *	@param pcm_ring * ring
+ *	@param int sample_rate
+ *	@param int channels
+ *		of 16 bit interleaved samples
+ *	@param int ring_ms
+ *	@param size_t chunk
+ *		bytes of a renderer buffer, a multiple of a sample of all channels
+ *	@return int ret
+ *		0 on success, non-zero on failure
+ */
+int init_audio_submit ( audio_submit * submit, pcm_ring * ring, int sample_rate, int channels, int ring_ms, size_t chunk ) ;
+
+/**
+ *	Waits for a whole chunk; less is only returned once decoding is done.
+ *
+ *	@param audio_submit * submit
+ *	@param int64_t * ready
+ *		as for pcm_ring_wait, may be NULL
+ *	@return size_t available
+ *		bytes that can be taken, 0 once the ring is drained or aborted
+ */
+size_t audio_submit_wait ( audio_submit * submit, int64_t * ready ) ;
+
+/**
+ *	Takes up to a chunk out of the ring.
+ *
+ *	@param audio_submit * submit
+ *	@param uint8_t * buffer
+ *		of at least a chunk
+ *	@param int64_t * pts
+ *		set to the timestamp of the first byte, AV_NOPTS_VALUE if unknown
+ *	@return size_t taken
+ *		bytes, 0 if a flush dropped what was waited for
+ */
+size_t audio_submit_take ( audio_submit * submit, uint8_t * buffer, int64_t * pts ) ;
@@ -0,0 +1,136 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/**
+ *	Samples per analysis window, a power of two. Windows don't overlap.
+ */
+#define AUDIO_TAP_FFT_SIZE 1024
+
+/**
+ *	Number of timestamp marks and of analysed windows kept.
+ */
+#define AUDIO_TAP_MARKS    64
+#define AUDIO_TAP_RESULTS  64
+
+/**
+ *	Timestamp of the frame at a position of the stream.
+ */
+typedef struct
+{
+	uint64_t position;
+	int64_t  pts;
+} audio_tap_mark ;
+
+/**
+ *	Level and spectrum analysis of the decoded audio, for visualizers.
+ *	The audio decoding thread copies every frame into a sample ring and never waits: it only
+ *	publishes how far it wrote, and the analysis thread picks the windows up from there. When the
+ *	analysis falls behind far enough for the writer to overwrite a window, the window is skipped.
+ *	Results are kept with the media time of their first sample, so what is shown can follow the
+ *	clock rather than the decoder, which runs ahead of it.
+ *	Needs rpi_mp.h (rpi_mp_audio_analysis) to be included first.
+ */
+typedef struct
+{
+	int16_t               * samples;      /* interleaved */
+	size_t                  capacity;     /* frames, a power of two */
+	int                     channels;
+	int                     sample_rate;
+	uint64_t                written;      /* frames, published by the writer */
+	audio_tap_mark          marks[AUDIO_TAP_MARKS];
+	uint32_t                n_marks;      /* published by the writer */
+	uint64_t                analysed;     /* frames, analysis thread only */
+
+	float                   window[AUDIO_TAP_FFT_SIZE];
+	float                   re[AUDIO_TAP_FFT_SIZE / 2];
+	float                   im[AUDIO_TAP_FFT_SIZE / 2];
+	float                   fft_cos[AUDIO_TAP_FFT_SIZE / 4];
+	float                   fft_sin[AUDIO_TAP_FFT_SIZE / 4];
+	float                   split_cos[AUDIO_TAP_FFT_SIZE / 2];
+	float                   split_sin[AUDIO_TAP_FFT_SIZE / 2];
+	uint16_t                bit_reverse[AUDIO_TAP_FFT_SIZE / 2];
+	int                     band_start[AUDIO_SPECTRUM_BANDS + 1];
+	float                   power_scale;
+
+	rpi_mp_audio_analysis   results[AUDIO_TAP_RESULTS];
+	unsigned                results_head;
+	unsigned                n_results;
+	uint64_t                windows;
+	uint64_t                skipped;
+	uint64_t                cpu_us;
+	pthread_mutex_t         results_mutex;
+
+	pthread_t               thread;
+	volatile int            running;
+} audio_tap ;
+
+
+/**
+ *	Initialize the tap.
+ *	Allocates about a second of samples. Don't forget to call destroy_audio_tap!
+ *
+ *	@param audio_tap * tap
+ *	@param int channels
+ *		of the interleaved signed 16-bit samples that will be written, at most AUDIO_TAP_CHANNELS
+ *	@param int sample_rate
+ *	@return int ret
+ *		0 on success, non-zero on failure
+ */
+int init_audio_tap ( audio_tap * tap, int channels, int sample_rate ) ;
+
+/**
+ *	Frees the sample ring. The thread has to be stopped.
+ */
+void destroy_audio_tap ( audio_tap * tap ) ;
+
+/**
+ *	Copies decoded frames into the ring. Never waits, one writer only.
+ *
+ *	@param audio_tap * tap
+ *	@param const int16_t * samples
+ *	@param int frames
+ *	@param int64_t pts
+ *		timestamp of the first frame in microseconds, AV_NOPTS_VALUE if unknown
+ */
+void audio_tap_write ( audio_tap * tap, const int16_t * samples, int frames, int64_t pts ) ;
+
+/**
+ *	Analyses the next window if it was written, on the calling thread.
+ *	The analysis thread calls this; so does the benchmark, without one.
+ *
+ *	@param audio_tap * tap
+ *	@return int ret
+ *		non-zero if a window was analysed or skipped, 0 if there is none yet
+ */
+int audio_tap_analyse ( audio_tap * tap ) ;
+
+/**
+ *	Starts the analysis thread, at a low priority. Don't forget to call stop_audio_tap!
+ *
+ *	@return int ret
+ *		0 on success, non-zero on failure
+ */
+int start_audio_tap ( audio_tap * tap ) ;
+
+/**
+ *	Stops and joins the analysis thread.
+ */
+void stop_audio_tap ( audio_tap * tap ) ;
+
+/**
+ *	Drops the results, e.g. after a seek.
+ */
+void audio_tap_flush ( audio_tap * tap ) ;
+
+/**
+ *	The latest result whose window started at or before a media time.
+ *
+ *	@param audio_tap * tap
+ *	@param int64_t time
+ *		media time in microseconds, usually the clock
+ *	@param rpi_mp_audio_analysis * analysis
+ *	@return int ret
+ *		0 on success, non-zero if there is none
+ */
+int audio_tap_result ( audio_tap * tap, int64_t time, rpi_mp_audio_analysis * analysis ) ;
@@ -0,0 +1,49 @@
+#include <libavformat/avformat.h>
+
+/**
+ *	Longest wait between two looks at a file that is still being written, in milliseconds. inotify
+ *	usually wakes the reader up as soon as data is appended; this is how quickly the completion
+ *	marker, a timeout or a stop is noticed, and how often the size is polled where inotify does not
+ *	work (network file systems).
+ */
+#define FOLLOW_POLL_MS       250
+
+/**
+ *	Defaults for rpi_mp_follow_settings.
+ */
+#define FOLLOW_MARKER_SUFFIX ".done"
+#define FOLLOW_TIMEOUT_MS    30000
+
+
+/**
+ *	Creates an AVIOContext that reads a file that is still being written. At the end of what was
+ *	written so far a read waits for more instead of returning AVERROR_EOF, until the file is
+ *	complete: the marker file exists, or the file did not grow for the timeout. Until then its size
+ *	is reported as unknown, so the demuxer treats it as a stream that goes on.
+ *	Needs rpi_mp.h to be included first.
+ *
+ *	@param const char * path
+ *	@param const char * marker_suffix
+ *		appended to path to name the marker file, NULL for none
+ *	@param int timeout_ms
+ *		how long the file may stop growing before it is taken as complete, 0 to wait for the marker
+ *	@return AVIOContext * ctx
+ *		the context to set as pb of an AVFormatContext, NULL on failure
+ */
+AVIOContext* open_follow_io ( const char * path, const char * marker_suffix, int timeout_ms ) ;
+
+/**
+ *	Closes the file and frees a context created by open_follow_io, sets *ctx to NULL.
+ */
+void close_follow_io ( AVIOContext ** ctx ) ;
+
+/**
+ *	Makes a read waiting for data, and all reads after it, fail with AVERROR_EXIT.
+ *	Can be called from any thread.
+ */
+void follow_io_abort ( AVIOContext * ctx ) ;
+
+/**
+ *	Fills in the state of the download, all but ahead_us. Can be called from any thread.
+ */
+void follow_io_stats ( AVIOContext * ctx, rpi_mp_download_stats * stats ) ;
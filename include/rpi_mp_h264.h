@@ -0,0 +1,36 @@
+#include <stdint.h>
+
+/**
+ *	Classification of an H.264 access unit by the slices it contains.
+ *	Pure parsing, no FFmpeg or OMX, so it can be built and run on the host.
+ */
+enum h264_frame_class
+{
+	H264_FRAME_UNKNOWN,        /* no slice found, e.g. only parameter sets or SEI */
+	H264_FRAME_NON_REFERENCE,  /* every slice has nal_ref_idc 0, nothing depends on it */
+	H264_FRAME_REFERENCE,      /* at least one slice is used for reference */
+	H264_FRAME_RECOVERY,       /* only I slices, or a recovery point SEI: decoding can restart here without an IDR */
+	H264_FRAME_IDR             /* contains an IDR slice, decoding can restart here */
+};
+
+
+/**
+ *	Reads the NAL length size from avcC extradata (MP4, MKV).
+ *
+ *	@param const uint8_t * extradata
+ *	@param int size
+ *	@return int length_size
+ *		size of the NAL length prefix in bytes, 0 if the stream uses Annex B start codes
+ */
+int h264_nal_length_size ( const uint8_t * extradata, int size ) ;
+
+/**
+ *	Classifies an access unit.
+ *
+ *	@param const uint8_t * data
+ *	@param int size
+ *	@param int nal_length_size
+ *		as returned by h264_nal_length_size, 0 for Annex B
+ *	@return enum h264_frame_class
+ */
+enum h264_frame_class h264_classify ( const uint8_t * data, int size, int nal_length_size ) ;
@@ -0,0 +1,24 @@
+#include <libavformat/avformat.h>
+
+/**
+ *	Default size of the buffer of a custom AVIOContext.
+ */
+#define CUSTOM_IO_BUFFER_SIZE (64 * 1024)
+
+
+/**
+ *	Creates an AVIOContext that reads from a memory span or the callbacks of io.
+ *	The description is copied, the span and opaque have to stay valid until close_custom_io.
+ *	A memory span is read in direct mode: reads bypass the context buffer and copy from the span
+ *	straight into the destination (the demuxer's packets).
+ *
+ *	@param const rpi_mp_io * io
+ *	@return AVIOContext * ctx
+ *		the context to set as pb of an AVFormatContext, NULL on failure
+ */
+AVIOContext* open_custom_io ( const rpi_mp_io * io ) ;
+
+/**
+ *	Frees a context created by open_custom_io and its buffer, sets *ctx to NULL.
+ */
+void close_custom_io ( AVIOContext ** ctx ) ;
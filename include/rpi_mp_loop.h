@@ -0,0 +1,56 @@
+#include <stdint.h>
+#include <libavformat/avformat.h>
+
+/**
+ *	Timestamp continuity for a clip that is played over and over without stopping the pipeline.
+ *	At the end of the clip the demuxer starts over at the first keyframe, and every packet of the
+ *	next pass is shifted by the length of the passes before, so decoders and renderers see one
+ *	endless stream. All times in AV_TIME_BASE units. soft_video_bench loops its clip with it.
+ */
+typedef struct
+{
+	int64_t start;     /* first timestamp of the clip */
+	int64_t end;       /* end of the latest packet of this pass, before shifting */
+	int64_t length;    /* of one pass, known after the first */
+	int64_t offset;    /* added to every timestamp of this pass */
+	int     packets;   /* read in this pass */
+	int     passes;    /* completed */
+} loop_state ;
+
+
+/**
+ *	Starts at the beginning of the clip, without any shift.
+ *
+ *	@param loop_state * loop
+ *	@param AVFormatContext * fmt_ctx
+ */
+void init_loop ( loop_state * loop, AVFormatContext * fmt_ctx ) ;
+
+/**
+ *	Shifts the timestamps of a packet of the current pass and remembers where it ends.
+ *
+ *	@param loop_state * loop
+ *	@param AVFormatContext * fmt_ctx
+ *	@param AVPacket * packet
+ */
+void loop_rebase_packet ( loop_state * loop, AVFormatContext * fmt_ctx, AVPacket * packet ) ;
+
+/**
+ *	Called at the end of the clip: seeks back to the first keyframe and makes the next pass follow
+ *	on from the end of this one.
+ *
+ *	@param loop_state * loop
+ *	@param AVFormatContext * fmt_ctx
+ *	@return int ret
+ *		0 if the clip starts over, non-zero if it can't (no packets in this pass, or not seekable)
+ */
+int loop_restart ( loop_state * loop, AVFormatContext * fmt_ctx ) ;
+
+/**
+ *	Maps a shifted time back into the clip, e.g. the media clock to a position in the file.
+ *
+ *	@param loop_state * loop
+ *	@param int64_t time
+ *	@return int64_t position
+ */
+int64_t loop_position ( const loop_state * loop, int64_t time ) ;
@@ -0,0 +1,42 @@
+#include <stdint.h>
+
+/**
+ *	Media clock interpolated from periodic samples of the OMX clock.
+ *	A sampler thread reads the OMX media time every period and publishes it together with the
+ *	CLOCK_MONOTONIC time it was taken at; readers extrapolate with the current scale, lock-free.
+ *	A clock that did not move between two samples (not started yet, stalled) is treated as stopped.
+ */
+
+
+/**
+ *	Starts the sampler thread. Don't forget to call stop_media_clock!
+ *
+ *	@param int64_t (*sample) (void)
+ *		returns the current media time of the OMX clock in microseconds
+ *	@param int period
+ *		sampling period in microseconds
+ *	@return int ret
+ *		0 on success, non-zero on failure
+ */
+int start_media_clock ( int64_t (*sample) (void), int period ) ;
+
+/**
+ *	Stops and joins the sampler thread.
+ */
+void stop_media_clock ( void ) ;
+
+/**
+ *	Sets the playback speed the clock extrapolates with, 16.16 fixed point (0 when paused),
+ *	and takes a new sample right away.
+ */
+void media_clock_scale ( int32_t scale ) ;
+
+/**
+ *	Takes a new sample right away, e.g. after a seek.
+ */
+void media_clock_resync ( void ) ;
+
+/**
+ *	Current media time in microseconds. Lock-free, does not talk to the OMX clock.
+ */
+int64_t media_clock_now ( void ) ;
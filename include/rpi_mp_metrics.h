@@ -0,0 +1,64 @@
+#include <stdint.h>
+
+/**
+ *	Counters bumped on the playback paths. Only ever updated with relaxed atomics (METRIC_ADD)
+ *	and read the same way, so a scrape never blocks playback. They count for the whole process.
+ *	Statistics of the player that a scrape reads (buffer waits, drops) are written the same way,
+ *	with METRIC_BUMP and METRIC_SET.
+ */
+typedef struct
+{
+	uint64_t packets_demuxed;
+	uint64_t bytes_demuxed;
+	uint64_t video_packets_decoded;
+	uint64_t audio_packets_decoded;
+	uint64_t loops;
+} player_counters ;
+
+extern player_counters rpi_mp_counters;
+
+#define METRIC_ADD(counter, n) __atomic_add_fetch (&rpi_mp_counters.counter, (n), __ATOMIC_RELAXED)
+#define METRIC_BUMP(value, n)  __atomic_add_fetch (&(value), (n), __ATOMIC_RELAXED)
+#define METRIC_SET(value, n)   __atomic_store_n (&(value), (n), __ATOMIC_RELAXED)
+#define METRIC_GET(value)      __atomic_load_n (&(value), __ATOMIC_RELAXED)
+
+/**
+ *	Output of one scrape, either Prometheus text or JSON.
+ */
+typedef struct metrics_writer metrics_writer ;
+
+
+/**
+ *	Adds a counter (a value that only goes up) to the scrape.
+ *
+ *	@param metrics_writer * writer
+ *	@param const char * name
+ *		Prometheus metric name, also the JSON key
+ *	@param const char * help
+ *	@param uint64_t value
+ */
+void metric_counter ( metrics_writer * writer, const char * name, const char * help, uint64_t value ) ;
+
+/**
+ *	Adds a gauge (a value that goes up and down) to the scrape.
+ */
+void metric_gauge ( metrics_writer * writer, const char * name, const char * help, double value ) ;
+
+/**
+ *	Listens on a Unix domain socket and answers every connection with a scrape.
+ *	A request containing "json" gets JSON, anything else Prometheus text; HTTP requests get an
+ *	HTTP response. Process CPU time and resident memory are always included.
+ *
+ *	@param const char * path
+ *		socket path, an existing socket file there is replaced
+ *	@param void (* collect) (metrics_writer *)
+ *		called from the server thread for each scrape to add the player's metrics, must not block
+ *	@return int ret
+ *		0 on success, non-zero if the socket could not be set up
+ */
+int start_metrics_server ( const char * path, void ( * collect ) ( metrics_writer * ) ) ;
+
+/**
+ *	Stops the server and removes the socket file.
+ */
+void stop_metrics_server ( void ) ;
@@ -19,6 +19,11 @@ typedef struct
 	AVPacket      * packets;
 	AVPacket      * _front;
 	AVPacket      * _back;
+	uint64_t        full;      /* times the FIFO turned full and refused pushes, i.e. demuxing stalled */
+	uint64_t        empty;     /* times a pop found the FIFO run empty, i.e. decoding starved */
+	int             stalled;   /* the last push was refused */
+	int             starved;   /* the last pop found nothing */
+	int64_t         max_duration; /* span of timestamps it may hold, 0 for no limit */
 	pthread_mutex_t mutex;
 } packet_buffer ;
 
@@ -36,6 +41,16 @@ typedef struct
  */
 int init_packet_buffer ( packet_buffer * buffer, uint size ) ;
 
+/**
+ *	Limits the FIFO by time as well as by size: a packet is refused if the FIFO holds packets
+ *	more than duration before it. The timestamps of the packets have to share one time base.
+ *
+ *	@param packet_buffer * buffer
+ *	@param int64_t duration
+ *		in the time base of the packets, 0 for no limit
+ */
+void packet_buffer_max_duration ( packet_buffer * buffer, int64_t duration ) ;
+
 /**
  *	Destroys a FIFO buffer.
  *	Performs necessary deallocation of buffers.
@@ -0,0 +1,41 @@
+#include <libavformat/avformat.h>
+
+/**
+ *	Size-classed pool for the data of demuxed packets.
+ *	Buffers are taken in the demuxing thread and returned by av_packet_unref in the decoding
+ *	threads, so the data queued between demuxing and decoding lives in memory that is reused
+ *	rather than freed by other threads than the one that allocated it.
+ *
+ *	This is not allocation free: libavformat has no hook for the packet buffers, so the
+ *	demuxer still allocates every packet, which pool_packet copies and frees right away in the
+ *	same thread, and av_buffer_pool_get allocates a small AVBufferRef for each packet.
+ *	What the pool buys is a bounded, non-fragmenting packet queue, for one extra copy per packet.
+ */
+
+
+/**
+ *	Initialize the pool.
+ *	Buffers are allocated lazily. Don't forget to call destroy_packet_pool!
+ *
+ *	@param size_t max_size
+ *		maximum number of bytes the pool may hold, packets beyond it keep their own buffer
+ *	@return int ret
+ *		0 on success, or non-zero on failure
+ */
+int init_packet_pool ( size_t max_size ) ;
+
+/**
+ *	Releases the pool. Buffers still referenced by packets are freed when those are unreferenced.
+ */
+void destroy_packet_pool ( void ) ;
+
+/**
+ *	Copies the data of a packet into a pool buffer and frees the buffer allocated by the demuxer.
+ *	Must only be called from one thread (the demuxing one).
+ *
+ *	@param AVPacket * p
+ *		packet to move, unchanged if the pool could not take it
+ *	@return int ret
+ *		0 if the packet data now lives in the pool, non-zero otherwise
+ */
+int pool_packet ( AVPacket * p ) ;
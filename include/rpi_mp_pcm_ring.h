@@ -0,0 +1,136 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/**
+ *	Number of timestamp marks a ring can hold, i.e. decoded frames it can hold.
+ */
+#define PCM_RING_MARKS 256
+
+/**
+ *	Timestamp of the sample that starts at a byte position of the stream.
+ */
+typedef struct
+{
+	uint64_t position;
+	int64_t  pts;
+} pcm_mark ;
+
+/**
+ *	Byte ring of interleaved PCM between the audio decoding and the audio submit stage.
+ *	One thread writes, one thread reads. Positions count bytes since the last flush.
+ */
+typedef struct
+{
+	uint8_t       * data;
+	size_t          size;
+	int             bytes_per_second;
+	uint64_t        written;
+	uint64_t        read;
+	size_t          peak;
+	int64_t         offset;    /* added to the timestamps written */
+	pcm_mark        marks[PCM_RING_MARKS];
+	unsigned        mark_front;
+	unsigned        n_marks;
+	unsigned        flushes;
+	int             finished;
+	int             aborted;
+	uint64_t        write_wait_us;
+	uint64_t        read_wait_us;
+	size_t          wanted;    /* bytes the reader is waiting for */
+	int64_t         ready_at;  /* when they became available */
+	pthread_mutex_t mutex;
+	pthread_cond_t  cond;
+} pcm_ring ;
+
+
+/**
+ *	Initialize the ring.
+ *	Allocates the sample buffer. Don't forget to call destroy_pcm_ring!
+ *
+ *	@param pcm_ring * ring
+ *		pointer to a struct to perform initialization on
+ *	@param size_t size
+ *		capacity of the ring in bytes
+ *	@param int bytes_per_second
+ *		byte rate of the PCM, used to timestamp reads that start inside a frame
+ *	@return int ret
+ *		0 on success, or non-zero on failure
+ */
+int init_pcm_ring ( pcm_ring * ring, size_t size, int bytes_per_second ) ;
+
+/**
+ *	Frees the sample buffer.
+ */
+void destroy_pcm_ring ( pcm_ring * ring ) ;
+
+/**
+ *	Copies a decoded frame into the ring, waiting while there is no room for it.
+ *
+ *	@param pcm_ring * ring
+ *	@param const uint8_t * data
+ *	@param size_t size
+ *		number of bytes, at most the capacity of the ring
+ *	@param int64_t pts
+ *		timestamp of the first sample in microseconds, AV_NOPTS_VALUE if unknown
+ *	@return int ret
+ *		0 on success, non-zero if the ring was aborted
+ */
+int pcm_ring_write ( pcm_ring * ring, const uint8_t * data, size_t size, int64_t pts ) ;
+
+/**
+ *	Waits until at least size bytes can be read, or the writer finished, or the ring was aborted.
+ *
+ *	@param pcm_ring * ring
+ *	@param size_t size
+ *	@param int64_t * ready
+ *		if the reader had to wait, set to the monotonic time in microseconds the writer made the
+ *		bytes available, so the caller can tell how long it took to wake up; 0 otherwise. May be NULL.
+ *	@return size_t available
+ *		number of bytes that can be read, 0 once the ring is drained or aborted
+ */
+size_t pcm_ring_wait ( pcm_ring * ring, size_t size, int64_t * ready ) ;
+
+/**
+ *	Copies up to size bytes out of the ring without waiting.
+ *
+ *	@param pcm_ring * ring
+ *	@param uint8_t * data
+ *	@param size_t size
+ *	@param int64_t * pts
+ *		set to the timestamp of the first byte read, AV_NOPTS_VALUE if unknown
+ *	@return size_t read
+ *		number of bytes copied, 0 if the ring was flushed while copying
+ */
+size_t pcm_ring_read ( pcm_ring * ring, uint8_t * data, size_t size, int64_t * pts ) ;
+
+/**
+ *	Bytes written but not read yet.
+ */
+size_t pcm_ring_fill ( pcm_ring * ring ) ;
+
+/**
+ *	Tells the reader no more data will be written; it drains what is left.
+ */
+void pcm_ring_finish ( pcm_ring * ring ) ;
+
+/**
+ *	Wakes both stages up and makes every further call return immediately, e.g. when stopping.
+ */
+void pcm_ring_abort ( pcm_ring * ring ) ;
+
+/**
+ *	Drops all data and timestamps, e.g. after a seek.
+ */
+void pcm_ring_flush ( pcm_ring * ring ) ;
+
+/**
+ *	Moves the timestamps of the ring, e.g. to play a source on the timeline of another one.
+ *
+ *	@param pcm_ring * ring
+ *	@param int64_t held
+ *		microseconds added to the timestamps of the data in the ring
+ *	@param int64_t written
+ *		microseconds added to the timestamps written from now on, in place of what was added so far
+ */
+void pcm_ring_shift ( pcm_ring * ring, int64_t held, int64_t written ) ;
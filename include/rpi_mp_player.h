@@ -0,0 +1,18 @@
+/** ----------------------------------------------------------------------------------
+ * File: rpi_mp_player.h
+ * Description: Internal interface the player exposes to the other library modules.
+ * ----------------------------------------------------------------------------------- */
+#include <stdint.h>
+
+/**
+ *	Copies the keyframe index of the video stream that is opened for playback.
+ *	Timestamps are in microseconds relative to the start of the file.
+ *
+ *	@param const char * source
+ *		path of the file the caller is interested in
+ *	@param int64_t ** keyframes
+ *		set to a malloc'ed array of timestamps, which the caller must free
+ *	@return int ret
+ *		number of keyframes, 0 if source is not the file being played or it has no index
+ */
+int player_keyframe_index ( const char * source, int64_t ** keyframes ) ;
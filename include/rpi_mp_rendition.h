@@ -0,0 +1,27 @@
+#include "ilclient.h"
+
+/**
+ *	Decode speed, as a multiple of real time, a rendition needs to be picked.
+ *	The probe only measures the decoder, the margin covers scheduling and rendering.
+ */
+#define RENDITION_HEADROOM 1.2
+
+
+/**
+ *	Orders the renditions of an asset from the highest to the lowest pixel rate and picks the
+ *	first one the board decodes with RENDITION_HEADROOM. Renditions with the same codec, size and
+ *	frame rate as one measured before on this board model reuse the stored result, the others are
+ *	probed by decoding their first seconds on the hardware decoder, so nothing else may be decoding.
+ *
+ *	@param ILCLIENT_T * client
+ *	@param const char * files[]
+ *	@param int count
+ *	@param int * order
+ *		filled with the indices of files, highest pixel rate first; renditions that could not be
+ *		opened are left out
+ *	@param int * n_order
+ *		set to the number of indices in order
+ *	@return int chosen
+ *		position of the chosen rendition in order, the last one if none keeps up, -1 if none opens
+ */
+int select_rendition ( ILCLIENT_T * client, const char * files[], int count, int * order, int * n_order ) ;
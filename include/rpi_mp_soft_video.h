@@ -0,0 +1,152 @@
+#include <stdint.h>
+#include <pthread.h>
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+
+/**
+ *	Number of decoded frames the pool holds between the decoder and the render side.
+ */
+#define SOFT_VIDEO_FRAMES 4
+
+/**
+ *	Frames that are later than this against the clock are dropped after decoding, and while the
+ *	output lags by more than this the decoder skips non-reference frames.
+ */
+#define SOFT_VIDEO_LATE_US 40000
+
+/**
+ *	Software video decoder for codecs the hardware decoder does not handle (HEVC, VP9, AV1).
+ *	libavcodec decodes with frame and slice threads; decoded frames are kept as references into
+ *	the decoder's own buffers in a small pool until the render side releases them, so the only
+ *	copy is the conversion into the output buffer.
+ *	One thread decodes, one thread acquires and releases frames.
+ */
+typedef struct
+{
+	AVCodecContext   * codec_ctx;
+	AVFrame          * decoded;
+	struct SwsContext* sws;
+	AVRational         time_base;
+	int64_t         (* clock) (void);
+	int64_t            last_pts;
+	AVFrame          * frames[SOFT_VIDEO_FRAMES];
+	int                front;
+	int                count;
+	int                in_use;
+	int                finished;
+	int                aborted;
+	int                flush;
+	unsigned           flushes;
+	unsigned           acquired_flushes;
+	uint64_t           packets;
+	uint64_t           decoded_frames;
+	uint64_t           late;
+	uint64_t           decode_us;
+	pthread_mutex_t    mutex;
+	pthread_cond_t     cond;
+} soft_video ;
+
+
+/**
+ *	Opens a decoder for the stream.
+ *
+ *	@param soft_video * video
+ *	@param AVStream * stream
+ *	@param int threads
+ *		decoding threads, 0 for one per core
+ *	@param int64_t (* clock) (void)
+ *		media time in AV_TIME_BASE units to drop late frames against, NULL to decode every frame
+ *	@return int ret
+ *		0 on success, non-zero if the codec could not be opened
+ */
+int open_soft_video ( soft_video * video, AVStream * stream, int threads, int64_t ( * clock ) ( void ) ) ;
+
+/**
+ *	Frees the decoder and any frames still in the pool.
+ */
+void close_soft_video ( soft_video * video ) ;
+
+/**
+ *	Decodes a packet and queues the frames it completes, waiting while the pool is full.
+ *	A packet without data drains the frames the decoder threads still hold.
+ *
+ *	@param soft_video * video
+ *	@param AVPacket * packet
+ *	@return int ret
+ *		0 on success, non-zero on a decoding error or if the pool was aborted
+ */
+int soft_video_decode ( soft_video * video, AVPacket * packet ) ;
+
+/**
+ *	Waits for the next decoded frame. The frame stays in the pool until soft_video_release.
+ *
+ *	@param soft_video * video
+ *	@param int64_t * pts
+ *		set to the presentation time in AV_TIME_BASE units, AV_NOPTS_VALUE if unknown
+ *	@return AVFrame * frame
+ *		NULL once the pool is finished and empty, or aborted
+ */
+AVFrame * soft_video_acquire ( soft_video * video, int64_t * pts ) ;
+
+/**
+ *	Tells whether a frame is waiting without taking it, for a render side that only wants it once
+ *	it is due.
+ *
+ *	@param soft_video * video
+ *	@param int64_t * pts
+ *		set to the presentation time of the next frame in AV_TIME_BASE units
+ *	@return int ret
+ *		non-zero if a frame is queued and not acquired yet
+ */
+int soft_video_peek ( soft_video * video, int64_t * pts ) ;
+
+/**
+ *	Tells whether the pool was flushed since the frame in use was acquired. The frame then
+ *	belongs to the position before a seek, and the render side should release it rather than
+ *	wait for its time.
+ *
+ *	@param soft_video * video
+ *	@return int ret
+ *		non-zero if the acquired frame is stale
+ */
+int soft_video_stale ( soft_video * video ) ;
+
+/**
+ *	Hands the acquired frame back to the decoder.
+ */
+void soft_video_release ( soft_video * video ) ;
+
+/**
+ *	Converts a frame to 8 bit YUV 4:2:0 with the planes one after the other, as OMX
+ *	YUV420PackedPlanar expects. 8 bit 4:2:0 frames are copied plane by plane, anything else
+ *	goes through swscale.
+ *
+ *	@param soft_video * video
+ *	@param const AVFrame * frame
+ *	@param uint8_t * buffer
+ *	@param int stride
+ *		bytes per luma row, chroma rows are half of it
+ *	@param int slice_height
+ *		luma rows per plane in the buffer
+ *	@return int ret
+ *		0 on success, non-zero if the frame could not be converted
+ */
+int soft_video_convert ( soft_video * video, const AVFrame * frame, uint8_t * buffer, int stride, int slice_height ) ;
+
+/**
+ *	Marks the end of decoding, soft_video_acquire returns NULL once the pool is empty.
+ */
+void soft_video_finish ( soft_video * video ) ;
+
+/**
+ *	Wakes up and ends both sides, e.g. when playback is stopped.
+ */
+void soft_video_abort ( soft_video * video ) ;
+
+/**
+ *	Drops the queued frames after a seek. May be called from any thread, the decoder's own
+ *	reference frames are dropped before it decodes the next packet. The frame in use is left to
+ *	the render side, which finds out with soft_video_stale.
+ */
+void soft_video_flush ( soft_video * video ) ;
@@ -0,0 +1,67 @@
+#include <libavcodec/avcodec.h>
+
+/**
+ *	Number of subtitle events that are decoded and rasterized ahead of their display time.
+ */
+#define SUBTITLE_EVENTS 4
+
+
+/**
+ *	Prepares the subtitle renderer.
+ *  Loads the font and allocates the glyph atlas. Don't forget to call destroy_subtitles!
+ *
+ *	@param AVCodecContext * codec_ctx
+ *		opened decoder of the subtitle stream
+ *	@param int video_width, video_height
+ *		size of the video the subtitles are positioned in
+ *	@param int use_dispmanx
+ *		non-zero to present the overlay on a dispmanx layer above the video
+ *	@return int ret
+ *		0 on success, non-zero on failure
+ */
+int init_subtitles ( AVCodecContext * codec_ctx, int video_width, int video_height, int use_dispmanx ) ;
+
+/**
+ *	Frees the atlas and overlay buffers and removes the dispmanx layer.
+ */
+void destroy_subtitles ( void ) ;
+
+/**
+ *	Returns non-zero when no more events can be rasterized ahead of time.
+ */
+int subtitles_pending_full ( void ) ;
+
+/**
+ *	Decodes a subtitle packet and rasterizes it into a pending event.
+ *
+ *	@param AVPacket * packet
+ *	@param int64_t pts
+ *		presentation time of the packet in microseconds, on the same scale as the media clock
+ *	@param int64_t duration
+ *		duration of the packet in microseconds, used if the subtitle has no end time itself
+ *	@return int ret
+ *		0 on success, non-zero on failure
+ */
+int decode_subtitle_packet ( AVPacket * packet, int64_t pts, int64_t duration ) ;
+
+/**
+ *	Shows the pending event that is due and hides the one that expired.
+ *
+ *	@param int64_t media_time
+ *		current media time in microseconds
+ */
+void update_subtitles ( int64_t media_time ) ;
+
+/**
+ *	Drops pending events and hides the current one, e.g. after a seek.
+ */
+void flush_subtitles ( void ) ;
+
+/**
+ *	Decodes the following packets with another decoder, after switching the subtitle track.
+ *	Call flush_subtitles first.
+ *
+ *	@param AVCodecContext * codec_ctx
+ *		opened decoder of the new subtitle stream
+ */
+void subtitles_codec ( AVCodecContext * codec_ctx ) ;
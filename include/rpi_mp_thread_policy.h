@@ -0,0 +1,44 @@
+#include <stdint.h>
+
+/**
+ *	Scheduling of the pipeline threads. Each thread applies the policy set for it with
+ *	rpi_mp_set_thread_policy when it starts, and measures how late it wakes up from its timed
+ *	waits into a histogram, which is how a policy is judged: an audio thread that is preempted by
+ *	the UI wakes up late.
+ *	The threads are identified by the rpi_mp_thread values of the public header.
+ */
+
+
+/**
+ *	Applies the policy set for a thread to the calling thread. The settings it replaces are kept
+ *	for thread_policy_leave, which only matters for a thread that outlives playback (THREAD_DEMUX).
+ *	Threads without a policy keep what they inherited, and threads started afterwards inherit
+ *	the policy, so the demux thread enters its own after starting the others.
+ *
+ *	@param int thread
+ *	@return int ret
+ *		0 on success, non-zero if the policy could not be applied (e.g. no permission for
+ *		SCHED_FIFO); the thread then runs with the settings it had
+ */
+int thread_policy_enter ( int thread ) ;
+
+/**
+ *	Restores the settings thread_policy_enter replaced.
+ */
+void thread_policy_leave ( int thread ) ;
+
+/**
+ *	Sleeps like usleep and records how much longer than asked the thread slept.
+ */
+void thread_sleep ( int thread, int us ) ;
+
+/**
+ *	Records a wakeup that was due at deadline (CLOCK_MONOTONIC, microseconds), for threads that
+ *	wait some other way, e.g. on a condition with a timeout.
+ */
+void thread_wakeup ( int thread, int64_t deadline ) ;
+
+/**
+ *	Clears the histograms of all threads.
+ */
+void thread_latency_reset ( void ) ;
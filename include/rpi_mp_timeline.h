@@ -0,0 +1,112 @@
+#include <stdint.h>
+#include <libavformat/avformat.h>
+
+/**
+ *	Backward jumps of the decoding timestamps up to this much are treated as jitter of a broken
+ *	stream and clamped, bigger ones are discontinuities.
+ */
+#define TIMELINE_MAX_BACKWARD_US 1000000
+
+/**
+ *	Forward gaps up to this much are taken as missing data, bigger ones are discontinuities.
+ */
+#define TIMELINE_MAX_GAP_US      (10 * 1000000LL)
+
+
+/**
+ *	What the timeline knows about one stream.
+ */
+typedef struct
+{
+	int64_t wrap_offset;  /* in the stream's time base, a multiple of the wrap period */
+	int64_t last_raw;     /* dts (or pts) of the previous packet in the stream's time base, unwrapped */
+	int64_t offset;       /* microseconds added after a discontinuity */
+	int64_t next_dts;     /* microseconds, where the next packet is expected */
+	int64_t last_dts;     /* microseconds, as handed out */
+	int64_t last_pts;
+	int     reorders;     /* has B-frames, a missing pts can't be taken from the dts */
+} timeline_stream ;
+
+/**
+ *	Turns the timestamps of demuxed packets into one continuous timeline in microseconds, with
+ *	integer rescaling, so nothing downstream needs the stream time bases.
+ *	Timestamps that wrap (33 bits in MPEG-TS, every 26.5 hours) are unwrapped. In containers that
+ *	can have discontinuities (AVFMT_TS_DISCONT: MPEG-TS, MPEG-PS, FLV) a jump of the decoding
+ *	timestamps rebases the stream to continue where it was expected to. The first stream to jump
+ *	decides the offset, the others take it when they get there, so they stay in sync across the
+ *	splice. Decoding timestamps never go backwards; a missing pts is taken from the dts unless
+ *	the stream has B-frames, where it stays unknown.
+ */
+typedef struct
+{
+	timeline_stream * streams;
+	int               n_streams;
+	int               check_gaps;       /* the container can have discontinuities */
+	int64_t           offset;           /* microseconds, of the segment the demuxer is in */
+	int               discontinuities;
+	int               wraps;
+} timeline ;
+
+
+/**
+ *	Starts a timeline for the streams of a demuxer.
+ *	Don't forget to call destroy_timeline!
+ *
+ *	@param timeline * t
+ *	@param AVFormatContext * fmt_ctx
+ */
+void init_timeline ( timeline * t, AVFormatContext * fmt_ctx ) ;
+
+/**
+ *	Frees the stream states.
+ */
+void destroy_timeline ( timeline * t ) ;
+
+/**
+ *	Rescales pts, dts and duration of a packet to microseconds on the timeline, in place.
+ *
+ *	@param timeline * t
+ *	@param AVFormatContext * fmt_ctx
+ *	@param AVPacket * packet
+ *		as read from fmt_ctx, timestamps in the time base of its stream
+ */
+void timeline_packet ( timeline * t, AVFormatContext * fmt_ctx, AVPacket * packet ) ;
+
+/**
+ *	Starts over after a seek: the demuxer's timestamps are taken as they are again.
+ */
+void timeline_reset ( timeline * t ) ;
+
+/**
+ *	Moves the whole timeline, the timestamps handed out so far and those still to come, e.g. to go
+ *	on where another source left off.
+ *
+ *	@param timeline * t
+ *	@param int64_t offset
+ *		microseconds added
+ */
+void timeline_shift ( timeline * t, int64_t offset ) ;
+
+/**
+ *	Returns non-zero if timestamps were unwrapped or rebased since the last reset, i.e. media time
+ *	no longer maps to a position in the file directly.
+ */
+int timeline_rebased ( const timeline * t ) ;
+
+/**
+ *	Splits a timestamp in microseconds into the halves of an OMX_TICKS (built with OMX_SKIP64BIT).
+ *
+ *	@param int64_t us
+ *	@param uint32_t * low
+ *	@param uint32_t * high
+ */
+void timeline_ticks ( int64_t us, uint32_t * low, uint32_t * high ) ;
+
+/**
+ *	Joins the halves of an OMX_TICKS into microseconds.
+ *
+ *	@param uint32_t low
+ *	@param uint32_t high
+ *	@return int64_t us
+ */
+int64_t timeline_ticks_us ( uint32_t low, uint32_t high ) ;
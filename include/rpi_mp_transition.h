@@ -0,0 +1,157 @@
+#include <stdint.h>
+#include <pthread.h>
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+
+/**
+ *	Demuxed packets of the next clip waiting per stream, in bytes.
+ */
+#define TRANSITION_FIFO_SIZE (1024 * 1024 * 2)
+
+
+/**
+ *	The clip a crossfade goes into, played next to the pipeline until the pipeline takes it over.
+ *	A demuxing thread puts the packets on the timeline into two FIFOs. Video packets are taken by a
+ *	second hardware decoder the player runs; audio is decoded into a PCM ring the player provides,
+ *	in the format the pipeline renders (16 bit interleaved). Both stop when their buffers are full,
+ *	so a prepared clip holds its first packets and audio until the crossfade starts. From then on
+ *	its timestamps are shifted onto the outgoing timeline, so the clip runs on the same clock:
+ *	its start time plays at the media time the crossfade started at. Audio is mixed into the
+ *	outgoing audio by timestamp. At the handover the pipeline takes the demuxer, the codec, the
+ *	ring and the packets left over.
+ *	Needs rpi_mp.h and the headers of the packet buffer, PCM ring, audio decoding stage and timeline
+ *	to be included first.
+ */
+typedef struct
+{
+	AVFormatContext   * fmt_ctx;
+	timeline            packet_timeline;
+	int                 video_idx;
+	int                 audio_idx;
+	packet_buffer       video_fifo;
+	packet_buffer       audio_fifo;
+	AVPacket            held;              /* read when demuxing stopped, not queued yet */
+	int                 has_held;
+	int                 has_video;
+	int                 done_reading;
+	int                 stop;
+	pthread_t           threads[2];
+	int                 n_threads;
+	int64_t             start_time;        /* media time the clip starts at */
+	int64_t             shift;             /* added to its timestamps, onto the outgoing timeline */
+
+	// audio
+	AVCodecContext    * audio_ctx;
+	pcm_ring          * pcm;
+	int                 mix;               /* the audio matches the outgoing format */
+	int                 aligned;           /* the ring is read at the position the mix is at */
+	int                 channels;          /* of the outgoing audio */
+	int                 block_align;
+	int                 sample_rate;
+	uint8_t           * mix_buffer;
+	size_t              mix_size;
+	audio_decoder       decoder;           /* of audio_ctx, the pipeline takes both over */
+
+	// the crossfade
+	int64_t             started;           /* monotonic time it started, 0 before */
+	int64_t             duration;
+	int64_t             media_start;       /* outgoing media time it started at */
+	int64_t             cpu_start;
+	uint64_t            decode_us_start;
+	size_t              rss_start;
+	size_t              rss_peak;
+} transition ;
+
+
+/**
+ *	Opens the clip and starts demuxing it, and decoding its audio if it can be mixed.
+ *	Don't forget to call close_transition!
+ *
+ *	@param transition * t
+ *	@param const char * source
+ *	@param pcm_ring * pcm
+ *		initialized ring for the decoded audio, in the format of the outgoing audio; NULL if there
+ *		is none to mix into. The caller destroys it.
+ *	@param int sample_rate
+ *		of the outgoing audio, the clip's audio is only mixed in if it has the same format
+ *	@param int channels
+ *		of the outgoing audio
+ *	@return int ret
+ *		0 on success, non-zero if the clip could not be opened or has no video
+ */
+int open_transition ( transition * t, const char * source, pcm_ring * pcm, int sample_rate, int channels ) ;
+
+/**
+ *	Stops demuxing and decoding and frees what the pipeline did not take over.
+ */
+void close_transition ( transition * t ) ;
+
+/**
+ *	Starts the crossfade now, and puts the clip on the outgoing timeline.
+ *
+ *	@param transition * t
+ *	@param int64_t duration
+ *		in microseconds, 0 for a cut
+ *	@param int64_t media_now
+ *		outgoing media time the start time of the clip plays at
+ */
+void transition_start ( transition * t, int64_t duration, int64_t media_now ) ;
+
+/**
+ *	Blend factor of the next clip now: 0 before and at the start of the crossfade, 1 from its end.
+ */
+float transition_blend ( const transition * t ) ;
+
+/**
+ *	Takes the next video packet, on the outgoing timeline.
+ *
+ *	@param transition * t
+ *	@param AVPacket * packet
+ *	@return int ret
+ *		0 on success, 1 if there is none queued, -1 if the clip was read to the end
+ */
+int transition_video_packet ( transition * t, AVPacket * packet ) ;
+
+/**
+ *	Stops the demuxing and audio decoding threads for the handover, without dropping anything they
+ *	read or decoded. The audio thread finishes what it decoded into the ring, so the ring must be
+ *	read meanwhile.
+ */
+void transition_detach ( transition * t ) ;
+
+/**
+ *	Moves the packets that were not decoded yet into the pipeline's FIFOs, on the outgoing timeline,
+ *	once the clip was detached.
+ *
+ *	@param transition * t
+ *	@param packet_buffer * video
+ *	@param packet_buffer * audio
+ *		NULL if the audio was not mixed and is dropped
+ *	@return int ret
+ *		0 on success, non-zero if packets were dropped because the FIFOs were full
+ */
+int transition_take_packets ( transition * t, packet_buffer * video, packet_buffer * audio ) ;
+
+/**
+ *	Crossfades a buffer of outgoing audio, in place: the outgoing samples get the remaining weight,
+ *	the next clip's samples heard at the same time the blend factor. Buffers heard before the start
+ *	are left alone. Called by the audio submit stage only.
+ *
+ *	@param transition * t
+ *	@param int16_t * samples
+ *		interleaved, in the format given to open_transition
+ *	@param int frames
+ *		number of samples per channel
+ *	@param int64_t pts
+ *		outgoing media time of the first sample
+ */
+void transition_mix ( transition * t, int16_t * samples, int frames, int64_t pts ) ;
+
+/**
+ *	Fills in what the overlap cost so far.
+ *
+ *	@param transition * t
+ *	@param rpi_mp_overlap_stats * stats
+ *		frames and handover_us are left alone, the transition does not know about the decoder
+ */
+void transition_stats ( transition * t, rpi_mp_overlap_stats * stats ) ;
@@ -1,11 +1,20 @@
 #include <stdint.h>
+#include <stddef.h>
 
-void flt_to_s16 (uint8_t *flt, uint8_t **s16, int size) ;
+void flt_to_s16 (uint8_t *flt, uint8_t *s16, int size) ;
 
 unsigned long time_ms (void);
 
 unsigned long time_us (void);
 
+int64_t monotonic_us (void);
+
+/**
+ *	Path of a cache file in $RPI_MP_CACHE, or in ~/.cache if that is not set.
+ *	Returns path, or NULL if there is nowhere to keep it.
+ */
+const char* cache_file_path (const char* name, char* path, size_t size);
+
 void ts (void);
 
 void tp (void);
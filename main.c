@@ -2,6 +2,9 @@
 #include <stdio.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
 #include "GLES/gl.h"
 #include "EGL/egl.h"
 #include "EGL/eglext.h"
@@ -9,6 +12,7 @@
 #include "bcm_host.h"
 #include <math.h>
 #include "rpi_mp_utils.h"
+#include "rpi_mp_io.h"
 
 
 #ifndef M_PI
@@ -38,6 +42,17 @@ int flags;
 char * source;
 
 static int layer = 0;
+static const char* metrics_socket = NULL;
+static int thumbnail_benchmark = 0;
+static int io_benchmark = 0;
+static int scan_benchmark = 0;
+static int loopback_test = 0;
+static int realtime = 0;
+static const char* next_clip = NULL;
+// the second set of textures, the clip faded into renders into the set the playing one does not use
+static GLuint transition_textures[BUFFER_COUNT];
+static void* transition_images[BUFFER_COUNT];
+static int transition_current = 0;
 
 /** Texture coordinates for the quad. */
 static const GLfloat tex_coords[6 * 4 * 2] = {
@@ -111,6 +126,206 @@ static const GLbyte quadx[6*4*3] = {
 };
 
 
+static void print_buffer_stats ()
+{
+	rpi_mp_buffer_stats video, audio;
+	rpi_mp_input_buffer_stats (&video, &audio);
+	printf ("video: %d x %d bytes, %llu buffers, waited %llu us (max %llu us), %llu split packets\n",
+	        video.buffer_count, video.buffer_size, video.buffers, video.wait_us, video.max_wait_us, video.split_packets);
+	printf ("audio: %d x %d bytes, %llu buffers, waited %llu us (max %llu us), %llu split packets\n",
+	        audio.buffer_count, audio.buffer_size, audio.buffers, audio.wait_us, audio.max_wait_us, audio.split_packets);
+
+	rpi_mp_drop_stats drops;
+	rpi_mp_video_drop_stats (&drops);
+	printf ("video drops: %llu late packets (max %lld us), %llu non-reference dropped, %llu dropped in %llu skips to a restart point\n",
+	        drops.late, drops.max_lateness_us, drops.non_reference, drops.skipped, drops.skips);
+
+	rpi_mp_audio_pipeline_stats pipeline;
+	rpi_mp_audio_stats (&pipeline);
+	printf ("audio pipeline: %llu frames decoded in %llu us, ring %zu bytes (peak %zu), "
+	        "waited %llu us for room, %llu us for samples, %llu us for the renderer\n",
+	        pipeline.frames, pipeline.decode_us, pipeline.ring_size, pipeline.ring_peak,
+	        pipeline.ring_full_us, pipeline.ring_empty_us, pipeline.render_wait_us);
+
+	rpi_mp_audio_latency latency;
+	if (rpi_mp_audio_output_latency (&latency) == 0)
+		printf ("audio latency: %lld us (%lld us decoded, %lld us in the renderer), target %lld us, first audio %lld us after start\n",
+		        latency.total_us, latency.ring_us, latency.render_us, latency.target_us, latency.startup_us);
+
+	rpi_mp_live_stats live;
+	if (rpi_mp_live_latency (&live) == 0)
+		printf ("live latency: %lld us in the player (max %lld us), target %lld us, glass to glass %lld us, "
+		        "%llu catch-ups skipped %lld us\n", live.buffered_us, live.max_buffered_us, live.target_us,
+		        live.glass_to_glass_us, live.catch_ups, live.skipped_us);
+}
+
+
+static void print_clock_stats ()
+{
+	rpi_mp_clock_stats clock;
+	rpi_mp_media_clock_stats (&clock);
+	printf ("media time %lld us, sampled every %d us (%llu samples), error %lld us (max %lld us), "
+	        "clock read %lld us (max %lld us)\n",
+	        rpi_mp_media_time_us (), clock.period_us, clock.samples, clock.error_us, clock.max_error_us,
+	        clock.round_trip_us, clock.max_round_trip_us);
+}
+
+
+static void print_latency_stats ()
+{
+	const char* names[PIPELINE_THREADS] = { "demux", "video", "video render", "audio", "audio submit", "subtitle", "clock", "next video" };
+	rpi_mp_latency_histogram histogram;
+	int thread, i;
+
+	for (thread = 0; thread < PIPELINE_THREADS; thread ++)
+	{
+		rpi_mp_thread_latency (thread, &histogram);
+		if (!histogram.wakeups)
+			continue;
+		printf ("%-12s %8llu wakeups, late %llu us on average (max %llu us):", names[thread], histogram.wakeups,
+		        histogram.total_us / histogram.wakeups, histogram.max_us);
+		for (i = 0; i < LATENCY_BUCKETS; i ++)
+			if (histogram.buckets[i])
+				printf (" <%dus:%llu", 1 << i, histogram.buckets[i]);
+		printf ("\n");
+	}
+}
+
+
+/**
+ *  Levels of the audio being heard and its spectrum as a row of bars.
+ */
+static void print_audio_levels ()
+{
+	const char* bars = " .:-=+*#%@";
+	rpi_mp_audio_analysis analysis;
+	uint64_t windows, skipped, cpu_us;
+	char spectrum[AUDIO_SPECTRUM_BANDS + 1];
+	int ch, i, level;
+
+	if (rpi_mp_audio_levels (&analysis) != 0)
+	{
+		printf ("no audio levels\n");
+		return;
+	}
+	for (ch = 0; ch < analysis.channels; ch ++)
+		printf ("ch%d peak %5.1f dB rms %5.1f dB\n", ch, 20 * log10f (analysis.peak[ch] + 1e-6f), 20 * log10f (analysis.rms[ch] + 1e-6f));
+	// one character per 6 dB down to -60 dBFS
+	for (i = 0; i < AUDIO_SPECTRUM_BANDS; i ++)
+	{
+		level = (int) (analysis.spectrum[i] + 60) / 6;
+		spectrum[i] = bars[level < 0 ? 0 : level > 9 ? 9 : level];
+	}
+	spectrum[AUDIO_SPECTRUM_BANDS] = '\0';
+	rpi_mp_audio_tap_stats (&windows, &skipped, &cpu_us);
+	printf ("[%s] at %lld us, %llu windows (%llu skipped) in %llu us of CPU\n", spectrum, analysis.pts, windows, skipped, cpu_us);
+}
+
+
+/**
+ *  What the crossfade into the next clip cost.
+ */
+static void print_overlap_stats ()
+{
+	rpi_mp_overlap_stats stats;
+
+	if (rpi_mp_transition_stats (&stats) != 0)
+	{
+		printf ("no crossfade yet\n");
+		return;
+	}
+	printf ("%s overlap of %lld us (crossfade %lld us, handover %lld us): %llu frames decoded, %llu shown, %llu skipped\n",
+	        stats.running ? "running" : "finished", stats.overlap_us, stats.duration_us, stats.handover_us,
+	        stats.frames_decoded, stats.frames_shown, stats.frames_skipped);
+	printf ("decoder load %.2f cores, process %.2f cores, memory %zu kB -> %zu kB, audio %s\n", stats.decoder_load,
+	        stats.cpu_load, stats.rss_start / 1024, stats.rss_peak / 1024, stats.audio_mixed ? "mixed" : "faded out");
+}
+
+
+/**
+ *  How far the download of a file played with follow is.
+ */
+static void print_download_stats ()
+{
+	rpi_mp_download_stats stats;
+
+	if (rpi_mp_follow_stats (&stats) != 0)
+	{
+		printf ("not following a download\n");
+		return;
+	}
+	printf ("download %s: %lld of %lld bytes read, %.1f s ahead of playback, waited %llu times for %lld us%s\n",
+	        stats.timed_out ? "timed out" : stats.complete ? "complete" : "running", stats.read, stats.size, stats.ahead_us / 1000000.0,
+	        stats.waits, stats.wait_us, stats.waiting ? ", waiting now" : "");
+}
+
+
+#define MAX_TRACKS 32
+
+static void print_tracks ()
+{
+	const char* types[] = { "video", "audio", "subtitle" };
+	rpi_mp_track tracks[MAX_TRACKS];
+	int i, n = rpi_mp_tracks (tracks, MAX_TRACKS);
+
+	for (i = 0; i < n && i < MAX_TRACKS; i ++)
+	{
+		printf ("%c %2d %-8s %-8s %-3s", tracks[i].selected ? '*' : ' ', tracks[i].index, types[tracks[i].type], tracks[i].codec, tracks[i].language);
+		if (tracks[i].type == TRACK_VIDEO)
+			printf (" %dx%d", tracks[i].width, tracks[i].height);
+		else if (tracks[i].type == TRACK_AUDIO)
+			printf (" %d Hz %d ch", tracks[i].sample_rate, tracks[i].channels);
+		printf (" %s\n", tracks[i].title);
+	}
+}
+
+
+/**
+ *  Switches to the track of a type after the one playing, subtitles go through off.
+ */
+static void next_track (rpi_mp_track_type type)
+{
+	rpi_mp_track tracks[MAX_TRACKS];
+	int i, n = rpi_mp_tracks (tracks, MAX_TRACKS), current = -1, next = -1;
+
+	if (n > MAX_TRACKS)
+		n = MAX_TRACKS;
+	for (i = 0; i < n; i ++)
+		if (tracks[i].type == type && tracks[i].selected)
+			current = i;
+	for (i = current + 1; i < n && next < 0; i ++)
+		if (tracks[i].type == type)
+			next = tracks[i].index;
+	if (next < 0 && type == TRACK_AUDIO)
+		for (i = 0; i < current && next < 0; i ++)
+			if (tracks[i].type == type)
+				next = tracks[i].index;
+	if (next >= 0 || type == TRACK_SUBTITLE)
+		rpi_mp_select_track (type, next);
+}
+
+
+/**
+ *  Runs the audio path and the clock with real-time priority, on the last core if there are four or
+ *  more, video and demuxing just below, and keeps all memory resident.
+ */
+static void set_realtime_policy ()
+{
+	int ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+	rpi_mp_thread_policy audio = { SCHED_FIFO, 50, ncpu >= 4 ? 1u << (ncpu - 1) : 0 };
+	rpi_mp_thread_policy video = { SCHED_FIFO, 40, 0 };
+
+	rpi_mp_set_thread_policy (THREAD_AUDIO, &audio);
+	rpi_mp_set_thread_policy (THREAD_AUDIO_SUBMIT, &audio);
+	rpi_mp_set_thread_policy (THREAD_CLOCK, &audio);
+	rpi_mp_set_thread_policy (THREAD_VIDEO, &video);
+	rpi_mp_set_thread_policy (THREAD_VIDEO_RENDER, &video);
+	rpi_mp_set_thread_policy (THREAD_NEXT_VIDEO, &video);
+	rpi_mp_set_thread_policy (THREAD_DEMUX, &video);
+	rpi_mp_lock_memory (1);
+}
+
+
 static void* listen_stdin (void* thread_id)
 {
 	char command;
@@ -149,6 +364,47 @@ static void* listen_stdin (void* thread_id)
 					printf ("current time is : %.2d:%.2d:%.2d\n", (int) t / 3600, (int) (t % 3600) / 60, (int) t % 60);
 					break;
 
+				case 'b':
+					print_buffer_stats ();
+					break;
+
+				case 'c':
+					print_clock_stats ();
+					break;
+
+				case 'l':
+					print_latency_stats ();
+					break;
+
+				case 'i':
+					print_tracks ();
+					break;
+
+				case 'v':
+					print_audio_levels ();
+					break;
+
+				case 'o':
+					next_track (TRACK_AUDIO);
+					break;
+
+				case 'u':
+					next_track (TRACK_SUBTITLE);
+					break;
+
+				case 'x':
+					if (rpi_mp_transition_start (1000) != 0)
+						printf ("no clip to crossfade into\n");
+					break;
+
+				case 'f':
+					print_overlap_stats ();
+					break;
+
+				case 'd':
+					print_download_stats ();
+					break;
+
 				case 'a':
 					if (rpi_mp_metadata ("StreamTitle", &title) == 0)
 						  printf ("title: %s\n", title);
@@ -171,14 +427,13 @@ static void* listen_stdin (void* thread_id)
 	return NULL;
 }
 
-static void init_textures ()
+static void create_texture_set (GLuint* set, void** images)
 {
-	// the textures containing the video frames
-	glGenTextures ( BUFFER_COUNT, &textures[0] );
+	glGenTextures ( BUFFER_COUNT, set );
 
 	for ( int i = 0; i < BUFFER_COUNT; i++ )
 	{
-		glBindTexture ( GL_TEXTURE_2D, textures[i] );
+		glBindTexture ( GL_TEXTURE_2D, set[i] );
 		glTexImage2D  ( GL_TEXTURE_2D, 0, GL_RGBA, image_width, image_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -186,12 +441,20 @@ static void init_textures ()
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-		egl_images[i] = eglCreateImageKHR ( display,
+		images[i] = eglCreateImageKHR ( display,
 										context,
 										EGL_GL_TEXTURE_2D_KHR,
-										(EGLClientBuffer) textures[i],
+										(EGLClientBuffer) set[i],
 										0 );
 	}
+}
+
+static void init_textures ()
+{
+	// the textures containing the video frames, and those of a clip faded into
+	create_texture_set (textures, egl_images);
+	if (next_clip)
+		create_texture_set (transition_textures, transition_images);
 
 	// setup overall texture environment
 	glTexCoordPointer(2, GL_FLOAT, 0, tex_coords);
@@ -326,6 +589,8 @@ static void destroy_function ()
 		{
 			if (!eglDestroyImageKHR (display, (EGLImageKHR) egl_images[i]))
 				fprintf (stderr, "eglDestroyImageKHR failed.");
+			if (transition_images[i] && !eglDestroyImageKHR (display, (EGLImageKHR) transition_images[i]))
+				fprintf (stderr, "eglDestroyImageKHR failed.");
 		}
 		// clear screen
 		glClear           (GL_COLOR_BUFFER_BIT);
@@ -339,6 +604,27 @@ static void destroy_function ()
 	rpi_mp_deinit ();
 }
 
+/**
+ *  Draws the frame of the clip being faded into over the current one, with the blend factor as alpha.
+ */
+static void draw_transition ()
+{
+	rpi_mp_transition_frame frame;
+
+	if (rpi_mp_transition_frame_lock (&frame) != 0)
+		return;
+	// the decoder of the next clip does not refill the texture until it is unlocked
+	glBindTexture (GL_TEXTURE_2D, (frame.texture_set ? transition_textures : textures)[frame.texture]);
+	glEnable      (GL_BLEND);
+	glBlendFunc   (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glColor4f     (1.f, 1.f, 1.f, frame.blend);
+	glDrawArrays  (GL_TRIANGLE_STRIP, 0, 4);
+	glColor4f     (1.f, 1.f, 1.f, 1.f);
+	glDisable     (GL_BLEND);
+	rpi_mp_transition_frame_unlock ();
+}
+
+
 // animating zoom level to make tearing visible by uncoupling video decoder and opengl renderer
 float zoom = -34.f;
 int busy_wait = 0;
@@ -351,12 +637,17 @@ static void draw ()
 	usleep(busy_wait);
 
 	glClear        (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glBindTexture ( GL_TEXTURE_2D, textures[(current_texture + 1) % BUFFER_COUNT] );
+	// after a crossfade the clip faded into plays on in the other set
+	if (rpi_mp_texture_set ())
+		glBindTexture ( GL_TEXTURE_2D, transition_textures[(transition_current + 1) % BUFFER_COUNT] );
+	else
+		glBindTexture ( GL_TEXTURE_2D, textures[(current_texture + 1) % BUFFER_COUNT] );
 	glMatrixMode   (GL_MODELVIEW);
 	glLoadIdentity ();
 	glTranslatef   (0.f, 0.f, zoom);
 	zoom -= 0.005;
 	glDrawArrays   (GL_TRIANGLE_STRIP, 0, 4);
+	draw_transition ();
 
 	eglSwapBuffers (display, surface);
 }
@@ -370,6 +661,232 @@ static void* play_video ()
 }
 
 
+/**
+ *  Generates a thumbnail for every second of the source and reports the rate.
+ */
+static int run_thumbnail_benchmark (const char* file)
+{
+	rpi_mp_thumbnail* thumbnails = NULL;
+	int count = 0, generated;
+	unsigned long start = time_ms ();
+
+	generated = rpi_mp_thumbnails_interval (file, 1000000, 160, 0, &thumbnails, &count);
+	unsigned long elapsed = time_ms () - start;
+	if (generated < 0)
+	{
+		fprintf (stderr, "Could not generate thumbnails for %s\n", file);
+		return 1;
+	}
+	printf ("%d/%d thumbnails (%dx%d) in %lu ms: %.1f thumbnails/s\n", generated, count,
+	        count ? thumbnails[0].width : 0, count ? thumbnails[0].height : 0,
+	        elapsed, elapsed ? generated * 1000.0 / elapsed : 0.0);
+	rpi_mp_free_thumbnails (thumbnails, count);
+	free (thumbnails);
+	return 0;
+}
+
+
+/**
+ *  Stands in for a compositor in YUV mode: locks every frame it can get and reports the rate.
+ */
+static void consume_yuv_frames ()
+{
+	rpi_mp_yuv_frame frame;
+	unsigned long    start  = time_us ();
+	int              frames = 0;
+
+	while (!done)
+	{
+		if (rpi_mp_yuv_frame_lock (&frame, 100) != 0)
+			continue;
+		if (frames ++ == 0)
+			printf ("YUV frames %dx%d, %s, strides %d/%d/%d\n", frame.width, frame.height,
+			        frame.nv12 ? "NV12" : "I420", frame.strides[0], frame.strides[1], frame.strides[2]);
+		rpi_mp_yuv_frame_unlock ();
+		if (frames % 250 == 0)
+			printf ("%d YUV frames, %.1f fps\n", frames, frames * 1e6 / (time_us () - start));
+	}
+}
+
+
+/**
+ *  Demuxes all packets of a source and returns the throughput in MB/s, negative on error.
+ *  If pb is set the source is only used as a name.
+ */
+static double demux_rate (const char* file, AVIOContext* pb, int64_t size)
+{
+	AVFormatContext* ctx = avformat_alloc_context ();
+	AVPacket packet;
+	int packets = 0;
+	unsigned long start = time_us ();
+
+	if (!ctx)
+		return -1;
+	ctx->pb = pb;
+	if (avformat_open_input (&ctx, file, NULL, NULL) < 0)
+		return -1;
+	av_init_packet (&packet);
+	while (av_read_frame (ctx, &packet) >= 0)
+	{
+		packets ++;
+		av_packet_unref (&packet);
+	}
+	avformat_close_input (&ctx);
+	unsigned long elapsed = time_us () - start;
+	printf ("  %d packets in %lu ms\n", packets, elapsed / 1000);
+	return elapsed ? (double) size / elapsed : 0.0;
+}
+
+
+static int run_io_benchmark (const char* file)
+{
+	FILE* f;
+	rpi_mp_io io;
+	AVIOContext* pb;
+	uint8_t* data;
+	long size;
+	double rate;
+
+	av_register_all ();
+	if (!(f = fopen (file, "rb")) || fseek (f, 0, SEEK_END) != 0 || (size = ftell (f)) <= 0)
+	{
+		fprintf (stderr, "Could not read %s\n", file);
+		return 1;
+	}
+	rewind (f);
+	if (!(data = (uint8_t*) malloc (size)) || fread (data, 1, size, f) != (size_t) size)
+	{
+		fprintf (stderr, "Could not load %s into memory\n", file);
+		return 1;
+	}
+	fclose (f);
+
+	printf ("file:\n");
+	rate = demux_rate (file, NULL, size);
+	printf ("  %.1f MB/s\n", rate);
+
+	memset (&io, 0x0, sizeof (io));
+	io.data   = data;
+	io.length = size;
+	if (!(pb = open_custom_io (&io)))
+		return 1;
+	printf ("memory:\n");
+	rate = demux_rate (file, pb, size);
+	printf ("  %.1f MB/s\n", rate);
+	close_custom_io (&pb);
+	free (data);
+	return 0;
+}
+
+
+/**
+ *  Scans a directory of media with an empty cache on one thread, again on all cores and then once
+ *  more from the cache, and reports the rate of each pass.
+ */
+static int run_scan_benchmark (const char* directory)
+{
+	const char* passes[3] = { "cold, 1 thread", "cold, all cores", "cached" };
+	rpi_mp_media_info* infos;
+	char cache[] = "/tmp/rpi_mp_scanXXXXXX", file[64];
+	unsigned long start, elapsed;
+	int count, read, cached, i, pass;
+
+	// keep the user's cache out of it
+	if (!mkdtemp (cache))
+		return 1;
+	setenv ("RPI_MP_CACHE", cache, 1);
+	snprintf (file, sizeof (file), "%s/rpi_mp_media", cache);
+	for (pass = 0; pass < 3; pass ++)
+	{
+		start   = time_us ();
+		read    = rpi_mp_scan_directory (directory, pass == 0 ? 1 : 0, &infos, &count);
+		elapsed = time_us () - start;
+		if (read < 0)
+			return 1;
+		for (i = cached = 0; i < count; i ++)
+			cached += infos[i].cached;
+		if (pass == 0)
+			for (i = 0; i < count; i ++)
+				if (infos[i].status == 0)
+					printf ("%s: %s %s %dx%d@%.2f %s %d Hz, %.1f s\n", infos[i].path, infos[i].format, infos[i].video_codec,
+					        infos[i].width, infos[i].height, infos[i].fps, infos[i].audio_codec, infos[i].sample_rate,
+					        infos[i].duration / 1e6);
+		printf ("%s: %d/%d files read, %d cached, in %lu ms: %.1f files/s\n", passes[pass], read, count, cached,
+		        elapsed / 1000, elapsed ? count * 1e6 / elapsed : 0.0);
+		rpi_mp_free_scan (infos, count);
+		if (pass == 0)
+			unlink (file);
+	}
+	unlink (file);
+	rmdir (cache);
+	return 0;
+}
+
+
+#define LOOPBACK_SDP     "/tmp/rpi_mp_loopback.sdp"
+#define LOOPBACK_SECONDS 20
+#define LOOPBACK_WARM_UP 8
+
+/**
+ *  Sends a test pattern with ffmpeg to a local RTP port and plays it LIVE, reporting the live
+ *  latency once a second. ffmpeg sends its wall clock in RTCP sender reports, about every five
+ *  seconds, so glass to glass shows up after the first one arrives. Fails if none arrives, or if
+ *  the player is still further behind than twice the target after warming up.
+ */
+static int run_live_loopback ()
+{
+	rpi_mp_live_stats live;
+	pthread_t         player;
+	pid_t             sender;
+	int               i, measured = 0, behind = 0;
+
+	unlink (LOOPBACK_SDP);
+	if ((sender = fork ()) == 0)
+	{
+		execlp ("ffmpeg", "ffmpeg", "-loglevel", "error", "-re", "-f", "lavfi", "-i", "testsrc=size=1280x720:rate=30",
+		        "-c:v", "libx264", "-tune", "zerolatency", "-g", "30", "-f", "rtp", "-sdp_file", LOOPBACK_SDP,
+		        "rtp://127.0.0.1:5004", (char*) NULL);
+		fprintf (stderr, "Could not run ffmpeg\n");
+		_exit (127);
+	}
+	if (sender < 0)
+		return 1;
+	for (i = 0; i < 50 && access (LOOPBACK_SDP, R_OK) != 0; i ++)
+		usleep (100000);
+
+	if (i == 50 || rpi_mp_init () || rpi_mp_open (LOOPBACK_SDP, &image_width, &image_height, &duration, flags | LIVE))
+	{
+		fprintf (stderr, "Could not play the loopback stream\n");
+		kill (sender, SIGTERM);
+		waitpid (sender, NULL, 0);
+		return 1;
+	}
+	pthread_create (&player, NULL, &play_video, NULL);
+	for (i = 1; i <= LOOPBACK_SECONDS && !done; i ++)
+	{
+		sleep (1);
+		if (rpi_mp_live_latency (&live) != 0)
+			continue;
+		printf ("%2d s: %lld us in the player (target %lld us), glass to glass %lld us, %llu catch-ups\n", i,
+		        live.buffered_us, live.target_us, live.glass_to_glass_us, live.catch_ups);
+		if (live.glass_to_glass_us >= 0)
+			measured ++;
+		if (i > LOOPBACK_WARM_UP && live.buffered_us > 2 * live.target_us)
+			behind ++;
+	}
+	rpi_mp_stop ();
+	pthread_join (player, NULL);
+	kill (sender, SIGTERM);
+	waitpid (sender, NULL, 0);
+	rpi_mp_deinit ();
+	unlink (LOOPBACK_SDP);
+
+	printf ("%s: glass to glass measured %d times, %d seconds behind after warming up\n",
+	        measured && !behind ? "ok" : "FAIL", measured, behind);
+	return !measured || behind;
+}
+
+
 static int check_arguments (int argc, char** argv)
 {
 	flags = 0;
@@ -377,7 +894,7 @@ static int check_arguments (int argc, char** argv)
 
 	if (argc < 2)
 	{
-		printf ("Usage: \n%s [texture] [analog-audio] <source>\n", argv[0]);
+		printf ("Usage: \n%s [texture|yuv|nv12] [analog-audio] [passthrough] [low-latency] [live] [follow] [tap] [thumbs] [iobench] [scan] [loopback] [rt] [metrics <socket>] [next <file>] <source>\n", argv[0]);
 		return 1;
 	}
 
@@ -385,10 +902,43 @@ static int check_arguments (int argc, char** argv)
 	{
 		if (strcmp (argv[i], "texture") == 0)
 			flags |= RENDER_VIDEO_TO_TEXTURE;
+		else if (strcmp (argv[i], "yuv") == 0)
+			flags |= RENDER_VIDEO_TO_I420;
+		else if (strcmp (argv[i], "nv12") == 0)
+			flags |= RENDER_VIDEO_TO_NV12;
 		else if (strcmp (argv[i], "analog-audio") == 0)
 			flags |= ANALOG_AUDIO;
+		else if (strcmp (argv[i], "passthrough") == 0)
+			flags |= AUDIO_PASSTHROUGH;
+		else if (strcmp (argv[i], "low-latency") == 0)
+			flags |= LOW_LATENCY_AUDIO;
+		// e.g. ffmpeg -re -f lavfi -i testsrc=size=1280x720:rate=30 -c:v libx264 -tune zerolatency -f mpegts udp://127.0.0.1:1234
+		// played as live udp://127.0.0.1:1234, or served by an RTSP server and played from rtsp://;
+		// loopback runs such a sender itself and checks the latency
+		else if (strcmp (argv[i], "live") == 0)
+			flags |= LIVE;
+		// a file still being downloaded, e.g. by ffmpeg -i <url> -c copy -movflags frag_keyframe+empty_moov file.mp4 && touch file.mp4.done
+		else if (strcmp (argv[i], "follow") == 0)
+			flags |= FOLLOW;
+		else if (strcmp (argv[i], "tap") == 0)
+			rpi_mp_audio_tap (1);
+		else if (strcmp (argv[i], "thumbs") == 0)
+			thumbnail_benchmark = 1;
+		else if (strcmp (argv[i], "iobench") == 0)
+			io_benchmark = 1;
+		else if (strcmp (argv[i], "scan") == 0)
+			scan_benchmark = 1;
+		else if (strcmp (argv[i], "loopback") == 0)
+			loopback_test = 1;
+		else if (strcmp (argv[i], "rt") == 0)
+			realtime = 1;
 		else if (strcmp (argv[i], "layer") == 0)
 			layer = atoi(argv[i+1]);
+		else if (strcmp (argv[i], "metrics") == 0 && i + 1 < argc)
+			metrics_socket = argv[i + 1];
+		// crossfaded into with 'x', or cut to when the source ends
+		else if (strcmp (argv[i], "next") == 0 && i + 1 < argc - 1)
+			next_clip = argv[i + 1];
 	}
 	return 0;
 }
@@ -401,7 +951,19 @@ int main (int argc, char** argv)
 
 	if (check_arguments (argc, argv))
 		return 1;
+	if (thumbnail_benchmark)
+		return run_thumbnail_benchmark (argv[argc - 1]);
+	if (io_benchmark)
+		return run_io_benchmark (argv[argc - 1]);
+	if (scan_benchmark)
+		return run_scan_benchmark (argv[argc - 1]);
 	bcm_host_init ();
+	if (realtime)
+		set_realtime_policy ();
+	if (metrics_socket && rpi_mp_metrics_start (metrics_socket) == 0)
+		printf ("metrics on %s\n", metrics_socket);
+	if (loopback_test)
+		return run_live_loopback ();
 
 
 	if (rpi_mp_init () || rpi_mp_open (argv[argc - 1],
@@ -416,7 +978,11 @@ int main (int argc, char** argv)
 		init_ogl();
 		init_textures();
 		rpi_mp_setup_render_buffer (egl_images, &current_texture, &texture_ready_mut, &texture_ready_cond);
+		if (next_clip)
+			rpi_mp_setup_transition_buffer (transition_images, &transition_current);
 	}
+	if (next_clip && rpi_mp_transition_prepare (next_clip) != 0)
+		fprintf (stderr, "Can't crossfade into %s\n", next_clip);
 
 	pthread_create (&egl_draw,       NULL, &play_video,   NULL);
 	pthread_create (&input_listener, NULL, &listen_stdin, NULL);
@@ -424,12 +990,16 @@ int main (int argc, char** argv)
 	if (flags & RENDER_VIDEO_TO_TEXTURE)
 		while (!done)
 			draw ();
+	else if (flags & (RENDER_VIDEO_TO_I420 | RENDER_VIDEO_TO_NV12))
+		consume_yuv_frames ();
 	printf("Draw loop finished\n");
 	pthread_cancel (input_listener );
 	printf("input_listener finished\n");
 	pthread_join (egl_draw, NULL);
 	printf("egl_draw finished\n");
+	print_latency_stats ();
 	destroy_function ();
+	rpi_mp_metrics_stop ();
 	printf("destroy finished\n");
 	return 0;
 }
@@ -0,0 +1,162 @@
+/** ----------------------------------------------------------------------------------
+ * File: soft_video_bench.c
+ * Description: Headless benchmark of the software video decoder, built with `make host`
+ *              so it runs on x86 as well as on the Pi. Decodes a file as fast as it can
+ *              and converts every frame the way the render thread does.
+ *              With a loop count the file is demuxed that many times the way LOOP plays it,
+ *              and the frame timestamps around each restart are checked for continuity.
+ * ----------------------------------------------------------------------------------- */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "rpi_mp_loop.h"
+#include "rpi_mp_soft_video.h"
+#include "rpi_mp_utils.h"
+
+#define MAX_LOOPS 64
+
+static soft_video video;
+static uint64_t   converted = 0;
+static int64_t  * frame_pts = NULL;
+static size_t     n_frame_pts = 0, frame_pts_size = 0;
+
+
+static void* convert_frames (void* arg)
+{
+	AVFrame* frame;
+	int64_t  pts;
+	uint8_t* buffer = NULL;
+	int      stride = 0, slice_height = 0;
+
+	while ((frame = soft_video_acquire (&video, &pts)) != NULL)
+	{
+		if (!buffer)
+		{
+			stride       = FFALIGN (frame->width, 32);
+			slice_height = FFALIGN (frame->height, 16);
+			buffer       = (uint8_t*) malloc (stride * slice_height * 3 / 2);
+		}
+		if (buffer && soft_video_convert (&video, frame, buffer, stride, slice_height) == 0)
+			converted ++;
+		if (n_frame_pts == frame_pts_size)
+		{
+			frame_pts_size = frame_pts_size ? frame_pts_size * 2 : 4096;
+			frame_pts      = (int64_t*) realloc (frame_pts, frame_pts_size * sizeof (int64_t));
+		}
+		if (frame_pts)
+			frame_pts[n_frame_pts ++] = pts;
+		soft_video_release (&video);
+	}
+	free (buffer);
+	return NULL;
+}
+
+/**
+ *	Prints the gap between the last frame of each pass and the first of the next, which should be
+ *	one frame duration, and counts frames whose timestamp does not increase.
+ */
+static int check_loops (const int64_t* boundaries, int n, int64_t frame_duration)
+{
+	size_t i;
+	int    k, backwards = 0, bad = 0;
+
+	for (i = 1; i < n_frame_pts; i ++)
+		if (frame_pts[i] != AV_NOPTS_VALUE && frame_pts[i - 1] != AV_NOPTS_VALUE && frame_pts[i] <= frame_pts[i - 1])
+			backwards ++;
+	for (k = 0; k < n; k ++)
+	{
+		for (i = 1; i < n_frame_pts && frame_pts[i] < boundaries[k]; i ++)
+			;
+		if (i == n_frame_pts)
+			break;
+		printf ("restart %d: %lld us between last and first frame (frame duration %lld us)\n", k + 1,
+		        (long long) (frame_pts[i] - frame_pts[i - 1]), (long long) frame_duration);
+		if (frame_pts[i] - frame_pts[i - 1] > 2 * frame_duration)
+			bad ++;
+	}
+	printf ("%d timestamps not increasing, %d restarts with a gap\n", backwards, bad);
+	return backwards || bad;
+}
+
+
+int main (int argc, char** argv)
+{
+	AVFormatContext* fmt_ctx = NULL;
+	AVPacket         packet;
+	pthread_t        converter;
+	loop_state       loop;
+	int64_t          boundaries[MAX_LOOPS];
+	int              stream, threads, loops, ret = 0;
+	int64_t          start, elapsed;
+
+	if (argc < 2)
+	{
+		fprintf (stderr, "usage: %s <file> [threads] [loops]\n", argv[0]);
+		return 1;
+	}
+	threads = argc > 2 ? atoi (argv[2]) : 0;
+	loops   = argc > 3 ? atoi (argv[3]) : 1;
+	if (loops > MAX_LOOPS)
+		loops = MAX_LOOPS;
+
+	av_register_all ();
+	if (avformat_open_input (&fmt_ctx, argv[1], NULL, NULL) < 0 || avformat_find_stream_info (fmt_ctx, NULL) < 0)
+	{
+		fprintf (stderr, "Could not open %s\n", argv[1]);
+		return 1;
+	}
+	if ((stream = av_find_best_stream (fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0)) < 0)
+	{
+		fprintf (stderr, "No video stream in %s\n", argv[1]);
+		return 1;
+	}
+	// no clock, so nothing is dropped
+	if (open_soft_video (&video, fmt_ctx->streams[stream], threads, NULL) != 0)
+		return 1;
+
+	init_loop (&loop, fmt_ctx);
+	pthread_create (&converter, NULL, convert_frames, NULL);
+	start = monotonic_us ();
+	for (;;)
+	{
+		if (av_read_frame (fmt_ctx, &packet) < 0)
+		{
+			if (loop.passes + 1 < loops && loop_restart (&loop, fmt_ctx) == 0)
+			{
+				boundaries[loop.passes - 1] = loop.start + loop.offset;
+				continue;
+			}
+			break;
+		}
+		loop_rebase_packet (&loop, fmt_ctx, &packet);
+		if (packet.stream_index == stream && soft_video_decode (&video, &packet) != 0)
+		{
+			av_packet_unref (&packet);
+			break;
+		}
+		av_packet_unref (&packet);
+	}
+	av_init_packet (&packet);
+	packet.data = NULL;
+	packet.size = 0;
+	soft_video_decode (&video, &packet);
+	soft_video_finish (&video);
+	pthread_join (converter, NULL);
+	elapsed = monotonic_us () - start;
+
+	printf ("%s: %s %dx%d, %d threads\n", argv[1], video.codec_ctx->codec->name,
+	        video.codec_ctx->width, video.codec_ctx->height, video.codec_ctx->thread_count);
+	printf ("%llu frames in %.2f s: %.1f fps, decoder busy %.0f%% of the time\n",
+	        (unsigned long long) converted, elapsed / 1e6, elapsed > 0 ? converted * 1e6 / elapsed : 0.0,
+	        elapsed > 0 ? 100.0 * video.decode_us / elapsed : 0.0);
+	if (loop.passes)
+	{
+		AVRational rate = fmt_ctx->streams[stream]->r_frame_rate;
+		ret = check_loops (boundaries, loop.passes, rate.num ? av_rescale (AV_TIME_BASE, rate.den, rate.num) : 0);
+	}
+
+	close_soft_video (&video);
+	avformat_close_input (&fmt_ctx);
+	free (frame_pts);
+	return ret;
+}
@@ -0,0 +1,314 @@
+// dladdr and RTLD_NEXT
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include "rpi_mp.h"
+#include "rpi_mp_alloc_debug.h"
+#include "rpi_mp_utils.h"
+
+#define TRACE_DEPTH 16
+
+// glibc's allocator under the names it exports for interposers
+extern void* __libc_malloc   (size_t size);
+extern void* __libc_calloc   (size_t n, size_t size);
+extern void* __libc_realloc  (void* p, size_t size);
+extern void* __libc_memalign (size_t alignment, size_t size);
+
+typedef struct
+{
+	uint64_t count;
+	uint64_t bytes;
+}
+alloc_count;
+
+static const char* phase_names[ALLOC_PHASES]      = { "open", "start-up", "steady", "seek", "close" };
+static const char* thread_names[PIPELINE_THREADS + 1] = { "demux", "video", "video render", "audio", "audio submit", "subtitle", "clock", "next video", "other" };
+
+// [phase][thread][ours], with relaxed atomics so the report can be made any time
+static alloc_count     counts[ALLOC_PHASES][PIPELINE_THREADS + 1][2];
+static int             phase       = ALLOC_OPEN;
+static int64_t         phase_start = 0;
+static int64_t         warmup      = ALLOC_WARMUP_US;
+static int             traces      = 0;
+static void          * own_base    = NULL;
+static void*        (* real_av_malloc)  (size_t)         = NULL;
+static void*        (* real_av_mallocz) (size_t)         = NULL;
+static void*        (* real_av_realloc) (void*, size_t)  = NULL;
+static __thread int    current_thread = PIPELINE_THREADS;
+// allocations made while one is being counted are the hook's own (dladdr, backtrace) or nested
+// calls of the allocator (av_malloc), not the caller's
+static __thread int    depth = 0;
+
+
+static int in_libc (const Dl_info* info)
+{
+	// libc.so.6, or libc-2.28.so where it is not a link
+	return info->dli_fname && (strstr (info->dli_fname, "/libc.") || strstr (info->dli_fname, "/libc-"));
+}
+
+/**
+ *	Whether an allocation was made by our code, which is linked into the executable, rather than
+ *	inside a shared library. The C library allocates on behalf of its caller (strdup, fopen...) but
+ *	also for itself or for the libraries (stdio buffers, thread stacks), so for an allocation it
+ *	made the first caller outside of it on the stack decides.
+ */
+static int is_ours (const void* caller)
+{
+	Dl_info info;
+	void*   frames[TRACE_DEPTH];
+	int     n, i;
+
+	if (!own_base && dladdr ((void*) &is_ours, &info))
+		own_base = info.dli_fbase;
+	if (!caller || !dladdr (caller, &info))
+		return 1;
+	if (info.dli_fbase == own_base)
+		return 1;
+	if (!in_libc (&info))
+		return 0;
+	// frames up to the caller are this hook's
+	n = backtrace (frames, TRACE_DEPTH);
+	for (i = 0; i < n && frames[i] != caller; i ++)
+		;
+	for (i ++; i < n; i ++)
+		if (dladdr (frames[i], &info) && !in_libc (&info))
+			return info.dli_fbase == own_base;
+	return 0;
+}
+
+
+/**
+ *	The phase now, start-up and seeking become the steady state once warmed up.
+ */
+static int current_phase ()
+{
+	int p = __atomic_load_n (&phase, __ATOMIC_ACQUIRE);
+
+	if ((p == ALLOC_STARTUP || p == ALLOC_SEEK) && warmup > 0 &&
+	    monotonic_us () - __atomic_load_n (&phase_start, __ATOMIC_RELAXED) >= warmup)
+	{
+		// unless the phase changed in the meantime
+		if (!__atomic_compare_exchange_n (&phase, &p, ALLOC_STEADY, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			return p;
+		p = ALLOC_STEADY;
+	}
+	return p;
+}
+
+
+static void steady_allocation (size_t size)
+{
+	void* frames[TRACE_DEPTH];
+	char  line[128];
+	int   n;
+
+	if (__atomic_fetch_add (&traces, 1, __ATOMIC_RELAXED) < ALLOC_TRACES)
+	{
+		// stdio may allocate, write does not
+		n = snprintf (line, sizeof (line), "steady state allocation of %zu bytes in the %s thread:\n", size, thread_names[current_thread]);
+		write (STDERR_FILENO, line, n);
+		n = backtrace (frames, TRACE_DEPTH);
+		backtrace_symbols_fd (frames, n, STDERR_FILENO);
+	}
+#ifdef ALLOC_DEBUG_STRICT
+	abort ();
+#endif
+}
+
+
+static void counted (size_t size, const void* caller)
+{
+	alloc_count* c;
+	int          p, ours;
+
+	if (depth)
+		return;
+	depth ++;
+	p    = current_phase ();
+	ours = is_ours (caller);
+	c    = &counts[p][current_thread][ours];
+	__atomic_add_fetch (&c->count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch (&c->bytes, size, __ATOMIC_RELAXED);
+	if (ours && p == ALLOC_STEADY)
+		steady_allocation (size);
+	depth --;
+}
+
+
+void* malloc (size_t size)
+{
+	void* p = __libc_malloc (size);
+	counted (size, __builtin_return_address (0));
+	return p;
+}
+
+
+void* calloc (size_t n, size_t size)
+{
+	void* p = __libc_calloc (n, size);
+	counted (n * size, __builtin_return_address (0));
+	return p;
+}
+
+
+void* realloc (void* ptr, size_t size)
+{
+	void* p = __libc_realloc (ptr, size);
+	// shrinking to nothing is a free
+	if (size > 0)
+		counted (size, __builtin_return_address (0));
+	return p;
+}
+
+
+int posix_memalign (void** ptr, size_t alignment, size_t size)
+{
+	void* p;
+
+	// a power of two and a multiple of the size of a pointer
+	if (alignment == 0 || alignment & (alignment - 1) || alignment % sizeof (void*) != 0)
+		return EINVAL;
+	if (!(p = __libc_memalign (alignment, size)) && size > 0)
+		return ENOMEM;
+	*ptr = p;
+	counted (size, __builtin_return_address (0));
+	return 0;
+}
+
+
+void* memalign (size_t alignment, size_t size)
+{
+	void* p = __libc_memalign (alignment, size);
+	counted (size, __builtin_return_address (0));
+	return p;
+}
+
+
+void* aligned_alloc (size_t alignment, size_t size)
+{
+	void* p = __libc_memalign (alignment, size);
+	counted (size, __builtin_return_address (0));
+	return p;
+}
+
+
+// av_malloc allocates with posix_memalign inside libavutil, which would make all of them look like
+// FFmpeg's; counted here they are the caller's
+void* av_malloc (size_t size)
+{
+	void* p;
+
+	if (!real_av_malloc)
+		real_av_malloc = (void* (*) (size_t)) dlsym (RTLD_NEXT, "av_malloc");
+	depth ++;
+	p = real_av_malloc (size);
+	depth --;
+	counted (size, __builtin_return_address (0));
+	return p;
+}
+
+
+void* av_mallocz (size_t size)
+{
+	void* p;
+
+	if (!real_av_mallocz)
+		real_av_mallocz = (void* (*) (size_t)) dlsym (RTLD_NEXT, "av_mallocz");
+	depth ++;
+	p = real_av_mallocz (size);
+	depth --;
+	counted (size, __builtin_return_address (0));
+	return p;
+}
+
+
+void* av_realloc (void* ptr, size_t size)
+{
+	void* p;
+
+	if (!real_av_realloc)
+		real_av_realloc = (void* (*) (void*, size_t)) dlsym (RTLD_NEXT, "av_realloc");
+	depth ++;
+	p = real_av_realloc (ptr, size);
+	depth --;
+	if (size > 0)
+		counted (size, __builtin_return_address (0));
+	return p;
+}
+
+
+void alloc_debug_thread (int thread)
+{
+	current_thread = thread >= 0 && thread < PIPELINE_THREADS ? thread : PIPELINE_THREADS;
+}
+
+
+void alloc_debug_phase (int p)
+{
+	__atomic_store_n (&phase_start, monotonic_us (), __ATOMIC_RELAXED);
+	__atomic_store_n (&phase, p, __ATOMIC_RELEASE);
+}
+
+
+void alloc_debug_warmup (int64_t us)
+{
+	warmup = us;
+}
+
+
+void alloc_debug_counts (int p, int thread, int ours, uint64_t* count, uint64_t* bytes)
+{
+	alloc_count* c = &counts[p][thread][ours ? 1 : 0];
+	if (count)
+		*count = __atomic_load_n (&c->count, __ATOMIC_RELAXED);
+	if (bytes)
+		*bytes = __atomic_load_n (&c->bytes, __ATOMIC_RELAXED);
+}
+
+
+uint64_t alloc_debug_report ()
+{
+	uint64_t ours, theirs, steady = 0, any;
+	char     cell[32];
+	int      thread, p;
+
+	printf ("allocations of our code (inside the libraries)\n%-13s", "");
+	for (p = 0; p < ALLOC_PHASES; p ++)
+		printf (" %19s", phase_names[p]);
+	printf ("\n");
+	for (thread = 0; thread <= PIPELINE_THREADS; thread ++)
+	{
+		for (p = 0, any = 0; p < ALLOC_PHASES; p ++)
+			any += counts[p][thread][0].count + counts[p][thread][1].count;
+		if (!any)
+			continue;
+		printf ("%-13s", thread_names[thread]);
+		for (p = 0; p < ALLOC_PHASES; p ++)
+		{
+			alloc_debug_counts (p, thread, 1, &ours, NULL);
+			alloc_debug_counts (p, thread, 0, &theirs, NULL);
+			snprintf (cell, sizeof (cell), "%llu (%llu)", (unsigned long long) ours, (unsigned long long) theirs);
+			printf (" %19s", cell);
+		}
+		printf ("\n");
+		alloc_debug_counts (ALLOC_STEADY, thread, 1, &ours, NULL);
+		steady += ours;
+	}
+	printf ("%llu allocations of our code in the steady state\n", (unsigned long long) steady);
+	return steady;
+}
+
+
+void alloc_debug_reset ()
+{
+	memset (counts, 0x0, sizeof (counts));
+	__atomic_store_n (&traces, 0, __ATOMIC_RELAXED);
+	alloc_debug_phase (ALLOC_OPEN);
+}
@@ -0,0 +1,100 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rpi_mp_pcm_ring.h"
+#include "rpi_mp_audio_decode.h"
+#include "rpi_mp_utils.h"
+
+
+int init_audio_decoder (audio_decoder* decoder, AVCodecContext* codec_ctx)
+{
+	memset (decoder, 0x0, sizeof (audio_decoder));
+	decoder->codec_ctx = codec_ctx;
+	if (!(decoder->frame = av_frame_alloc ()))
+		return 1;
+	// a codec frame of 32 bit samples, grown only for streams with longer frames
+	decoder->scratch_size = codec_ctx->frame_size > 0 ? codec_ctx->frame_size * codec_ctx->channels * 4 : 0;
+	decoder->scratch      = decoder->scratch_size ? (uint8_t*) malloc (decoder->scratch_size) : NULL;
+	if (!decoder->scratch)
+		decoder->scratch_size = 0;
+	return 0;
+}
+
+
+void destroy_audio_decoder (audio_decoder* decoder)
+{
+	av_frame_free (&decoder->frame);
+	free (decoder->scratch);
+	decoder->scratch      = NULL;
+	decoder->scratch_size = 0;
+}
+
+
+void audio_decoder_switch (audio_decoder* decoder, AVCodecContext* codec_ctx)
+{
+	// the frame may still hold buffers of the previous codec
+	av_frame_unref (decoder->frame);
+	decoder->codec_ctx = codec_ctx;
+}
+
+
+int audio_decode_packet (audio_decoder* decoder, AVPacket* packet, pcm_ring* ring)
+{
+	AVCodecContext* ctx = decoder->codec_ctx;
+	AVFrame*        frame = decoder->frame;
+	int64_t         pts = packet->pts;
+	uint8_t       * data, * p;
+	unsigned long   start;
+	int             got_frame = 0, ret, size, bps, i, ch;
+
+	// some audio decoders only decode part of the data
+	while (packet->size > 0)
+	{
+		start = time_us ();
+		if ((ret = avcodec_decode_audio4 (ctx, frame, &got_frame, packet)) < 0)
+			return ret;
+		packet->size -= ret;
+		packet->data += ret;
+		if (!got_frame)
+			continue;
+		if ((size = av_samples_get_buffer_size (NULL, ctx->channels, frame->nb_samples, ctx->sample_fmt, 1)) <= 0)
+			break;
+		bps = av_get_bytes_per_sample (ctx->sample_fmt);
+
+		// the scratch buffer only grows until it fits the largest frame of the stream
+		if ((av_sample_fmt_is_planar (ctx->sample_fmt) || bps > 2) && size > decoder->scratch_size)
+		{
+			if (!(p = (uint8_t*) realloc (decoder->scratch, size)))
+				return 1;
+			decoder->scratch      = p;
+			decoder->scratch_size = size;
+		}
+		// interleave data if it is planar
+		if (av_sample_fmt_is_planar (ctx->sample_fmt))
+		{
+			for (i = 0, p = data = decoder->scratch; i < frame->nb_samples; i ++)
+				for (ch = 0; ch < ctx->channels; ch ++, p += bps)
+					memcpy (p, frame->data[ch] + i * bps, bps);
+		}
+		else
+			data = frame->data[0];
+		// 32 bit samples are taken as floating point and converted to 16 bit
+		if (bps > 2)
+		{
+			flt_to_s16 (data, decoder->scratch, size);
+			size /= 2;
+			data  = decoder->scratch;
+		}
+		decoder->decode_us += time_us () - start;
+		decoder->frames ++;
+
+		if (decoder->tap)
+			decoder->tap (decoder->tap_opaque, (const int16_t*) data, size / (ctx->channels * 2), pts);
+		if (pcm_ring_write (ring, data, size, pts) != 0)
+			return 1;
+		if (pts != AV_NOPTS_VALUE)
+			pts += (int64_t) frame->nb_samples * AV_TIME_BASE / ctx->sample_rate;
+	}
+	packet->size = 0;
+	packet->data = NULL;
+	return 0;
+}
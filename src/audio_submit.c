@@ -0,0 +1,37 @@
+#include <string.h>
+#include <libavutil/avutil.h>
+#include "rpi_mp_pcm_ring.h"
+#include "rpi_mp_audio_submit.h"
+
+
+int init_audio_submit (audio_submit* submit, pcm_ring* ring, int sample_rate, int channels, int ring_ms, size_t chunk)
+{
+	int    block_align = channels * 2;
+	size_t size        = (size_t) sample_rate * ring_ms / 1000 * block_align;
+
+	memset (submit, 0x0, sizeof (audio_submit));
+	submit->ring  = ring;
+	submit->chunk = chunk;
+	submit->end   = AV_NOPTS_VALUE;
+	if (size < 2 * chunk)
+		size = 2 * chunk;
+	size -= size % block_align;
+	return init_pcm_ring (ring, size, sample_rate * block_align);
+}
+
+
+size_t audio_submit_wait (audio_submit* submit, int64_t* ready)
+{
+	return pcm_ring_wait (submit->ring, submit->chunk, ready);
+}
+
+
+size_t audio_submit_take (audio_submit* submit, uint8_t* buffer, int64_t* pts)
+{
+	size_t n = pcm_ring_read (submit->ring, buffer, submit->chunk, pts);
+
+	if (n && *pts != AV_NOPTS_VALUE)
+		submit->end = *pts + (int64_t) n * AV_TIME_BASE / submit->ring->bytes_per_second;
+	submit->taken += n;
+	return n;
+}
@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <libavutil/avutil.h>
+#include "rpi_mp.h"
+#include "rpi_mp_audio_tap.h"
+
+#define TAP_NICE        10
+#define TAP_LOW_HZ      20.0
+#define TAP_HIGH_HZ     20000.0
+#define TAP_FLOOR_DB    -120.0f
+
+#define FFT_N           AUDIO_TAP_FFT_SIZE
+#define FFT_M           (AUDIO_TAP_FFT_SIZE / 2)
+
+
+static int64_t thread_cpu_us ()
+{
+	struct timespec t;
+	clock_gettime (CLOCK_THREAD_CPUTIME_ID, &t);
+	return (int64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+
+/**
+ *	Tables of the transform: a real window of FFT_N is transformed as a complex one of FFT_M,
+ *	then split into the spectrum of the real signal. Bands are spaced logarithmically and have at
+ *	least one bin each, so the lowest ones are a bin wide.
+ */
+static void init_tables (audio_tap* tap)
+{
+	double high = tap->sample_rate / 2.0 < TAP_HIGH_HZ ? tap->sample_rate / 2.0 : TAP_HIGH_HZ;
+	int    i, j, bits, start;
+
+	for (i = 0; i < FFT_N; i ++)
+		tap->window[i] = 0.5f - 0.5f * cosf (2.0f * M_PI * i / FFT_N);
+	for (i = 0; i < FFT_M / 2; i ++)
+	{
+		tap->fft_cos[i] = cosf (2.0f * M_PI * i / FFT_M);
+		tap->fft_sin[i] = sinf (2.0f * M_PI * i / FFT_M);
+	}
+	for (i = 0; i < FFT_M; i ++)
+	{
+		tap->split_cos[i] = cosf (2.0f * M_PI * i / FFT_N);
+		tap->split_sin[i] = sinf (2.0f * M_PI * i / FFT_N);
+	}
+	for (bits = 0; 1 << bits < FFT_M; bits ++)
+		;
+	for (i = 0; i < FFT_M; i ++)
+	{
+		for (j = 0, tap->bit_reverse[i] = 0; j < bits; j ++)
+			if (i & 1 << j)
+				tap->bit_reverse[i] |= 1 << (bits - 1 - j);
+	}
+	for (i = 0; i <= AUDIO_SPECTRUM_BANDS; i ++)
+	{
+		start = (int) ceil (TAP_LOW_HZ * pow (high / TAP_LOW_HZ, (double) i / AUDIO_SPECTRUM_BANDS) * FFT_N / tap->sample_rate);
+		if (i > 0 && start <= tap->band_start[i - 1])
+			start = tap->band_start[i - 1] + 1;
+		tap->band_start[i] = start < FFT_M ? start : FFT_M;
+	}
+	// a full scale sine gives 0 dB: the Hann window halves the amplitude and spreads the power over
+	// 1.5 bins, FFT_N / 4 is the magnitude of its peak bin
+	tap->power_scale = 1.0f / ((FFT_N / 4.0f) * (FFT_N / 4.0f) * 1.5f);
+}
+
+
+/**
+ *	In-place radix-2 transform of re/im, FFT_M points.
+ */
+static void fft (audio_tap* tap)
+{
+	float* re = tap->re;
+	float* im = tap->im;
+	float  tr, ti, wr, wi;
+	int    i, j, size, half, step, k;
+
+	for (i = 0; i < FFT_M; i ++)
+	{
+		j = tap->bit_reverse[i];
+		if (j > i)
+		{
+			tr = re[i]; re[i] = re[j]; re[j] = tr;
+			ti = im[i]; im[i] = im[j]; im[j] = ti;
+		}
+	}
+	for (size = 2; size <= FFT_M; size <<= 1)
+	{
+		half = size >> 1;
+		step = FFT_M / size;
+		for (i = 0; i < FFT_M; i += size)
+			for (j = 0, k = 0; j < half; j ++, k += step)
+			{
+				wr = tap->fft_cos[k];
+				wi = -tap->fft_sin[k];
+				tr = re[i + j + half] * wr - im[i + j + half] * wi;
+				ti = re[i + j + half] * wi + im[i + j + half] * wr;
+				re[i + j + half] = re[i + j] - tr;
+				im[i + j + half] = im[i + j] - ti;
+				re[i + j] += tr;
+				im[i + j] += ti;
+			}
+	}
+}
+
+
+/**
+ *	Media time of a frame from the latest mark before it, AV_NOPTS_VALUE if there is none.
+ */
+static int64_t frame_pts (audio_tap* tap, uint64_t position)
+{
+	uint32_t n = __atomic_load_n (&tap->n_marks, __ATOMIC_ACQUIRE);
+	uint32_t i;
+	audio_tap_mark mark;
+
+	// the oldest half may be overwritten while we look
+	for (i = 0; i < n && i < AUDIO_TAP_MARKS / 2; i ++)
+	{
+		mark = tap->marks[(n - 1 - i) % AUDIO_TAP_MARKS];
+		if (mark.position <= position)
+			return mark.pts + (int64_t) (position - mark.position) * AV_TIME_BASE / tap->sample_rate;
+	}
+	return AV_NOPTS_VALUE;
+}
+
+
+static void* tap_thread (void* arg)
+{
+	audio_tap* tap  = (audio_tap*) arg;
+	int        idle = FFT_N * 1000000LL / tap->sample_rate / 2;
+	int64_t    start;
+
+	setpriority (PRIO_PROCESS, syscall (SYS_gettid), TAP_NICE);
+	start = thread_cpu_us ();
+	while (tap->running)
+	{
+		// polling counts too
+		if (!audio_tap_analyse (tap))
+			usleep (idle);
+		__atomic_store_n (&tap->cpu_us, thread_cpu_us () - start, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+
+int init_audio_tap (audio_tap* tap, int channels, int sample_rate)
+{
+	memset (tap, 0x0, sizeof (audio_tap));
+	if (channels < 1 || channels > AUDIO_TAP_CHANNELS || sample_rate <= 0)
+		return 1;
+	// about a second, the decoder runs ahead in bursts as the PCM ring makes room
+	for (tap->capacity = FFT_N; tap->capacity < (size_t) sample_rate; tap->capacity <<= 1)
+		;
+	if (!(tap->samples = (int16_t*) malloc (tap->capacity * channels * sizeof (int16_t))))
+		return 1;
+	tap->channels    = channels;
+	tap->sample_rate = sample_rate;
+	init_tables (tap);
+	pthread_mutex_init (&tap->results_mutex, NULL);
+	return 0;
+}
+
+
+void destroy_audio_tap (audio_tap* tap)
+{
+	free (tap->samples);
+	tap->samples = NULL;
+	pthread_mutex_destroy (&tap->results_mutex);
+}
+
+
+void audio_tap_write (audio_tap* tap, const int16_t* samples, int frames, int64_t pts)
+{
+	uint64_t position = tap->written;
+	size_t   offset, first;
+
+	if (frames <= 0)
+		return;
+	// only the last capacity frames would survive anyway
+	if ((size_t) frames > tap->capacity)
+	{
+		samples  += (frames - tap->capacity) * tap->channels;
+		position += frames - tap->capacity;
+		if (pts != AV_NOPTS_VALUE)
+			pts += (int64_t) (frames - tap->capacity) * AV_TIME_BASE / tap->sample_rate;
+		frames = tap->capacity;
+	}
+	offset = position & (tap->capacity - 1);
+	first  = tap->capacity - offset < (size_t) frames ? tap->capacity - offset : (size_t) frames;
+	memcpy (tap->samples + offset * tap->channels, samples, first * tap->channels * sizeof (int16_t));
+	memcpy (tap->samples, samples + first * tap->channels, (frames - first) * tap->channels * sizeof (int16_t));
+
+	if (pts != AV_NOPTS_VALUE)
+	{
+		tap->marks[tap->n_marks % AUDIO_TAP_MARKS].position = position;
+		tap->marks[tap->n_marks % AUDIO_TAP_MARKS].pts      = pts;
+		__atomic_store_n (&tap->n_marks, tap->n_marks + 1, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n (&tap->written, position + frames, __ATOMIC_RELEASE);
+}
+
+
+int audio_tap_analyse (audio_tap* tap)
+{
+	rpi_mp_audio_analysis result;
+	uint64_t written = __atomic_load_n (&tap->written, __ATOMIC_ACQUIRE);
+	uint64_t start   = tap->analysed;
+	double   sum[AUDIO_TAP_CHANNELS] = { 0 };
+	float    peak[AUDIO_TAP_CHANNELS] = { 0 };
+	float    scale = 1.0f / (32768.0f * tap->channels);
+	float    x, power, zr, zi, cr, ci, er, ei, orr, oi, tr, ti, xr, xi;
+	const int16_t* frame;
+	int      i, ch, k, b;
+
+	// the writer is about to overwrite the window, skip ahead to where it leaves a window of room
+	if (written - start > tap->capacity - FFT_N)
+	{
+		tap->analysed = written - tap->capacity + 2 * FFT_N;
+		pthread_mutex_lock (&tap->results_mutex);
+		tap->skipped += (tap->analysed - start + FFT_N - 1) / FFT_N;
+		pthread_mutex_unlock (&tap->results_mutex);
+		return 1;
+	}
+	if (written - start < FFT_N)
+		return 0;
+
+	// mix down into the even/odd halves of the complex input, levels per channel on the way
+	for (i = 0; i < FFT_N; i ++)
+	{
+		frame = tap->samples + ((start + i) & (tap->capacity - 1)) * tap->channels;
+		for (ch = 0, x = 0.0f; ch < tap->channels; ch ++)
+		{
+			float s = frame[ch];
+			x += s;
+			sum[ch] += s * s;
+			if (fabsf (s) > peak[ch])
+				peak[ch] = fabsf (s);
+		}
+		x *= scale * tap->window[i];
+		if (i & 1)
+			tap->im[i >> 1] = x;
+		else
+			tap->re[i >> 1] = x;
+	}
+	tap->analysed = start + FFT_N;
+	// overwritten while we read it
+	if (__atomic_load_n (&tap->written, __ATOMIC_ACQUIRE) - start > tap->capacity)
+	{
+		pthread_mutex_lock (&tap->results_mutex);
+		tap->skipped ++;
+		pthread_mutex_unlock (&tap->results_mutex);
+		return 1;
+	}
+
+	memset (&result, 0x0, sizeof (result));
+	result.pts      = frame_pts (tap, start);
+	result.duration = (int64_t) FFT_N * AV_TIME_BASE / tap->sample_rate;
+	result.channels = tap->channels;
+	for (ch = 0; ch < tap->channels; ch ++)
+	{
+		result.peak[ch] = peak[ch] / 32768.0f;
+		result.rms[ch]  = sqrtf (sum[ch] / FFT_N) / 32768.0f;
+	}
+
+	fft (tap);
+	for (b = 0, k = tap->band_start[0]; b < AUDIO_SPECTRUM_BANDS; b ++)
+	{
+		for (power = 0.0f; k < tap->band_start[b + 1]; k ++)
+		{
+			// spectrum of the real signal from the half size complex one
+			zr  = tap->re[k];
+			zi  = tap->im[k];
+			cr  = tap->re[(FFT_M - k) & (FFT_M - 1)];
+			ci  = -tap->im[(FFT_M - k) & (FFT_M - 1)];
+			er  = 0.5f * (zr + cr);
+			ei  = 0.5f * (zi + ci);
+			orr = 0.5f * (zr - cr);
+			oi  = 0.5f * (zi - ci);
+			tr  = tap->split_cos[k] * orr + tap->split_sin[k] * oi;
+			ti  = tap->split_cos[k] * oi  - tap->split_sin[k] * orr;
+			xr  = er + ti;
+			xi  = ei - tr;
+			power += xr * xr + xi * xi;
+		}
+		power *= tap->power_scale;
+		result.spectrum[b] = power > 0.0f ? 10.0f * log10f (power) : TAP_FLOOR_DB;
+		if (result.spectrum[b] < TAP_FLOOR_DB)
+			result.spectrum[b] = TAP_FLOOR_DB;
+	}
+
+	pthread_mutex_lock (&tap->results_mutex);
+	tap->windows ++;
+	if (result.pts != AV_NOPTS_VALUE)
+	{
+		tap->results[(tap->results_head + tap->n_results) % AUDIO_TAP_RESULTS] = result;
+		if (tap->n_results < AUDIO_TAP_RESULTS)
+			tap->n_results ++;
+		else
+			tap->results_head = (tap->results_head + 1) % AUDIO_TAP_RESULTS;
+	}
+	pthread_mutex_unlock (&tap->results_mutex);
+	return 1;
+}
+
+
+int start_audio_tap (audio_tap* tap)
+{
+	tap->running = 1;
+	if (pthread_create (&tap->thread, NULL, tap_thread, tap) != 0)
+	{
+		fprintf (stderr, "Could not start audio analysis thread\n");
+		tap->running = 0;
+		return 1;
+	}
+	return 0;
+}
+
+
+void stop_audio_tap (audio_tap* tap)
+{
+	if (!tap->running)
+		return;
+	tap->running = 0;
+	pthread_join (tap->thread, NULL);
+}
+
+
+void audio_tap_flush (audio_tap* tap)
+{
+	pthread_mutex_lock (&tap->results_mutex);
+	tap->results_head = tap->n_results = 0;
+	pthread_mutex_unlock (&tap->results_mutex);
+}
+
+
+int audio_tap_result (audio_tap* tap, int64_t time, rpi_mp_audio_analysis* analysis)
+{
+	int i, ret = 1;
+
+	pthread_mutex_lock (&tap->results_mutex);
+	for (i = tap->n_results - 1; i >= 0; i --)
+	{
+		const rpi_mp_audio_analysis* r = &tap->results[(tap->results_head + i) % AUDIO_TAP_RESULTS];
+		if (r->pts <= time)
+		{
+			*analysis = *r;
+			ret = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock (&tap->results_mutex);
+	return ret;
+}
@@ -0,0 +1,108 @@
+#include "rpi_mp.h"
+#include "rpi_mp_io.h"
+
+typedef struct
+{
+	rpi_mp_io io;
+	size_t    position;
+} custom_io ;
+
+
+static int span_read (void* opaque, uint8_t* buf, int size)
+{
+	custom_io* c = (custom_io*) opaque;
+	size_t     n = c->io.length - c->position;
+
+	if (n == 0)
+		return AVERROR_EOF;
+	if (n > (size_t) size)
+		n = size;
+	memcpy (buf, c->io.data + c->position, n);
+	c->position += n;
+	return n;
+}
+
+static int64_t span_seek (void* opaque, int64_t offset, int whence)
+{
+	custom_io* c = (custom_io*) opaque;
+	int64_t    position;
+
+	switch (whence & ~AVSEEK_FORCE)
+	{
+		case AVSEEK_SIZE: return c->io.length;
+		case SEEK_SET:    position = offset;                           break;
+		case SEEK_CUR:    position = (int64_t) c->position  + offset; break;
+		case SEEK_END:    position = (int64_t) c->io.length + offset; break;
+		default:          return AVERROR (EINVAL);
+	}
+	if (position < 0 || position > (int64_t) c->io.length)
+		return AVERROR (EINVAL);
+	c->position = position;
+	return position;
+}
+
+static int callback_read (void* opaque, uint8_t* buf, int size)
+{
+	custom_io* c = (custom_io*) opaque;
+	int        n = c->io.read (c->io.opaque, buf, size);
+	return n == 0 ? AVERROR_EOF : n < 0 ? AVERROR (EIO) : n;
+}
+
+static int64_t callback_seek (void* opaque, int64_t offset, int whence)
+{
+	custom_io* c = (custom_io*) opaque;
+	int64_t    ret;
+
+	if (whence & AVSEEK_SIZE)
+		return c->io.size ? c->io.size (c->io.opaque) : -1;
+	ret = c->io.seek (c->io.opaque, offset, whence & ~AVSEEK_FORCE);
+	return ret < 0 ? AVERROR (EIO) : ret;
+}
+
+
+AVIOContext* open_custom_io (const rpi_mp_io* io)
+{
+	AVIOContext* ctx;
+	custom_io*   c;
+	uint8_t*     buffer;
+	int          size = io->buffer_size > 0 ? io->buffer_size : CUSTOM_IO_BUFFER_SIZE;
+
+	if (!io->data && !io->read)
+	{
+		fprintf (stderr, "Custom IO needs either a memory span or a read callback\n");
+		return NULL;
+	}
+	if (!(c = (custom_io*) av_mallocz (sizeof (custom_io))))
+		return NULL;
+	c->io = *io;
+	if (!(buffer = (uint8_t*) av_malloc (size)))
+	{
+		av_free (c);
+		return NULL;
+	}
+	if (io->data)
+		ctx = avio_alloc_context (buffer, size, 0, c, span_read, NULL, span_seek);
+	else
+		ctx = avio_alloc_context (buffer, size, 0, c, callback_read, NULL, io->seek ? callback_seek : NULL);
+	if (!ctx)
+	{
+		av_free (buffer);
+		av_free (c);
+		return NULL;
+	}
+	// the span is already in memory, buffering it again only costs a copy
+	if (io->data)
+		ctx->direct = 1;
+	ctx->seekable = io->data || io->seek ? AVIO_SEEKABLE_NORMAL : 0;
+	return ctx;
+}
+
+
+void close_custom_io (AVIOContext** ctx)
+{
+	if (!*ctx)
+		return;
+	av_freep (&(*ctx)->opaque);
+	av_freep (&(*ctx)->buffer);
+	av_freep (ctx);
+}
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "rpi_mp.h"
+#include "rpi_mp_follow.h"
+#include "rpi_mp_io.h"
+#include "rpi_mp_utils.h"
+
+typedef struct
+{
+	int      fd;
+	int      notify;        /* inotify descriptor watching the file, -1 to poll its size */
+	char   * marker;
+	int      timeout_ms;
+	int64_t  grown;         /* monotonic time the size last changed */
+	// read by follow_io_stats from other threads
+	int64_t  size;          /* as of the last look */
+	int64_t  position;
+	int      complete;
+	int      timed_out;
+	int      aborted;
+	int      waiting;
+	uint64_t waits;
+	int64_t  wait_us;
+} follow_io ;
+
+
+/**
+ *	Looks at the size and for the marker, returns non-zero once the file is complete.
+ */
+static int follow_complete (follow_io* f)
+{
+	struct stat st;
+	int64_t     now = monotonic_us ();
+
+	if (__atomic_load_n (&f->complete, __ATOMIC_RELAXED))
+		return 1;
+	if (fstat (f->fd, &st) == 0 && st.st_size != __atomic_load_n (&f->size, __ATOMIC_RELAXED))
+	{
+		__atomic_store_n (&f->size, (int64_t) st.st_size, __ATOMIC_RELAXED);
+		f->grown = now;
+	}
+	if (f->marker && access (f->marker, F_OK) == 0)
+		printf ("download complete, found %s\n", f->marker);
+	else if (f->timeout_ms > 0 && now - f->grown >= (int64_t) f->timeout_ms * 1000)
+	{
+		printf ("download taken as complete, the file did not grow for %d ms\n", f->timeout_ms);
+		__atomic_store_n (&f->timed_out, 1, __ATOMIC_RELAXED);
+	}
+	else
+		return 0;
+	__atomic_store_n (&f->complete, 1, __ATOMIC_RELAXED);
+	return 1;
+}
+
+
+/**
+ *	Waits until the file was written to or FOLLOW_POLL_MS passed.
+ */
+static void follow_wait (follow_io* f)
+{
+	struct pollfd p = { f->notify, POLLIN, 0 };
+	char          events[1024];
+
+	if (f->notify < 0)
+	{
+		usleep (FOLLOW_POLL_MS * 1000);
+		return;
+	}
+	// what changed does not matter, the next read finds out
+	if (poll (&p, 1, FOLLOW_POLL_MS) > 0)
+		while (read (f->notify, events, sizeof (events)) > 0)
+			;
+}
+
+
+static void follow_waited (follow_io* f, int64_t started)
+{
+	if (!started)
+		return;
+	__atomic_add_fetch (&f->wait_us, monotonic_us () - started, __ATOMIC_RELAXED);
+	__atomic_store_n (&f->waiting, 0, __ATOMIC_RELAXED);
+}
+
+
+static int follow_read (void* opaque, uint8_t* buf, int size)
+{
+	follow_io* f        = (follow_io*) opaque;
+	int64_t    started  = 0;
+	int        complete = __atomic_load_n (&f->complete, __ATOMIC_RELAXED);
+	ssize_t    n;
+
+	for (;;)
+	{
+		if ((n = read (f->fd, buf, size)) > 0)
+		{
+			__atomic_add_fetch (&f->position, n, __ATOMIC_RELAXED);
+			follow_waited (f, started);
+			return n;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 || complete || __atomic_load_n (&f->aborted, __ATOMIC_RELAXED))
+		{
+			follow_waited (f, started);
+			return n < 0 ? AVERROR (errno) : complete ? AVERROR_EOF : AVERROR_EXIT;
+		}
+		// read once more after it was completed, the last data may have come just before the marker
+		if ((complete = follow_complete (f)))
+			continue;
+		// caught up with the download
+		if (!started)
+		{
+			started = monotonic_us ();
+			__atomic_add_fetch (&f->waits, 1, __ATOMIC_RELAXED);
+			__atomic_store_n (&f->waiting, 1, __ATOMIC_RELAXED);
+		}
+		follow_wait (f);
+	}
+}
+
+
+static int64_t follow_seek (void* opaque, int64_t offset, int whence)
+{
+	follow_io* f = (follow_io*) opaque;
+	off_t      position;
+
+	// the size is only known once the file is complete, until then it is a stream that goes on
+	if (whence & AVSEEK_SIZE)
+		return follow_complete (f) ? __atomic_load_n (&f->size, __ATOMIC_RELAXED) : -1;
+	whence &= ~AVSEEK_FORCE;
+	if (whence == SEEK_END && !follow_complete (f))
+		return AVERROR (EINVAL);
+	// past the end is fine, reads there wait until the download gets there
+	if ((position = lseek (f->fd, offset, whence)) < 0)
+		return AVERROR (errno);
+	__atomic_store_n (&f->position, (int64_t) position, __ATOMIC_RELAXED);
+	return position;
+}
+
+
+AVIOContext* open_follow_io (const char* path, const char* marker_suffix, int timeout_ms)
+{
+	AVIOContext* ctx;
+	follow_io*   f;
+	uint8_t*     buffer;
+
+	if (!(f = (follow_io*) av_mallocz (sizeof (follow_io))))
+		return NULL;
+	f->notify     = -1;
+	f->timeout_ms = timeout_ms;
+	f->grown      = monotonic_us ();
+	if ((f->fd = open (path, O_RDONLY)) < 0)
+	{
+		fprintf (stderr, "Could not open %s: %s\n", path, strerror (errno));
+		av_free (f);
+		return NULL;
+	}
+	if (marker_suffix && (f->marker = (char*) av_malloc (strlen (path) + strlen (marker_suffix) + 1)))
+		sprintf (f->marker, "%s%s", path, marker_suffix);
+	// without inotify the size is polled
+	if ((f->notify = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC)) >= 0 &&
+	    inotify_add_watch (f->notify, path, IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB) < 0)
+	{
+		close (f->notify);
+		f->notify = -1;
+	}
+	follow_complete (f);
+	if (!(buffer = (uint8_t*) av_malloc (CUSTOM_IO_BUFFER_SIZE)) ||
+	    !(ctx = avio_alloc_context (buffer, CUSTOM_IO_BUFFER_SIZE, 0, f, follow_read, NULL, follow_seek)))
+	{
+		av_free (buffer);
+		if (f->notify >= 0)
+			close (f->notify);
+		close (f->fd);
+		av_free (f->marker);
+		av_free (f);
+		return NULL;
+	}
+	ctx->seekable = AVIO_SEEKABLE_NORMAL;
+	return ctx;
+}
+
+
+void close_follow_io (AVIOContext** ctx)
+{
+	follow_io* f;
+
+	if (!*ctx)
+		return;
+	f = (follow_io*) (*ctx)->opaque;
+	if (f->notify >= 0)
+		close (f->notify);
+	close (f->fd);
+	av_free (f->marker);
+	av_freep (&(*ctx)->opaque);
+	av_freep (&(*ctx)->buffer);
+	av_freep (ctx);
+}
+
+
+void follow_io_abort (AVIOContext* ctx)
+{
+	follow_io* f = (follow_io*) ctx->opaque;
+	__atomic_store_n (&f->aborted, 1, __ATOMIC_RELAXED);
+}
+
+
+void follow_io_stats (AVIOContext* ctx, rpi_mp_download_stats* stats)
+{
+	follow_io*  f = (follow_io*) ctx->opaque;
+	struct stat st;
+
+	memset (stats, 0x0, sizeof (rpi_mp_download_stats));
+	// the reader only looks when it has caught up
+	stats->size      = fstat (f->fd, &st) == 0 ? (int64_t) st.st_size : __atomic_load_n (&f->size, __ATOMIC_RELAXED);
+	stats->read      = __atomic_load_n (&f->position, __ATOMIC_RELAXED);
+	stats->waits     = __atomic_load_n (&f->waits, __ATOMIC_RELAXED);
+	stats->wait_us   = __atomic_load_n (&f->wait_us, __ATOMIC_RELAXED);
+	stats->waiting   = __atomic_load_n (&f->waiting, __ATOMIC_RELAXED);
+	stats->complete  = __atomic_load_n (&f->complete, __ATOMIC_RELAXED);
+	stats->timed_out = __atomic_load_n (&f->timed_out, __ATOMIC_RELAXED);
+}
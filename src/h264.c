@@ -0,0 +1,217 @@
+#include "rpi_mp_h264.h"
+
+#define NAL_SLICE     1
+#define NAL_SLICE_IDR 5
+#define NAL_SEI       6
+
+#define SEI_RECOVERY_POINT 6
+#define SLICE_TYPE_I       2
+#define SLICE_TYPE_SI      4
+
+
+/**
+ *	Reads the payload of a NAL unit, dropping the emulation prevention bytes (00 00 03).
+ */
+typedef struct
+{
+	const uint8_t * data;
+	int             size;
+	int             position;
+	int             zeros;
+	uint32_t        bits;
+	int             n_bits;
+}
+rbsp_reader;
+
+/**
+ *	What the NAL units of an access unit seen so far tell about it.
+ */
+typedef struct
+{
+	int idr;
+	int recovery_point;
+	int intra_slices;
+	int other_slices;
+	int reference;
+}
+access_unit;
+
+
+/**
+ *	Returns the next payload byte, -1 at the end.
+ */
+static int rbsp_byte (rbsp_reader* r)
+{
+	int byte;
+	if (r->position >= r->size)
+		return -1;
+	byte = r->data[r->position ++];
+	if (r->zeros >= 2 && byte == 3)
+	{
+		r->zeros = 0;
+		if (r->position >= r->size)
+			return -1;
+		byte = r->data[r->position ++];
+	}
+	r->zeros = byte == 0 ? r->zeros + 1 : 0;
+	return byte;
+}
+
+/**
+ *	Reads an unsigned Exp-Golomb code, -1 if the payload ends first or the code is too long.
+ */
+static int rbsp_ue (rbsp_reader* r)
+{
+	int leading = 0, byte;
+	uint32_t value;
+
+	for (;;)
+	{
+		if (r->n_bits == 0)
+		{
+			if ((byte = rbsp_byte (r)) < 0)
+				return -1;
+			r->bits   = byte;
+			r->n_bits = 8;
+		}
+		if ((r->bits >> -- r->n_bits) & 1)
+			break;
+		if (++ leading > 30)
+			return -1;
+	}
+	for (value = 1; leading > 0; leading --)
+	{
+		if (r->n_bits == 0)
+		{
+			if ((byte = rbsp_byte (r)) < 0)
+				return -1;
+			r->bits   = byte;
+			r->n_bits = 8;
+		}
+		value = value << 1 | ((r->bits >> -- r->n_bits) & 1);
+	}
+	return value - 1;
+}
+
+/**
+ *	Returns non-zero if the SEI NAL unit carries a recovery point, after which decoding starts
+ *	cleanly without an IDR frame (open GOPs, broadcast streams with periodic intra refresh).
+ */
+static int sei_recovery_point (const uint8_t* data, int size)
+{
+	rbsp_reader r = { data, size, 1, 0, 0, 0 };
+	int         type, length, byte, i;
+
+	// each message: type and size as runs of 0xFF plus a last byte, then the payload
+	while (r.position < r.size && r.data[r.position] != 0x80)
+	{
+		for (type = 0; (byte = rbsp_byte (&r)) == 0xFF; type += 255)
+			;
+		if (byte < 0)
+			return 0;
+		type += byte;
+		for (length = 0; (byte = rbsp_byte (&r)) == 0xFF; length += 255)
+			;
+		if (byte < 0)
+			return 0;
+		length += byte;
+		if (type == SEI_RECOVERY_POINT)
+			return 1;
+		for (i = 0; i < length; i ++)
+			if (rbsp_byte (&r) < 0)
+				return 0;
+	}
+	return 0;
+}
+
+/**
+ *	Folds one NAL unit into what is known about the access unit.
+ */
+static void classify_nal (const uint8_t* data, int size, access_unit* au)
+{
+	rbsp_reader r = { data, size, 1, 0, 0, 0 };
+	int         type, slice_type;
+
+	if (size < 1)
+		return;
+	type = data[0] & 0x1f;
+	if (type == NAL_SEI)
+	{
+		au->recovery_point |= sei_recovery_point (data, size);
+		return;
+	}
+	if (type != NAL_SLICE && type != NAL_SLICE_IDR)
+		return;
+	au->reference |= (data[0] >> 5) & 0x3;
+	if (type == NAL_SLICE_IDR)
+	{
+		au->idr = 1;
+		return;
+	}
+	// first_mb_in_slice, then slice_type; 5 to 9 say all slices of the picture have that type
+	if (rbsp_ue (&r) < 0 || (slice_type = rbsp_ue (&r)) < 0)
+	{
+		au->other_slices = 1;
+		return;
+	}
+	if (slice_type % 5 == SLICE_TYPE_I || slice_type % 5 == SLICE_TYPE_SI)
+		au->intra_slices = 1;
+	else
+		au->other_slices = 1;
+}
+
+
+int h264_nal_length_size (const uint8_t* extradata, int size)
+{
+	// avcC starts with configurationVersion 1, Annex B with a start code
+	if (!extradata || size < 7 || extradata[0] != 1)
+		return 0;
+	return (extradata[4] & 0x3) + 1;
+}
+
+
+enum h264_frame_class h264_classify (const uint8_t* data, int size, int nal_length_size)
+{
+	access_unit au = { 0, 0, 0, 0, 0 };
+	uint32_t    length;
+	int         i, start = -1;
+
+	if (nal_length_size > 0)
+	{
+		while (size > nal_length_size)
+		{
+			for (i = 0, length = 0; i < nal_length_size; i ++)
+				length = length << 8 | data[i];
+			data += nal_length_size;
+			size -= nal_length_size;
+			if (length == 0 || length > (uint32_t) size)
+				break;
+			classify_nal (data, length, &au);
+			data += length;
+			size -= length;
+		}
+	}
+	else
+	{
+		// Annex B: each NAL unit follows a 00 00 01 (a 4-byte start code ends the same way)
+		// and runs up to the next start code
+		for (i = 0; i + 2 < size; i ++)
+			if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+			{
+				if (start >= 0)
+					classify_nal (data + start, i - start, &au);
+				start = i + 3 < size ? i + 3 : -1;
+				i += 2;
+			}
+		if (start >= 0)
+			classify_nal (data + start, size - start, &au);
+	}
+
+	if (au.idr)
+		return H264_FRAME_IDR;
+	if (au.recovery_point || (au.intra_slices && !au.other_slices))
+		return H264_FRAME_RECOVERY;
+	if (au.intra_slices || au.other_slices)
+		return au.reference ? H264_FRAME_REFERENCE : H264_FRAME_NON_REFERENCE;
+	return H264_FRAME_UNKNOWN;
+}
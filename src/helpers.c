@@ -1,16 +1,17 @@
 #include <math.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
+#include <sys/stat.h>
 #include "rpi_mp_utils.h"
 
 unsigned timer = 0;
 
-void flt_to_s16 (uint8_t *flt, uint8_t **s16, int size)
+void flt_to_s16 (uint8_t *flt, uint8_t *s16, int size)
 {
 	int         i = 0;
-             *s16 = (uint8_t *) malloc (size / 2);
-	int16_t    *p = (int16_t *) *s16;
+	int16_t    *p = (int16_t *) s16;
 	float     *fp = (float   *) flt;
 
 	for (; i < size / 4; i ++)
@@ -19,16 +20,39 @@ void flt_to_s16 (uint8_t *flt, uint8_t **s16, int size)
 
 unsigned long time_ms(void) {
     struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
     return (ts.tv_sec*1000000 + ts.tv_nsec/1000) / 1000;
 }
 
 unsigned long time_us(void) {
     struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
     return (ts.tv_sec*1000000 + ts.tv_nsec/1000);
 }
 
+int64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+const char* cache_file_path (const char* name, char* path, size_t size)
+{
+	const char* env = getenv ("RPI_MP_CACHE");
+
+	if (env)
+		snprintf (path, size, "%s/%s", env, name);
+	else if (getenv ("HOME"))
+	{
+		snprintf (path, size, "%s/.cache", getenv ("HOME"));
+		mkdir (path, 0755);
+		snprintf (path, size, "%s/.cache/%s", getenv ("HOME"), name);
+	}
+	else
+		return NULL;
+	return path;
+}
+
 void ts(void)
 {
 	timer = time_ms();
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include "rpi_mp_loop.h"
+
+
+void init_loop (loop_state* loop, AVFormatContext* fmt_ctx)
+{
+	loop->start   = fmt_ctx->start_time != AV_NOPTS_VALUE ? fmt_ctx->start_time : 0;
+	loop->end     = loop->start;
+	loop->length  = 0;
+	loop->offset  = 0;
+	loop->packets = 0;
+	loop->passes  = 0;
+}
+
+
+void loop_rebase_packet (loop_state* loop, AVFormatContext* fmt_ctx, AVPacket* packet)
+{
+	AVRational time_base = fmt_ctx->streams[packet->stream_index]->time_base;
+	int64_t    ts        = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+	int64_t    shift;
+
+	loop->packets ++;
+	if (ts != AV_NOPTS_VALUE)
+	{
+		ts = av_rescale_q (ts + packet->duration, time_base, AV_TIME_BASE_Q);
+		if (ts > loop->end)
+			loop->end = ts;
+	}
+	if (loop->offset == 0)
+		return;
+	shift = av_rescale_q (loop->offset, AV_TIME_BASE_Q, time_base);
+	if (packet->pts != AV_NOPTS_VALUE)
+		packet->pts += shift;
+	if (packet->dts != AV_NOPTS_VALUE)
+		packet->dts += shift;
+}
+
+
+int loop_restart (loop_state* loop, AVFormatContext* fmt_ctx)
+{
+	if (loop->packets == 0 || loop->end <= loop->start)
+		return 1;
+	// backwards from the start lands on the first keyframe
+	if (av_seek_frame (fmt_ctx, -1, loop->start, AVSEEK_FLAG_BACKWARD) < 0)
+	{
+		fprintf (stderr, "Could not seek back to the start of the loop\n");
+		return 1;
+	}
+	// the longest stream decides, a shorter one leaves a gap rather than overlapping the next pass
+	if (loop->passes == 0)
+		loop->length = loop->end - loop->start;
+	loop->offset += loop->end - loop->start;
+	loop->end     = loop->start;
+	loop->packets = 0;
+	loop->passes ++;
+	return 0;
+}
+
+
+int64_t loop_position (const loop_state* loop, int64_t time)
+{
+	if (loop->length <= 0 || time < loop->start)
+		return time;
+	return loop->start + (time - loop->start) % loop->length;
+}
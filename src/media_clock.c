@@ -0,0 +1,197 @@
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include "rpi_mp.h"
+#include "rpi_mp_media_clock.h"
+#include "rpi_mp_thread_policy.h"
+#include "rpi_mp_utils.h"
+
+// published sample, written by the sampler only, under a sequence lock so readers retry torn reads
+static uint32_t         sequence   = 0;
+static volatile int64_t base_media = 0;
+static volatile int64_t base_mono  = 0;
+static volatile int32_t base_scale = 0;
+
+static int64_t      (* sample_clock) (void) = NULL;
+static int32_t         scale   = 1 << 16;
+static int             period  = 0;
+static int             running = 0;
+static int             resync  = 0;
+static pthread_t       sampler;
+static pthread_mutex_t sampler_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  sampler_cond  = PTHREAD_COND_INITIALIZER;
+static rpi_mp_clock_stats stats;
+
+
+static int64_t extrapolate (int64_t media, int64_t mono, int32_t s, int64_t now)
+{
+	return media + ((now - mono) * s >> 16);
+}
+
+static void publish (int64_t media, int64_t mono, int32_t s)
+{
+	__atomic_add_fetch (&sequence, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	base_media = media;
+	base_mono  = mono;
+	base_scale = s;
+	__atomic_add_fetch (&sequence, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ *	Reads the OMX clock, bracketed by monotonic timestamps; the sample is taken to be from the
+ *	middle of the round trip. Returns the round trip in microseconds.
+ */
+static int64_t take_sample (int64_t* media, int64_t* mono)
+{
+	int64_t before = monotonic_us ();
+	*media = sample_clock ();
+	int64_t after  = monotonic_us ();
+	*mono = before + (after - before) / 2;
+	return after - before;
+}
+
+static void* sampler_thread (void* arg)
+{
+	int64_t media, mono, previous = INT64_MIN, error, round_trip;
+	int     forced = 1;
+	struct timespec deadline;
+
+	thread_policy_enter (THREAD_CLOCK);
+	pthread_mutex_lock (&sampler_mutex);
+	while (running)
+	{
+		int32_t s = scale;
+		pthread_mutex_unlock (&sampler_mutex);
+
+		round_trip = take_sample (&media, &mono);
+		// how far off the extrapolation of the last sample was
+		error = extrapolate (base_media, base_mono, base_scale, mono) - media;
+		publish (media, mono, media == previous ? 0 : s);
+		previous = media;
+
+		pthread_mutex_lock (&sampler_mutex);
+		stats.samples ++;
+		stats.round_trip_us = round_trip;
+		if (round_trip > stats.max_round_trip_us)
+			stats.max_round_trip_us = round_trip;
+		// a seek or speed change is not an interpolation error
+		if (!forced)
+		{
+			stats.error_us = error < 0 ? -error : error;
+			if (stats.error_us > stats.max_error_us)
+				stats.max_error_us = stats.error_us;
+		}
+		clock_gettime (CLOCK_MONOTONIC, &deadline);
+		deadline.tv_nsec += (long) period * 1000;
+		deadline.tv_sec  += deadline.tv_nsec / 1000000000;
+		deadline.tv_nsec %= 1000000000;
+		while (running && !resync)
+			if (pthread_cond_timedwait (&sampler_cond, &sampler_mutex, &deadline) != 0)
+			{
+				thread_wakeup (THREAD_CLOCK, (int64_t) deadline.tv_sec * 1000000 + deadline.tv_nsec / 1000);
+				break;
+			}
+		forced = resync;
+		resync = 0;
+	}
+	pthread_mutex_unlock (&sampler_mutex);
+	return NULL;
+}
+
+
+int start_media_clock (int64_t (*sample) (void), int sample_period)
+{
+	pthread_condattr_t attr;
+
+	sample_clock = sample;
+	period       = sample_period;
+	running      = 1;
+	resync       = 0;
+	scale        = 1 << 16;
+	memset (&stats, 0x0, sizeof (stats));
+	stats.period_us = sample_period;
+	// the deadline of the timed wait is on the monotonic clock as well
+	pthread_condattr_init (&attr);
+	pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+	pthread_cond_destroy (&sampler_cond);
+	pthread_cond_init (&sampler_cond, &attr);
+	pthread_condattr_destroy (&attr);
+	publish (0, monotonic_us (), 0);
+	if (pthread_create (&sampler, NULL, sampler_thread, NULL) != 0)
+	{
+		fprintf (stderr, "Could not start media clock sampler\n");
+		running = 0;
+		return 1;
+	}
+	return 0;
+}
+
+
+void stop_media_clock ()
+{
+	pthread_mutex_lock (&sampler_mutex);
+	if (!running)
+	{
+		pthread_mutex_unlock (&sampler_mutex);
+		return;
+	}
+	running = 0;
+	pthread_cond_signal (&sampler_cond);
+	pthread_mutex_unlock (&sampler_mutex);
+	pthread_join (sampler, NULL);
+}
+
+
+void media_clock_scale (int32_t s)
+{
+	pthread_mutex_lock (&sampler_mutex);
+	scale  = s;
+	resync = 1;
+	pthread_cond_signal (&sampler_cond);
+	pthread_mutex_unlock (&sampler_mutex);
+}
+
+
+void media_clock_resync ()
+{
+	pthread_mutex_lock (&sampler_mutex);
+	resync = 1;
+	pthread_cond_signal (&sampler_cond);
+	pthread_mutex_unlock (&sampler_mutex);
+}
+
+
+int64_t media_clock_now ()
+{
+	uint32_t before, after;
+	int64_t  media, mono;
+	int32_t  s;
+
+	do
+	{
+		before = __atomic_load_n (&sequence, __ATOMIC_ACQUIRE);
+		media  = base_media;
+		mono   = base_mono;
+		s      = base_scale;
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+		after  = __atomic_load_n (&sequence, __ATOMIC_RELAXED);
+	}
+	while (before != after || before & 1);
+	return extrapolate (media, mono, s, monotonic_us ());
+}
+
+
+int64_t rpi_mp_media_time_us ()
+{
+	return media_clock_now ();
+}
+
+
+void rpi_mp_media_clock_stats (rpi_mp_clock_stats* s)
+{
+	pthread_mutex_lock (&sampler_mutex);
+	*s = stats;
+	pthread_mutex_unlock (&sampler_mutex);
+}
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "rpi_mp_metrics.h"
+
+#define METRICS_POLL_MS    200
+#define METRICS_REQUEST    512
+#define METRICS_TIMEOUT_MS 100
+
+struct metrics_writer
+{
+	char*  data;
+	size_t size;
+	size_t length;
+	int    json;
+};
+
+player_counters rpi_mp_counters;
+
+static int         server_fd = -1;
+static int         running   = 0;
+static char        socket_path[sizeof (((struct sockaddr_un*) 0)->sun_path)];
+static pthread_t   server;
+static void     (* collect_player) (metrics_writer*) = NULL;
+
+
+static void append (metrics_writer* writer, const char* format, ...)
+{
+	va_list args;
+	int     n;
+
+	for (;;)
+	{
+		va_start (args, format);
+		n = vsnprintf (writer->data + writer->length, writer->size - writer->length, format, args);
+		va_end (args);
+		if (n < 0)
+			return;
+		if (writer->length + n < writer->size)
+		{
+			writer->length += n;
+			return;
+		}
+		char* data = (char*) realloc (writer->data, writer->size * 2 + n);
+		if (!data)
+			return;
+		writer->data  = data;
+		writer->size  = writer->size * 2 + n;
+	}
+}
+
+
+void metric_counter (metrics_writer* writer, const char* name, const char* help, uint64_t value)
+{
+	if (writer->json)
+		append (writer, "%s\"%s\":%llu", writer->length > 1 ? "," : "", name, (unsigned long long) value);
+	else
+		append (writer, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name, (unsigned long long) value);
+}
+
+
+void metric_gauge (metrics_writer* writer, const char* name, const char* help, double value)
+{
+	if (writer->json)
+		append (writer, "%s\"%s\":%.15g", writer->length > 1 ? "," : "", name, value);
+	else
+		append (writer, "# HELP %s %s\n# TYPE %s gauge\n%s %.15g\n", name, help, name, name, value);
+}
+
+/**
+ *	CPU time from getrusage, resident memory from /proc/self/statm.
+ */
+static void collect_process (metrics_writer* writer)
+{
+	struct rusage usage;
+	unsigned long pages, resident = 0;
+	FILE*         statm;
+
+	if (getrusage (RUSAGE_SELF, &usage) == 0)
+		metric_gauge (writer, "rpi_mp_process_cpu_seconds", "User and system CPU time of the process",
+		              usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6);
+	if ((statm = fopen ("/proc/self/statm", "r")))
+	{
+		if (fscanf (statm, "%lu %lu", &pages, &resident) == 2)
+			metric_gauge (writer, "rpi_mp_process_resident_memory_bytes", "Resident set size of the process",
+			              (double) resident * sysconf (_SC_PAGESIZE));
+		fclose (statm);
+	}
+}
+
+
+static void answer (int fd)
+{
+	char            request[METRICS_REQUEST];
+	metrics_writer  writer;
+	struct timeval  timeout = { 0, METRICS_TIMEOUT_MS * 1000 };
+	ssize_t         n, sent;
+	int             http;
+
+	// a client that sends nothing still gets Prometheus text once the timeout expires
+	setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout));
+	n = recv (fd, request, sizeof (request) - 1, 0);
+	request[n > 0 ? n : 0] = '\0';
+	http = strncmp (request, "GET ", 4) == 0;
+
+	memset (&writer, 0x0, sizeof (writer));
+	writer.json = strstr (request, "json") != NULL;
+	writer.size = 4096;
+	if (!(writer.data = (char*) malloc (writer.size)))
+		return;
+	if (writer.json)
+		append (&writer, "{");
+	collect_process (&writer);
+	if (collect_player)
+		collect_player (&writer);
+	append (&writer, writer.json ? "}\n" : "");
+
+	if (http)
+	{
+		char header[128];
+		int  length = snprintf (header, sizeof (header), "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\n\r\n",
+		                        writer.json ? "application/json" : "text/plain; version=0.0.4", writer.length);
+		send (fd, header, length, MSG_NOSIGNAL);
+	}
+	for (sent = 0; sent < (ssize_t) writer.length; sent += n)
+		if ((n = send (fd, writer.data + sent, writer.length - sent, MSG_NOSIGNAL)) <= 0)
+			break;
+	free (writer.data);
+}
+
+
+static void* server_thread (void* arg)
+{
+	struct pollfd listener = { server_fd, POLLIN, 0 };
+	int           fd;
+
+	while (__atomic_load_n (&running, __ATOMIC_RELAXED))
+	{
+		if (poll (&listener, 1, METRICS_POLL_MS) <= 0)
+			continue;
+		if ((fd = accept (server_fd, NULL, NULL)) < 0)
+			continue;
+		answer (fd);
+		close (fd);
+	}
+	return NULL;
+}
+
+
+int start_metrics_server (const char* path, void (*collect) (metrics_writer*))
+{
+	struct sockaddr_un address;
+
+	if (running)
+		stop_metrics_server ();
+	if (strlen (path) >= sizeof (address.sun_path))
+	{
+		fprintf (stderr, "Metrics socket path too long: %s\n", path);
+		return 1;
+	}
+	memset (&address, 0x0, sizeof (address));
+	address.sun_family = AF_UNIX;
+	strcpy (address.sun_path, path);
+	strcpy (socket_path, path);
+	unlink (path);
+	if ((server_fd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+	    bind (server_fd, (struct sockaddr*) &address, sizeof (address)) < 0 ||
+	    listen (server_fd, 4) < 0)
+	{
+		fprintf (stderr, "Could not listen on metrics socket %s\n", path);
+		if (server_fd >= 0)
+			close (server_fd);
+		server_fd = -1;
+		return 1;
+	}
+	collect_player = collect;
+	running        = 1;
+	if (pthread_create (&server, NULL, server_thread, NULL) != 0)
+	{
+		fprintf (stderr, "Could not start metrics server\n");
+		running = 0;
+		close (server_fd);
+		server_fd = -1;
+		unlink (socket_path);
+		return 1;
+	}
+	return 0;
+}
+
+
+void stop_metrics_server ()
+{
+	if (!running)
+		return;
+	__atomic_store_n (&running, 0, __ATOMIC_RELAXED);
+	pthread_join (server, NULL);
+	close (server_fd);
+	server_fd = -1;
+	unlink (socket_path);
+}
@@ -3,11 +3,22 @@
 #define FIFO_ALLOC_SIZE 1000
 
 
+static inline int64_t packet_time (const AVPacket* p)
+{
+	return p->dts != AV_NOPTS_VALUE ? p->dts : p->pts;
+}
+
+
 int init_packet_buffer (packet_buffer* buffer, uint size)
 {
 	buffer->n_packets 	= 0;
 	buffer->size  		= size;
 	buffer->capacity	= FIFO_ALLOC_SIZE;
+	buffer->full		= 0;
+	buffer->empty		= 0;
+	buffer->stalled		= 0;
+	buffer->starved		= 0;
+	buffer->max_duration = 0;
 	buffer->packets 	= (AVPacket*) malloc (FIFO_ALLOC_SIZE * sizeof (AVPacket));
 	pthread_mutex_init (&buffer->mutex, NULL);
 
@@ -21,6 +32,14 @@ int init_packet_buffer (packet_buffer* buffer, uint size)
 }
 
 
+void packet_buffer_max_duration (packet_buffer* buffer, int64_t duration)
+{
+	pthread_mutex_lock (&buffer->mutex);
+	buffer->max_duration = duration;
+	pthread_mutex_unlock (&buffer->mutex);
+}
+
+
 void destroy_packet_buffer (packet_buffer* buffer)
 {
 	flush_buffer (buffer);
@@ -36,20 +55,34 @@ int push_packet (packet_buffer* buffer, AVPacket p)
 	pthread_mutex_lock (&buffer->mutex);
 	int ret = 0;
 	// check if size would be too large
-	if (buffer->size_packets + p.size > buffer->size)
+	if (buffer->size_packets + p.size > buffer->size ||
+	    (buffer->max_duration > 0 && buffer->n_packets > 0 && packet_time (&p) != AV_NOPTS_VALUE &&
+	     packet_time (buffer->_front) != AV_NOPTS_VALUE && packet_time (&p) - packet_time (buffer->_front) > buffer->max_duration))
 	{
+		// read without the lock by the metrics server; the demuxer retries until there is room,
+		// which counts once
+		if (!buffer->stalled)
+			__atomic_add_fetch (&buffer->full, 1, __ATOMIC_RELAXED);
+		buffer->stalled = 1;
 		ret = FULL_BUFFER;
 		goto end;
 	}
-	// we might need to increment the size of the allocated buffer
+	// we might need to increment the size of the allocated buffer, doubling it so a FIFO that
+	// fills up with small packets stops growing after a few steps instead of every 1000 packets
 	if (buffer->n_packets == buffer->capacity - 1)
 	{
 		// allocate new larger buffer
-		AVPacket* tmp = (AVPacket*) malloc (sizeof (AVPacket) * (buffer->capacity + FIFO_ALLOC_SIZE));
-		memset (tmp, 0x0, sizeof (AVPacket) * (buffer->capacity + FIFO_ALLOC_SIZE));
+		AVPacket* tmp = (AVPacket*) malloc (sizeof (AVPacket) * buffer->capacity * 2);
+		if (!tmp)
+		{
+			// the caller retries later, like with a full FIFO
+			ret = FULL_BUFFER;
+			goto end;
+		}
+		memset (tmp, 0x0, sizeof (AVPacket) * buffer->capacity * 2);
 		// copy packets
 		if (buffer->_front < buffer->_back)
-			memcpy (tmp, buffer->_front, sizeof (AVPacket) * (buffer->n_packets - 1));
+			memcpy (tmp, buffer->_front, sizeof (AVPacket) * buffer->n_packets);
 		else
 		{
 			int n = buffer->capacity - (buffer->_front - buffer->packets);
@@ -58,11 +91,12 @@ int push_packet (packet_buffer* buffer, AVPacket p)
 		}
 		// free old buffer and set pointers
 		free (buffer->packets);
-		buffer->capacity += FIFO_ALLOC_SIZE;
+		buffer->capacity *= 2;
 		buffer->packets = tmp;
 		buffer->_front = buffer->packets;
 		buffer->_back  = buffer->packets + buffer->n_packets;
 	}
+	buffer->stalled = 0;
 	*buffer->_back = p;
 	buffer->n_packets ++;
 	buffer->_back ++;
@@ -83,9 +117,14 @@ int pop_packet (packet_buffer* buffer, AVPacket* p)
 	// empty buffer
 	if (buffer->n_packets == 0)
 	{
+		// the decoding threads poll until a packet comes, which counts once
+		if (!buffer->starved)
+			__atomic_add_fetch (&buffer->empty, 1, __ATOMIC_RELAXED);
+		buffer->starved = 1;
 		ret = EMPTY_BUFFER;
 		goto end;
 	}
+	buffer->starved = 0;
 	*p = *buffer->_front;
 
 	buffer->_front ++;
@@ -0,0 +1,114 @@
+#include "rpi_mp.h"
+#include "rpi_mp_packet_pool.h"
+
+#define POOL_MIN_CLASS   10   // 1 KiB
+#define POOL_CLASSES     13   // up to 4 MiB
+#define CLASS_SIZE(c)    (1 << (POOL_MIN_CLASS + (c)))
+
+
+static AVBufferPool * pools[POOL_CLASSES];
+static size_t         max_bytes  = 0;
+static size_t         allocated  = 0;
+static size_t         high_water = 0;
+static unsigned       fallbacks  = 0;
+
+
+/**
+ *	Returns the smallest class that holds size bytes, -1 if it is too large.
+ */
+static int size_class (int size)
+{
+	int c;
+	for (c = 0; c < POOL_CLASSES; c ++)
+		if (size <= CLASS_SIZE (c))
+			return c;
+	return -1;
+}
+
+static void pool_free (void* opaque, uint8_t* data)
+{
+	av_free (data);
+	__atomic_sub_fetch (&allocated, (size_t) opaque, __ATOMIC_RELAXED);
+}
+
+/**
+ *	Allocates a new buffer for one of the pools, unless that would exceed the cap.
+ *  Called with the lock of the pool held, so it is only ever called by the demuxing thread.
+ */
+static AVBufferRef* pool_alloc (int size)
+{
+	AVBufferRef* buf;
+	uint8_t*     data;
+	size_t       total = __atomic_add_fetch (&allocated, size, __ATOMIC_RELAXED), peak;
+
+	if (total > max_bytes || !(data = (uint8_t*) av_malloc (size)))
+	{
+		__atomic_sub_fetch (&allocated, size, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	if (!(buf = av_buffer_create (data, size, pool_free, (void*) (size_t) size, 0)))
+	{
+		pool_free ((void*) (size_t) size, data);
+		return NULL;
+	}
+	peak = __atomic_load_n (&high_water, __ATOMIC_RELAXED);
+	while (total > peak && !__atomic_compare_exchange_n (&high_water, &peak, total, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	return buf;
+}
+
+
+int init_packet_pool (size_t max_size)
+{
+	memset (pools, 0x0, sizeof (pools));
+	max_bytes = max_size;
+	__atomic_store_n (&fallbacks, 0, __ATOMIC_RELAXED);
+	__atomic_store_n (&high_water, 0, __ATOMIC_RELAXED);
+	return 0;
+}
+
+
+void destroy_packet_pool ()
+{
+	int c;
+	for (c = 0; c < POOL_CLASSES; c ++)
+		av_buffer_pool_uninit (&pools[c]);
+}
+
+
+int pool_packet (AVPacket* p)
+{
+	AVBufferRef* buf;
+	int c = size_class (p->size + AV_INPUT_BUFFER_PADDING_SIZE);
+
+	if (c < 0 || (!pools[c] && !(pools[c] = av_buffer_pool_init (CLASS_SIZE (c), pool_alloc))) ||
+	    !(buf = av_buffer_pool_get (pools[c])))
+	{
+		__atomic_add_fetch (&fallbacks, 1, __ATOMIC_RELAXED);
+		return 1;
+	}
+	memcpy (buf->data, p->data, p->size);
+	memset (buf->data + p->size, 0x0, AV_INPUT_BUFFER_PADDING_SIZE);
+	// the demuxer's buffer is freed by the thread that allocated it
+	av_buffer_unref (&p->buf);
+	p->buf  = buf;
+	p->data = buf->data;
+	return 0;
+}
+
+
+void rpi_mp_packet_pool_size (size_t max_size)
+{
+	max_bytes = max_size;
+}
+
+
+void rpi_mp_packet_pool_stats (size_t* size, size_t* peak, unsigned* unpooled)
+{
+	if (size)
+		*size = __atomic_load_n (&allocated, __ATOMIC_RELAXED);
+	if (peak)
+		*peak = __atomic_load_n (&high_water, __ATOMIC_RELAXED);
+	if (unpooled)
+		*unpooled = __atomic_load_n (&fallbacks, __ATOMIC_RELAXED);
+}
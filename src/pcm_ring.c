@@ -0,0 +1,199 @@
+#include <stdlib.h>
+#include <string.h>
+#include <libavutil/avutil.h>
+#include "rpi_mp_pcm_ring.h"
+#include "rpi_mp_utils.h"
+
+
+int init_pcm_ring (pcm_ring* ring, size_t size, int bytes_per_second)
+{
+	memset (ring, 0x0, sizeof (pcm_ring));
+	if (!(ring->data = (uint8_t*) malloc (size)))
+		return 1;
+	ring->size             = size;
+	ring->bytes_per_second = bytes_per_second;
+	pthread_mutex_init (&ring->mutex, NULL);
+	pthread_cond_init  (&ring->cond, NULL);
+	return 0;
+}
+
+
+void destroy_pcm_ring (pcm_ring* ring)
+{
+	free (ring->data);
+	ring->data = NULL;
+	ring->size = 0;
+	pthread_mutex_destroy (&ring->mutex);
+	pthread_cond_destroy  (&ring->cond);
+}
+
+
+int pcm_ring_write (pcm_ring* ring, const uint8_t* data, size_t size, int64_t pts)
+{
+	size_t   offset, n;
+	unsigned flushes;
+	unsigned long start;
+
+	if (size > ring->size)
+		return 1;
+	pthread_mutex_lock (&ring->mutex);
+	if (ring->written - ring->read + size > ring->size && !ring->aborted)
+	{
+		start = time_us ();
+		while (ring->written - ring->read + size > ring->size && !ring->aborted)
+			pthread_cond_wait (&ring->cond, &ring->mutex);
+		ring->write_wait_us += time_us () - start;
+	}
+	if (ring->aborted)
+	{
+		pthread_mutex_unlock (&ring->mutex);
+		return 1;
+	}
+	// a full mark table only costs timestamp precision, reads interpolate from the previous mark
+	if (pts != AV_NOPTS_VALUE && ring->n_marks < PCM_RING_MARKS)
+	{
+		pcm_mark* mark = &ring->marks[(ring->mark_front + ring->n_marks) % PCM_RING_MARKS];
+		mark->position = ring->written;
+		mark->pts      = pts + ring->offset;
+		ring->n_marks ++;
+	}
+	flushes = ring->flushes;
+	offset  = ring->written % ring->size;
+	pthread_mutex_unlock (&ring->mutex);
+
+	// only this thread moves written, the reader never touches the free part
+	n      = size < ring->size - offset ? size : ring->size - offset;
+	memcpy (ring->data + offset, data, n);
+	memcpy (ring->data, data + n, size - n);
+
+	pthread_mutex_lock (&ring->mutex);
+	// the frame belongs to before a flush that happened while copying
+	if (flushes == ring->flushes)
+		ring->written += size;
+	if (ring->written - ring->read > ring->peak)
+		ring->peak = ring->written - ring->read;
+	if (ring->wanted && !ring->ready_at && ring->written - ring->read >= ring->wanted)
+		ring->ready_at = monotonic_us ();
+	pthread_cond_broadcast (&ring->cond);
+	pthread_mutex_unlock (&ring->mutex);
+	return 0;
+}
+
+
+size_t pcm_ring_wait (pcm_ring* ring, size_t size, int64_t* ready)
+{
+	size_t available;
+	unsigned long start;
+
+	if (ready)
+		*ready = 0;
+	pthread_mutex_lock (&ring->mutex);
+	if (ring->written - ring->read < size && !ring->finished && !ring->aborted)
+	{
+		start          = time_us ();
+		ring->wanted   = size;
+		ring->ready_at = 0;
+		while (ring->written - ring->read < size && !ring->finished && !ring->aborted)
+			pthread_cond_wait (&ring->cond, &ring->mutex);
+		ring->read_wait_us += time_us () - start;
+		ring->wanted = 0;
+		if (ready)
+			*ready = ring->ready_at;
+	}
+	available = ring->aborted ? 0 : ring->written - ring->read;
+	pthread_mutex_unlock (&ring->mutex);
+	return available;
+}
+
+
+size_t pcm_ring_fill (pcm_ring* ring)
+{
+	size_t fill;
+	pthread_mutex_lock (&ring->mutex);
+	fill = ring->written - ring->read;
+	pthread_mutex_unlock (&ring->mutex);
+	return fill;
+}
+
+
+size_t pcm_ring_read (pcm_ring* ring, uint8_t* data, size_t size, int64_t* pts)
+{
+	size_t   offset, n;
+	unsigned flushes;
+
+	pthread_mutex_lock (&ring->mutex);
+	if (size > ring->written - ring->read)
+		size = ring->written - ring->read;
+	// drop marks of frames that were read completely
+	while (ring->n_marks > 1 && ring->marks[(ring->mark_front + 1) % PCM_RING_MARKS].position <= ring->read)
+	{
+		ring->mark_front = (ring->mark_front + 1) % PCM_RING_MARKS;
+		ring->n_marks --;
+	}
+	if (ring->n_marks && ring->marks[ring->mark_front].position <= ring->read)
+	{
+		pcm_mark* mark = &ring->marks[ring->mark_front];
+		*pts = mark->pts + (int64_t) (ring->read - mark->position) * AV_TIME_BASE / ring->bytes_per_second;
+	}
+	else
+		*pts = AV_NOPTS_VALUE;
+	flushes = ring->flushes;
+	offset  = ring->read % ring->size;
+	pthread_mutex_unlock (&ring->mutex);
+
+	// only this thread moves read, the writer never touches the filled part
+	n      = size < ring->size - offset ? size : ring->size - offset;
+	memcpy (data, ring->data + offset, n);
+	memcpy (data + n, ring->data, size - n);
+
+	// what we copied was flushed meanwhile and must not be played
+	pthread_mutex_lock (&ring->mutex);
+	if (flushes == ring->flushes)
+		ring->read += size;
+	else
+		size = 0;
+	pthread_cond_broadcast (&ring->cond);
+	pthread_mutex_unlock (&ring->mutex);
+	return size;
+}
+
+
+void pcm_ring_finish (pcm_ring* ring)
+{
+	pthread_mutex_lock (&ring->mutex);
+	ring->finished = 1;
+	pthread_cond_broadcast (&ring->cond);
+	pthread_mutex_unlock (&ring->mutex);
+}
+
+
+void pcm_ring_abort (pcm_ring* ring)
+{
+	pthread_mutex_lock (&ring->mutex);
+	ring->aborted = 1;
+	pthread_cond_broadcast (&ring->cond);
+	pthread_mutex_unlock (&ring->mutex);
+}
+
+
+void pcm_ring_flush (pcm_ring* ring)
+{
+	pthread_mutex_lock (&ring->mutex);
+	ring->read     = ring->written = 0;
+	ring->n_marks  = 0;
+	ring->finished = 0;
+	ring->flushes ++;
+	pthread_cond_broadcast (&ring->cond);
+	pthread_mutex_unlock (&ring->mutex);
+}
+
+
+void pcm_ring_shift (pcm_ring* ring, int64_t held, int64_t written)
+{
+	unsigned i;
+	pthread_mutex_lock (&ring->mutex);
+	for (i = 0; i < ring->n_marks; i ++)
+		ring->marks[(ring->mark_front + i) % PCM_RING_MARKS].pts += held;
+	ring->offset = written;
+	pthread_mutex_unlock (&ring->mutex);
+}
@@ -6,12 +6,56 @@
 #include "bcm_host.h"
 #include "ilclient.h"
 #include "rpi_mp.h"
+#include "rpi_mp_alloc_debug.h"
+#include "rpi_mp_audio_tap.h"
+#include "rpi_mp_follow.h"
 #include "rpi_mp_packet_buffer.h"
+#include "rpi_mp_h264.h"
+#include "rpi_mp_io.h"
+#include "rpi_mp_loop.h"
+#include "rpi_mp_media_clock.h"
+#include "rpi_mp_metrics.h"
+#include "rpi_mp_packet_pool.h"
+#include "rpi_mp_pcm_ring.h"
+#include "rpi_mp_audio_decode.h"
+#include "rpi_mp_audio_submit.h"
+#include "rpi_mp_rendition.h"
+#include "rpi_mp_soft_video.h"
+#include "rpi_mp_player.h"
+#include "rpi_mp_subtitle.h"
+#include "rpi_mp_thread_policy.h"
+#include "rpi_mp_timeline.h"
+#include "rpi_mp_transition.h"
 #include "rpi_mp_utils.h"
 
 #define FIFO_SLEEPY_TIME               10000
+#define PACKET_POOL_SIZE               (1024 * 1024 * 24)
+#define VIDEO_INPUT_BUFFER_MS          500
+#define VIDEO_INPUT_BUFFER_MEMORY      (1024 * 1024 * 8)
+#define AUDIO_INPUT_BUFFER_MS          250
+#define PCM_RING_MS                    200
+#define AUDIO_LATENCY_TARGET_MS        40
+#define LOW_LATENCY_BUFFERS            4
+#define LOW_LATENCY_POLL_US            2000
+#define CLOCK_SAMPLE_PERIOD            50000
+#define VIDEO_LATE_US                  20000
+#define VIDEO_SKIP_US                  250000
+#define VIDEO_SKIP_LIMIT_US            2000000
+#define RENDITION_DROP_WINDOW          (5 * AV_TIME_BASE)
+#define RENDITION_DROP_LIMIT           30
+#define MAX_INPUT_BUFFERS              64
+#define INPUT_BUFFER_ALIGN             (16 * 1024)
 #define DIGITAL_AUDIO_DESTINATION_NAME "hdmi"
 #define ANALOG_AUDIO_DESTINATION_NAME  "local"
+#define NO_TRACK_SWITCH                -2
+#define LIVE_LATENCY_TARGET_MS         200
+#define LIVE_TOLERANCE_US              150000
+#define LIVE_RESYNC_INTERVAL_US        500000
+#define LIVE_FIFO_US                   1000000
+#define LIVE_PROBE_SIZE                32768
+#define LIVE_ANALYZE_US                500000
+#define LIVE_REORDER_US                50000
+#define TRANSITION_MAX_MS              60000
 
 
 /* OMX Component ports --------------------- */
@@ -25,10 +69,13 @@ enum omxports
 	VIDEO_SCHEDULER_CLOCK_PORT  =  12,
 	EGL_RENDER_INPUT_PORT       = 220,
 	EGL_RENDER_OUT_PORT         = 221,
+	RESIZE_INPUT_PORT           =  60,
+	RESIZE_OUTPUT_PORT          =  61,
 	AUDIO_RENDER_INPUT_PORT     = 100,
 	AUDIO_RENDER_CLOCK_PORT     = 101,
 	CLOCK_VIDEO_PORT            =  80,
-	CLOCK_AUDIO_PORT            =  81
+	CLOCK_AUDIO_PORT            =  81,
+	CLOCK_NEXT_VIDEO_PORT       =  82
 };
 
 /* FLAGS ----------------------------------- */
@@ -48,6 +95,26 @@ enum flags
 	AUDIO_STOPPED         = 0x0800,
 	ANALOG_AUDIO_OUT      = 0x1000,
 	NO_AUDIO_STREAM       = 0x2000,
+	SUBTITLES_ON          = 0x4000,
+	PASSTHROUGH_AUDIO     = 0x8000,
+	SWITCH_RENDITION      = 0x10000,
+	SOFTWARE_VIDEO        = 0x20000,
+	RENDER_2_YUV          = 0x40000,
+	LOOPING               = 0x80000,
+	LOW_LATENCY           = 0x100000,
+	LIVE_SOURCE           = 0x200000,
+	SWITCH_CLIP           = 0x400000,
+	FOLLOW_SOURCE         = 0x800000,
+	SPAN_SOURCE           = 0x1000000,
+};
+
+/* Crossfade into the next clip ------------ */
+enum transition_states
+{
+	TRANSITION_NONE,
+	TRANSITION_PREPARED,   // demuxed ahead, its decoder chain waits for the crossfade
+	TRANSITION_FADING,     // decoded into the other set of textures, blended with the clip playing
+	TRANSITION_HANDOVER    // the pipeline takes its chain, demuxer and audio over
 };
 
 #define OUT_CHANNELS(num_channels) ((num_channels) > 4 ? 8 : (num_channels) > 2 ? 4 : (num_channels))
@@ -66,16 +133,33 @@ enum flags
 
 // Demuxing variables (ffmpeg)
 static AVFormatContext      * fmt_ctx          = NULL;
-static AVCodecContext       * video_codec_ctx  = NULL,
-                            * audio_codec_ctx  = NULL;
-static AVStream             * video_stream     = NULL,
-                            * audio_stream     = NULL;
-static int                    video_stream_idx =   -1,
-                              audio_stream_idx =   -1;
+static AVCodecContext       * video_codec_ctx    = NULL,
+                            * audio_codec_ctx    = NULL,
+                            * subtitle_codec_ctx = NULL;
+static AVStream             * video_stream       = NULL,
+                            * audio_stream       = NULL,
+                            * subtitle_stream    = NULL;
+static int                    video_stream_idx   =   -1,
+                              audio_stream_idx   =   -1,
+                              subtitle_stream_idx =  -1;
 static AVPacket               av_packet,
                               video_packet,
-                              audio_packet;
-static AVFrame              * av_frame;
+                              audio_packet,
+                              subtitle_packet;
+static AVIOContext          * custom_pb = NULL;
+static AVIOContext          * follow_pb = NULL;
+static loop_state             loop;
+static timeline               packet_timeline;  // packets leave the demuxer with timestamps in microseconds
+
+// Track switches the application asked for, carried out by the demuxing thread between two packets
+static int                    next_audio_idx    = NO_TRACK_SWITCH,
+                              next_subtitle_idx = NO_TRACK_SWITCH;
+// Timestamp of the last packet queued per track type; after a switch sent the demuxer back,
+// packets up to skip_until are dropped when read again (AV_NOPTS_VALUE when not skipping)
+static int64_t                queued_until[TRACK_SUBTITLE + 1],
+                              skip_until[TRACK_SUBTITLE + 1];
+// Codec of the audio track switched away from, until the audio thread has taken the new one over
+static AVCodecContext       * replaced_audio_ctx = NULL;
 
 // Decoding variables (OMX)
 static COMPONENT_T          * video_decode    = NULL,
@@ -84,7 +168,8 @@ static COMPONENT_T          * video_decode    = NULL,
                             * video_clock     = NULL,
                             * audio_decode    = NULL,
                             * audio_render    = NULL,
-                            * egl_render      = NULL;
+                            * egl_render      = NULL,
+                            * resize          = NULL;
 
 static TUNNEL_T               video_tunnel[4];
 static TUNNEL_T               audio_tunnel[3];
@@ -95,12 +180,115 @@ static OMX_BUFFERHEADERTYPE * omx_video_buffer,
                             * omx_audio_buffer,
                             * omx_egl_buffers[BUFFER_COUNT];
 
-static void                 * egl_images[BUFFER_COUNT];
-static int                  * current_texture = NULL;
+static rpi_mp_buffer_stats    video_buffer_stats,
+                              audio_buffer_stats;
+
+// Catching up with the clock when the video decoder falls behind (H.264 only)
+static int                    drop_late_video = 0,
+                              nal_length_size = 0,
+                              skip_to_restart = 0;
+static int64_t                skip_start      = 0;
+static rpi_mp_drop_stats      drop_stats;
+
+// YUV output: the resizer converts decoded frames into CPU visible buffers the application locks
+static OMX_COLOR_FORMATTYPE   yuv_format       = OMX_COLOR_FormatYUV420PackedPlanar;
+static OMX_BUFFERHEADERTYPE * yuv_locked       = NULL;
+static int                    yuv_ready        = 0,
+                              yuv_stride       = 0,
+                              yuv_slice_height = 0;
+
+// Decoder for codecs the VPU can't handle, its frames are copied into video_render input buffers
+static soft_video             software_video;
+static int                    software_stride       = 0,
+                              software_slice_height = 0;
+
+// Renditions of the asset from the highest to the lowest pixel rate, when opened with rpi_mp_open_renditions
+static char                ** renditions        = NULL;
+static int                    n_renditions      = 0,
+                              current_rendition = 0,
+                              open_flags        = 0,
+                              window_drops      = 0,
+                              renditions_fixed  = 0;   // texture output that can't switch stays with the one playing
+static int64_t                window_start      = 0,
+                              switch_position   = 0,
+                              video_resume      = AV_NOPTS_VALUE;   // the video of a rendition switched to starts at this keyframe
+// Demuxer of a rendition switched away from, the audio decoder playing on is one of its codecs
+static AVFormatContext      * retired_fmt_ctx   = NULL;
+
+// Texture output: the sets of rpi_mp_setup_render_buffer and rpi_mp_setup_transition_buffer
+static void                 * egl_images[2][BUFFER_COUNT];
+static int                  * current_texture[2] = { NULL, NULL };
+static int                    playing_set        = 0,   // filled by the clip playing
+                              shown_set          = 0,   // drawn, follows with the first frame of a clip faded into
+                              texture_width      = 0,   // of the video the textures were set up for
+                              texture_height     = 0;
 static int32_t                flags     =  0;
 
+// Keyframe index of the video stream, shared with the thumbnail generator
+static char                 * source_path    = NULL;
+static int64_t              * keyframe_index = NULL;
+static int                    n_keyframes    = 0;
+
 // Helpers
-static packet_buffer video_packet_fifo, audio_packet_fifo;
+static packet_buffer video_packet_fifo, audio_packet_fifo, subtitle_packet_fifo;
+
+// Software audio path: decoding and submitting to the renderer are joined by a PCM ring
+static pcm_ring                    pcm_rings[2];
+static pcm_ring                  * audio_ring       = &pcm_rings[0];   // the other one decodes a clip faded into
+static int                         pcm_pipeline     = 0;
+static audio_decoder               pcm_decoder;
+static audio_submit                pcm_submit;
+static size_t                      audio_chunk      = 0;
+
+// Analysis of the decoded audio for visualizers, fed from the PCM path
+static audio_tap                   audio_analysis;
+static int                         audio_tap_enabled = 0,
+                                   audio_tap_on      = 0;
+
+// Audio output latency: the target of LOW_LATENCY_AUDIO and when the first audio went out
+static int                         audio_latency_target  = AUDIO_LATENCY_TARGET_MS;
+static int64_t                     playback_started      = 0;
+static int64_t                     first_audio_submitted = 0;
+
+// Live sources: the clock is anchored to the newest packet received, target behind it
+static int                         live_target_ms = LIVE_LATENCY_TARGET_MS;
+static int64_t                     live_newest    = AV_NOPTS_VALUE,
+                                   live_resynced  = 0;
+static rpi_mp_live_stats           live_stats;
+
+// Growing files: newest timestamp demuxed, against which the rest of the download is estimated
+static char                        follow_suffix[64]  = FOLLOW_MARKER_SUFFIX;
+static int                         follow_timeout_ms  = FOLLOW_TIMEOUT_MS;
+static int64_t                     follow_newest      = AV_NOPTS_VALUE;
+
+// Crossfade: the next clip is decoded by a second chain on the same clock, into the other set of
+// textures, until the pipeline takes it over
+static transition                  next_clip;
+static char                      * next_source         = NULL;
+static int                         transition_state    = TRANSITION_NONE,
+                                   transition_locked   = 0,   // the application holds a frame of it
+                                   transition_reported = 0,
+                                   next_open           = 0;   // closed by whoever ends the transition
+static int64_t                     handover_start      = 0,
+                                   clip_offset         = 0;   // media time of the clip playing is shifted by
+static rpi_mp_overlap_stats        transition_result;
+static COMPONENT_T               * next_decode         = NULL,
+                                 * next_scheduler      = NULL,
+                                 * next_egl_render     = NULL;
+static TUNNEL_T                    next_tunnel[4];
+static OMX_BUFFERHEADERTYPE      * next_egl_buffers[BUFFER_COUNT];
+static rpi_mp_buffer_stats         next_buffer_stats;
+static pthread_t                   next_feeder;
+static int                         next_feeding        = 0,   // the feeder thread runs
+                                   next_stop           = 0,
+                                   next_output         = 0,   // its egl_render has the textures
+                                   next_set            = 1,
+                                   faded_set           = 1,   // the next clip renders into, for the whole transition
+                                   video_clock_port    = CLOCK_VIDEO_PORT,
+                                   next_clock_port     = CLOCK_NEXT_VIDEO_PORT;
+static uint64_t                    next_filled         = 0,
+                                   next_locked         = 0,
+                                   next_shown          = 0;
 
 // Thread variables
 static pthread_mutex_t flags_mutex        = PTHREAD_MUTEX_INITIALIZER;
@@ -110,30 +298,95 @@ static pthread_mutex_t audio_mutex        = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t  pause_condition    = PTHREAD_COND_INITIALIZER;
 static pthread_mutex_t buffer_filled_mut  = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t  buffer_filled_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t index_mutex        = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t yuv_mutex          = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  yuv_cond           = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t audio_track_mutex  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t subtitle_mutex     = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t transition_mutex   = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  transition_cond    = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t drops_mutex        = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t chains_mutex       = PTHREAD_MUTEX_INITIALIZER;
 
 
 /**
- *  Convert PTS (from libFFmpeg) to OMX_TICKS struct.
+ *  Convert microseconds to OMX_TICKS struct.
  */
-static inline OMX_TICKS pts__omx_timestamp (double pts)
+static inline OMX_TICKS pts__omx_timestamp (int64_t pts)
 {
 	OMX_TICKS ticks;
-	ticks.nLowPart 	= (int64_t) pts;
-	ticks.nHighPart = (int64_t) pts >> 32;
+	uint32_t  low, high;
+	timeline_ticks (pts, &low, &high);
+	ticks.nLowPart  = low;
+	ticks.nHighPart = high;
 	return ticks;
 }
 
 /**
- *	Converts AVPacket timestamp to an OMX_TICKS timestamp
+ *  Convert OMX_TICKS back to microseconds.
+ */
+static inline int64_t omx_timestamp__pts (OMX_TICKS ticks)
+{
+	return timeline_ticks_us (ticks.nLowPart, ticks.nHighPart);
+}
+
+/**
+ *	Converts AVPacket timestamp to an OMX_TICKS timestamp. The timeline rescaled it to microseconds
+ *	when it was demuxed; a packet without a pts needs OMX_BUFFERFLAG_TIME_UNKNOWN.
  */
 static inline OMX_TICKS omx_timestamp (AVPacket p)
 {
-	uint64_t pts = p.pts != AV_NOPTS_VALUE ? p.pts : p.dts != AV_NOPTS_VALUE ? p.dts : 0;
-	int      num = fmt_ctx->streams[p.stream_index]->time_base.num;
-	int      den = fmt_ctx->streams[p.stream_index]->time_base.den;
+	return pts__omx_timestamp (p.pts != AV_NOPTS_VALUE ? p.pts : 0);
+}
+
+/**
+ *  Current media time of the clock component in microseconds.
+ */
+static int64_t media_time ()
+{
+	OMX_TIME_CONFIG_TIMESTAMPTYPE timestamp;
+	OMX_ERRORTYPE omx_error;
+	memset (&timestamp, 0x0, sizeof (timestamp));
+	timestamp.nVersion.nVersion = OMX_VERSION;
+	timestamp.nSize 			= sizeof (OMX_TIME_CONFIG_TIMESTAMPTYPE);
+	timestamp.nPortIndex		= CLOCK_AUDIO_PORT;
+
+	if ((omx_error = OMX_GetParameter (ILC_GET_HANDLE (video_clock), OMX_IndexConfigTimeCurrentMediaTime, &timestamp)) != OMX_ErrorNone)
+	{
+		fprintf (stderr, "Could not get timestamp config from clock component. Error 0x%08x\n", omx_error);
+		return 0;
+	}
+	return omx_timestamp__pts (timestamp.nTimestamp);
+}
+
+/**
+ *  ilclient_get_input_buffer (blocking) that keeps track of how long we waited for the buffer.
+ */
+static OMX_BUFFERHEADERTYPE* get_input_buffer (COMPONENT_T* component, int port, rpi_mp_buffer_stats* stats)
+{
+	unsigned long         start  = time_us ();
+	OMX_BUFFERHEADERTYPE* buffer = ilclient_get_input_buffer (component, port, 1);
+	unsigned long         wait   = time_us () - start;
+
+	// only this thread writes them, the metrics server reads them
+	METRIC_BUMP (stats->buffers, 1);
+	METRIC_BUMP (stats->wait_us, wait);
+	if (wait > stats->max_wait_us)
+		METRIC_SET (stats->max_wait_us, wait);
+	return buffer;
+}
 
-	double timestamp = (double) pts * num / den * AV_TIME_BASE;
-	return pts__omx_timestamp (timestamp);
+/**
+ *  Samples the audio renderer has been given but not played yet, -1 if it does not tell.
+ */
+static int audio_render_latency ()
+{
+	OMX_PARAM_U32TYPE latency;
+	OMX_INIT_STRUCTURE (latency);
+	latency.nPortIndex = AUDIO_RENDER_INPUT_PORT;
+	if (!audio_render || OMX_GetConfig (ILC_GET_HANDLE (audio_render), OMX_IndexConfigAudioRenderingLatency, &latency) != OMX_ErrorNone)
+		return -1;
+	return latency.nU32;
 }
 
 /**
@@ -171,20 +424,166 @@ static void vsync_offset( int offs ) // not used at the moment
 /**
  *  Fill the EGL render buffer with decoded raw image data.
  *  Should only be called as callback for the fillbuffer event when video decoding
- *  of a frame is finished.
+ *  of a frame is finished. During a crossfade both egl_render components call it,
+ *  each refills its own set of textures.
  */
 static void fill_egl_texture_buffer (void* data, COMPONENT_T* c)
 {
-	if (~flags & STOPPED)
+	COMPONENT_T*          render = NULL;
+	OMX_BUFFERHEADERTYPE* buffer = NULL;
+	int*                  texture;
+
+	// not held across OMX calls, the chains are swapped under it
+	pthread_mutex_lock (&chains_mutex);
+	if (c == next_egl_render && next_output)
+	{
+		render  = next_egl_render;
+		texture = current_texture[next_set];
+		buffer  = next_egl_buffers[*texture];
+		next_filled ++;
+	}
+	else if (c == egl_render && ~flags & (STOPPED | VIDEO_STOPPED))
+	{
+		render    = egl_render;
+		texture   = current_texture[playing_set];
+		buffer    = omx_egl_buffers[*texture];
+		shown_set = playing_set;
+	}
+	if (render)
+		*texture = (*texture + 1) % BUFFER_COUNT;
+	pthread_mutex_unlock (&chains_mutex);
+
+	if (render && OMX_FillThisBuffer (ILC_GET_HANDLE (render), buffer) != OMX_ErrorNone)
+		fprintf (stderr, "OMX_FillThisBuffer failed for egl buffer in callback\n");
+}
+
+/**
+ *	Called when the resizer filled a YUV buffer; ilclient already queued it in its output list.
+ */
+static void yuv_buffer_filled (void* data, COMPONENT_T* c)
+{
+	pthread_mutex_lock (&yuv_mutex);
+	pthread_cond_broadcast (&yuv_cond);
+	pthread_mutex_unlock (&yuv_mutex);
+}
+
+/**
+ *	Configures the resizer output once the decoder knows the frame size: same size, YUV in
+ *	BUFFER_COUNT buffers, which all go to the resizer to be filled.
+ *  @return int 0 on success, non-zero on failure
+ */
+static int open_yuv_output ()
+{
+	OMX_PARAM_PORTDEFINITIONTYPE port;
+	OMX_BUFFERHEADERTYPE*        buffer;
+
+	ilclient_change_component_state (resize, OMX_StateIdle);
+	OMX_INIT_STRUCTURE (port);
+	port.nPortIndex = RESIZE_OUTPUT_PORT;
+	OMX_GetParameter (ILC_GET_HANDLE (resize), OMX_IndexParamPortDefinition, &port);
+	port.format.image.nFrameWidth        = video_codec_ctx->width;
+	port.format.image.nFrameHeight       = video_codec_ctx->height;
+	port.format.image.nStride            = 0;
+	port.format.image.nSliceHeight       = 0;
+	port.format.image.eCompressionFormat = OMX_IMAGE_CodingUnused;
+	port.format.image.eColorFormat       = yuv_format;
+	if (port.nBufferCountMin < BUFFER_COUNT)
+		port.nBufferCountActual = BUFFER_COUNT;
+	if (OMX_SetParameter (ILC_GET_HANDLE (resize), OMX_IndexParamPortDefinition, &port) != OMX_ErrorNone)
+	{
+		fprintf (stderr, "Error setting YUV output format on resize\n");
+		return 1;
+	}
+	// the resizer picks the alignment
+	OMX_GetParameter (ILC_GET_HANDLE (resize), OMX_IndexParamPortDefinition, &port);
+	yuv_stride       = port.format.image.nStride;
+	yuv_slice_height = port.format.image.nSliceHeight ? port.format.image.nSliceHeight : port.format.image.nFrameHeight;
+
+	if (ilclient_enable_port_buffers (resize, RESIZE_OUTPUT_PORT, NULL, NULL, NULL) != 0)
+	{
+		fprintf (stderr, "Could not enable output buffers on resize\n");
+		return 1;
+	}
+	ilclient_change_component_state (resize, OMX_StateExecuting);
+	// empty buffers start out in the output list as well
+	while ((buffer = ilclient_get_output_buffer (resize, RESIZE_OUTPUT_PORT, 0)) != NULL)
+		if (OMX_FillThisBuffer (ILC_GET_HANDLE (resize), buffer) != OMX_ErrorNone)
+		{
+			fprintf (stderr, "OMX_FillThisBuffer failed for YUV buffer\n");
+			return 1;
+		}
+	pthread_mutex_lock (&yuv_mutex);
+	yuv_ready = 1;
+	pthread_mutex_unlock (&yuv_mutex);
+	printf ("YUV output %dx%d, stride %d, slice height %d\n", video_codec_ctx->width, video_codec_ctx->height, yuv_stride, yuv_slice_height);
+	return 0;
+}
+
+/**
+ *	Takes back a frame the application still holds and returns all buffers of the resizer,
+ *	so its output port can be disabled.
+ */
+static void close_yuv_output ()
+{
+	pthread_mutex_lock (&yuv_mutex);
+	if (yuv_ready && yuv_locked)
+		OMX_FillThisBuffer (ILC_GET_HANDLE (resize), yuv_locked);
+	yuv_locked = NULL;
+	yuv_ready  = 0;
+	pthread_cond_broadcast (&yuv_cond);
+	pthread_mutex_unlock (&yuv_mutex);
+	if (OMX_SendCommand (ILC_GET_HANDLE (resize), OMX_CommandFlush, RESIZE_OUTPUT_PORT, NULL) == OMX_ErrorNone)
+		ilclient_wait_for_event (resize, OMX_EventCmdComplete, OMX_CommandFlush, 0, RESIZE_OUTPUT_PORT, 0, ILCLIENT_PORT_FLUSH, 1000);
+	ilclient_disable_port_buffers (resize, RESIZE_OUTPUT_PORT, NULL, NULL, NULL);
+}
+
+/**
+ *	Hands a set of textures to egl_render once the decoder in front of it knows the frame size,
+ *	and asks for the first frame.
+ *  @return int 0 on success, non-zero on failure
+ */
+static int use_egl_images (COMPONENT_T* render, OMX_BUFFERHEADERTYPE* buffers[], void* images[], int* texture)
+{
+	OMX_PARAM_PORTDEFINITIONTYPE portFormat;
+	int                          first;
+
+	ilclient_change_component_state (render, OMX_StateIdle);
+	// Enable the output port and tell egl_render to use the texture as a buffer
+	//ilclient_enable_port(egl_render, 221); THIS BLOCKS SO CANT BE USED
+	if (OMX_SendCommand (ILC_GET_HANDLE (render), OMX_CommandPortEnable, EGL_RENDER_OUT_PORT, NULL) != OMX_ErrorNone)
+	{
+		fprintf (stderr, "OMX_CommandPortEnable failed.\n");
+		return 1;
+	}
+	for ( int i = 0; i < BUFFER_COUNT; i++)
 	{
-		// ts(); //start the timer
-		int err = OMX_FillThisBuffer (ILC_GET_HANDLE (egl_render), omx_egl_buffers[*current_texture]);
-		if ( err != OMX_ErrorNone )
-			fprintf (stderr, "OMX_FillThisBuffer failed for egl buffer in callback\n");
-		// tp(); // print the time spent on filling the buffer
+		if (OMX_UseEGLImage (ILC_GET_HANDLE (render), &buffers[i], EGL_RENDER_OUT_PORT, NULL, images[i]) != OMX_ErrorNone)
+		{
+			fprintf (stderr, "OMX_UseEGLImage failed.\n");
+			return 1;
+		}
+	}
+
+	OMX_INIT_STRUCTURE(portFormat);
+	portFormat.nPortIndex = EGL_RENDER_OUT_PORT;
+
+	OMX_GetParameter(ILC_GET_HANDLE (render), OMX_IndexParamPortDefinition, &portFormat);
+
+	printf("nBufferCountActual: %d\n", portFormat.nBufferCountActual );
+	printf("nBufferCountMin: %d\n", portFormat.nBufferCountMin );
+	printf("nBufferAlignment: %d\n", portFormat.nBufferAlignment );
 
-		*current_texture = (*current_texture + 1) % BUFFER_COUNT;
+	// Set egl_render to executing
+	ilclient_change_component_state (render, OMX_StateExecuting);
+	// Request egl_render to write data to the texture buffer; the fill callback may run right away
+	first    = *texture;
+	*texture = (first + 1) % BUFFER_COUNT;
+	if (OMX_FillThisBuffer (ILC_GET_HANDLE (render), buffers[first]) != OMX_ErrorNone)
+	{
+		fprintf (stderr, "OMX_FillThisBuffer failed for egl buffer.\n");
+		return 1;
 	}
+	return 0;
 }
 
 /**
@@ -195,15 +594,18 @@ static inline int decode_video_packet ()
 {
 	int packet_size = 0;
 	OMX_TICKS ticks = omx_timestamp (video_packet);
+	uint8_t *first_data = video_packet.data;
 
 	while (video_packet.size > 0)
 	{
 		// feed data to video decoder
-		if ((omx_video_buffer = ilclient_get_input_buffer (video_decode, VIDEO_DECODE_INPUT_PORT, 1)) == NULL)
+		if ((omx_video_buffer = get_input_buffer (video_decode, VIDEO_DECODE_INPUT_PORT, &video_buffer_stats)) == NULL)
 		{
 			fprintf (stderr, "Error getting buffer to video decoder\n");
 			return 1;
 		}
+		if (video_packet.size > omx_video_buffer->nAllocLen && video_packet.data == first_data)
+			METRIC_BUMP (video_buffer_stats.split_packets, 1);
 		packet_size                  = video_packet.size > omx_video_buffer->nAllocLen ? omx_video_buffer->nAllocLen : video_packet.size;
 		omx_video_buffer->nFilledLen = packet_size;
 		omx_video_buffer->nOffset    = 0;
@@ -219,7 +621,7 @@ static inline int decode_video_packet ()
 			omx_video_buffer->nFlags = OMX_BUFFERFLAG_STARTTIME;
 			UNSET_FLAG (FIRST_VIDEO)
 		}
-		else if (omx_video_buffer->nTimeStamp.nLowPart == 0 && omx_video_buffer->nTimeStamp.nHighPart == 0)
+		else if (video_packet.pts == AV_NOPTS_VALUE)
 			omx_video_buffer->nFlags |= OMX_BUFFERFLAG_TIME_UNKNOWN;
 
 		// end of frame
@@ -248,42 +650,13 @@ static inline int decode_video_packet ()
 			// if we are rendering to texture we need to some setup to the egl component
 			if (flags & RENDER_2_TEXTURE)
 			{
-				ilclient_change_component_state (egl_render, OMX_StateIdle);
-				// Enable the output port and tell egl_render to use the texture as a buffer
-				//ilclient_enable_port(egl_render, 221); THIS BLOCKS SO CANT BE USED
-				if (OMX_SendCommand (ILC_GET_HANDLE (egl_render), OMX_CommandPortEnable, EGL_RENDER_OUT_PORT, NULL) != OMX_ErrorNone)
-				{
-					fprintf (stderr, "OMX_CommandPortEnable failed.\n");
+				if (use_egl_images (egl_render, omx_egl_buffers, egl_images[playing_set], current_texture[playing_set]) != 0)
 					return 1;
-				}
-				for ( int i = 0; i < BUFFER_COUNT; i++)
-				{
-					if (OMX_UseEGLImage (ILC_GET_HANDLE (egl_render), &omx_egl_buffers[i], EGL_RENDER_OUT_PORT, NULL, egl_images[i]) != OMX_ErrorNone)
-					{
-						fprintf (stderr, "OMX_UseEGLImage failed.\n");
-						return 1;
-					}
-				}
-
-				OMX_PARAM_PORTDEFINITIONTYPE portFormat;
-				OMX_INIT_STRUCTURE(portFormat);
-				portFormat.nPortIndex = EGL_RENDER_OUT_PORT;
-
-				OMX_GetParameter(ILC_GET_HANDLE (egl_render), OMX_IndexParamPortDefinition, &portFormat);
-
-				printf("nBufferCountActual: %d\n", portFormat.nBufferCountActual );
-				printf("nBufferCountMin: %d\n", portFormat.nBufferCountMin );
-				printf("nBufferAlignment: %d\n", portFormat.nBufferAlignment );
-
-				// Set egl_render to executing
-				ilclient_change_component_state (egl_render, OMX_StateExecuting);
-				// Request egl_render to write data to the texture buffer
-				if (OMX_FillThisBuffer (ILC_GET_HANDLE (egl_render), omx_egl_buffers[*current_texture]) != OMX_ErrorNone)
-				{
-					fprintf (stderr, "OMX_FillThisBuffer failed for egl buffer.\n");
+			}
+			else if (flags & RENDER_2_YUV)
+			{
+				if (open_yuv_output () != 0)
 					return 1;
-				}
-				*current_texture = (*current_texture + 1) % BUFFER_COUNT;
 			}
 			// if we are not rendering to texture we just need to change the video renderer to excecuting
 			else
@@ -299,6 +672,89 @@ static inline int decode_video_packet ()
 	return 0;
 }
 
+/**
+ *	Counts a dropped video frame, before decoding or after (software video drops there too, from
+ *	the decoding and the render thread). Too many drops within RENDITION_DROP_WINDOW ask the reading
+ *	loop to switch to the next lower rendition.
+ */
+static void sustained_drops ()
+{
+	int64_t now = media_clock_now ();
+
+	if (current_rendition + 1 >= n_renditions || renditions_fixed || transition_state != TRANSITION_NONE || flags & SWITCH_RENDITION)
+		return;
+	pthread_mutex_lock (&drops_mutex);
+	if (now - window_start > RENDITION_DROP_WINDOW)
+	{
+		window_start = now;
+		window_drops = 0;
+	}
+	if (++ window_drops >= RENDITION_DROP_LIMIT)
+	{
+		printf ("%d video frames dropped within %d s, switching to %s\n", window_drops,
+		        RENDITION_DROP_WINDOW / AV_TIME_BASE, renditions[current_rendition + 1]);
+		switch_position = now;
+		SET_FLAG (SWITCH_RENDITION)
+	}
+	pthread_mutex_unlock (&drops_mutex);
+}
+
+/**
+ *	Decides whether the current video packet is too late to be worth decoding.
+ *	Late non-reference frames are dropped since nothing depends on them; if a packet is later
+ *	than VIDEO_SKIP_US everything up to the next frame decoding restarts cleanly at is dropped:
+ *	an IDR frame, an intra frame or a recovery point. Streams with neither within
+ *	VIDEO_SKIP_LIMIT_US (intra refresh without SEI) go on at the next reference frame and
+ *	show artifacts until they have refreshed, rather than freezing for good.
+ *  @return int non-zero if the packet should be dropped
+ */
+static int drop_video_packet ()
+{
+	enum h264_frame_class frame;
+	int64_t pts, lateness;
+
+	if (!drop_late_video || flags & FIRST_VIDEO)
+		return 0;
+	pts = video_packet.pts != AV_NOPTS_VALUE ? video_packet.pts : video_packet.dts;
+	if (pts == AV_NOPTS_VALUE)
+		return 0;
+	frame    = h264_classify (video_packet.data, video_packet.size, nal_length_size);
+	lateness = media_clock_now () - pts;
+
+	if (skip_to_restart)
+	{
+		if (frame != H264_FRAME_IDR && frame != H264_FRAME_RECOVERY &&
+		    (frame != H264_FRAME_REFERENCE || pts - skip_start < VIDEO_SKIP_LIMIT_US))
+		{
+			METRIC_BUMP (drop_stats.skipped, 1);
+			sustained_drops ();
+			return 1;
+		}
+		skip_to_restart = 0;
+	}
+	if (lateness <= VIDEO_LATE_US)
+		return 0;
+	METRIC_BUMP (drop_stats.late, 1);
+	if (lateness > drop_stats.max_lateness_us)
+		METRIC_SET (drop_stats.max_lateness_us, lateness);
+	if (lateness > VIDEO_SKIP_US && frame != H264_FRAME_IDR && frame != H264_FRAME_RECOVERY)
+	{
+		skip_to_restart = 1;
+		skip_start      = pts;
+		METRIC_BUMP (drop_stats.skips, 1);
+		METRIC_BUMP (drop_stats.skipped, 1);
+		sustained_drops ();
+		return 1;
+	}
+	if (frame == H264_FRAME_NON_REFERENCE)
+	{
+		METRIC_BUMP (drop_stats.non_reference, 1);
+		sustained_drops ();
+		return 1;
+	}
+	return 0;
+}
+
 /**
  *  Thread for decoding video packets.
  *  Polls the video packet buffer for new packets to decode and
@@ -308,7 +764,10 @@ static void video_decoding_thread ()
 {
 	uint8_t *d;
 	int ret;
-	while (~flags & STOPPED && (~flags & DONE_READING || video_packet_fifo.n_packets))
+	uint64_t late;
+	thread_policy_enter (THREAD_VIDEO);
+	// at the end of a crossfade the rest of the clip is not seen, nor after a rendition switch
+	while (~flags & (STOPPED | VIDEO_STOPPED | SWITCH_CLIP) && (~flags & DONE_READING || video_packet_fifo.n_packets))
 	{
 		// check pause
 		if (flags & PAUSED)
@@ -320,14 +779,32 @@ static void video_decoding_thread ()
 		if ((ret = pop_packet (&video_packet_fifo, &video_packet)) != 0)
 		{
 			// pthread_mutex_unlock (&video_mutex);
-			usleep (FIFO_SLEEPY_TIME);
+			thread_sleep (THREAD_VIDEO, FIFO_SLEEPY_TIME);
+			continue;
+		}
+		if (drop_video_packet ())
+		{
+			av_packet_unref (&video_packet);
 			continue;
 		}
 		// decode
-		d = video_packet.data;
-		ret = decode_video_packet ();
-		video_packet.data = d;
+		if (flags & SOFTWARE_VIDEO)
+		{
+			late = METRIC_GET (software_video.late);
+			ret  = soft_video_decode (&software_video, &video_packet);
+			// frames decoded too late to be queued
+			for (late = METRIC_GET (software_video.late) - late; late > 0; late --)
+				sustained_drops ();
+		}
+		else
+		{
+			d = video_packet.data;
+			ret = decode_video_packet ();
+			video_packet.data = d;
+		}
 		av_packet_unref (&video_packet);
+		if (ret == 0)
+			METRIC_ADD (video_packets_decoded, 1);
 		// pthread_mutex_unlock (&video_mutex);
 		if (ret != 0)
 		{
@@ -335,126 +812,172 @@ static void video_decoding_thread ()
 			break;
 		}
 	}
+	if (flags & SOFTWARE_VIDEO)
+	{
+		// the decoding threads still hold the last frames
+		if (~flags & (STOPPED | VIDEO_STOPPED))
+		{
+			av_init_packet (&video_packet);
+			video_packet.data = NULL;
+			video_packet.size = 0;
+			soft_video_decode (&software_video, &video_packet);
+		}
+		soft_video_finish (&software_video);
+	}
 	printf ("stopping video decoding thread\n");
 }
 
 /**
-	Decode audio packet (using FFMPEG) and send it to hardware for rendering
- *	return int 0 on success, non-zero on failure
+ *  Thread presenting software decoded frames.
+ *  Waits for the media clock to reach each frame and copies it into a video_render input buffer;
+ *  frames that are late by then are dropped, and so are frames a seek flushed while we waited.
  */
-static inline int decode_audio_packet ()
+static void software_render_thread ()
 {
-	int got_frame = 0, ret = 0, data_size = 0;
-	uint8_t *audio_data, *audio_data_p = NULL;
-	OMX_TICKS ticks = omx_timestamp (audio_packet);
+	OMX_BUFFERHEADERTYPE* buffer;
+	AVFrame*              frame;
+	int64_t               pts, wait;
+	int                   ret;
 
-	// some audio decoders only decode part of the data
-	while (audio_packet.size > 0)
+	thread_policy_enter (THREAD_VIDEO_RENDER);
+	while ((frame = soft_video_acquire (&software_video, &pts)) != NULL)
 	{
-		if ((ret = avcodec_decode_audio4 (audio_codec_ctx, av_frame, &got_frame, &audio_packet)) < 0)
+		if (flags & PAUSED)
 		{
-			fprintf (stderr, "Error decoding audio packet \n");
-			return ret; // we return that it's alright to continue
+			WAIT_WHILE_PAUSED
 		}
-		audio_packet.size -= ret;
-		audio_packet.data += ret;
-
-		if (got_frame)
+		if (pts != AV_NOPTS_VALUE)
 		{
-			if ((data_size = av_samples_get_buffer_size (NULL,
-                                                         audio_codec_ctx->channels,
-                                                         av_frame->nb_samples,
-                                                         audio_codec_ctx->sample_fmt,
-                                                         1)) <= 0)
+			while (~flags & (STOPPED | VIDEO_STOPPED) && !soft_video_stale (&software_video) && (wait = pts - media_clock_now ()) > 0)
+				thread_sleep (THREAD_VIDEO_RENDER, wait > FIFO_SLEEPY_TIME ? FIFO_SLEEPY_TIME : wait);
+			if (soft_video_stale (&software_video))
 			{
-				fprintf (stderr, "Error getting samples buffer size\n");
-				break;
+				soft_video_release (&software_video);
+				continue;
 			}
-			int bps = av_get_bytes_per_sample (audio_codec_ctx->sample_fmt);
-
-			// interleave data if it is planar
-			if (av_sample_fmt_is_planar (audio_codec_ctx->sample_fmt))
+			if (media_clock_now () - pts > VIDEO_LATE_US)
 			{
-				int i, ch;
-				audio_data = (uint8_t *) malloc (data_size);
-				audio_data_p = audio_data;
-				for (i = 0; i < av_frame->nb_samples; i ++)
-					for (ch = 0; ch < audio_codec_ctx->channels; ch ++, audio_data_p += bps)
-						memcpy (audio_data_p, av_frame->data[ch] + i * bps, bps);
-				audio_data_p = audio_data;
+				METRIC_BUMP (drop_stats.late, 1);
+				soft_video_release (&software_video);
+				sustained_drops ();
+				continue;
 			}
-			else
-				audio_data = av_frame->data[0];
+		}
+		if ((buffer = ilclient_get_input_buffer (video_render, VIDEO_RENDER_INPUT_PORT, 1)) == NULL)
+		{
+			fprintf (stderr, "Error getting buffer to video render\n");
+			break;
+		}
+		ret = soft_video_convert (&software_video, frame, buffer->pBuffer, software_stride, software_slice_height);
+		soft_video_release (&software_video);
+		buffer->nFilledLen = ret == 0 ? software_stride * software_slice_height * 3 / 2 : 0;
+		buffer->nOffset    = 0;
+		buffer->nFlags     = OMX_BUFFERFLAG_ENDOFFRAME;
+		buffer->nTimeStamp = pts__omx_timestamp (pts != AV_NOPTS_VALUE ? pts : 0);
+		if (OMX_EmptyThisBuffer (ILC_GET_HANDLE (video_render), buffer) != OMX_ErrorNone)
+		{
+			fprintf (stderr, "Error emptying video render buffer\n");
+			break;
+		}
+	}
+	printf ("stopping software render thread\n");
+}
 
-			// if 32-bit we need to resample to 16-bit
-			// (we are assuming it's floating point in this case)
-			if (bps > 2)
-			{
-				uint8_t *tmp = NULL;
-				flt_to_s16 (audio_data, &tmp, data_size);
+/**
+ *	Hands every frame decoded to the analysis tap.
+ */
+static void tap_audio_frame (void* opaque, const int16_t* samples, int frames, int64_t pts)
+{
+	audio_tap_write (&audio_analysis, samples, frames, pts);
+}
 
-				if (audio_data_p)
-					free (audio_data_p);
+/**
+	Decode audio packet (using FFMPEG) and queue the samples in the PCM ring for the submit thread
+ *	return int 0 on success, non-zero on failure
+ */
+static inline int decode_audio_packet ()
+{
+	int ret = audio_decode_packet (&pcm_decoder, &audio_packet, audio_ring);
 
-				data_size /= 2;
-				audio_data = audio_data_p = tmp;
-			}
+	// we return that it's alright to continue
+	if (ret < 0)
+		fprintf (stderr, "Error decoding audio packet \n");
+	return ret;
+}
 
-			// send frame data to audio render
-			while (data_size > 0)
-			{
-				if ((omx_audio_buffer = ilclient_get_input_buffer (audio_render, AUDIO_RENDER_INPUT_PORT, 1)) == NULL)
-				{
-					fprintf ( stderr, "Error getting buffer to audio decoder\n" );
-					return 1; // errors with hardware, stop trying to render audio
-				}
-				omx_audio_buffer->nFilledLen = data_size > omx_audio_buffer->nAllocLen ? omx_audio_buffer->nAllocLen : data_size;
-				omx_audio_buffer->nOffset    = 0;
-				omx_audio_buffer->nFlags	 = 0;
-				// copy data
-				memcpy (omx_audio_buffer->pBuffer, audio_data, omx_audio_buffer->nFilledLen);
-				audio_data += omx_audio_buffer->nFilledLen;
-				data_size  -= omx_audio_buffer->nFilledLen;
-
-				// first audio packet of stream
-				if (flags & FIRST_AUDIO)
-				{
-					omx_audio_buffer->nFlags = OMX_BUFFERFLAG_STARTTIME;
-					UNSET_FLAG (FIRST_AUDIO)
-				}
-				else
-				{
-					omx_audio_buffer->nTimeStamp = ticks;
-					if (omx_audio_buffer->nTimeStamp.nLowPart == 0 && omx_audio_buffer->nTimeStamp.nHighPart == 0)
-						omx_audio_buffer->nFlags |= OMX_BUFFERFLAG_TIME_UNKNOWN;
-				}
-				// last packet of frame
-				if (data_size == 0 && audio_packet.size == 0)
-					omx_audio_buffer->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
-				// empty the buffer for render
-				if (OMX_EmptyThisBuffer (ILC_GET_HANDLE (audio_render), omx_audio_buffer) != OMX_ErrorNone)
-				{
-					fprintf (stderr, "Error emptying audio render buffer\n");
-					return 1; // errors with hardware, stop trying to render audio
-				}
-			}
+/**
+ *  Audio submit thread.
+ *  Takes PCM from the ring and hands it to the audio renderer, always filling whole buffers.
+ */
+static void audio_submit_thread ()
+{
+	OMX_BUFFERHEADERTYPE *buffer = NULL;
+	int     target = (int64_t) audio_latency_target * audio_codec_ctx->sample_rate / 1000;
+	int64_t pts, ready;
+
+	thread_policy_enter (THREAD_AUDIO_SUBMIT);
+	// the ring returns less than a full chunk only once decoding is done
+	while (audio_submit_wait (&pcm_submit, &ready) > 0)
+	{
+		if (ready)
+			thread_wakeup (THREAD_AUDIO_SUBMIT, ready);
+		// the renderer takes buffers as fast as they come and queues them internally, hold back
+		// while it has more than the target to play
+		if (flags & LOW_LATENCY)
+			while (~flags & STOPPED && audio_render_latency () > target)
+				thread_sleep (THREAD_AUDIO_SUBMIT, LOW_LATENCY_POLL_US);
+		if (!buffer && (buffer = get_input_buffer (audio_render, AUDIO_RENDER_INPUT_PORT, &audio_buffer_stats)) == NULL)
+		{
+			fprintf (stderr, "Error getting buffer to audio render\n");
+			break;
+		}
+		// a seek flushed what was read, keep the buffer for the audio after it
+		if ((buffer->nFilledLen = audio_submit_take (&pcm_submit, buffer->pBuffer, &pts)) == 0)
+			continue;
+		buffer->nOffset    = 0;
+		// the audio playing fades out as the next clip's fades in, to the end of what is left of it
+		if (transition_state == TRANSITION_FADING)
+		{
+			pthread_mutex_lock (&transition_mutex);
+			if (transition_state == TRANSITION_FADING)
+				transition_mix (&next_clip, (int16_t*) buffer->pBuffer, buffer->nFilledLen / (audio_codec_ctx->channels * 2), pts);
+			pthread_mutex_unlock (&transition_mutex);
+		}
+		buffer->nFlags     = OMX_BUFFERFLAG_ENDOFFRAME;
+
+		if (pts == AV_NOPTS_VALUE)
+			buffer->nFlags |= OMX_BUFFERFLAG_TIME_UNKNOWN;
+		else
+			buffer->nTimeStamp = pts__omx_timestamp (pts);
+		// first audio buffer of stream
+		if (flags & FIRST_AUDIO)
+		{
+			buffer->nFlags = OMX_BUFFERFLAG_STARTTIME | OMX_BUFFERFLAG_ENDOFFRAME;
+			UNSET_FLAG (FIRST_AUDIO)
+			first_audio_submitted = monotonic_us ();
+		}
+
+		if (OMX_EmptyThisBuffer (ILC_GET_HANDLE (audio_render), buffer) != OMX_ErrorNone)
+		{
+			fprintf (stderr, "Error emptying audio render buffer\n");
+			break;
 		}
+		buffer = NULL;
 	}
-	if (audio_data_p)
-		free (audio_data_p);
-	audio_packet.size = 0;
-	audio_packet.data = NULL;
-	return 0;
+	// unblock the decoding stage in case we stopped on an error
+	pcm_ring_abort (audio_ring);
+	printf ("stopping audio submit thread\n");
 }
 
 
 static int hardwaredecode_audio_packet ()
 {
-	OMX_TICKS ticks;
+	OMX_TICKS ticks = omx_timestamp (audio_packet);
+	int first_buffer = 1;
 	while (audio_packet.size > 0)
 	{
 		// get buffer handler to audio decoder
-		if ((omx_audio_buffer = ilclient_get_input_buffer (audio_decode, 120, 1)) == NULL)
+		if ((omx_audio_buffer = get_input_buffer (audio_decode, 120, &audio_buffer_stats)) == NULL)
 		{
 			fprintf (stderr, "Error getting buffer to audio decoder\n");
 			return 1;
@@ -467,16 +990,17 @@ static int hardwaredecode_audio_packet ()
 		audio_packet.data += omx_audio_buffer->nFilledLen;
 
 		omx_audio_buffer->nOffset = 0;
-		omx_audio_buffer->nFlags  = OMX_BUFFERFLAG_TIME_UNKNOWN;
+		// the rest of a packet split over buffers has no timestamp of its own
+		omx_audio_buffer->nFlags  = first_buffer && audio_packet.pts != AV_NOPTS_VALUE ? 0 : OMX_BUFFERFLAG_TIME_UNKNOWN;
+		first_buffer = 0;
 
 		// first audio packet
 		if (flags & FIRST_AUDIO)
 		{
 			omx_audio_buffer->nFlags = OMX_BUFFERFLAG_STARTTIME;
 			UNSET_FLAG (FIRST_AUDIO)
+			first_audio_submitted = monotonic_us ();
 		}
-		ticks.nLowPart  = audio_packet.pts;
-		ticks.nHighPart = audio_packet.pts >> 32;
 		omx_audio_buffer->nTimeStamp = ticks;
 		if (OMX_EmptyThisBuffer (ILC_GET_HANDLE (audio_decode), omx_audio_buffer) != OMX_ErrorNone)
 		{
@@ -487,6 +1011,84 @@ static int hardwaredecode_audio_packet ()
 	return 0;
 }
 
+/**
+ *	Send a compressed audio packet to the audio renderer as is.
+ *	The firmware wraps the frames in IEC 61937 bursts for the HDMI sink.
+ *	return int 0 on success, non-zero on failure
+ */
+static int passthrough_audio_packet ()
+{
+	OMX_TICKS ticks = omx_timestamp (audio_packet);
+	int first_buffer = 1;
+	while (audio_packet.size > 0)
+	{
+		if ((omx_audio_buffer = get_input_buffer (audio_render, AUDIO_RENDER_INPUT_PORT, &audio_buffer_stats)) == NULL)
+		{
+			fprintf (stderr, "Error getting buffer to audio render\n");
+			return 1;
+		}
+		if (audio_packet.size > omx_audio_buffer->nAllocLen && first_buffer)
+			METRIC_BUMP (audio_buffer_stats.split_packets, 1);
+		first_buffer = 0;
+		omx_audio_buffer->nFilledLen = audio_packet.size < omx_audio_buffer->nAllocLen ? audio_packet.size : omx_audio_buffer->nAllocLen;
+		omx_audio_buffer->nOffset    = 0;
+		omx_audio_buffer->nFlags     = audio_packet.pts == AV_NOPTS_VALUE ? OMX_BUFFERFLAG_TIME_UNKNOWN : 0;
+		omx_audio_buffer->nTimeStamp = ticks;
+		memcpy (omx_audio_buffer->pBuffer, audio_packet.data, omx_audio_buffer->nFilledLen);
+
+		audio_packet.size -= omx_audio_buffer->nFilledLen;
+		audio_packet.data += omx_audio_buffer->nFilledLen;
+
+		// the clock starts at the timestamp of the first buffer
+		if (flags & FIRST_AUDIO)
+		{
+			omx_audio_buffer->nFlags |= OMX_BUFFERFLAG_STARTTIME;
+			UNSET_FLAG (FIRST_AUDIO)
+			first_audio_submitted = monotonic_us ();
+		}
+		if (audio_packet.size == 0)
+			omx_audio_buffer->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
+		if (OMX_EmptyThisBuffer (ILC_GET_HANDLE (audio_render), omx_audio_buffer) != OMX_ErrorNone)
+		{
+			fprintf (stderr, "Error emptying audio render buffer\n");
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ *  Called by the audio thread between two packets after the audio track was switched: drops what
+ *  is left of the old track in the audio path and decodes with the new codec from now on.
+ *  Expects audio_track_mutex to be held.
+ */
+static void take_over_audio_track ()
+{
+	OMX_ERRORTYPE omx_error;
+
+	if (pcm_pipeline)
+		pcm_ring_flush (audio_ring);
+	if (audio_tap_on)
+		audio_tap_flush (&audio_analysis);
+	if (flags & HARDWARE_DECODE_AUDIO)
+	{
+		if ((omx_error = OMX_SendCommand (ILC_GET_HANDLE (audio_decode), OMX_CommandFlush, 120, NULL)) != OMX_ErrorNone)
+			fprintf (stderr, "Could not flush audio decoder input (0x%08x)\n", omx_error);
+		// decoder to renderer
+		ilclient_flush_tunnels (audio_tunnel, 1);
+	}
+	else if ((omx_error = OMX_SendCommand (ILC_GET_HANDLE (audio_render), OMX_CommandFlush, AUDIO_RENDER_INPUT_PORT, NULL)) != OMX_ErrorNone)
+		fprintf (stderr, "Could not flush audio render input (0x%08x)\n", omx_error);
+
+	// the decoding stage keeps a codec of its own
+	if (pcm_pipeline)
+		audio_decoder_switch (&pcm_decoder, audio_codec_ctx);
+	// unless the switches went back to it
+	if (replaced_audio_ctx != audio_codec_ctx)
+		avcodec_close (replaced_audio_ctx);
+	replaced_audio_ctx = NULL;
+}
+
 /**
  *  Audio decoding thread.
  *  Polls the audio packet buffer for new packets to decode
@@ -497,7 +1099,8 @@ static void audio_decoding_thread ()
 	// AVPacket tmp_pack;
 	uint8_t *d;
 	int ret;
-	while (~flags & STOPPED && ~flags & NO_AUDIO_STREAM)
+	thread_policy_enter (THREAD_AUDIO);
+	while (~flags & (STOPPED | SWITCH_CLIP) && ~flags & NO_AUDIO_STREAM)
 	{
 		// check if we are done demuxing
 		if (flags & DONE_READING && !audio_packet_fifo.n_packets)
@@ -507,53 +1110,199 @@ static void audio_decoding_thread ()
 		{
 			WAIT_WHILE_PAUSED
 		}
-		// pop a audio packet from the decoding queue
-		// pthread_mutex_lock (&audio_mutex);
-		if ((ret = pop_packet (&audio_packet_fifo, &audio_packet)) != 0)
+		// pop a audio packet from the decoding queue, taking a switched track over before the
+		// first packet of it; decoding may block on a full ring or renderer and is done unlocked
+		pthread_mutex_lock (&audio_track_mutex);
+		if (replaced_audio_ctx)
+			take_over_audio_track ();
+		ret = pop_packet (&audio_packet_fifo, &audio_packet);
+		pthread_mutex_unlock (&audio_track_mutex);
+		if (ret != 0)
 		{
-			// pthread_mutex_unlock (&audio_mutex);
-			usleep (FIFO_SLEEPY_TIME);
+			thread_sleep (THREAD_AUDIO, FIFO_SLEEPY_TIME);
 			continue;
 		}
 		// send data for decoding
 		d = audio_packet.data;
-		ret = flags & HARDWARE_DECODE_AUDIO ? hardwaredecode_audio_packet () : decode_audio_packet () ;
+		ret = flags & PASSTHROUGH_AUDIO     ? passthrough_audio_packet ()    :
+		      flags & HARDWARE_DECODE_AUDIO ? hardwaredecode_audio_packet () : decode_audio_packet () ;
 		audio_packet.data = d;
-		// pthread_mutex_unlock (&audio_mutex);
 
-		// deallocate packet
+		// deallocate packet, a packet the decoder rejected is dropped
 		if (ret == 0)
-			av_packet_unref (&audio_packet);
-		else if (ret > 0)
+			METRIC_ADD (audio_packets_decoded, 1);
+		av_packet_unref (&audio_packet);
+		if (ret > 0)
 		{
 			fprintf (stderr, "Error while decoding audio packet, ending thread\n");
 			break;
 		}
 	}
+	// let the submit thread drain the ring
+	if (pcm_pipeline)
+		pcm_ring_finish (audio_ring);
 	printf ("stopping audio decoding thread\n");
 }
 
 /**
- *  Takes the current demuxed packet and sorts it to the correct buffer polled
- *  by decoding threads.
+ *  Subtitle thread.
+ *  Rasterizes subtitle packets ahead of time and shows them when the clock reaches them.
  */
-static inline int process_packet ()
+static void subtitle_decoding_thread ()
+{
+	int ret;
+	int64_t pts;
+	thread_policy_enter (THREAD_SUBTITLE);
+	while (~flags & (STOPPED | SWITCH_CLIP))
+	{
+		if (flags & PAUSED)
+		{
+			WAIT_WHILE_PAUSED
+		}
+		update_subtitles (media_clock_now ());
+		// only decode as far ahead as we have room for rasterized events
+		pthread_mutex_lock (&subtitle_mutex);
+		if (subtitles_pending_full () || (ret = pop_packet (&subtitle_packet_fifo, &subtitle_packet)) != 0)
+		{
+			pthread_mutex_unlock (&subtitle_mutex);
+			thread_sleep (THREAD_SUBTITLE, FIFO_SLEEPY_TIME);
+			continue;
+		}
+		pts = subtitle_packet.pts != AV_NOPTS_VALUE ? subtitle_packet.pts : subtitle_packet.dts;
+		if (pts != AV_NOPTS_VALUE && decode_subtitle_packet (&subtitle_packet, pts, subtitle_packet.duration) != 0)
+			fprintf (stderr, "Error decoding subtitle packet\n");
+		av_packet_unref (&subtitle_packet);
+		pthread_mutex_unlock (&subtitle_mutex);
+	}
+	printf ("stopping subtitle thread\n");
+}
+
+/**
+ *  Sets the media time of the running clock, through the reference of the stream that drives it.
+ */
+static void set_clock_time (int64_t time)
+{
+	OMX_TIME_CONFIG_TIMESTAMPTYPE timestamp;
+	OMX_ERRORTYPE omx_error;
+	int audio = audio_stream_idx != AVERROR_STREAM_NOT_FOUND;
+
+	OMX_INIT_STRUCTURE (timestamp);
+	timestamp.nPortIndex = audio ? CLOCK_AUDIO_PORT : video_clock_port;
+	timestamp.nTimestamp = pts__omx_timestamp (time);
+	if ((omx_error = OMX_SetConfig (ILC_GET_HANDLE (video_clock), audio ? OMX_IndexConfigTimeCurrentAudioReference :
+	                                OMX_IndexConfigTimeCurrentVideoReference, &timestamp)) != OMX_ErrorNone)
+		fprintf (stderr, "Could not set the clock to %lld. Error 0x%08x\n", time, omx_error);
+	media_clock_resync ();
+}
+
+/**
+ *  Keeps the clock of a live source the latency target behind the newest packet received.
+ *  The first packet anchors it. When the player falls behind (a burst after a stall, decoding too
+ *  slow) the clock jumps ahead: queued audio is dropped and late video is dropped by the decoding
+ *  thread up to the next restart point. When packets arrive late already the clock goes back.
+ */
+static void live_packet (int64_t time)
+{
+	int64_t now = monotonic_us (), target = (int64_t) live_target_ms * 1000, buffered;
+
+	if (live_newest == AV_NOPTS_VALUE || time > live_newest)
+		live_newest = time;
+	buffered = live_newest - media_clock_now ();
+	live_stats.buffered_us = buffered;
+	if (live_resynced)
+	{
+		if (buffered > live_stats.max_buffered_us)
+			live_stats.max_buffered_us = buffered;
+		if ((buffered <= target + LIVE_TOLERANCE_US && buffered >= -LIVE_TOLERANCE_US) || now - live_resynced < LIVE_RESYNC_INTERVAL_US)
+			return;
+		live_stats.catch_ups ++;
+		if (buffered > target)
+		{
+			live_stats.skipped_us += buffered - target;
+			flush_buffer (&audio_packet_fifo);
+			if (pcm_pipeline)
+				pcm_ring_flush (audio_ring);
+			if (audio_tap_on)
+				audio_tap_flush (&audio_analysis);
+		}
+		printf ("live latency %lld ms, back to %d ms\n", buffered / 1000, live_target_ms);
+	}
+	set_clock_time (live_newest - target);
+	live_resynced = now;
+}
+
+/**
+ *  Takes the current demuxed packet and sorts it to the correct buffer polled
+ *  by decoding threads.
+ */
+static inline int process_packet ()
 {
 	int ret = 0;
 	packet_buffer* buf = NULL;
+	rpi_mp_track_type type;
+	int64_t time;
 	// negative size ???
 	if (av_packet.size < 0)
 		return ret;
 
 	// current packet is video
 	if (av_packet.stream_index == video_stream_idx)
-		buf = &video_packet_fifo;
+	{
+		buf  = &video_packet_fifo;
+		type = TRACK_VIDEO;
+	}
 	// current packet is audio
 	else if (av_packet.stream_index == audio_stream_idx)
-		buf = &audio_packet_fifo;
+	{
+		buf  = &audio_packet_fifo;
+		type = TRACK_AUDIO;
+	}
+	// current packet is subtitle
+	else if (flags & SUBTITLES_ON && av_packet.stream_index == subtitle_stream_idx)
+	{
+		buf  = &subtitle_packet_fifo;
+		type = TRACK_SUBTITLE;
+	}
 	// not interrested
 	else
+	{
+		av_packet_unref (&av_packet);
 		return ret;
+	}
+	// the video of a rendition switched to starts at a keyframe, up to there the previous one played
+	if (type == TRACK_VIDEO && video_resume != AV_NOPTS_VALUE)
+	{
+		if (~av_packet.flags & AV_PKT_FLAG_KEY || av_packet.pts == AV_NOPTS_VALUE || av_packet.pts < video_resume)
+		{
+			av_packet_unref (&av_packet);
+			return ret;
+		}
+		video_resume = AV_NOPTS_VALUE;
+	}
+	// reading again after a track switch, this was queued already
+	time = av_packet.dts != AV_NOPTS_VALUE ? av_packet.dts : av_packet.pts;
+	if (time != AV_NOPTS_VALUE)
+	{
+		if (skip_until[type] != AV_NOPTS_VALUE)
+		{
+			if (time <= skip_until[type])
+			{
+				av_packet_unref (&av_packet);
+				return ret;
+			}
+			skip_until[type] = AV_NOPTS_VALUE;
+		}
+		queued_until[type] = time;
+	}
+	if (flags & LIVE_SOURCE && type != TRACK_SUBTITLE && av_packet.pts != AV_NOPTS_VALUE)
+		live_packet (av_packet.pts);
+	if (flags & FOLLOW_SOURCE && type != TRACK_SUBTITLE && av_packet.pts != AV_NOPTS_VALUE &&
+	    (follow_newest == AV_NOPTS_VALUE || av_packet.pts > follow_newest))
+		__atomic_store_n (&follow_newest, av_packet.pts, __ATOMIC_RELAXED);
+	// the decoding threads return the data to the pool instead of the heap; the demuxer
+	// already copied a memory span once, the pool would only add a second copy
+	if (~flags & SPAN_SOURCE)
+		pool_packet (&av_packet);
 
 	// the buffer might be full therefor we need to keep trying until there room has been
 	// made by either decoding threads, hence the while loop
@@ -566,7 +1315,279 @@ static inline int process_packet ()
 		if (ret == 0)
 			break;
 		// sleep a little to save CPU
-		usleep (FIFO_SLEEPY_TIME);
+		thread_sleep (THREAD_DEMUX, FIFO_SLEEPY_TIME);
+	}
+	return 0;
+}
+
+/**
+ *  Finds the largest packet and the peak bitrate (over one second windows) of a stream from
+ *  the demuxer's index. Falls back to the bitrate advertised by the codec or container.
+ */
+static void stream_peak_rate (AVStream* stream, int* max_packet, int64_t* peak_bitrate)
+{
+	int64_t window = av_rescale_q (AV_TIME_BASE, AV_TIME_BASE_Q, stream->time_base);
+	int64_t bytes  = 0;
+	int     i, j   = 0;
+
+	*max_packet   = 0;
+	*peak_bitrate = 0;
+	for (i = 0; i < stream->nb_index_entries; i ++)
+	{
+		AVIndexEntry* e = &stream->index_entries[i];
+		if (e->size > *max_packet)
+			*max_packet = e->size;
+		bytes += e->size;
+		while (j < i && e->timestamp - stream->index_entries[j].timestamp >= window)
+			bytes -= stream->index_entries[j ++].size;
+		if (bytes * 8 > *peak_bitrate)
+			*peak_bitrate = bytes * 8;
+	}
+	if (*peak_bitrate == 0)
+		*peak_bitrate = stream->codec->rc_max_rate > 0 ? stream->codec->rc_max_rate :
+		                stream->codec->bit_rate    > 0 ? stream->codec->bit_rate    : fmt_ctx->bit_rate;
+}
+
+/**
+ *  Sets the number and size of input buffers of a port, keeping at least the minimum count
+ *  the component requires. Fills in the configuration that was actually applied.
+ */
+static void configure_input_buffers (COMPONENT_T* component, int port_index, int size, int count, rpi_mp_buffer_stats* stats)
+{
+	OMX_PARAM_PORTDEFINITIONTYPE port;
+	OMX_ERRORTYPE omx_error;
+	OMX_INIT_STRUCTURE (port);
+	port.nPortIndex = port_index;
+
+	if (OMX_GetParameter (ILC_GET_HANDLE (component), OMX_IndexParamPortDefinition, &port) != OMX_ErrorNone)
+		return;
+	if (size > 0)
+	{
+		port.nBufferSize        = (size + INPUT_BUFFER_ALIGN - 1) / INPUT_BUFFER_ALIGN * INPUT_BUFFER_ALIGN;
+		port.nBufferCountActual = count < port.nBufferCountMin ? port.nBufferCountMin : count > MAX_INPUT_BUFFERS ? MAX_INPUT_BUFFERS : count;
+		if ((omx_error = OMX_SetParameter (ILC_GET_HANDLE (component), OMX_IndexParamPortDefinition, &port)) != OMX_ErrorNone)
+			fprintf (stderr, "Could not set input buffers of port %d. Error 0x%08x\n", port_index, omx_error);
+		OMX_GetParameter (ILC_GET_HANDLE (component), OMX_IndexParamPortDefinition, &port);
+	}
+	stats->buffer_size  = port.nBufferSize;
+	stats->buffer_count = port.nBufferCountActual;
+}
+
+/**
+ *  A video decoder input buffer holds the largest packet of the stream, so packets are never split,
+ *  and there are enough of them for VIDEO_INPUT_BUFFER_MS of frames within the memory budget.
+ */
+static void configure_video_input_buffers (COMPONENT_T* decoder, AVStream* stream, rpi_mp_buffer_stats* stats)
+{
+	int     max_packet, count;
+	int64_t peak_bitrate;
+	double  fps = stream->avg_frame_rate.den > 0 && stream->avg_frame_rate.num > 0 ? av_q2d (stream->avg_frame_rate) :
+	              stream->r_frame_rate.den   > 0 && stream->r_frame_rate.num   > 0 ? av_q2d (stream->r_frame_rate)   : 30;
+
+	stream_peak_rate (stream, &max_packet, &peak_bitrate);
+	// without an index assume keyframes are a few times the average frame
+	if (max_packet == 0)
+		max_packet = peak_bitrate / 8 / fps * 4;
+	if (max_packet > 0)
+	{
+		max_packet = (max_packet + INPUT_BUFFER_ALIGN - 1) / INPUT_BUFFER_ALIGN * INPUT_BUFFER_ALIGN;
+		count = fps * VIDEO_INPUT_BUFFER_MS / 1000;
+		if ((int64_t) max_packet * count > VIDEO_INPUT_BUFFER_MEMORY)
+			count = VIDEO_INPUT_BUFFER_MEMORY / max_packet;
+	}
+	else
+		count = 0;
+	configure_input_buffers (decoder, VIDEO_DECODE_INPUT_PORT, max_packet, count, stats);
+	printf ("video input buffers: %d x %d bytes (largest packet %d, peak %lld kbit/s)\n",
+	        stats->buffer_count, stats->buffer_size, max_packet, (long long) peak_bitrate / 1000);
+}
+
+/**
+ *  An audio render input buffer holds one decoded (or, in passthrough, compressed) frame,
+ *  there are enough for AUDIO_INPUT_BUFFER_MS.
+ *  For LOW_LATENCY_AUDIO there are LOW_LATENCY_BUFFERS, each filled with a chunk of a quarter of
+ *  the latency target, so a buffer goes out as soon as that much is decoded. The buffers themselves
+ *  stay aligned to INPUT_BUFFER_ALIGN, they are just not filled.
+ */
+static void configure_audio_input_buffers ()
+{
+	int block_align = audio_codec_ctx->channels * 2;
+	int frame_size  = audio_codec_ctx->frame_size > 0 ? audio_codec_ctx->frame_size : audio_codec_ctx->sample_rate / 50;
+	int size        = flags & PASSTHROUGH_AUDIO ? INPUT_BUFFER_ALIGN : frame_size * block_align;
+	int count       = frame_size > 0 ? AUDIO_INPUT_BUFFER_MS * audio_codec_ctx->sample_rate / 1000 / frame_size : 0;
+
+	if (flags & LOW_LATENCY && ~flags & PASSTHROUGH_AUDIO)
+	{
+		size  = (int64_t) audio_latency_target * audio_codec_ctx->sample_rate / 1000 / LOW_LATENCY_BUFFERS * block_align;
+		count = LOW_LATENCY_BUFFERS;
+	}
+	configure_input_buffers (audio_render, AUDIO_RENDER_INPUT_PORT, size, count, &audio_buffer_stats);
+	audio_chunk = size < audio_buffer_stats.buffer_size ? size : audio_buffer_stats.buffer_size;
+	audio_chunk -= audio_chunk % block_align;
+	printf ("audio input buffers: %d x %d bytes, filled with %zu\n", audio_buffer_stats.buffer_count, audio_buffer_stats.buffer_size, audio_chunk);
+}
+
+/**
+ *	OMX coding for the codecs the hardware decoder handles, OMX_VIDEO_CodingUnused for the
+ *	ones decoded in software (HEVC, VP9, AV1, ...).
+ */
+static OMX_VIDEO_CODINGTYPE omx_video_coding (enum AVCodecID codec_id)
+{
+	switch (codec_id)
+	{
+		case AV_CODEC_ID_H264:
+			return OMX_VIDEO_CodingAVC;
+
+		case AV_CODEC_ID_MPEG4:
+			return OMX_VIDEO_CodingMPEG4;
+
+		case AV_CODEC_ID_MPEG2VIDEO:
+			return OMX_VIDEO_CodingMPEG2;
+
+		// the decoder recognises these itself, some depend on the licenses of the board
+		case AV_CODEC_ID_MPEG1VIDEO:
+		case AV_CODEC_ID_H263:
+		case AV_CODEC_ID_MJPEG:
+		case AV_CODEC_ID_VC1:
+		case AV_CODEC_ID_WMV3:
+		case AV_CODEC_ID_VP6:
+		case AV_CODEC_ID_VP6F:
+		case AV_CODEC_ID_VP8:
+		case AV_CODEC_ID_THEORA:
+			return OMX_VIDEO_CodingAutoDetect;
+
+		default:
+			return OMX_VIDEO_CodingUnused;
+	}
+}
+
+/**
+ *	Sets up decoding in software, the frames go straight into the input port of video_render.
+ *	There is no scheduler in between, software_render_thread times the frames on the media clock.
+ *  @return int 0 on success, non-zero on failure.
+ */
+static int open_software_video ()
+{
+	OMX_PARAM_PORTDEFINITIONTYPE port;
+
+	if (flags & (RENDER_2_TEXTURE | RENDER_2_YUV))
+	{
+		fprintf (stderr, "Software decoded %s can only be rendered to the display\n", avcodec_get_name (video_codec_ctx->codec_id));
+		return 1;
+	}
+	if (open_soft_video (&software_video, video_stream, 0, media_clock_now) != 0)
+		return 1;
+	// the timeline hands out packets in microseconds
+	software_video.time_base = AV_TIME_BASE_Q;
+	SET_FLAG (SOFTWARE_VIDEO)
+	printf ("decoding %s in software\n", avcodec_get_name (video_codec_ctx->codec_id));
+
+	memset (video_tunnel, 0, sizeof (video_tunnel));
+	if (ilclient_create_component (client, &video_render, "video_render", ILCLIENT_DISABLE_ALL_PORTS | ILCLIENT_ENABLE_INPUT_BUFFERS) != 0)
+	{
+		fprintf (stderr, "Error creating IL COMPONENT video render\n");
+		return -14;
+	}
+	list[1] = video_render;
+
+	// the planes follow each other at the alignment the renderer expects
+	software_stride       = FFALIGN (video_codec_ctx->width, 32);
+	software_slice_height = FFALIGN (video_codec_ctx->height, 16);
+	OMX_INIT_STRUCTURE (port);
+	port.nPortIndex = VIDEO_RENDER_INPUT_PORT;
+	OMX_GetParameter (ILC_GET_HANDLE (video_render), OMX_IndexParamPortDefinition, &port);
+	port.format.video.nFrameWidth        = video_codec_ctx->width;
+	port.format.video.nFrameHeight       = video_codec_ctx->height;
+	port.format.video.nStride            = software_stride;
+	port.format.video.nSliceHeight       = software_slice_height;
+	port.format.video.eCompressionFormat = OMX_VIDEO_CodingUnused;
+	port.format.video.eColorFormat       = OMX_COLOR_FormatYUV420PackedPlanar;
+	port.nBufferSize                     = software_stride * software_slice_height * 3 / 2;
+	if (OMX_SetParameter (ILC_GET_HANDLE (video_render), OMX_IndexParamPortDefinition, &port) != OMX_ErrorNone)
+	{
+		fprintf (stderr, "Error setting port format on video render\n");
+		return 1;
+	}
+	ilclient_change_component_state (video_render, OMX_StateIdle);
+	if (ilclient_enable_port_buffers (video_render, VIDEO_RENDER_INPUT_PORT, NULL, NULL, NULL) != 0)
+	{
+		fprintf (stderr, "Could not enable port buffers on video render\n");
+		return 1;
+	}
+	ilclient_change_component_state (video_render, OMX_StateExecuting);
+	return 0;
+}
+
+/**
+ *	Returns the buffers held by video_render and frees the software decoder.
+ */
+static void close_software_video ()
+{
+	if (video_render && OMX_SendCommand (ILC_GET_HANDLE (video_render), OMX_CommandFlush, VIDEO_RENDER_INPUT_PORT, NULL) == OMX_ErrorNone)
+		ilclient_wait_for_event (video_render, OMX_EventCmdComplete, OMX_CommandFlush, 0, VIDEO_RENDER_INPUT_PORT, 0, ILCLIENT_PORT_FLUSH, 1000);
+	if (video_render)
+		ilclient_disable_port_buffers (video_render, VIDEO_RENDER_INPUT_PORT, NULL, NULL, NULL);
+	close_soft_video (&software_video);
+	if (video_codec_ctx)
+		avcodec_close (video_codec_ctx);
+}
+
+/**
+ *	Sets the coding and the input buffers of a video decoder in Idle, starts it and sends it the
+ *	codec configuration of the stream.
+ *  @return int 0 on success, non-zero on failure
+ */
+static int start_video_decoder (COMPONENT_T* decoder, AVStream* stream, rpi_mp_buffer_stats* stats)
+{
+	OMX_VIDEO_PARAM_PORTFORMATTYPE video_format;
+	OMX_BUFFERHEADERTYPE*          buffer;
+	AVCodecContext*                codec_ctx = stream->codec;
+
+	memset (&video_format, 0, sizeof (OMX_VIDEO_PARAM_PORTFORMATTYPE));
+	video_format.nSize 			     = sizeof (OMX_VIDEO_PARAM_PORTFORMATTYPE);
+	video_format.nVersion.nVersion   = OMX_VERSION;
+	video_format.nPortIndex 		 = VIDEO_DECODE_INPUT_PORT;
+
+	if (stream->r_frame_rate.den > 0)
+		video_format.xFramerate	= (long long) (stream->r_frame_rate.num / stream->r_frame_rate.den) * (1 << 16);
+
+	video_format.eCompressionFormat = omx_video_coding (codec_ctx->codec_id);
+	// set format parameters for video decoder
+	if (OMX_SetParameter (ILC_GET_HANDLE (decoder), OMX_IndexParamVideoPortFormat, &video_format) != OMX_ErrorNone)
+	{
+		fprintf (stderr, "Error setting port format parameter on video decoder \n");
+		return 1;
+	}
+	configure_video_input_buffers (decoder, stream, stats);
+	// enable video decoder buffers
+	if (ilclient_enable_port_buffers (decoder, VIDEO_DECODE_INPUT_PORT, NULL, NULL, NULL) == 0)
+	{
+		ilclient_change_component_state (decoder, OMX_StateExecuting);
+		// send decoding extra information
+		if (codec_ctx->extradata)
+		{
+			if ((buffer = ilclient_get_input_buffer (decoder, VIDEO_DECODE_INPUT_PORT, 1)) == NULL)
+			{
+				fprintf (stderr, "Error getting input buffer to video decoder to send decoding information\n");
+				return 1;
+			}
+			buffer->nOffset = 0;
+			buffer->nFilledLen = codec_ctx->extradata_size;
+			memset (buffer->pBuffer, 0x0, buffer->nAllocLen);
+			memcpy (buffer->pBuffer, codec_ctx->extradata, codec_ctx->extradata_size);
+			buffer->nFlags = OMX_BUFFERFLAG_CODECCONFIG | OMX_BUFFERFLAG_ENDOFFRAME;
+
+			if (OMX_EmptyThisBuffer (ILC_GET_HANDLE (decoder), buffer) != OMX_ErrorNone)
+			{
+				fprintf (stderr, "Error emptying buffer with extra decoder information\n");
+				return 1;
+			}
+		}
+	}
+	else
+	{
+		fprintf (stderr, "Could not enable port buffers on video decoder\n");
+		return 1;
 	}
 	return 0;
 }
@@ -579,9 +1600,14 @@ static inline int process_packet ()
 static int open_video ()
 {
 	int ret = 0;
-	OMX_VIDEO_PARAM_PORTFORMATTYPE video_format;
 	int render_input_port = VIDEO_RENDER_INPUT_PORT;
 
+	skip_to_restart = 0;
+	drop_late_video = video_codec_ctx->codec_id == AV_CODEC_ID_H264;
+	nal_length_size = h264_nal_length_size (video_codec_ctx->extradata, video_codec_ctx->extradata_size);
+	if (omx_video_coding (video_codec_ctx->codec_id) == OMX_VIDEO_CodingUnused)
+		return open_software_video ();
+
 	memset (video_tunnel, 0, sizeof (video_tunnel));
 	// create video decode component
 	if (ilclient_create_component (client, &video_decode, "video_decode", ILCLIENT_DISABLE_ALL_PORTS | ILCLIENT_ENABLE_INPUT_BUFFERS) != 0)
@@ -627,6 +1653,17 @@ static int open_video ()
   		portFormat.nBufferCountActual = BUFFER_COUNT;
   		OMX_SetParameter(ILC_GET_HANDLE (egl_render), OMX_IndexParamPortDefinition, &portFormat);
 	}
+	else if (flags & RENDER_2_YUV)
+	{
+		// the resizer only converts, its output buffers are read by the application
+		if (ilclient_create_component (client, &resize, "resize", ILCLIENT_DISABLE_ALL_PORTS | ILCLIENT_ENABLE_OUTPUT_BUFFERS) != 0)
+		{
+			fprintf (stderr, "Error creating IL COMPONENT resize\n");
+			ret = -14;
+		}
+		list[1] = resize;
+		render_input_port = RESIZE_INPUT_PORT;
+	}
 	else
 	{
 		// create video render component
@@ -647,7 +1684,7 @@ static int open_video ()
 	// setup tunnels
 	set_tunnel (video_tunnel, 		video_decode, 		 VIDEO_DECODE_OUT_PORT, 	video_scheduler, 	VIDEO_SCHEDULER_INPUT_PORT);
 	set_tunnel (video_tunnel + 1, 	video_scheduler, 	 VIDEO_SCHEDULER_OUT_PORT,  list[1], 			render_input_port);
-	set_tunnel (video_tunnel + 2, 	video_clock, 		 CLOCK_VIDEO_PORT, 			video_scheduler, 	VIDEO_SCHEDULER_CLOCK_PORT);
+	set_tunnel (video_tunnel + 2, 	video_clock, 		 video_clock_port, 			video_scheduler, 	VIDEO_SCHEDULER_CLOCK_PORT);
 	// setup clock tunnel
 	if (ilclient_setup_tunnel (video_tunnel + 2, 0, 0) != 0)
 	{
@@ -657,78 +1694,16 @@ static int open_video ()
 	// setup decoding
 	if (ret == 0)
 		ilclient_change_component_state (video_decode, OMX_StateIdle);
-
-	memset (&video_format, 0, sizeof (OMX_VIDEO_PARAM_PORTFORMATTYPE));
-	video_format.nSize 			     = sizeof (OMX_VIDEO_PARAM_PORTFORMATTYPE);
-	video_format.nVersion.nVersion   = OMX_VERSION;
-	video_format.nPortIndex 		 = VIDEO_DECODE_INPUT_PORT;
-
-	if (video_stream->r_frame_rate.den > 0)
-		video_format.xFramerate	= (long long) (video_stream->r_frame_rate.num / video_stream->r_frame_rate.den) * (1 << 16);
-
-	switch (video_codec_ctx->codec_id)
-	{
-		case AV_CODEC_ID_H264:
-			video_format.eCompressionFormat = OMX_VIDEO_CodingAVC;
-			break;
-
-		case AV_CODEC_ID_MPEG4:
-			video_format.eCompressionFormat = OMX_VIDEO_CodingMPEG4;
-			break;
-
-		case AV_CODEC_ID_MPEG2VIDEO:
-			video_format.eCompressionFormat = OMX_VIDEO_CodingMPEG2;
-			break;
-
-		default:
-			video_format.eCompressionFormat = OMX_VIDEO_CodingAutoDetect;
-			break;
-	}
-	// set format parameters for video decoder
-	if (OMX_SetParameter (ILC_GET_HANDLE (video_decode), OMX_IndexParamVideoPortFormat, &video_format) != OMX_ErrorNone)
-	{
-		fprintf (stderr, "Error setting port format parameter on video decoder \n");
-		return 1;
-	}
-	// enable video decoder buffers
-	if (ilclient_enable_port_buffers (video_decode, VIDEO_DECODE_INPUT_PORT, NULL, NULL, NULL) == 0)
-	{
-		ilclient_change_component_state (video_decode, OMX_StateExecuting);
-		// send decoding extra information
-		if (video_codec_ctx->extradata)
-		{
-			if ((omx_video_buffer = ilclient_get_input_buffer (video_decode, VIDEO_DECODE_INPUT_PORT, 1)) == NULL)
-			{
-				fprintf (stderr, "Error getting input buffer to video decoder to send decoding information\n");
-				return 1;
-			}
-			omx_video_buffer->nOffset = 0;
-			omx_video_buffer->nFilledLen = video_codec_ctx->extradata_size;
-			memset (omx_video_buffer->pBuffer, 0x0, omx_video_buffer->nAllocLen);
-			memcpy (omx_video_buffer->pBuffer, video_codec_ctx->extradata, video_codec_ctx->extradata_size);
-			omx_video_buffer->nFlags = OMX_BUFFERFLAG_CODECCONFIG | OMX_BUFFERFLAG_ENDOFFRAME;
-
-			if (OMX_EmptyThisBuffer (ILC_GET_HANDLE (video_decode), omx_video_buffer) != OMX_ErrorNone)
-			{
-				fprintf (stderr, "Error emptying buffer with extra decoder information\n");
-				return 1;
-			}
-		}
-	}
-	else
-	{
-		fprintf (stderr, "Could not enable port buffers on video decoder\n");
-		return 1;
-	}
-	return 0;
+	return start_video_decoder (video_decode, video_stream, &video_buffer_stats);
 }
 
-/**
- *	Close video
- * 	Destroy components and tunnels between them,
- */
 static void close_video ()
 {
+	if (flags & SOFTWARE_VIDEO)
+	{
+		close_software_video ();
+		return;
+	}
 	if ((omx_video_buffer = ilclient_get_input_buffer (video_decode, VIDEO_DECODE_INPUT_PORT, 1)) != NULL)
 	{
 		omx_video_buffer->nFilledLen = 0;
@@ -741,8 +1716,10 @@ static void close_video ()
 
 	// wait for EOS from render
 	printf("VID: Waiting for EOS from render\n");
-	if (~flags & RENDER_2_TEXTURE)
+	if (~flags & (RENDER_2_TEXTURE | RENDER_2_YUV))
 		ilclient_wait_for_event (video_render, OMX_EventBufferFlag, VIDEO_RENDER_INPUT_PORT, 0, OMX_BUFFERFLAG_EOS, 0, ILCLIENT_BUFFER_FLAG_EOS, 10000);
+	if (flags & RENDER_2_YUV && flags & PORT_SETTINGS_CHANGED)
+		close_yuv_output ();
 	// need to flush the renderer to allow video_decode to disable its input port
 	printf("VID: Flushing tunnels\n");
 	ilclient_flush_tunnels        (video_tunnel, 0);
@@ -758,38 +1735,369 @@ static void close_video ()
 }
 
 /**
- *	Open audio
- *	Create audio components and tunnels with their buffers.
+ *	Open the decoder chain of the clip faded into: video_decode, video_scheduler on a clock port of
+ *	its own and egl_render, which renders into the set of textures the clip playing does not use.
+ *	The decoder starts with the crossfade; the rest of the chain is set up by its first frame.
+ *  @return int 0 on success, non-zero on failure.
  */
-static int open_audio ()
+static int open_next_video (AVStream* stream)
 {
-	int ret = 0;
-	OMX_CONFIG_BRCMAUDIODESTINATIONTYPE audio_destination;
-	OMX_ERRORTYPE omx_error;
-	OMX_AUDIO_PARAM_PCMMODETYPE pcm;
-	OMX_AUDIO_PARAM_PORTFORMATTYPE audio_format;
-
-	memset (audio_tunnel, 0, sizeof (audio_tunnel));
+	OMX_PARAM_PORTDEFINITIONTYPE portFormat;
 
-	// create audio render component
-	if (ilclient_create_component (client, &audio_render, "audio_render", ILCLIENT_DISABLE_ALL_PORTS | ILCLIENT_ENABLE_INPUT_BUFFERS) != 0)
+	memset (next_tunnel, 0, sizeof (next_tunnel));
+	memset (next_egl_buffers, 0, sizeof (next_egl_buffers));
+	if (ilclient_create_component (client, &next_decode, "video_decode", ILCLIENT_DISABLE_ALL_PORTS | ILCLIENT_ENABLE_INPUT_BUFFERS) != 0 ||
+	    ilclient_create_component (client, &next_egl_render, "egl_render", ILCLIENT_DISABLE_ALL_PORTS | ILCLIENT_ENABLE_OUTPUT_BUFFERS) != 0 ||
+	    ilclient_create_component (client, &next_scheduler, "video_scheduler", ILCLIENT_DISABLE_ALL_PORTS) != 0)
 	{
-		fprintf (stderr, "Error creating IL COMPONENT audio render\n");
-		ret = -14;
+		fprintf (stderr, "Error creating IL COMPONENTS for the next clip\n");
+		return 1;
 	}
-	list[4] = audio_render;
-
-	// setup audio decoder parameters
-	// 	this will be used if audio decoding is supported by the hardware
-	memset (&audio_format, 0x0, sizeof (OMX_AUDIO_PARAM_PORTFORMATTYPE));
-	audio_format.nSize 				= sizeof (OMX_AUDIO_PARAM_PORTFORMATTYPE);
-	audio_format.nVersion.nVersion 	= OMX_VERSION;
-	audio_format.nPortIndex 		= 120;
-
-	// check if we can decode audio on hardware
-	switch (audio_codec_ctx->codec_id)
+	OMX_INIT_STRUCTURE (portFormat);
+	portFormat.nPortIndex = EGL_RENDER_OUT_PORT;
+	OMX_GetParameter (ILC_GET_HANDLE (next_egl_render), OMX_IndexParamPortDefinition, &portFormat);
+	portFormat.nBufferCountActual = BUFFER_COUNT;
+	OMX_SetParameter (ILC_GET_HANDLE (next_egl_render), OMX_IndexParamPortDefinition, &portFormat);
+
+	set_tunnel (next_tunnel, 		next_decode, 		 VIDEO_DECODE_OUT_PORT, 	next_scheduler, 	VIDEO_SCHEDULER_INPUT_PORT);
+	set_tunnel (next_tunnel + 1, 	next_scheduler, 	 VIDEO_SCHEDULER_OUT_PORT,  next_egl_render, 	EGL_RENDER_INPUT_PORT);
+	set_tunnel (next_tunnel + 2, 	video_clock, 		 next_clock_port, 			next_scheduler, 	VIDEO_SCHEDULER_CLOCK_PORT);
+	if (ilclient_setup_tunnel (next_tunnel + 2, 0, 0) != 0)
 	{
-		case AV_CODEC_ID_MP2:
+		fprintf (stderr, "Error setting up the clock tunnel of the next clip\n");
+		return 1;
+	}
+	ilclient_change_component_state (next_decode, OMX_StateIdle);
+	return start_video_decoder (next_decode, stream, &next_buffer_stats);
+}
+
+/**
+ *	Takes the textures back from an egl_render, so they can be handed to another one.
+ */
+static void release_egl_images (COMPONENT_T* render, OMX_BUFFERHEADERTYPE* buffers[])
+{
+	int i;
+
+	if (OMX_SendCommand (ILC_GET_HANDLE (render), OMX_CommandFlush, EGL_RENDER_OUT_PORT, NULL) == OMX_ErrorNone)
+		ilclient_wait_for_event (render, OMX_EventCmdComplete, OMX_CommandFlush, 0, EGL_RENDER_OUT_PORT, 0, ILCLIENT_PORT_FLUSH, 1000);
+	if (OMX_SendCommand (ILC_GET_HANDLE (render), OMX_CommandPortDisable, EGL_RENDER_OUT_PORT, NULL) != OMX_ErrorNone)
+		return;
+	for (i = 0; i < BUFFER_COUNT; i ++)
+		if (buffers[i])
+		{
+			OMX_FreeBuffer (ILC_GET_HANDLE (render), EGL_RENDER_OUT_PORT, buffers[i]);
+			buffers[i] = NULL;
+		}
+	ilclient_wait_for_event (render, OMX_EventCmdComplete, OMX_CommandPortDisable, 0, EGL_RENDER_OUT_PORT, 0, ILCLIENT_PORT_DISABLED, 1000);
+}
+
+/**
+ *	Close the second decoder chain: the one of a clip that was not faded into to the end, or after
+ *	the handover the one of the clip faded out. The clock runs on.
+ */
+static void close_next_video ()
+{
+	COMPONENT_T* components[4];
+	int          n = 0;
+
+	if (!next_decode && !next_scheduler && !next_egl_render)
+		return;
+	pthread_mutex_lock (&chains_mutex);
+	next_output = 0;
+	pthread_mutex_unlock (&chains_mutex);
+	if (next_egl_render)
+		release_egl_images (next_egl_render, next_egl_buffers);
+	if (next_decode && next_scheduler && next_egl_render)
+	{
+		ilclient_flush_tunnels        (next_tunnel, 0);
+		ilclient_disable_port_buffers (next_decode, VIDEO_DECODE_INPUT_PORT, NULL, NULL, NULL);
+		ilclient_disable_tunnel       (next_tunnel);
+		ilclient_disable_tunnel       (next_tunnel + 1);
+		ilclient_disable_tunnel       (next_tunnel + 2);
+		ilclient_teardown_tunnels     (next_tunnel);
+	}
+	// ilclient stops at the first NULL
+	if (next_decode)
+		components[n ++] = next_decode;
+	if (next_scheduler)
+		components[n ++] = next_scheduler;
+	if (next_egl_render)
+		components[n ++] = next_egl_render;
+	components[n] = NULL;
+	ilclient_state_transition   (components, OMX_StateIdle);
+	ilclient_cleanup_components (components);
+	next_decode = next_scheduler = next_egl_render = NULL;
+	memset (next_tunnel, 0, sizeof (next_tunnel));
+	memset (next_egl_buffers, 0, sizeof (next_egl_buffers));
+}
+
+/**
+ *	Close the video chain for a rendition switch, the clock and the audio run on. What the decoder
+ *	holds is flushed rather than played out, and egl_render gives the textures back for the next one.
+ */
+static void close_video_chain ()
+{
+	COMPONENT_T* components[4];
+	int          n = 0;
+
+	if (flags & SOFTWARE_VIDEO)
+		close_software_video ();
+	else
+	{
+		if (flags & RENDER_2_TEXTURE && flags & PORT_SETTINGS_CHANGED)
+			release_egl_images (egl_render, omx_egl_buffers);
+		else if (flags & RENDER_2_YUV && flags & PORT_SETTINGS_CHANGED)
+			close_yuv_output ();
+		ilclient_flush_tunnels        (video_tunnel, 0);
+		ilclient_disable_port_buffers (video_decode, VIDEO_DECODE_INPUT_PORT, NULL, NULL, NULL);
+		ilclient_disable_tunnel       (video_tunnel);
+		ilclient_disable_tunnel       (video_tunnel + 1);
+		ilclient_disable_tunnel       (video_tunnel + 2);
+		ilclient_teardown_tunnels     (video_tunnel);
+		if (video_codec_ctx)
+			avcodec_close (video_codec_ctx);
+	}
+	// ilclient stops at the first NULL
+	if (list[0])
+		components[n ++] = list[0];
+	if (list[1])
+		components[n ++] = list[1];
+	if (list[3])
+		components[n ++] = list[3];
+	components[n] = NULL;
+	ilclient_state_transition   (components, OMX_StateIdle);
+	ilclient_cleanup_components (components);
+	list[0] = list[1] = list[3] = NULL;
+	pthread_mutex_lock (&chains_mutex);
+	video_decode = video_scheduler = video_render = egl_render = resize = NULL;
+	pthread_mutex_unlock (&chains_mutex);
+	memset (video_tunnel, 0, sizeof (video_tunnel));
+	memset (omx_egl_buffers, 0, sizeof (omx_egl_buffers));
+}
+
+/**
+ *	Feeds a packet of the clip faded into to its decoder, on the clock that is running already, and
+ *	hands its egl_render the other set of textures once the decoder knows the frame size.
+ *  @return int 0 on success, non-zero on error
+ */
+static int decode_next_video_packet (AVPacket* packet)
+{
+	OMX_BUFFERHEADERTYPE* buffer;
+	OMX_TICKS             ticks = omx_timestamp (*packet);
+	int                   size;
+
+	while (packet->size > 0)
+	{
+		if ((buffer = get_input_buffer (next_decode, VIDEO_DECODE_INPUT_PORT, &next_buffer_stats)) == NULL)
+		{
+			fprintf (stderr, "Error getting buffer to the video decoder of the next clip\n");
+			return 1;
+		}
+		size               = packet->size > buffer->nAllocLen ? buffer->nAllocLen : packet->size;
+		buffer->nFilledLen = size;
+		buffer->nOffset    = 0;
+		buffer->nTimeStamp = ticks;
+		buffer->nFlags     = packet->pts == AV_NOPTS_VALUE ? OMX_BUFFERFLAG_TIME_UNKNOWN : 0;
+		memcpy (buffer->pBuffer, packet->data, size);
+		packet->size -= size;
+		packet->data += size;
+		if (packet->size == 0)
+			buffer->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
+
+		if (!next_output && ilclient_remove_event (next_decode, OMX_EventPortSettingsChanged, VIDEO_DECODE_OUT_PORT, 0, 0, 1) == 0)
+		{
+			if (ilclient_setup_tunnel (next_tunnel, 0, 0) != 0)
+			{
+				fprintf (stderr, "Error setting up tunnel between the video decoder and scheduler of the next clip\n");
+				return 1;
+			}
+			ilclient_change_component_state (next_scheduler, OMX_StateExecuting);
+			if (ilclient_setup_tunnel (next_tunnel + 1, 0, 1000) != 0)
+			{
+				fprintf (stderr, "Error setting up tunnel between the video scheduler and render of the next clip\n");
+				return 1;
+			}
+			// before the first buffer is asked for, the fill callback ignores it otherwise
+			pthread_mutex_lock (&chains_mutex);
+			next_output = 1;
+			pthread_mutex_unlock (&chains_mutex);
+			if (use_egl_images (next_egl_render, next_egl_buffers, egl_images[next_set], current_texture[next_set]) != 0)
+				return 1;
+		}
+		if (OMX_EmptyThisBuffer (ILC_GET_HANDLE (next_decode), buffer) != OMX_ErrorNone)
+		{
+			fprintf (stderr, "Error emptying video decode buffer of the next clip\n");
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ *	Feeds the decoder of the clip faded into from the start of the crossfade until the handover,
+ *	from there on the video decoding thread does.
+ */
+static void next_video_thread ()
+{
+	AVPacket packet;
+	uint8_t* d;
+	int      ret;
+
+	thread_policy_enter (THREAD_NEXT_VIDEO);
+	while (!__atomic_load_n (&next_stop, __ATOMIC_ACQUIRE))
+	{
+		if (!__atomic_load_n (&next_clip.started, __ATOMIC_ACQUIRE) || (ret = transition_video_packet (&next_clip, &packet)) > 0)
+		{
+			thread_sleep (THREAD_NEXT_VIDEO, FIFO_SLEEPY_TIME);
+			continue;
+		}
+		// read to the end before the crossfade is
+		if (ret < 0)
+			break;
+		d = packet.data;
+		ret = decode_next_video_packet (&packet);
+		packet.data = d;
+		av_packet_unref (&packet);
+		if (ret != 0)
+		{
+			fprintf (stderr, "Error while decoding the next clip, ending thread\n");
+			break;
+		}
+	}
+	printf ("stopping video decoding thread of the next clip\n");
+}
+
+/**
+ *	Stops feeding the decoder of the clip faded into.
+ *	@param int flush
+ *		non-zero to flush its input, when its chain is closed: with the clock paused the thread
+ *		waits for an input buffer otherwise
+ */
+static void stop_next_feeder (int flush)
+{
+	if (!next_feeding)
+		return;
+	__atomic_store_n (&next_stop, 1, __ATOMIC_RELEASE);
+	if (flush && OMX_SendCommand (ILC_GET_HANDLE (next_decode), OMX_CommandFlush, VIDEO_DECODE_INPUT_PORT, NULL) != OMX_ErrorNone)
+		fprintf (stderr, "Could not flush the video decoder input of the next clip\n");
+	pthread_join (next_feeder, NULL);
+	next_feeding = 0;
+}
+
+/**
+ *	Returns the audio format the HDMI sink has to accept for passthrough of the audio stream,
+ *	0 if the stream can not be passed through.
+ */
+static int passthrough_format ()
+{
+	EDID_AudioSampleRate rate;
+
+	if (flags & ANALOG_AUDIO_OUT)
+		return 0;
+	switch (audio_codec_ctx->sample_rate)
+	{
+		case 32000: rate = EDID_AudioSampleRate_e32KHz; break;
+		case 44100: rate = EDID_AudioSampleRate_e44KHz; break;
+		case 48000: rate = EDID_AudioSampleRate_e48KHz; break;
+		default:    return 0;
+	}
+	switch (audio_codec_ctx->codec_id)
+	{
+		case AV_CODEC_ID_AC3:
+			return vc_tv_hdmi_audio_supported (EDID_AudioFormat_eAC3, audio_codec_ctx->channels, rate, EDID_AudioSampleSize_16bit) == 0 ? EDID_AudioFormat_eAC3 : 0;
+
+		case AV_CODEC_ID_EAC3:
+			return vc_tv_hdmi_audio_supported (EDID_AudioFormat_eDDPlus, audio_codec_ctx->channels, rate, EDID_AudioSampleSize_16bit) == 0 ? EDID_AudioFormat_eDDPlus : 0;
+
+		case AV_CODEC_ID_DTS:
+			return vc_tv_hdmi_audio_supported (EDID_AudioFormat_eDTS, audio_codec_ctx->channels, rate, EDID_AudioSampleSize_16bit) == 0 ? EDID_AudioFormat_eDTS : 0;
+
+		default:
+			return 0;
+	}
+}
+
+/**
+ *	Switch the audio renderer input to the compressed format of the stream.
+ *	return int 0 on success, non-zero if the renderer refused it
+ */
+static int setup_passthrough ()
+{
+	OMX_ERRORTYPE omx_error;
+	OMX_AUDIO_PARAM_PORTFORMATTYPE audio_format;
+	OMX_INIT_STRUCTURE (audio_format);
+	audio_format.nPortIndex = AUDIO_RENDER_INPUT_PORT;
+	audio_format.eEncoding  = audio_codec_ctx->codec_id == AV_CODEC_ID_DTS ? OMX_AUDIO_CodingDTS : OMX_AUDIO_CodingDDP;
+
+	if ((omx_error = OMX_SetParameter (ILC_GET_HANDLE (audio_render), OMX_IndexParamAudioPortFormat, &audio_format)) != OMX_ErrorNone)
+	{
+		fprintf (stderr, "Error setting passthrough format for audio renderer; error: 0x%08x\n", omx_error);
+		return 1;
+	}
+	if (audio_codec_ctx->codec_id == AV_CODEC_ID_DTS)
+	{
+		OMX_AUDIO_PARAM_DTSTYPE dts;
+		OMX_INIT_STRUCTURE (dts);
+		dts.nPortIndex  = AUDIO_RENDER_INPUT_PORT;
+		dts.nChannels   = audio_codec_ctx->channels;
+		dts.nSampleRate = audio_codec_ctx->sample_rate;
+		dts.nBitRate    = audio_codec_ctx->bit_rate;
+		omx_error = OMX_SetParameter (ILC_GET_HANDLE (audio_render), OMX_IndexParamAudioDts, &dts);
+	}
+	else
+	{
+		OMX_AUDIO_PARAM_DDPTYPE ddp;
+		OMX_INIT_STRUCTURE (ddp);
+		ddp.nPortIndex  = AUDIO_RENDER_INPUT_PORT;
+		ddp.nChannels   = audio_codec_ctx->channels;
+		ddp.nSampleRate = audio_codec_ctx->sample_rate;
+		ddp.nBitRate    = audio_codec_ctx->bit_rate;
+		omx_error = OMX_SetParameter (ILC_GET_HANDLE (audio_render), OMX_IndexParamAudioDdp, &ddp);
+	}
+	if (omx_error != OMX_ErrorNone)
+	{
+		fprintf (stderr, "Error setting passthrough parameters for audio renderer; error: 0x%08x\n", omx_error);
+		// back to PCM, the stream will be decoded
+		audio_format.eEncoding = OMX_AUDIO_CodingPCM;
+		OMX_SetParameter (ILC_GET_HANDLE (audio_render), OMX_IndexParamAudioPortFormat, &audio_format);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ *	Open audio
+ *	Create audio components and tunnels with their buffers.
+ */
+static int open_audio ()
+{
+	int ret = 0;
+	OMX_CONFIG_BRCMAUDIODESTINATIONTYPE audio_destination;
+	OMX_ERRORTYPE omx_error;
+	OMX_AUDIO_PARAM_PCMMODETYPE pcm;
+	OMX_AUDIO_PARAM_PORTFORMATTYPE audio_format;
+
+	memset (audio_tunnel, 0, sizeof (audio_tunnel));
+
+	// create audio render component
+	if (ilclient_create_component (client, &audio_render, "audio_render", ILCLIENT_DISABLE_ALL_PORTS | ILCLIENT_ENABLE_INPUT_BUFFERS) != 0)
+	{
+		fprintf (stderr, "Error creating IL COMPONENT audio render\n");
+		ret = -14;
+	}
+	list[4] = audio_render;
+
+	// setup audio decoder parameters
+	// 	this will be used if audio decoding is supported by the hardware
+	memset (&audio_format, 0x0, sizeof (OMX_AUDIO_PARAM_PORTFORMATTYPE));
+	audio_format.nSize 				= sizeof (OMX_AUDIO_PARAM_PORTFORMATTYPE);
+	audio_format.nVersion.nVersion 	= OMX_VERSION;
+	audio_format.nPortIndex 		= 120;
+
+	// check if we can decode audio on hardware
+	switch (audio_codec_ctx->codec_id)
+	{
+		case AV_CODEC_ID_MP2:
 		case AV_CODEC_ID_MP3:
 			audio_format.eEncoding = OMX_AUDIO_CodingMP3;
 		break;
@@ -808,6 +2116,18 @@ static int open_audio ()
             break;
 	}
 
+	// compressed audio goes to the HDMI sink untouched, if it can handle it; otherwise we decode
+	if (flags & PASSTHROUGH_AUDIO)
+	{
+		if (passthrough_format () != 0)
+			UNSET_FLAG (HARDWARE_DECODE_AUDIO)
+		else
+		{
+			printf ("Audio passthrough of %s not supported by the sink, decoding\n", avcodec_get_name (audio_codec_ctx->codec_id));
+			UNSET_FLAG (PASSTHROUGH_AUDIO)
+		}
+	}
+
 	// if the hardware supports the audio encoder we setup new IL components to handle audio decoding
 	if (flags & HARDWARE_DECODE_AUDIO)
 	{
@@ -941,6 +2261,12 @@ static int open_audio ()
     	fprintf (stderr, "Error setting PCM parameters for audio renderer; error: 0x%08x\n", omx_error);
     	return 1;
     }
+    if (flags & PASSTHROUGH_AUDIO && setup_passthrough () != 0)
+        UNSET_FLAG (PASSTHROUGH_AUDIO)
+    if (flags & PASSTHROUGH_AUDIO)
+        printf ("Passing %s through to HDMI\n", avcodec_get_name (audio_codec_ctx->codec_id));
+    if (~flags & HARDWARE_DECODE_AUDIO)
+        configure_audio_input_buffers ();
     // change audio renderer state to executing
     ilclient_enable_port_buffers    (audio_render, AUDIO_RENDER_INPUT_PORT, NULL, NULL, NULL);
     ilclient_change_component_state (audio_render, OMX_StateExecuting);
@@ -949,6 +2275,48 @@ static int open_audio ()
 }
 
 
+/**
+ *	Allocate the PCM ring between the audio decoding and submit threads,
+ *	and the scratch buffer for interleaving and converting frames.
+ */
+static int open_pcm_pipeline ()
+{
+	int ring_ms = flags & LOW_LATENCY ? audio_latency_target : PCM_RING_MS;
+
+	if (init_audio_submit (&pcm_submit, audio_ring, audio_codec_ctx->sample_rate, audio_codec_ctx->channels, ring_ms, audio_chunk) != 0)
+	{
+		fprintf (stderr, "Could not allocate PCM ring\n");
+		return 1;
+	}
+	if (init_audio_decoder (&pcm_decoder, audio_codec_ctx) != 0)
+	{
+		fprintf (stderr, "Could not allocate frame\n");
+		destroy_pcm_ring (audio_ring);
+		return 1;
+	}
+	// 8-bit samples stay as they are and are not analysed
+	audio_tap_on = audio_tap_enabled && av_get_bytes_per_sample (audio_codec_ctx->sample_fmt) != 1 &&
+	               init_audio_tap (&audio_analysis, audio_codec_ctx->channels, audio_codec_ctx->sample_rate) == 0;
+	if (audio_tap_on)
+		pcm_decoder.tap = tap_audio_frame;
+	pcm_pipeline = 1;
+	return 0;
+}
+
+
+static void close_pcm_pipeline ()
+{
+	if (!pcm_pipeline)
+		return;
+	destroy_pcm_ring (audio_ring);
+	destroy_audio_decoder (&pcm_decoder);
+	if (audio_tap_on)
+		destroy_audio_tap (&audio_analysis);
+	audio_tap_on = 0;
+	pcm_pipeline = 0;
+}
+
+
 static void close_audio ()
 {
 	if ((omx_audio_buffer = ilclient_get_input_buffer (audio_render, AUDIO_RENDER_INPUT_PORT, 1)) != NULL)
@@ -974,113 +2342,398 @@ static void close_audio ()
 
 	if (audio_codec_ctx)
         avcodec_close (audio_codec_ctx);
+	// a track switch the audio thread did not get to
+	if (replaced_audio_ctx)
+		avcodec_close (replaced_audio_ctx);
+	replaced_audio_ctx = NULL;
     fprintf (stderr, "AUD: Cleanup completed.\n");
 }
 
 
-static int open_codec_context (int* stream_idx, enum AVMediaType type)
+static int open_stream_codec (AVStream* stream)
 {
 	int 			ret;
-	AVStream* 	    stream;
-	AVCodecContext* codec_ctx 	= NULL;
-	AVCodec* 	    codec 		= NULL;
-
-	ret = av_find_best_stream (fmt_ctx, type, -1, -1, NULL, 0);
-	*stream_idx = ret;
-	if (ret < 0)
-	{
-		fprintf (stderr, "Could not find %s stream in input file\n", type == AVMEDIA_TYPE_VIDEO ? "video" : "audio");
-		return ret;
-	}
-
-	stream    = fmt_ctx->streams[*stream_idx];
-	codec_ctx = stream->codec;
-	codec     = avcodec_find_decoder (codec_ctx->codec_id);
+	AVCodecContext* codec_ctx 	= stream->codec;
+	AVCodec* 	    codec 		= avcodec_find_decoder (codec_ctx->codec_id);
 
 	if (!codec)
 	{
-		fprintf (stderr, "Failed to find %s codec\n", type == AVMEDIA_TYPE_VIDEO ? "video" : "audio");
+		fprintf (stderr, "Failed to find %s codec\n", av_get_media_type_string (codec_ctx->codec_type));
 		return 1;
 	}
 	if ((ret = avcodec_open2 (codec_ctx, codec, NULL)) < 0)
 	{
-		fprintf (stderr, "Failed to open %s codec\n", type == AVMEDIA_TYPE_VIDEO ? "video" : "audio");
+		fprintf (stderr, "Failed to open %s codec\n", av_get_media_type_string (codec_ctx->codec_type));
 		return ret;
 	}
 	return 0;
 }
 
 
-static int create_hw_clock ()
+static int open_codec_context (int* stream_idx, enum AVMediaType type)
 {
-	int ret = 0;
-	// create clock
-	if (ilclient_create_component (client, &video_clock, "clock", ILCLIENT_DISABLE_ALL_PORTS) != 0)
+	int ret = av_find_best_stream (fmt_ctx, type, -1, -1, NULL, 0);
+	*stream_idx = ret;
+	if (ret < 0)
 	{
-		fprintf (stderr, "Error creating IL COMPONENT video clock\n");
-		ret = -14;
+		fprintf (stderr, "Could not find %s stream in input file\n", av_get_media_type_string (type));
+		return ret;
 	}
-	if (video_clock == NULL)
-		fprintf (stderr, "Error?\n");
+	return open_stream_codec (fmt_ctx->streams[*stream_idx]);
+}
 
-	list[2] = video_clock;
-	return ret;
+
+/**
+ *  Which kind of track a stream is, -1 for streams that are not played (cover art, data).
+ */
+static int track_type (const AVStream* stream)
+{
+	switch (stream->codec->codec_type)
+	{
+		case AVMEDIA_TYPE_VIDEO:
+			return stream->disposition & AV_DISPOSITION_ATTACHED_PIC ? -1 : TRACK_VIDEO;
+		case AVMEDIA_TYPE_AUDIO:
+			return TRACK_AUDIO;
+		case AVMEDIA_TYPE_SUBTITLE:
+			return TRACK_SUBTITLE;
+		default:
+			return -1;
+	}
 }
 
 
-static int setup_clock ()
+/**
+ *  Whether a stream can replace the audio stream without reconfiguring the renderer: it has to go
+ *  the same way (decoded here, by the hardware, or passed through) and come out in the same format.
+ */
+static int audio_track_compatible (const AVStream* stream)
 {
-	OMX_TIME_CONFIG_CLOCKSTATETYPE clock_state;
-	int ret = 0;
+	const AVCodecContext* ctx = stream->codec;
+	if (ctx->sample_rate != audio_codec_ctx->sample_rate || ctx->channels != audio_codec_ctx->channels)
+		return 0;
+	if (flags & (PASSTHROUGH_AUDIO | HARDWARE_DECODE_AUDIO))
+		return ctx->codec_id == audio_codec_ctx->codec_id;
+	// DTS would go to the hardware decoder, 8-bit samples are rendered as such
+	return ctx->codec_id != AV_CODEC_ID_DTS &&
+	       (av_get_bytes_per_sample (ctx->sample_fmt) == 1) == (av_get_bytes_per_sample (audio_codec_ctx->sample_fmt) == 1);
+}
 
-	// set clock configuration
-	memset (&clock_state, 0, sizeof (clock_state));
-	clock_state.nSize             = sizeof (clock_state);
-	clock_state.nVersion.nVersion = OMX_VERSION;
-	clock_state.eState            = OMX_TIME_ClockStateWaitingForStartTime;
-	clock_state.nWaitMask         = 0;
 
-	if (video_stream_idx != AVERROR_STREAM_NOT_FOUND)
-		clock_state.nWaitMask |= OMX_CLOCKPORT0;
-	if (audio_stream_idx != AVERROR_STREAM_NOT_FOUND)
-		clock_state.nWaitMask |= OMX_CLOCKPORT1;
+/**
+ *  Replaces the audio stream. The audio thread flushes the audio path and takes the new codec over
+ *  before its next packet, so the switch does not wait for it to get through the one it is on.
+ *  return int 0 on success, non-zero if the new decoder could not be opened
+ */
+static int switch_audio_track (int index)
+{
+	AVStream* stream = fmt_ctx->streams[index];
 
-	if (video_clock != NULL && OMX_SetParameter (ILC_GET_HANDLE (video_clock), OMX_IndexConfigTimeClockState, &clock_state) != OMX_ErrorNone)
-	{
-		fprintf (stderr, "Error settings parameters for video clock\n");
-		ret = -13;
-	}
-	return ret;
+	if (open_stream_codec (stream) != 0)
+		return 1;
+	pthread_mutex_lock (&audio_track_mutex);
+	flush_buffer (&audio_packet_fifo);
+	// the audio thread closes the codec it decodes with once it took over, a track switched past
+	// before that was never decoded with
+	if (!replaced_audio_ctx)
+		replaced_audio_ctx = audio_codec_ctx;
+	else if (audio_codec_ctx != replaced_audio_ctx)
+		avcodec_close (audio_codec_ctx);
+	audio_stream->discard = AVDISCARD_ALL;
+	stream->discard       = AVDISCARD_DEFAULT;
+	audio_stream_idx      = index;
+	audio_stream          = stream;
+	audio_codec_ctx       = stream->codec;
+	pthread_mutex_unlock (&audio_track_mutex);
+	// what is queued of the old track goes now, and a decoding thread waiting to write gets room
+	if (pcm_pipeline)
+		pcm_ring_flush (audio_ring);
+	printf ("switched audio to stream %d\n", index);
+	return 0;
 }
 
 
-static void cleanup ()
+/**
+ *  Replaces the subtitle stream, or turns subtitles off with -1.
+ *  return int 0 on success, non-zero if the new decoder could not be opened
+ */
+static int switch_subtitle_track (int index)
 {
-	destroy_packet_buffer (&video_packet_fifo);
-	destroy_packet_buffer (&audio_packet_fifo);
+	AVStream* stream = index >= 0 ? fmt_ctx->streams[index] : NULL;
 
-	printf ("  closing streams\n");
-	if (audio_stream_idx != AVERROR_STREAM_NOT_FOUND)
+	if (stream && open_stream_codec (stream) != 0)
+		return 1;
+	pthread_mutex_lock (&subtitle_mutex);
+	flush_buffer (&subtitle_packet_fifo);
+	flush_subtitles ();
+	if (subtitle_stream_idx >= 0)
 	{
-		close_audio ();
-		printf ("     audio closed\n");
+		avcodec_close (subtitle_codec_ctx);
+		subtitle_stream->discard = AVDISCARD_ALL;
 	}
-	if (video_stream_idx != AVERROR_STREAM_NOT_FOUND)
+	subtitle_stream_idx = index;
+	subtitle_stream     = stream;
+	subtitle_codec_ctx  = stream ? stream->codec : NULL;
+	if (stream)
 	{
-		close_video ();
-		printf ("     video closed\n");
+		stream->discard = AVDISCARD_DEFAULT;
+		subtitles_codec (subtitle_codec_ctx);
 	}
+	pthread_mutex_unlock (&subtitle_mutex);
+	printf ("switched subtitles to stream %d\n", index);
+	return 0;
+}
 
-	printf ("  freeing ffmpeg structs\n");
-	av_frame_free (&av_frame);
-	avformat_close_input (&fmt_ctx);
 
-	printf ("  cleaning up components\n");
-	ilclient_state_transition   (list, OMX_StateIdle);
-	printf ("  OMX_StateIdle OK\n");
-	// ilclient_state_transition   (list, OMX_StateLoaded);
-	// printf ("  OMX_StateLoaded OK\n");
-	ilclient_cleanup_components (list);
+/**
+ *  Sends the demuxer back to a media time after a track switch, so the new track does not have to
+ *  wait until everything queued before it has played. The other streams drop what they read again
+ *  up to their last queued packet; the new audio drops what is late already.
+ *  switched has a bit (1 << rpi_mp_track_type) for each track type that was switched.
+ */
+static void reread_from (int64_t time, int switched)
+{
+	int type;
+
+	// a looping clip may have queued the next pass already, the new track catches up by itself;
+	// after a wrap or a discontinuity media time no longer is a position in the file either
+	if (flags & LOOPING || timeline_rebased (&packet_timeline) ||
+	    (queued_until[TRACK_VIDEO] == AV_NOPTS_VALUE && queued_until[TRACK_AUDIO] == AV_NOPTS_VALUE))
+		return;
+	if (av_seek_frame (fmt_ctx, -1, time, AVSEEK_FLAG_BACKWARD) < 0)
+	{
+		fprintf (stderr, "Could not go back to %lld after switching tracks\n", time);
+		return;
+	}
+	timeline_reset (&packet_timeline);
+	for (type = TRACK_VIDEO; type <= TRACK_SUBTITLE; type ++)
+		skip_until[type] = queued_until[type];
+	if (switched & 1 << TRACK_AUDIO)
+		skip_until[TRACK_AUDIO] = time;
+	// all of the new subtitles, events that are over already are dropped as they come
+	if (switched & 1 << TRACK_SUBTITLE)
+		skip_until[TRACK_SUBTITLE] = AV_NOPTS_VALUE;
+}
+
+
+/**
+ *  Carries out the track switches asked for since the last packet.
+ */
+static void switch_tracks ()
+{
+	int     audio, subtitle, switched = 0;
+	int64_t now = media_clock_now ();
+
+	pthread_mutex_lock (&flags_mutex);
+	audio             = next_audio_idx;
+	subtitle          = next_subtitle_idx;
+	next_audio_idx    = NO_TRACK_SWITCH;
+	next_subtitle_idx = NO_TRACK_SWITCH;
+	pthread_mutex_unlock (&flags_mutex);
+
+	if (audio != NO_TRACK_SWITCH && audio != audio_stream_idx && switch_audio_track (audio) == 0)
+		switched |= 1 << TRACK_AUDIO;
+	// turning subtitles off needs nothing read again
+	if (subtitle != NO_TRACK_SWITCH && subtitle != subtitle_stream_idx && switch_subtitle_track (subtitle) == 0 && subtitle >= 0)
+		switched |= 1 << TRACK_SUBTITLE;
+	if (switched)
+		reread_from (now, switched);
+}
+
+
+/**
+ *  Forgets what was queued, e.g. when opening or seeking.
+ */
+static void reset_track_switching ()
+{
+	int type;
+	for (type = TRACK_VIDEO; type <= TRACK_SUBTITLE; type ++)
+		queued_until[type] = skip_until[type] = AV_NOPTS_VALUE;
+	video_resume      = AV_NOPTS_VALUE;
+	next_audio_idx    = NO_TRACK_SWITCH;
+	next_subtitle_idx = NO_TRACK_SWITCH;
+}
+
+
+/**
+ *  Keep a copy of the keyframe positions of the video stream, the demuxer may
+ *  still modify its own index while we are playing.
+ */
+static void build_keyframe_index (const char* source)
+{
+	int     i;
+	int64_t start = fmt_ctx->start_time != AV_NOPTS_VALUE ? fmt_ctx->start_time : 0;
+
+	pthread_mutex_lock (&index_mutex);
+	source_path    = strdup (source);
+	keyframe_index = (int64_t*) malloc (video_stream->nb_index_entries * sizeof (int64_t));
+	n_keyframes    = 0;
+	for (i = 0; keyframe_index && i < video_stream->nb_index_entries; i ++)
+		if (video_stream->index_entries[i].flags & AVINDEX_KEYFRAME)
+			keyframe_index[n_keyframes ++] = av_rescale_q (video_stream->index_entries[i].timestamp,
+			                                               video_stream->time_base, AV_TIME_BASE_Q) - start;
+	pthread_mutex_unlock (&index_mutex);
+}
+
+/**
+ *	The first keyframe at or after position (media time), position itself if the index has none.
+ */
+static int64_t next_keyframe (int64_t position)
+{
+	int64_t start  = fmt_ctx->start_time != AV_NOPTS_VALUE ? fmt_ctx->start_time : 0;
+	int64_t target = position;
+	int     i;
+
+	pthread_mutex_lock (&index_mutex);
+	for (i = 0; i < n_keyframes; i ++)
+		if (keyframe_index[i] + start >= position)
+		{
+			target = keyframe_index[i] + start;
+			break;
+		}
+	pthread_mutex_unlock (&index_mutex);
+	return target;
+}
+
+/**
+ *	Positions a freshly opened rendition or clip at the first keyframe at or after position (media time),
+ *	so playback resumes close to where the previous one stopped without repeating frames.
+ */
+static void seek_to_keyframe (int64_t position)
+{
+	int64_t target = next_keyframe (position);
+
+	if (av_seek_frame (fmt_ctx, -1, target, AVSEEK_FLAG_BACKWARD) < 0)
+		fprintf (stderr, "Could not seek %s to %lld\n", fmt_ctx->filename, (long long) target);
+}
+
+static void free_keyframe_index ()
+{
+	pthread_mutex_lock (&index_mutex);
+	free (source_path);
+	free (keyframe_index);
+	source_path    = NULL;
+	keyframe_index = NULL;
+	n_keyframes    = 0;
+	pthread_mutex_unlock (&index_mutex);
+}
+
+
+int player_keyframe_index (const char* source, int64_t** keyframes)
+{
+	int n = 0;
+	*keyframes = NULL;
+	pthread_mutex_lock (&index_mutex);
+	if (source_path && n_keyframes > 0 && strcmp (source, source_path) == 0 &&
+	    (*keyframes = (int64_t*) malloc (n_keyframes * sizeof (int64_t))) != NULL)
+	{
+		memcpy (*keyframes, keyframe_index, n_keyframes * sizeof (int64_t));
+		n = n_keyframes;
+	}
+	pthread_mutex_unlock (&index_mutex);
+	return n;
+}
+
+
+static int create_hw_clock ()
+{
+	int ret = 0;
+	// create clock
+	if (ilclient_create_component (client, &video_clock, "clock", ILCLIENT_DISABLE_ALL_PORTS) != 0)
+	{
+		fprintf (stderr, "Error creating IL COMPONENT video clock\n");
+		ret = -14;
+	}
+	if (video_clock == NULL)
+		fprintf (stderr, "Error?\n");
+
+	list[2] = video_clock;
+	return ret;
+}
+
+
+static int setup_clock ()
+{
+	OMX_TIME_CONFIG_CLOCKSTATETYPE clock_state;
+	int ret = 0;
+
+	// set clock configuration
+	memset (&clock_state, 0, sizeof (clock_state));
+	clock_state.nSize             = sizeof (clock_state);
+	clock_state.nVersion.nVersion = OMX_VERSION;
+	clock_state.eState            = OMX_TIME_ClockStateWaitingForStartTime;
+	clock_state.nWaitMask         = 0;
+
+	if (audio_stream_idx != AVERROR_STREAM_NOT_FOUND)
+		clock_state.nWaitMask |= OMX_CLOCKPORT1;
+	// for low latency audio starts the clock alone, video that comes later catches up or is dropped
+	if (video_stream_idx != AVERROR_STREAM_NOT_FOUND && ~flags & SOFTWARE_VIDEO && !(flags & LOW_LATENCY && clock_state.nWaitMask))
+		clock_state.nWaitMask |= OMX_CLOCKPORT0;
+	// a live source runs the clock from the start, the first packet read sets it
+	if (flags & LIVE_SOURCE)
+		clock_state.nWaitMask = 0;
+	// software decoded video does not report a start time, without audio nothing else does
+	if (clock_state.nWaitMask == 0)
+	{
+		clock_state.eState     = OMX_TIME_ClockStateRunning;
+		clock_state.nStartTime = pts__omx_timestamp (fmt_ctx->start_time != AV_NOPTS_VALUE ? fmt_ctx->start_time : 0);
+	}
+
+	if (video_clock != NULL && OMX_SetParameter (ILC_GET_HANDLE (video_clock), OMX_IndexConfigTimeClockState, &clock_state) != OMX_ErrorNone)
+	{
+		fprintf (stderr, "Error settings parameters for video clock\n");
+		ret = -13;
+	}
+	return ret;
+}
+
+
+static void cleanup ()
+{
+	int i, n;
+
+	destroy_packet_buffer (&video_packet_fifo);
+	destroy_packet_buffer (&audio_packet_fifo);
+	if (flags & SUBTITLES_ON)
+	{
+		destroy_packet_buffer (&subtitle_packet_fifo);
+		destroy_subtitles ();
+		if (subtitle_stream_idx >= 0)
+			avcodec_close (subtitle_codec_ctx);
+	}
+
+	printf ("  closing streams\n");
+	if (audio_stream_idx != AVERROR_STREAM_NOT_FOUND)
+	{
+		close_audio ();
+		printf ("     audio closed\n");
+	}
+	if (video_stream_idx != AVERROR_STREAM_NOT_FOUND)
+	{
+		close_video ();
+		printf ("     video closed\n");
+	}
+
+	printf ("  freeing ffmpeg structs\n");
+	close_pcm_pipeline ();
+	free_keyframe_index ();
+	avformat_close_input (&fmt_ctx);
+	avformat_close_input (&retired_fmt_ctx);
+	close_custom_io (&custom_pb);
+	close_follow_io (&follow_pb);
+	destroy_timeline (&packet_timeline);
+
+	printf ("  cleaning up components\n");
+	// components that were not created leave holes, ilclient stops at the first NULL
+	for (i = 0, n = 0; i < sizeof (list) / sizeof (list[0]); i ++)
+		if (list[i])
+			list[n ++] = list[i];
+	while (n < sizeof (list) / sizeof (list[0]))
+		list[n ++] = NULL;
+	ilclient_state_transition   (list, OMX_StateIdle);
+	printf ("  OMX_StateIdle OK\n");
+	// ilclient_state_transition   (list, OMX_StateLoaded);
+	// printf ("  OMX_StateLoaded OK\n");
+	ilclient_cleanup_components (list);
 	printf ("  ilclient_cleanup_components OK\n");
 
 	flags = 0;
@@ -1090,20 +2743,7 @@ static void cleanup ()
 
 uint64_t rpi_mp_current_time ()
 {
-	OMX_TIME_CONFIG_TIMESTAMPTYPE timestamp;
-	memset (&timestamp, 0x0, sizeof (timestamp));
-	timestamp.nVersion.nVersion = OMX_VERSION;
-	timestamp.nSize 			= sizeof (OMX_TIME_CONFIG_TIMESTAMPTYPE);
-	timestamp.nPortIndex		= CLOCK_AUDIO_PORT;
-
-	OMX_ERRORTYPE omx_error;
-	if (( omx_error = OMX_GetParameter (ILC_GET_HANDLE (video_clock), OMX_IndexConfigTimeCurrentMediaTime, &timestamp)) != OMX_ErrorNone)
-	{
-		fprintf (stderr, "Could not get timestamp config from clock component. Error 0x%08x\n", omx_error);
-		return 0;
-	}
-	uint64_t pts = (uint64_t) (timestamp.nTimestamp.nLowPart | (uint64_t) timestamp.nTimestamp.nHighPart << 32);
-	return pts / AV_TIME_BASE;
+	return (uint64_t) loop_position (&loop, media_clock_now () - clip_offset) / AV_TIME_BASE;
 }
 
 
@@ -1114,6 +2754,7 @@ int rpi_mp_seek (int64_t position)
 	// make sure we are paused first
 	// if ( ~flags & PAUSED ) pause_playback ();
 	lock();
+	alloc_debug_phase ( ALLOC_SEEK );
 
 	OMX_TIME_CONFIG_CLOCKSTATETYPE clock;
 	memset ( & clock, 0x0, sizeof ( OMX_TIME_CONFIG_CLOCKSTATETYPE ) );
@@ -1135,12 +2776,24 @@ int rpi_mp_seek (int64_t position)
 	printf ( "trying to seek to position %llu\n", position );
 
 	// clear fifo queues
+	reset_track_switching ();
 	flush_buffer ( & video_packet_fifo );
 	flush_buffer ( & audio_packet_fifo );
+	if ( pcm_pipeline )
+		pcm_ring_flush ( audio_ring );
+	if ( audio_tap_on )
+		audio_tap_flush ( & audio_analysis );
+	if ( flags & SUBTITLES_ON )
+	{
+		flush_buffer ( & subtitle_packet_fifo );
+		flush_subtitles ();
+	}
 
 	// flush video buffer
 	//*
-	if ( ( omx_error = OMX_SendCommand ( ILC_GET_HANDLE ( video_decode ), OMX_CommandFlush, VIDEO_DECODE_INPUT_PORT, NULL ) != OMX_ErrorNone ) )
+	if ( flags & SOFTWARE_VIDEO )
+		soft_video_flush ( & software_video );
+	else if ( ( omx_error = OMX_SendCommand ( ILC_GET_HANDLE ( video_decode ), OMX_CommandFlush, VIDEO_DECODE_INPUT_PORT, NULL ) != OMX_ErrorNone ) )
 	{
 		fprintf ( stderr, "Could not flush video decoder input (0x%08x)\n", omx_error );
 		return 1;
@@ -1168,6 +2821,11 @@ int rpi_mp_seek (int64_t position)
 
 	// seek to frame
 	int ret = av_seek_frame ( fmt_ctx, -1, position, AVSEEK_FLAG_ANY );
+	timeline_reset ( & packet_timeline );
+	clip_offset = 0;
+	// the clock is set to the unshifted position below
+	if ( flags & LOOPING )
+		init_loop ( & loop, fmt_ctx );
 
 	double t = (double) position * audio_stream->r_frame_rate.num / audio_stream->r_frame_rate.den;
 
@@ -1186,6 +2844,7 @@ int rpi_mp_seek (int64_t position)
 		fprintf ( stderr, "Could not set timestamp for clock component. Error 0x%08x\n", omx_error );
 	 	return 0;
 	}
+	media_clock_resync ();
 	// SET_FLAG ( FIRST_AUDIO );
 	// SET_FLAG ( FIRST_VIDEO );
 
@@ -1223,12 +2882,14 @@ int rpi_mp_init ()
 		return 1;
 	}
 	memset (list, 0, sizeof (list));
+	init_packet_pool (PACKET_POOL_SIZE);
 	return 0;
 }
 
 
 void rpi_mp_deinit ()
 {
+	destroy_packet_pool ();
 	OMX_Deinit();
 	ilclient_destroy (client);
 }
@@ -1236,20 +2897,79 @@ void rpi_mp_deinit ()
 
 int rpi_mp_open (const char* source, int* image_width, int* image_height, int64_t* duration, int init_flags)
 {
-	int ret = 0;
+	AVDictionary* options = NULL;
+	int ret = 0, i;
+	alloc_debug_phase (ALLOC_OPEN);
+	open_flags       = init_flags;
+	window_drops     = 0;
+	window_start     = 0;
+	renditions_fixed = 0;
 	flags = FIRST_VIDEO |
 			FIRST_AUDIO |
-			(init_flags & RENDER_VIDEO_TO_TEXTURE ? RENDER_2_TEXTURE : 0) |
-			(init_flags & ANALOG_AUDIO ? ANALOG_AUDIO_OUT : 0);
+			(init_flags & RENDER_VIDEO_TO_TEXTURE ? RENDER_2_TEXTURE :
+			 init_flags & (RENDER_VIDEO_TO_I420 | RENDER_VIDEO_TO_NV12) ? RENDER_2_YUV : 0) |
+			(init_flags & ANALOG_AUDIO ? ANALOG_AUDIO_OUT : 0) |
+			(init_flags & AUDIO_PASSTHROUGH ? PASSTHROUGH_AUDIO : 0) |
+			(init_flags & LOOP ? LOOPING : 0) |
+			(init_flags & LOW_LATENCY_AUDIO ? LOW_LATENCY : 0) |
+			(init_flags & LIVE ? LIVE_SOURCE : 0) |
+			(init_flags & FOLLOW ? FOLLOW_SOURCE : 0);
+
+	memset (&video_buffer_stats, 0x0, sizeof (video_buffer_stats));
+	memset (&audio_buffer_stats, 0x0, sizeof (audio_buffer_stats));
+	memset (&drop_stats, 0x0, sizeof (drop_stats));
+	thread_latency_reset ();
+	reset_track_switching ();
+	memset (&live_stats, 0x0, sizeof (live_stats));
+	live_newest   = AV_NOPTS_VALUE;
+	live_resynced = 0;
+	follow_newest = AV_NOPTS_VALUE;
+	// a new clock, the crossfades on the last one swapped its video ports
+	clip_offset         = 0;
+	video_clock_port    = CLOCK_VIDEO_PORT;
+	next_clock_port     = CLOCK_NEXT_VIDEO_PORT;
 
 	// egl callback in case we are rendering to texture
 	if (flags & RENDER_2_TEXTURE)
 		ilclient_set_fill_buffer_done_callback (client, fill_egl_texture_buffer, 0);
+	else if (flags & RENDER_2_YUV)
+	{
+		yuv_format = init_flags & RENDER_VIDEO_TO_NV12 ? OMX_COLOR_FormatYUV420PackedSemiPlanar : OMX_COLOR_FormatYUV420PackedPlanar;
+		ilclient_set_fill_buffer_done_callback (client, yuv_buffer_filled, 0);
+	}
 
+	// a live source is probed only as far as needed to find the streams, and the packets read
+	// while probing are not kept; waiting out reordered RTP packets is kept short
+	if (flags & LIVE_SOURCE)
+	{
+		av_dict_set (&options, "fflags", "nobuffer", 0);
+		av_dict_set_int (&options, "probesize", LIVE_PROBE_SIZE, 0);
+		av_dict_set_int (&options, "analyzeduration", LIVE_ANALYZE_US, 0);
+		av_dict_set_int (&options, "max_delay", LIVE_REORDER_US, 0);
+		// a session description only names the RTP streams, which a local file may not open by default
+		if (av_match_ext (source, "sdp"))
+			av_dict_set (&options, "protocol_whitelist", "file,udp,rtp", 0);
+	}
+	// a file that is still being written is read through follow IO, which waits at its end;
+	// media opened with rpi_mp_open_io already has its reader
+	if (flags & FOLLOW_SOURCE && !fmt_ctx)
+	{
+		if (!(follow_pb = open_follow_io (source, follow_suffix[0] ? follow_suffix : NULL, follow_timeout_ms)) ||
+		    !(fmt_ctx = avformat_alloc_context ()))
+		{
+			close_follow_io (&follow_pb);
+			av_dict_free (&options);
+			return 1;
+		}
+		fmt_ctx->pb = follow_pb;
+	}
     // open source
-	if (avformat_open_input (&fmt_ctx, source, NULL, NULL) < 0)
+	ret = avformat_open_input (&fmt_ctx, source, NULL, &options);
+	av_dict_free (&options);
+	if (ret < 0)
 	{
 		fprintf (stderr, "Could not open source %s\n", source);
+		close_follow_io (&follow_pb);
 		return 1;
 	}
     // search for streams
@@ -1258,6 +2978,8 @@ int rpi_mp_open (const char* source, int* image_width, int* image_height, int64_
 		fprintf (stderr, "Could not find stream information\n");
 		return 1;
 	}
+	init_loop (&loop, fmt_ctx);
+	init_timeline (&packet_timeline, fmt_ctx);
 	// create clock
 	if (create_hw_clock() == 0)
 	{
@@ -1270,17 +2992,42 @@ int rpi_mp_open (const char* source, int* image_width, int* image_height, int64_
 			{
 				*image_width  = video_codec_ctx->width;
 				*image_height = video_codec_ctx->height;
+				// the application makes the textures this size
+				if (flags & RENDER_2_TEXTURE)
+				{
+					texture_width  = video_codec_ctx->width;
+					texture_height = video_codec_ctx->height;
+				}
 			}
+			build_keyframe_index (source);
 		}
 		// open audio
 		if (open_codec_context (&audio_stream_idx, AVMEDIA_TYPE_AUDIO) == 0)
 		{
 			audio_stream    = fmt_ctx->streams[audio_stream_idx];
 			audio_codec_ctx = audio_stream->codec;
-			open_audio ();
+			if (open_audio () == 0 && (~flags & (HARDWARE_DECODE_AUDIO | PASSTHROUGH_AUDIO)))
+				open_pcm_pipeline ();
 		}
 		else
 			SET_FLAG(NO_AUDIO_STREAM);
+		// open subtitles
+		if (init_flags & SUBTITLES && open_codec_context (&subtitle_stream_idx, AVMEDIA_TYPE_SUBTITLE) == 0)
+		{
+			subtitle_stream    = fmt_ctx->streams[subtitle_stream_idx];
+			subtitle_codec_ctx = subtitle_stream->codec;
+			if (init_subtitles (subtitle_codec_ctx,
+			                    video_codec_ctx ? video_codec_ctx->width  : 0,
+			                    video_codec_ctx ? video_codec_ctx->height : 0,
+			                    ~flags & (RENDER_2_TEXTURE | RENDER_2_YUV)) == 0)
+				SET_FLAG (SUBTITLES_ON)
+			else
+				avcodec_close (subtitle_codec_ctx);
+		}
+		// the demuxer skips the streams nobody plays instead of reading them into packets
+		for (i = 0; i < (int) fmt_ctx->nb_streams; i ++)
+			fmt_ctx->streams[i]->discard = i == video_stream_idx || i == audio_stream_idx ||
+			                               (flags & SUBTITLES_ON && i == subtitle_stream_idx) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
 
 		// check that we did get streams
 		if (video_stream_idx == AVERROR_STREAM_NOT_FOUND && audio_stream_idx == AVERROR_STREAM_NOT_FOUND)
@@ -1306,13 +3053,6 @@ int rpi_mp_open (const char* source, int* image_width, int* image_height, int64_
 	}
 	// dump input format
 	av_dump_format (fmt_ctx, 0, source, 0);
-	// allocate frame for decoding (audio here)
-	if (!(av_frame = av_frame_alloc()))
-	{
-		fprintf (stderr, "Could not allocate frame\n");
-		ret = AVERROR (ENOMEM);
-		goto end;
-	}
 	// initialize packet
 	av_init_packet (&av_packet);
 	av_packet.data = NULL;
@@ -1320,90 +3060,726 @@ int rpi_mp_open (const char* source, int* image_width, int* image_height, int64_
 	// init buffers
 	init_packet_buffer (&video_packet_fifo, 1024 * 1024 * 5);
 	init_packet_buffer (&audio_packet_fifo, 1024 * 1024 * 5);
+	if (flags & SUBTITLES_ON)
+		init_packet_buffer (&subtitle_packet_fifo, 1024 * 1024);
+	// the bytes of a second of a camera vary too much with the scene, a live source is buffered by time
+	if (flags & LIVE_SOURCE)
+	{
+		packet_buffer_max_duration (&video_packet_fifo, LIVE_FIFO_US);
+		packet_buffer_max_duration (&audio_packet_fifo, LIVE_FIFO_US);
+		live_stats.target_us = (int64_t) live_target_ms * 1000;
+	}
 end:
 	return ret;
 }
 
 
+/**
+ *	Frees the list of renditions.
+ */
+static void free_renditions ()
+{
+	int i;
+	for (i = 0; i < n_renditions; i ++)
+		free (renditions[i]);
+	free (renditions);
+	renditions        = NULL;
+	n_renditions      = 0;
+	current_rendition = 0;
+}
+
+
+int rpi_mp_open_renditions (const char* files[], int count, int* image_width, int* image_height, int64_t* duration, int init_flags)
+{
+	int* order = (int*) malloc (count * sizeof (int));
+	int  chosen = -1, n = 0, i;
+
+	free_renditions ();
+	if (order)
+		chosen = select_rendition (client, files, count, order, &n);
+	if (chosen < 0 || !(renditions = (char**) calloc (n - chosen, sizeof (char*))))
+	{
+		fprintf (stderr, "None of the renditions could be opened\n");
+		free (order);
+		return 1;
+	}
+	// only switching down is done, so the higher ones are not kept
+	for (i = chosen; i < n; i ++)
+		renditions[n_renditions ++] = strdup (files[order[i]]);
+	free (order);
+	printf ("playing rendition %s\n", renditions[0]);
+	return rpi_mp_open (renditions[0], image_width, image_height, duration, init_flags);
+}
+
+
+int rpi_mp_current_rendition (const char** file)
+{
+	if (file)
+		*file = n_renditions ? renditions[current_rendition] : NULL;
+	return n_renditions ? current_rendition : -1;
+}
+
+
+int rpi_mp_open_io (const rpi_mp_io* io, const char* name, int* image_width, int* image_height, int64_t* duration, int init_flags)
+{
+	int ret;
+	if (!(custom_pb = open_custom_io (io)))
+	{
+		fprintf (stderr, "Could not create IO context\n");
+		return 1;
+	}
+	// avformat_open_input uses a preallocated context and keeps a pb that is already set
+	if (!(fmt_ctx = avformat_alloc_context ()))
+	{
+		close_custom_io (&custom_pb);
+		return 1;
+	}
+	fmt_ctx->pb = custom_pb;
+	if ((ret = rpi_mp_open (name ? name : "", image_width, image_height, duration, init_flags)) != 0)
+	{
+		avformat_close_input (&fmt_ctx);
+		close_custom_io (&custom_pb);
+	}
+	else if (io->data)
+		SET_FLAG (SPAN_SOURCE);
+	return ret;
+}
+
+
 void rpi_mp_setup_render_buffer (void *_egl_images[], int *_current_texture, pthread_mutex_t** draw_mutex, pthread_cond_t** draw_cond)
 {
 	for ( int i = 0; i < BUFFER_COUNT; i++)
-		egl_images[i] = _egl_images[i];
+		egl_images[0][i] = _egl_images[i];
 
-	current_texture = _current_texture;
+	current_texture[0] = _current_texture;
 	*draw_mutex = &buffer_filled_mut;
 	*draw_cond  = &buffer_filled_cond;
 }
 
 
-int rpi_mp_start ()
+void rpi_mp_setup_transition_buffer (void *_egl_images[], int *_current_texture)
 {
-	// start threads
-	pthread_t video_decoding, audio_decoding;
-	pthread_create (&video_decoding, NULL, (void*) &video_decoding_thread, NULL);
-	pthread_create (&audio_decoding, NULL, (void*) &audio_decoding_thread, NULL);
-
-	// start clock
-	ilclient_change_component_state (video_clock, OMX_StateExecuting);
+	for ( int i = 0; i < BUFFER_COUNT; i++)
+		egl_images[1][i] = _egl_images[i];
 
-	// read packets from source
-	while (~flags & STOPPED && (av_read_frame (fmt_ctx, &av_packet) >= 0))
-	{
-		if (process_packet() != 0)
-			break;
-	}
-	SET_FLAG (DONE_READING);
-	printf ("done reading\n");
+	current_texture[1] = _current_texture;
+}
 
-	// wait for all threads to end
-	pthread_join (video_decoding, NULL);
-	pthread_join (audio_decoding, NULL);
-	SET_FLAG (STOPPED);
 
-	// cleanup
-	printf ("cleaning up... \n");
-	cleanup ();
-	printf ("stopping reading thread\n");
-	return 0;
+int rpi_mp_texture_set ()
+{
+	return __atomic_load_n (&shown_set, __ATOMIC_RELAXED);
 }
 
 
-void rpi_mp_stop ()
+/**
+ *	What the crossfade cost so far. Called with transition_mutex held.
+ */
+static void overlap_stats (rpi_mp_overlap_stats* stats)
 {
-	SET_FLAG (STOPPED);
-	// make sure to unpause otherwise threads won't exit
-	if (flags & PAUSED)
-        rpi_mp_pause();
-	// flush video component
-	if (video_stream_idx != AVERROR_STREAM_NOT_FOUND)
+	transition_stats (&next_clip, stats);
+	stats->frames_decoded = __atomic_load_n (&next_filled, __ATOMIC_RELAXED);
+	stats->frames_shown   = next_shown;
+	stats->frames_skipped = stats->frames_decoded > next_shown ? stats->frames_decoded - next_shown : 0;
+	stats->handover_us    = handover_start ? monotonic_us () - handover_start : 0;
+}
+
+/**
+ *	Ends the crossfade or drops the prepared clip, keeping the statistics of a crossfade.
+ *	Waits for the application to hand back the frame it holds. Called with transition_mutex held.
+ *	@return int non-zero if the caller is to close the clip with close_next_clip, without the mutex
+ */
+static int end_transition ()
+{
+	int close = next_open;
+
+	while (transition_locked)
+		pthread_cond_wait (&transition_cond, &transition_mutex);
+	if (transition_state == TRANSITION_FADING || transition_state == TRANSITION_HANDOVER)
 	{
-		OMX_ERRORTYPE omx_error;
-		if ((omx_error = OMX_SendCommand (ILC_GET_HANDLE (video_decode), OMX_CommandFlush, 130, NULL) != OMX_ErrorNone))
-			fprintf (stderr, "Could not flush video decoder input (0x%08x)\n", omx_error);
+		overlap_stats (&transition_result);
+		transition_result.running = 0;
+		transition_reported       = 1;
 	}
+	transition_state = TRANSITION_NONE;
+	handover_start   = 0;
+	next_open        = 0;
+	return close;
 }
 
+/**
+ *	Stops the decoder chain and the threads of the next clip and frees what the pipeline did not
+ *	take over of it. The submit thread mixes under transition_mutex, so not called with it held.
+ */
+static void close_next_clip ()
+{
+	pcm_ring* ring = next_clip.pcm;
+
+	stop_next_feeder (1);
+	close_transition (&next_clip);
+	close_next_video ();
+	if (ring)
+		destroy_pcm_ring (ring);
+	next_clip.pcm = NULL;
+}
 
-void rpi_mp_pause ()
+/**
+ *	Closes the demuxer and codecs of the clip faded out and takes those of the clip faded into, on
+ *	the timeline of the clip before.
+ *	@param int mix
+ *		its audio was decoded into a ring the pipeline plays on, it has no audio otherwise
+ */
+static void adopt_next_clip (int mix)
 {
-	OMX_TIME_CONFIG_SCALETYPE scale;
-	memset (&scale, 0x0, sizeof (OMX_TIME_CONFIG_SCALETYPE));
-	scale.nSize 			= sizeof (OMX_TIME_CONFIG_SCALETYPE);
-	scale.nVersion.nVersion = OMX_VERSION;
-	scale.xScale 			= (flags & PAUSED ? 1 << 16 : 0);
+	// the streams of the clip faded out; its subtitles end with it
+	if (flags & SUBTITLES_ON)
+	{
+		destroy_packet_buffer (&subtitle_packet_fifo);
+		destroy_subtitles ();
+		if (subtitle_stream_idx >= 0)
+			avcodec_close (subtitle_codec_ctx);
+	}
+	if (video_codec_ctx)
+		avcodec_close (video_codec_ctx);
+	if (audio_codec_ctx)
+		avcodec_close (audio_codec_ctx);
+	if (replaced_audio_ctx)
+		avcodec_close (replaced_audio_ctx);
+	replaced_audio_ctx = NULL;
+	free_keyframe_index ();
+	avformat_close_input (&fmt_ctx);
+	avformat_close_input (&retired_fmt_ctx);
+	close_custom_io (&custom_pb);
+	close_follow_io (&follow_pb);
+	destroy_timeline (&packet_timeline);
+	UNSET_FLAG ((SUBTITLES_ON | LIVE_SOURCE | FOLLOW_SOURCE | SPAN_SOURCE))
+
+	fmt_ctx           = next_clip.fmt_ctx;
+	next_clip.fmt_ctx = NULL;
+	packet_timeline   = next_clip.packet_timeline;
+	memset (&next_clip.packet_timeline, 0x0, sizeof (timeline));
+	timeline_shift (&packet_timeline, next_clip.shift);
+	clip_offset       = next_clip.shift;
+
+	video_stream_idx    = next_clip.video_idx;
+	video_stream        = fmt_ctx->streams[video_stream_idx];
+	video_codec_ctx     = video_stream->codec;
+	subtitle_stream_idx = AVERROR_STREAM_NOT_FOUND;
+	subtitle_stream     = NULL;
+	subtitle_codec_ctx  = NULL;
+	if (mix)
+	{
+		audio_stream_idx       = next_clip.audio_idx;
+		audio_stream           = fmt_ctx->streams[audio_stream_idx];
+		audio_codec_ctx        = next_clip.audio_ctx;
+		// and the decoding stage it was decoded with, its counts stay with the crossfade
+		destroy_audio_decoder (&pcm_decoder);
+		pcm_decoder               = next_clip.decoder;
+		pcm_decoder.tap           = audio_tap_on ? tap_audio_frame : NULL;
+		next_clip.decoder.frame   = NULL;
+		next_clip.decoder.scratch = NULL;
+	}
+	else
+	{
+		audio_stream_idx = AVERROR_STREAM_NOT_FOUND;
+		audio_stream     = NULL;
+		audio_codec_ctx  = NULL;
+		SET_FLAG (NO_AUDIO_STREAM)
+	}
+	next_clip.audio_ctx = NULL;
+
+	skip_to_restart = 0;
+	drop_late_video = video_codec_ctx->codec_id == AV_CODEC_ID_H264;
+	nal_length_size = h264_nal_length_size (video_codec_ctx->extradata, video_codec_ctx->extradata_size);
+	init_loop (&loop, fmt_ctx);
+	reset_track_switching ();
+	build_keyframe_index (next_source);
+}
 
-	OMX_ERRORTYPE omx_error;
-	if ((omx_error = OMX_SetParameter (ILC_GET_HANDLE (video_clock), OMX_IndexConfigTimeScale, &scale)) != OMX_ErrorNone)
+/**
+ *	Makes the chain of the clip faded into the video chain, and the one of the clip faded out the
+ *	second chain, which is closed next.
+ */
+static void swap_video_chains ()
+{
+	COMPONENT_T*          component;
+	OMX_BUFFERHEADERTYPE* buffer;
+	TUNNEL_T              tunnel;
+	int                   i, port, output;
+
+	pthread_mutex_lock (&chains_mutex);
+	component = video_decode;    video_decode    = next_decode;    next_decode    = component;
+	component = video_scheduler; video_scheduler = next_scheduler; next_scheduler = component;
+	component = egl_render;      egl_render      = next_egl_render; next_egl_render = component;
+	for (i = 0; i < 4; i ++)
 	{
-		fprintf (stderr, "Could not set scale parameter on video clock. Error 0x%08x\n", omx_error);
-		return;
+		tunnel          = video_tunnel[i];
+		video_tunnel[i] = next_tunnel[i];
+		next_tunnel[i]  = tunnel;
 	}
-	if (~flags & PAUSED)
+	for (i = 0; i < BUFFER_COUNT; i ++)
 	{
-		SET_FLAG (PAUSED);
-		/*
-		//printf ( "waiting for threads to pause...\n" );
-		// make sure threads are paused
+		buffer              = omx_egl_buffers[i];
+		omx_egl_buffers[i]  = next_egl_buffers[i];
+		next_egl_buffers[i] = buffer;
+	}
+	port             = video_clock_port;
+	video_clock_port = next_clock_port;
+	next_clock_port  = port;
+	playing_set      = faded_set;
+	next_set         = !faded_set;
+	// the application draws the clip faded into as the clip playing from its first frame on
+	if (next_filled)
+		shown_set = playing_set;
+	output      = next_output;
+	next_output = 0;
+	video_buffer_stats = next_buffer_stats;
+	list[0] = video_decode;
+	list[1] = egl_render;
+	list[3] = video_scheduler;
+	pthread_mutex_unlock (&chains_mutex);
+
+	// without a frame yet the video decoding thread sets up its output
+	if (output)
+		SET_FLAG (PORT_SETTINGS_CHANGED)
+	else
+		UNSET_FLAG (PORT_SETTINGS_CHANGED)
+}
+
+/**
+ *	Hands the pipeline over to the clip faded into once the decoding threads of the clip faded out
+ *	stopped: its decoder chain, which rendered into the other set of textures, becomes the video
+ *	chain, its ring the one the submit thread plays, and its demuxer and the packets it read go on
+ *	in the reading loop, on the timeline of the clip before. The clock and the renderers run on.
+ */
+static void hand_over (pthread_t* audio_submit)
+{
+	pcm_ring* outgoing = audio_ring;
+	int       mix      = next_clip.mix, close;
+	int64_t   now;
+
+	// the clock is running, no buffer of the next clip starts it
+	UNSET_FLAG ((FIRST_VIDEO | FIRST_AUDIO))
+	// what is left of the outgoing audio plays out, mixed with the next clip's
+	if (pcm_pipeline)
+		pthread_join (*audio_submit, NULL);
+	pthread_mutex_lock (&transition_mutex);
+	// the clip playing ended with a clip prepared, which follows the audio queued with a cut
+	if (transition_state == TRANSITION_PREPARED)
+	{
+		now = media_clock_now ();
+		transition_start (&next_clip, 0, pcm_pipeline && pcm_submit.end != AV_NOPTS_VALUE && pcm_submit.end > now ? pcm_submit.end : now);
+	}
+	transition_state = TRANSITION_HANDOVER;
+	handover_start   = monotonic_us ();
+	pthread_mutex_unlock (&transition_mutex);
+	printf ("handing over to %s\n", next_source);
+
+	// without its audio mixed in, the next clip plays without audio
+	if (!mix && pcm_pipeline)
+	{
+		if (audio_tap_on)
+			stop_audio_tap (&audio_analysis);
+		close_pcm_pipeline ();
+	}
+	// the video decoding thread feeds its decoder from now on, starting with what was demuxed
+	stop_next_feeder (0);
+	transition_detach (&next_clip);
+	flush_buffer (&video_packet_fifo);
+	flush_buffer (&audio_packet_fifo);
+	if (transition_take_packets (&next_clip, &video_packet_fifo, mix ? &audio_packet_fifo : NULL) != 0)
+		fprintf (stderr, "Packets of %s dropped at the handover\n", next_source);
+	adopt_next_clip (mix);
+	swap_video_chains ();
+	close_next_video ();
+	// its audio plays on from where the mix got; what the pipeline decodes is on the timeline already
+	if (mix)
+	{
+		audio_ring      = next_clip.pcm;
+		pcm_submit.ring = audio_ring;
+		pcm_ring_shift (audio_ring, 0, 0);
+		next_clip.pcm = NULL;
+		destroy_pcm_ring (outgoing);
+		pthread_create (audio_submit, NULL, (void*) &audio_submit_thread, NULL);
+	}
+
+	pthread_mutex_lock (&transition_mutex);
+	close = end_transition ();
+	pthread_mutex_unlock (&transition_mutex);
+	if (close)
+		close_next_clip ();
+	free_renditions ();
+	UNSET_FLAG ((SWITCH_CLIP | SWITCH_RENDITION | DONE_READING))
+}
+
+/**
+ *	Whether only the video chain has to change to play a rendition: the audio decoder plays on
+ *	with the same track of it, and with texture output its video has to fit the textures.
+ *  @return int non-zero if it can, with the streams to read in video_idx and audio_idx
+ */
+static int rendition_continues (AVFormatContext* next, int* video_idx, int* audio_idx)
+{
+	const AVCodecContext* video, * audio;
+	int64_t               start = next->start_time != AV_NOPTS_VALUE ? next->start_time : 0;
+
+	if ((*video_idx = av_find_best_stream (next, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0)) < 0)
+		return 0;
+	video = next->streams[*video_idx]->codec;
+	if (flags & RENDER_2_TEXTURE && (video->width > texture_width || video->height > texture_height))
+		return 0;
+	// software decoding renders to the display only
+	if (flags & (RENDER_2_TEXTURE | RENDER_2_YUV) && omx_video_coding (video->codec_id) == OMX_VIDEO_CodingUnused)
+		return 0;
+	// a loop goes back to the start of the first rendition
+	if (flags & LOOPING && start != loop.start)
+		return 0;
+	*audio_idx = AVERROR_STREAM_NOT_FOUND;
+	if (audio_stream_idx < 0)
+		return 1;
+	// the track playing if the streams are laid out alike, the best one otherwise
+	if (audio_stream_idx < (int) next->nb_streams && next->streams[audio_stream_idx]->codec->codec_type == AVMEDIA_TYPE_AUDIO)
+		*audio_idx = audio_stream_idx;
+	else if ((*audio_idx = av_find_best_stream (next, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0)) < 0)
+		return 0;
+	audio = next->streams[*audio_idx]->codec;
+	return audio->codec_id == audio_codec_ctx->codec_id && audio->sample_rate == audio_codec_ctx->sample_rate &&
+	       audio->channels == audio_codec_ctx->channels && audio->sample_fmt == audio_codec_ctx->sample_fmt &&
+	       audio->extradata_size == audio_codec_ctx->extradata_size &&
+	       (audio->extradata_size == 0 || memcmp (audio->extradata, audio_codec_ctx->extradata, audio->extradata_size) == 0);
+}
+
+/**
+ *	Switches to the next lower rendition while the clock and the audio play on: the video threads
+ *	stop, the video chain is closed, and opened again for the video of the next rendition from its
+ *	first keyframe after switch_position. The new demuxer goes on where the audio was queued to, on
+ *	the timeline of the one before. Texture output keeps its textures.
+ *	Called by the reading thread between two packets, it restarts the video threads.
+ *  @return int 0 to read on, non-zero to reopen the whole pipeline for the next rendition
+ */
+static int switch_video_rendition (pthread_t* video_decoding, pthread_t* software_render)
+{
+	AVFormatContext* next   = NULL,
+	               * previous;
+	const char*      source = renditions[current_rendition + 1];
+	int              video_idx, audio_idx, subtitle_idx, pending, retire, i;
+	int64_t          shift, keyframe, resume;
+
+	// a crossfade started since, the clip playing is on its way out anyway
+	pthread_mutex_lock (&transition_mutex);
+	pending = transition_state != TRANSITION_NONE;
+	pthread_mutex_unlock (&transition_mutex);
+	if (pending || (flags & LOOPING && switch_position < clip_offset + loop.offset))
+	{
+		// the demuxer looped ahead of the clock; the drops ask again if they go on
+		UNSET_FLAG (SWITCH_RENDITION)
+		return 0;
+	}
+	// after a track switch the audio thread takes over the codec of the demuxer first
+	pthread_mutex_lock (&audio_track_mutex);
+	pending = replaced_audio_ctx != NULL;
+	pthread_mutex_unlock (&audio_track_mutex);
+	if (pending)
+		return 0;
+	// media time has to be a position in the file
+	if (flags & (LIVE_SOURCE | FOLLOW_SOURCE) || timeline_rebased (&packet_timeline) ||
+	    avformat_open_input (&next, source, NULL, NULL) < 0)
+		goto reopen;
+	if (avformat_find_stream_info (next, NULL) < 0 || !rendition_continues (next, &video_idx, &audio_idx) ||
+	    open_stream_codec (next->streams[video_idx]) != 0)
+	{
+		avformat_close_input (&next);
+		goto reopen;
+	}
+	printf ("switching video to %s\n", source);
+
+	// only the video threads stop, audio plays on from what is queued
+	SET_FLAG (VIDEO_STOPPED)
+	if (flags & SOFTWARE_VIDEO)
+		soft_video_abort (&software_video);
+	pthread_join (*video_decoding, NULL);
+	if (flags & SOFTWARE_VIDEO)
+		pthread_join (*software_render, NULL);
+	flush_buffer (&video_packet_fifo);
+	close_video_chain ();
+
+	// the audio decoder is a codec of the demuxer it was opened with, which stays until it is closed
+	retire   = audio_stream && audio_codec_ctx == audio_stream->codec;
+	previous = fmt_ctx;
+	shift    = clip_offset + loop.start - (next->start_time != AV_NOPTS_VALUE ? next->start_time : 0);
+	for (i = 0; i < (int) next->nb_streams; i ++)
+		next->streams[i]->discard = i == video_idx || i == audio_idx ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+	fmt_ctx          = next;
+	video_stream_idx = video_idx;
+	video_stream     = next->streams[video_idx];
+	video_codec_ctx  = video_stream->codec;
+	pthread_mutex_lock (&audio_track_mutex);
+	audio_stream_idx = audio_idx;
+	audio_stream     = audio_idx >= 0 ? next->streams[audio_idx] : NULL;
+	pthread_mutex_unlock (&audio_track_mutex);
+	// subtitles go over to the new file, they are read again from the switch on
+	if (flags & SUBTITLES_ON && subtitle_stream_idx >= 0)
+	{
+		subtitle_idx = av_find_best_stream (next, AVMEDIA_TYPE_SUBTITLE, -1, -1, NULL, 0);
+		if (switch_subtitle_track (subtitle_idx >= 0 ? subtitle_idx : -1) != 0)
+			switch_subtitle_track (-1);
+	}
+	else if (~flags & SUBTITLES_ON)
+	{
+		subtitle_stream_idx = AVERROR_STREAM_NOT_FOUND;
+		subtitle_stream     = NULL;
+		subtitle_codec_ctx  = NULL;
+	}
+	if (retire)
+	{
+		avformat_close_input (&retired_fmt_ctx);
+		retired_fmt_ctx = previous;
+	}
+	else
+		avformat_close_input (&previous);
+	destroy_timeline (&packet_timeline);
+	init_timeline (&packet_timeline, fmt_ctx);
+	timeline_shift (&packet_timeline, shift);
+	free_keyframe_index ();
+	build_keyframe_index (source);
+
+	// positions in the file are media time without the shift and the passes looped
+	keyframe = next_keyframe (switch_position - shift - loop.offset);
+	resume   = keyframe;
+	if (queued_until[TRACK_AUDIO] != AV_NOPTS_VALUE && queued_until[TRACK_AUDIO] - shift - loop.offset < resume)
+		resume = queued_until[TRACK_AUDIO] - shift - loop.offset;
+	if (av_seek_frame (fmt_ctx, -1, resume, AVSEEK_FLAG_BACKWARD) < 0)
+		fprintf (stderr, "Could not seek %s to %lld\n", source, (long long) resume);
+	// a millisecond short of the keyframe, the index and the timeline rescale it separately
+	video_resume               = keyframe + shift + loop.offset - 1000;
+	skip_until[TRACK_VIDEO]    = AV_NOPTS_VALUE;
+	skip_until[TRACK_AUDIO]    = queued_until[TRACK_AUDIO];
+	skip_until[TRACK_SUBTITLE] = AV_NOPTS_VALUE;
+
+	current_rendition ++;
+	pthread_mutex_lock (&drops_mutex);
+	window_drops = 0;
+	window_start = media_clock_now ();
+	pthread_mutex_unlock (&drops_mutex);
+
+	// the clock is running, the new decoder does not start it
+	UNSET_FLAG ((PORT_SETTINGS_CHANGED | SOFTWARE_VIDEO | FIRST_VIDEO))
+	if (open_video () != 0)
+	{
+		fprintf (stderr, "Could not open the video of %s\n", source);
+		SET_FLAG (STOPPED)
+	}
+	UNSET_FLAG ((VIDEO_STOPPED | SWITCH_RENDITION))
+	// not with the policy of this thread
+	thread_policy_leave (THREAD_DEMUX);
+	pthread_create (video_decoding, NULL, (void*) &video_decoding_thread, NULL);
+	if (flags & SOFTWARE_VIDEO)
+		pthread_create (software_render, NULL, (void*) &software_render_thread, NULL);
+	thread_policy_enter (THREAD_DEMUX);
+	return 0;
+
+reopen:
+	if (~flags & RENDER_2_TEXTURE)
+		return 1;
+	// the application set up the textures for the rendition playing, it stays with that one
+	fprintf (stderr, "Can't switch to %s with the textures of %s\n", source, renditions[current_rendition]);
+	renditions_fixed = 1;
+	UNSET_FLAG (SWITCH_RENDITION)
+	return 0;
+}
+
+
+int rpi_mp_start ()
+{
+	pthread_t video_decoding, software_render, audio_decoding, audio_submit, subtitle_decoding;
+	int       next, close, switch_rendition, handed_over = 0;
+
+	// a rendition switch the video chain can't make alone reopens the pipeline and plays on from
+	// here, the end of a crossfade hands it over to the next clip
+	for (;;)
+	{
+		alloc_debug_phase (ALLOC_STARTUP);
+		pthread_create (&video_decoding, NULL, (void*) &video_decoding_thread, NULL);
+		if (flags & SOFTWARE_VIDEO)
+			pthread_create (&software_render, NULL, (void*) &software_render_thread, NULL);
+		pthread_create (&audio_decoding, NULL, (void*) &audio_decoding_thread, NULL);
+		if (flags & SUBTITLES_ON)
+			pthread_create (&subtitle_decoding, NULL, (void*) &subtitle_decoding_thread, NULL);
+		// the clock, the submit thread and the tap run on across a handover
+		if (!handed_over)
+		{
+			playback_started      = monotonic_us ();
+			first_audio_submitted = 0;
+			if (pcm_pipeline)
+				pthread_create (&audio_submit, NULL, (void*) &audio_submit_thread, NULL);
+			if (audio_tap_on)
+				start_audio_tap (&audio_analysis);
+
+			// start clock
+			ilclient_change_component_state (video_clock, OMX_StateExecuting);
+			start_media_clock (media_time, CLOCK_SAMPLE_PERIOD);
+		}
+		handed_over = 0;
+
+		// only now, the threads started above would inherit the policy
+		thread_policy_enter (THREAD_DEMUX);
+
+		// read packets from source
+		while (~flags & (STOPPED | SWITCH_CLIP))
+		{
+			// the crossfade is over, the next clip takes the pipeline over; no cancelling from here
+			if (transition_state == TRANSITION_FADING && transition_blend (&next_clip) >= 1.f)
+			{
+				pthread_mutex_lock (&transition_mutex);
+				if (transition_state == TRANSITION_FADING)
+					SET_FLAG (SWITCH_CLIP)
+				pthread_mutex_unlock (&transition_mutex);
+				continue;
+			}
+			if (next_audio_idx != NO_TRACK_SWITCH || next_subtitle_idx != NO_TRACK_SWITCH)
+				switch_tracks ();
+			if (flags & SWITCH_RENDITION && switch_video_rendition (&video_decoding, &software_render) != 0)
+				break;
+			if (av_read_frame (fmt_ctx, &av_packet) < 0)
+			{
+				// a looping clip starts over, the FIFOs and components downstream just keep going
+				if (flags & LOOPING && loop_restart (&loop, fmt_ctx) == 0)
+				{
+					METRIC_ADD (loops, 1);
+					printf ("loop %d\n", loop.passes);
+					continue;
+				}
+				break;
+			}
+			METRIC_ADD (packets_demuxed, 1);
+			METRIC_ADD (bytes_demuxed, av_packet.size);
+			if (flags & LOOPING)
+				loop_rebase_packet (&loop, fmt_ctx, &av_packet);
+			timeline_packet (&packet_timeline, fmt_ctx, &av_packet);
+			if (process_packet() != 0)
+				break;
+		}
+		// the textures are set up for the rendition playing, it plays to the end
+		if (flags & SWITCH_RENDITION && flags & RENDER_2_TEXTURE)
+			UNSET_FLAG (SWITCH_RENDITION)
+		if (flags & SWITCH_RENDITION)
+		{
+			// the video chain alone could not switch, tear down the whole pipeline
+			SET_FLAG (STOPPED);
+			if (pcm_pipeline)
+				pcm_ring_abort (audio_ring);
+			if (flags & SOFTWARE_VIDEO)
+				soft_video_abort (&software_video);
+		}
+		SET_FLAG (DONE_READING);
+		printf ("done reading\n");
+
+		// wait for the decoding threads to end, the submit thread plays out what they decoded
+		pthread_join (video_decoding, NULL);
+		if (flags & SOFTWARE_VIDEO)
+			pthread_join (software_render, NULL);
+		pthread_join (audio_decoding, NULL);
+		// the clip ended during the crossfade or with a clip prepared, which follows
+		pthread_mutex_lock (&transition_mutex);
+		if (~flags & (STOPPED | SWITCH_RENDITION) && transition_state != TRANSITION_NONE)
+			SET_FLAG (SWITCH_CLIP)
+		pthread_mutex_unlock (&transition_mutex);
+		next = flags & SWITCH_CLIP && ~flags & STOPPED;
+		thread_policy_leave (THREAD_DEMUX);
+		if (next)
+		{
+			if (flags & SUBTITLES_ON)
+				pthread_join (subtitle_decoding, NULL);
+			hand_over (&audio_submit);
+			handed_over = 1;
+			continue;
+		}
+
+		if (pcm_pipeline)
+			pthread_join (audio_submit, NULL);
+		if (audio_tap_on)
+			stop_audio_tap (&audio_analysis);
+		SET_FLAG (STOPPED);
+		if (flags & SUBTITLES_ON)
+			pthread_join (subtitle_decoding, NULL);
+		stop_media_clock ();
+		// stopped, or a rendition switch, with a clip prepared or faded into
+		pthread_mutex_lock (&transition_mutex);
+		close = end_transition ();
+		pthread_mutex_unlock (&transition_mutex);
+		if (close)
+			close_next_clip ();
+
+		// cleanup
+		alloc_debug_phase (ALLOC_CLOSE);
+		printf ("cleaning up... \n");
+		switch_rendition = flags & SWITCH_RENDITION;
+		cleanup ();
+		if (switch_rendition)
+		{
+			int     width, height;
+			int64_t duration;
+			int64_t position = loop_position (&loop, switch_position);
+
+			current_rendition ++;
+			if (rpi_mp_open (renditions[current_rendition], &width, &height, &duration, open_flags) != 0)
+				return 1;
+			seek_to_keyframe (position);
+			continue;
+		}
+		break;
+	}
+	free_renditions ();
+	alloc_debug_report ();
+	printf ("stopping reading thread\n");
+	return 0;
+}
+
+
+void rpi_mp_stop ()
+{
+	SET_FLAG (STOPPED);
+	alloc_debug_phase (ALLOC_CLOSE);
+	// the demuxer may be waiting for the download
+	if (follow_pb)
+		follow_io_abort (follow_pb);
+	if (pcm_pipeline)
+		pcm_ring_abort (audio_ring);
+	// make sure to unpause otherwise threads won't exit
+	if (flags & PAUSED)
+        rpi_mp_pause();
+	// flush video component
+	if (flags & SOFTWARE_VIDEO)
+		soft_video_abort (&software_video);
+	else if (video_stream_idx != AVERROR_STREAM_NOT_FOUND)
+	{
+		OMX_ERRORTYPE omx_error;
+		if ((omx_error = OMX_SendCommand (ILC_GET_HANDLE (video_decode), OMX_CommandFlush, 130, NULL) != OMX_ErrorNone))
+			fprintf (stderr, "Could not flush video decoder input (0x%08x)\n", omx_error);
+	}
+}
+
+
+void rpi_mp_pause ()
+{
+	OMX_TIME_CONFIG_SCALETYPE scale;
+	memset (&scale, 0x0, sizeof (OMX_TIME_CONFIG_SCALETYPE));
+	scale.nSize 			= sizeof (OMX_TIME_CONFIG_SCALETYPE);
+	scale.nVersion.nVersion = OMX_VERSION;
+	scale.xScale 			= (flags & PAUSED ? 1 << 16 : 0);
+
+	OMX_ERRORTYPE omx_error;
+	if ((omx_error = OMX_SetParameter (ILC_GET_HANDLE (video_clock), OMX_IndexConfigTimeScale, &scale)) != OMX_ErrorNone)
+	{
+		fprintf (stderr, "Could not set scale parameter on video clock. Error 0x%08x\n", omx_error);
+		return;
+	}
+	media_clock_scale (scale.xScale);
+	if (~flags & PAUSED)
+	{
+		SET_FLAG (PAUSED);
+		/*
+		//printf ( "waiting for threads to pause...\n" );
+		// make sure threads are paused
 		pthread_mutex_lock ( & video_mutex );
 		while ( ~flags & VIDEO_PAUSED )
 		{
@@ -1437,3 +3813,540 @@ int rpi_mp_metadata (const char* key, char** title)
 	*title = entry->value;
 	return 0;
 }
+
+
+int rpi_mp_tracks (rpi_mp_track* tracks, int max)
+{
+	AVDictionaryEntry* entry;
+	AVStream*          stream;
+	rpi_mp_track*      track;
+	int                i, type, n = 0;
+
+	if (!fmt_ctx)
+		return 0;
+	for (i = 0; i < (int) fmt_ctx->nb_streams; i ++)
+	{
+		stream = fmt_ctx->streams[i];
+		if ((type = track_type (stream)) < 0)
+			continue;
+		if (n < max)
+		{
+			track = &tracks[n];
+			memset (track, 0x0, sizeof (rpi_mp_track));
+			track->index       = i;
+			track->type        = type;
+			track->selected    = i == video_stream_idx || i == audio_stream_idx || (flags & SUBTITLES_ON && i == subtitle_stream_idx);
+			track->is_default  = (stream->disposition & AV_DISPOSITION_DEFAULT) != 0;
+			track->width       = stream->codec->width;
+			track->height      = stream->codec->height;
+			track->sample_rate = stream->codec->sample_rate;
+			track->channels    = stream->codec->channels;
+			snprintf (track->codec, sizeof (track->codec), "%s", avcodec_get_name (stream->codec->codec_id));
+			if ((entry = av_dict_get (stream->metadata, "language", NULL, 0)) != NULL)
+				snprintf (track->language, sizeof (track->language), "%s", entry->value);
+			if ((entry = av_dict_get (stream->metadata, "title", NULL, 0)) != NULL)
+				snprintf (track->title, sizeof (track->title), "%s", entry->value);
+		}
+		n ++;
+	}
+	return n;
+}
+
+
+int rpi_mp_select_track (rpi_mp_track_type type, int index)
+{
+	if (!fmt_ctx)
+		return 1;
+	if (index >= (int) fmt_ctx->nb_streams || (index >= 0 && track_type (fmt_ctx->streams[index]) != type) ||
+	    (index < 0 && (type != TRACK_SUBTITLE || index != -1)))
+	{
+		fprintf (stderr, "Stream %d is not a %s track\n", index, type == TRACK_AUDIO ? "audio" : type == TRACK_SUBTITLE ? "subtitle" : "video");
+		return 1;
+	}
+	switch (type)
+	{
+		case TRACK_AUDIO:
+			if (audio_stream_idx < 0 || (!pcm_pipeline && !(flags & (PASSTHROUGH_AUDIO | HARDWARE_DECODE_AUDIO))))
+			{
+				fprintf (stderr, "No audio is playing to switch\n");
+				return 1;
+			}
+			if (index != audio_stream_idx && !audio_track_compatible (fmt_ctx->streams[index]))
+			{
+				fprintf (stderr, "Audio stream %d differs in format from the one playing\n", index);
+				return 1;
+			}
+			pthread_mutex_lock (&flags_mutex);
+			next_audio_idx = index;
+			pthread_mutex_unlock (&flags_mutex);
+			return 0;
+
+		case TRACK_SUBTITLE:
+			if (~flags & SUBTITLES_ON)
+			{
+				fprintf (stderr, "Subtitles need to be turned on when opening\n");
+				return 1;
+			}
+			pthread_mutex_lock (&flags_mutex);
+			next_subtitle_idx = index;
+			pthread_mutex_unlock (&flags_mutex);
+			return 0;
+
+		default:
+			fprintf (stderr, "Only audio and subtitle tracks can be switched\n");
+			return 1;
+	}
+}
+
+
+void rpi_mp_input_buffer_stats (rpi_mp_buffer_stats* video, rpi_mp_buffer_stats* audio)
+{
+	if (video)
+		*video = video_buffer_stats;
+	if (audio)
+		*audio = audio_buffer_stats;
+}
+
+
+void rpi_mp_audio_latency_target (int ms)
+{
+	audio_latency_target = ms > 0 ? ms : AUDIO_LATENCY_TARGET_MS;
+}
+
+
+int rpi_mp_audio_output_latency (rpi_mp_audio_latency* latency)
+{
+	int samples = audio_render_latency ();
+
+	memset (latency, 0x0, sizeof (rpi_mp_audio_latency));
+	if (audio_stream_idx == AVERROR_STREAM_NOT_FOUND || samples < 0 || audio_codec_ctx->sample_rate <= 0)
+		return 1;
+	latency->target_us = flags & LOW_LATENCY ? (int64_t) audio_latency_target * 1000 : 0;
+	latency->render_us = (int64_t) samples * AV_TIME_BASE / audio_codec_ctx->sample_rate;
+	if (pcm_pipeline)
+		latency->ring_us = (int64_t) pcm_ring_fill (audio_ring) * AV_TIME_BASE / audio_ring->bytes_per_second;
+	latency->total_us   = latency->ring_us + latency->render_us;
+	latency->startup_us = first_audio_submitted ? first_audio_submitted - playback_started : -1;
+	return 0;
+}
+
+
+void rpi_mp_live_latency_target (int ms)
+{
+	live_target_ms = ms > 0 ? ms : LIVE_LATENCY_TARGET_MS;
+}
+
+
+int rpi_mp_live_latency (rpi_mp_live_stats* stats)
+{
+	struct timespec now;
+	int64_t         start, position;
+
+	if (~flags & LIVE_SOURCE || !fmt_ctx)
+		return 1;
+	*stats = live_stats;
+	stats->glass_to_glass_us = -1;
+	// the start of the stream was captured at start_time_realtime, once the source has sent its wall
+	// clock; media time is on the timeline, which may have rebased the source's timestamps
+	if (fmt_ctx->start_time_realtime != AV_NOPTS_VALUE && fmt_ctx->start_time_realtime > 0 && clock_gettime (CLOCK_REALTIME, &now) == 0)
+	{
+		start    = fmt_ctx->start_time != AV_NOPTS_VALUE ? fmt_ctx->start_time : 0;
+		position = media_clock_now () - __atomic_load_n (&packet_timeline.offset, __ATOMIC_RELAXED) - start;
+		stats->glass_to_glass_us = (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000 - fmt_ctx->start_time_realtime - position;
+	}
+	return 0;
+}
+
+
+void rpi_mp_follow_settings (const char* marker_suffix, int timeout_ms)
+{
+	snprintf (follow_suffix, sizeof (follow_suffix), "%s", marker_suffix ? marker_suffix : "");
+	follow_timeout_ms = timeout_ms;
+}
+
+
+int rpi_mp_follow_stats (rpi_mp_download_stats* stats)
+{
+	int64_t newest = __atomic_load_n (&follow_newest, __ATOMIC_RELAXED), start;
+
+	if (~flags & FOLLOW_SOURCE || !follow_pb)
+		return 1;
+	follow_io_stats (follow_pb, stats);
+	if (newest == AV_NOPTS_VALUE)
+		return 0;
+	stats->ahead_us = newest - media_clock_now ();
+	// the bytes not demuxed yet, because the FIFOs are full, at the byte rate so far
+	start = fmt_ctx->start_time != AV_NOPTS_VALUE ? fmt_ctx->start_time : 0;
+	if (stats->size > stats->read && stats->read > 0 && newest > start)
+		stats->ahead_us += (int64_t) ((double) (stats->size - stats->read) * (newest - start) / stats->read);
+	return 0;
+}
+
+
+void rpi_mp_audio_tap (int enable)
+{
+	audio_tap_enabled = enable;
+}
+
+
+int rpi_mp_audio_levels (rpi_mp_audio_analysis* analysis)
+{
+	if (!audio_tap_on)
+		return 1;
+	return audio_tap_result (&audio_analysis, media_clock_now (), analysis);
+}
+
+
+void rpi_mp_audio_tap_stats (uint64_t* windows, uint64_t* skipped, uint64_t* cpu_us)
+{
+	if (!audio_tap_on)
+	{
+		*windows = *skipped = *cpu_us = 0;
+		return;
+	}
+	pthread_mutex_lock (&audio_analysis.results_mutex);
+	*windows = audio_analysis.windows;
+	*skipped = audio_analysis.skipped;
+	pthread_mutex_unlock (&audio_analysis.results_mutex);
+	*cpu_us  = __atomic_load_n (&audio_analysis.cpu_us, __ATOMIC_RELAXED);
+}
+
+
+void rpi_mp_audio_stats (rpi_mp_audio_pipeline_stats* stats)
+{
+	memset (stats, 0x0, sizeof (rpi_mp_audio_pipeline_stats));
+	if (!pcm_pipeline)
+		return;
+	stats->frames         = pcm_decoder.frames;
+	stats->decode_us      = pcm_decoder.decode_us;
+	stats->ring_full_us   = audio_ring->write_wait_us;
+	stats->ring_empty_us  = audio_ring->read_wait_us;
+	stats->render_wait_us = audio_buffer_stats.wait_us;
+	stats->ring_size      = audio_ring->size;
+	stats->ring_peak      = audio_ring->peak;
+}
+
+
+/**
+ *	Pops every filled buffer off the resizer's output list and keeps the newest one that holds
+ *	a frame, the others go straight back to be filled. Called with yuv_mutex held.
+ */
+static OMX_BUFFERHEADERTYPE* newest_yuv_buffer ()
+{
+	OMX_BUFFERHEADERTYPE *buffer, *newest = NULL;
+
+	while ((buffer = ilclient_get_output_buffer (resize, RESIZE_OUTPUT_PORT, 0)) != NULL)
+	{
+		if (newest)
+			OMX_FillThisBuffer (ILC_GET_HANDLE (resize), newest);
+		newest = buffer;
+		if (newest->nFilledLen == 0)
+		{
+			OMX_FillThisBuffer (ILC_GET_HANDLE (resize), newest);
+			newest = NULL;
+		}
+	}
+	return newest;
+}
+
+
+int rpi_mp_yuv_frame_lock (rpi_mp_yuv_frame* frame, int timeout_ms)
+{
+	OMX_BUFFERHEADERTYPE* buffer = NULL;
+	struct timespec       deadline;
+	uint8_t*              data;
+	int                   chroma;
+
+	clock_gettime (CLOCK_REALTIME, &deadline);
+	deadline.tv_sec  += timeout_ms / 1000;
+	deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+	deadline.tv_sec  += deadline.tv_nsec / 1000000000;
+	deadline.tv_nsec %= 1000000000;
+
+	pthread_mutex_lock (&yuv_mutex);
+	if (yuv_locked)
+	{
+		pthread_mutex_unlock (&yuv_mutex);
+		fprintf (stderr, "A YUV frame is still locked\n");
+		return 1;
+	}
+	while (yuv_ready && !(buffer = newest_yuv_buffer ()) && timeout_ms > 0)
+		if (pthread_cond_timedwait (&yuv_cond, &yuv_mutex, &deadline) != 0)
+		{
+			if (yuv_ready)
+				buffer = newest_yuv_buffer ();
+			break;
+		}
+	if (!buffer)
+	{
+		pthread_mutex_unlock (&yuv_mutex);
+		return 1;
+	}
+	yuv_locked = buffer;
+
+	data   = buffer->pBuffer + buffer->nOffset;
+	chroma = yuv_stride * yuv_slice_height;
+	frame->width      = video_codec_ctx->width;
+	frame->height     = video_codec_ctx->height;
+	frame->nv12       = yuv_format == OMX_COLOR_FormatYUV420PackedSemiPlanar;
+	frame->pts        = omx_timestamp__pts (buffer->nTimeStamp);
+	frame->planes[0]  = data;
+	frame->strides[0] = yuv_stride;
+	frame->planes[1]  = data + chroma;
+	if (frame->nv12)
+	{
+		frame->strides[1] = yuv_stride;
+		frame->planes[2]  = NULL;
+		frame->strides[2] = 0;
+	}
+	else
+	{
+		frame->strides[1] = yuv_stride / 2;
+		frame->planes[2]  = data + chroma + chroma / 4;
+		frame->strides[2] = yuv_stride / 2;
+	}
+	pthread_mutex_unlock (&yuv_mutex);
+	return 0;
+}
+
+
+void rpi_mp_yuv_frame_unlock ()
+{
+	pthread_mutex_lock (&yuv_mutex);
+	// after playback ended the buffer was already taken back
+	if (yuv_ready && yuv_locked && OMX_FillThisBuffer (ILC_GET_HANDLE (resize), yuv_locked) != OMX_ErrorNone)
+		fprintf (stderr, "OMX_FillThisBuffer failed for YUV buffer\n");
+	yuv_locked = NULL;
+	pthread_mutex_unlock (&yuv_mutex);
+}
+
+
+int rpi_mp_transition_prepare (const char* file)
+{
+	pcm_ring* ring = NULL;
+	int       ret;
+
+	// the clip faded into is drawn by the application over the one playing, from its own textures
+	if (~flags & RENDER_2_TEXTURE || flags & SOFTWARE_VIDEO || !egl_images[1][0] || !current_texture[1])
+	{
+		fprintf (stderr, "A crossfade needs texture output from the hardware decoder and a second set of textures\n");
+		return 1;
+	}
+	pthread_mutex_lock (&transition_mutex);
+	if (transition_state != TRANSITION_NONE || next_open)
+	{
+		pthread_mutex_unlock (&transition_mutex);
+		fprintf (stderr, "A clip is already prepared\n");
+		return 1;
+	}
+	// only audio the pipeline decodes itself can be mixed, into a ring of the same size
+	if (pcm_pipeline)
+	{
+		ring = audio_ring == &pcm_rings[0] ? &pcm_rings[1] : &pcm_rings[0];
+		if (init_pcm_ring (ring, audio_ring->size, audio_ring->bytes_per_second) != 0)
+		{
+			pthread_mutex_unlock (&transition_mutex);
+			fprintf (stderr, "Could not allocate PCM ring\n");
+			return 1;
+		}
+	}
+	if ((ret = open_transition (&next_clip, file, ring,
+	                            pcm_pipeline ? audio_codec_ctx->sample_rate : 0,
+	                            pcm_pipeline ? audio_codec_ctx->channels : 0)) == 0)
+	{
+		if (omx_video_coding (next_clip.fmt_ctx->streams[next_clip.video_idx]->codec->codec_id) == OMX_VIDEO_CodingUnused)
+		{
+			fprintf (stderr, "The hardware can't decode the video of %s\n", file);
+			close_transition (&next_clip);
+			ret = 1;
+		}
+		else if ((ret = open_next_video (next_clip.fmt_ctx->streams[next_clip.video_idx])) != 0)
+		{
+			close_next_video ();
+			close_transition (&next_clip);
+		}
+	}
+	if (ret != 0)
+	{
+		if (ring)
+			destroy_pcm_ring (ring);
+		pthread_mutex_unlock (&transition_mutex);
+		return ret;
+	}
+	free (next_source);
+	next_source = strdup (file);
+	next_filled = next_locked = next_shown = 0;
+	faded_set   = next_set;
+	next_stop   = 0;
+	next_open   = 1;
+	pthread_create (&next_feeder, NULL, (void*) &next_video_thread, NULL);
+	next_feeding     = 1;
+	transition_state = TRANSITION_PREPARED;
+	pthread_mutex_unlock (&transition_mutex);
+	return 0;
+}
+
+
+int rpi_mp_transition_start (int duration_ms)
+{
+	pthread_mutex_lock (&transition_mutex);
+	if (transition_state != TRANSITION_PREPARED)
+	{
+		pthread_mutex_unlock (&transition_mutex);
+		return 1;
+	}
+	if (duration_ms > TRANSITION_MAX_MS)
+		duration_ms = TRANSITION_MAX_MS;
+	transition_start (&next_clip, (int64_t) duration_ms * 1000, media_clock_now ());
+	transition_state = TRANSITION_FADING;
+	pthread_mutex_unlock (&transition_mutex);
+	printf ("crossfading into %s over %d ms\n", next_source, duration_ms);
+	return 0;
+}
+
+
+void rpi_mp_transition_cancel ()
+{
+	int close = 0;
+
+	pthread_mutex_lock (&transition_mutex);
+	// once the end of the crossfade is reached the clip playing is on its way out
+	if (~flags & SWITCH_CLIP && (transition_state == TRANSITION_PREPARED ||
+	    (transition_state == TRANSITION_FADING && transition_blend (&next_clip) < 1.f)))
+		close = end_transition ();
+	pthread_mutex_unlock (&transition_mutex);
+	if (close)
+		close_next_clip ();
+}
+
+
+int rpi_mp_transition_frame_lock (rpi_mp_transition_frame* frame)
+{
+	uint64_t filled;
+
+	// called every frame, don't wait for a clip being prepared
+	if (transition_state != TRANSITION_FADING && transition_state != TRANSITION_HANDOVER)
+		return 1;
+	pthread_mutex_lock (&transition_mutex);
+	if (transition_locked)
+	{
+		pthread_mutex_unlock (&transition_mutex);
+		fprintf (stderr, "A transition frame is still locked\n");
+		return 1;
+	}
+	if (transition_state != TRANSITION_FADING && transition_state != TRANSITION_HANDOVER)
+	{
+		pthread_mutex_unlock (&transition_mutex);
+		return 1;
+	}
+	// the index the fill callback moved past is the newest texture
+	pthread_mutex_lock (&chains_mutex);
+	filled = next_filled;
+	if (filled)
+		frame->texture = (*current_texture[faded_set] + 1) % BUFFER_COUNT;
+	pthread_mutex_unlock (&chains_mutex);
+	if (!filled)
+	{
+		pthread_mutex_unlock (&transition_mutex);
+		return 1;
+	}
+	frame->texture_set = faded_set;
+	frame->blend       = transition_blend (&next_clip);
+	frame->fresh       = filled != next_locked;
+	if (frame->fresh)
+	{
+		next_locked = filled;
+		next_shown ++;
+	}
+	transition_locked = 1;
+	pthread_mutex_unlock (&transition_mutex);
+	return 0;
+}
+
+
+void rpi_mp_transition_frame_unlock ()
+{
+	pthread_mutex_lock (&transition_mutex);
+	transition_locked = 0;
+	pthread_cond_broadcast (&transition_cond);
+	pthread_mutex_unlock (&transition_mutex);
+}
+
+
+int rpi_mp_transition_stats (rpi_mp_overlap_stats* stats)
+{
+	int ret = 0;
+
+	pthread_mutex_lock (&transition_mutex);
+	if (transition_state == TRANSITION_FADING || transition_state == TRANSITION_HANDOVER)
+	{
+		overlap_stats (stats);
+		stats->running = 1;
+	}
+	else if (transition_reported)
+		*stats = transition_result;
+	else
+		ret = 1;
+	pthread_mutex_unlock (&transition_mutex);
+	return ret;
+}
+
+
+/**
+ *	Adds the player's metrics to a scrape. Runs on the metrics server thread, so it only reads:
+ *	counters and statistics with relaxed loads, and the lock free media clock.
+ */
+static void collect_metrics (metrics_writer* w)
+{
+	metric_counter (w, "rpi_mp_packets_demuxed_total", "Packets read from the source", METRIC_GET (rpi_mp_counters.packets_demuxed));
+	metric_counter (w, "rpi_mp_bytes_demuxed_total", "Bytes read from the source", METRIC_GET (rpi_mp_counters.bytes_demuxed));
+	metric_counter (w, "rpi_mp_video_packets_decoded_total", "Video packets handed to the decoder", METRIC_GET (rpi_mp_counters.video_packets_decoded));
+	metric_counter (w, "rpi_mp_audio_packets_decoded_total", "Audio packets decoded or passed through", METRIC_GET (rpi_mp_counters.audio_packets_decoded));
+	metric_counter (w, "rpi_mp_loops_total", "Times a looping clip started over", METRIC_GET (rpi_mp_counters.loops));
+
+	// the rest describes the media currently open and starts over with rpi_mp_open
+	metric_gauge   (w, "rpi_mp_video_fifo_packets", "Demuxed video packets waiting", METRIC_GET (video_packet_fifo.n_packets));
+	metric_gauge   (w, "rpi_mp_video_fifo_bytes", "Bytes of demuxed video waiting", METRIC_GET (video_packet_fifo.size_packets));
+	metric_counter (w, "rpi_mp_video_fifo_full_total", "Times demuxing waited for room in the video FIFO", METRIC_GET (video_packet_fifo.full));
+	metric_counter (w, "rpi_mp_video_fifo_empty_total", "Times video decoding found its FIFO empty", METRIC_GET (video_packet_fifo.empty));
+	metric_gauge   (w, "rpi_mp_audio_fifo_packets", "Demuxed audio packets waiting", METRIC_GET (audio_packet_fifo.n_packets));
+	metric_gauge   (w, "rpi_mp_audio_fifo_bytes", "Bytes of demuxed audio waiting", METRIC_GET (audio_packet_fifo.size_packets));
+	metric_counter (w, "rpi_mp_audio_fifo_full_total", "Times demuxing waited for room in the audio FIFO", METRIC_GET (audio_packet_fifo.full));
+	metric_counter (w, "rpi_mp_audio_fifo_empty_total", "Times audio decoding found its FIFO empty", METRIC_GET (audio_packet_fifo.empty));
+	metric_counter (w, "rpi_mp_video_buffer_wait_microseconds_total", "Time spent waiting for video decoder input buffers", METRIC_GET (video_buffer_stats.wait_us));
+	metric_gauge   (w, "rpi_mp_video_buffer_max_wait_microseconds", "Longest wait for a video decoder input buffer", METRIC_GET (video_buffer_stats.max_wait_us));
+	metric_counter (w, "rpi_mp_audio_buffer_wait_microseconds_total", "Time spent waiting for audio render input buffers", METRIC_GET (audio_buffer_stats.wait_us));
+	metric_gauge   (w, "rpi_mp_audio_buffer_max_wait_microseconds", "Longest wait for an audio render input buffer", METRIC_GET (audio_buffer_stats.max_wait_us));
+	metric_counter (w, "rpi_mp_video_frames_late_total", "Video frames dropped for being late",
+	                METRIC_GET (drop_stats.late) + (flags & SOFTWARE_VIDEO ? METRIC_GET (software_video.late) : 0));
+	metric_counter (w, "rpi_mp_video_frames_non_reference_dropped_total", "Non-reference video frames dropped to catch up", METRIC_GET (drop_stats.non_reference));
+	metric_counter (w, "rpi_mp_video_frames_skipped_total", "Video frames dropped while skipping to the next restart point", METRIC_GET (drop_stats.skipped));
+	metric_gauge   (w, "rpi_mp_media_time_seconds", "Media clock", media_clock_now () / 1e6);
+	metric_gauge   (w, "rpi_mp_position_seconds", "Position in the media", loop_position (&loop, media_clock_now () - clip_offset) / 1e6);
+	metric_gauge   (w, "rpi_mp_paused", "1 while paused", flags & PAUSED ? 1 : 0);
+}
+
+
+int rpi_mp_metrics_start (const char* path)
+{
+	return start_metrics_server (path, collect_metrics);
+}
+
+
+void rpi_mp_metrics_stop ()
+{
+	stop_metrics_server ();
+}
+
+
+void rpi_mp_video_drop_stats (rpi_mp_drop_stats* stats)
+{
+	stats->late            = METRIC_GET (drop_stats.late);
+	stats->non_reference   = METRIC_GET (drop_stats.non_reference);
+	stats->skipped         = METRIC_GET (drop_stats.skipped);
+	stats->skips           = METRIC_GET (drop_stats.skips);
+	stats->max_lateness_us = METRIC_GET (drop_stats.max_lateness_us);
+	// software decoding drops late frames before they reach the render thread as well
+	if (flags & SOFTWARE_VIDEO)
+		stats->late += METRIC_GET (software_video.late);
+}
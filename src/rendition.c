@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <libavformat/avformat.h>
+#include "rpi_mp_rendition.h"
+#include "rpi_mp_utils.h"
+
+#define PROBE_US              (3 * AV_TIME_BASE)
+#define PROBE_EOS_TIMEOUT     2000
+#define DECODE_INPUT_PORT     130
+#define DECODE_OUTPUT_PORT    131
+#define NULL_SINK_INPUT_PORT  240
+#define CACHE_FILE            "rpi_mp_renditions"
+
+#define OMX_INIT_STRUCTURE(a) \
+    memset(&(a), 0, sizeof(a)); \
+    (a).nSize = sizeof(a); \
+    (a).nVersion.nVersion = OMX_VERSION
+
+typedef struct
+{
+	enum AVCodecID codec_id;
+	int            width;
+	int            height;
+	double         fps;
+	double         pixel_rate;
+	char           key[64];
+} rendition_info ;
+
+
+/**
+ *	Reads what the decoder has to do for a rendition: codec, size and frame rate.
+ */
+static int read_rendition_info (const char* file, rendition_info* info)
+{
+	AVFormatContext* ctx = NULL;
+	AVStream*        stream;
+	int              idx;
+
+	if (avformat_open_input (&ctx, file, NULL, NULL) < 0)
+		return 1;
+	if (avformat_find_stream_info (ctx, NULL) < 0 ||
+	    (idx = av_find_best_stream (ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0)) < 0)
+	{
+		avformat_close_input (&ctx);
+		return 1;
+	}
+	stream         = ctx->streams[idx];
+	info->codec_id = stream->codec->codec_id;
+	info->width    = stream->codec->width;
+	info->height   = stream->codec->height;
+	info->fps      = stream->avg_frame_rate.num > 0 && stream->avg_frame_rate.den > 0 ? av_q2d (stream->avg_frame_rate) :
+	                 stream->r_frame_rate.num   > 0 && stream->r_frame_rate.den   > 0 ? av_q2d (stream->r_frame_rate)   : 30;
+	info->pixel_rate = (double) info->width * info->height * info->fps;
+	snprintf (info->key, sizeof (info->key), "%s %dx%d@%.2f", avcodec_get_name (info->codec_id), info->width, info->height, info->fps);
+	avformat_close_input (&ctx);
+	return 0;
+}
+
+static OMX_VIDEO_CODINGTYPE omx_coding (enum AVCodecID codec_id)
+{
+	switch (codec_id)
+	{
+		case AV_CODEC_ID_H264:       return OMX_VIDEO_CodingAVC;
+		case AV_CODEC_ID_MPEG4:      return OMX_VIDEO_CodingMPEG4;
+		case AV_CODEC_ID_MPEG2VIDEO: return OMX_VIDEO_CodingMPEG2;
+		default:                     return OMX_VIDEO_CodingAutoDetect;
+	}
+}
+
+/**
+ *	Sends data to the decoder and sets up the tunnel to the sink once the decoder knows the output format.
+ */
+static int probe_feed (COMPONENT_T* decode, COMPONENT_T* sink, TUNNEL_T* tunnel, int* tunnel_up,
+                       const uint8_t* data, int size, int buffer_flags)
+{
+	OMX_BUFFERHEADERTYPE* buffer;
+	do
+	{
+		if ((buffer = ilclient_get_input_buffer (decode, DECODE_INPUT_PORT, 1)) == NULL)
+			return 1;
+		buffer->nFilledLen = size < buffer->nAllocLen ? size : buffer->nAllocLen;
+		buffer->nOffset    = 0;
+		buffer->nFlags     = OMX_BUFFERFLAG_TIME_UNKNOWN;
+		memcpy (buffer->pBuffer, data, buffer->nFilledLen);
+		data += buffer->nFilledLen;
+		size -= buffer->nFilledLen;
+		if (size == 0)
+			buffer->nFlags |= buffer_flags;
+		if (OMX_EmptyThisBuffer (ILC_GET_HANDLE (decode), buffer) != OMX_ErrorNone)
+			return 1;
+		if (!*tunnel_up && ilclient_remove_event (decode, OMX_EventPortSettingsChanged, DECODE_OUTPUT_PORT, 0, 0, 1) == 0)
+		{
+			if (ilclient_setup_tunnel (tunnel, 0, 0) != 0)
+				return 1;
+			ilclient_change_component_state (sink, OMX_StateExecuting);
+			*tunnel_up = 1;
+		}
+	}
+	while (size > 0);
+	return 0;
+}
+
+/**
+ *	Decodes the first PROBE_US of video into a null sink as fast as the decoder goes.
+ *	Returns the decode speed as a multiple of real time, negative on failure.
+ */
+static double probe_headroom (ILCLIENT_T* client, const char* file)
+{
+	AVFormatContext* ctx = NULL;
+	COMPONENT_T    * decode = NULL, * sink = NULL, * list[3] = { NULL, NULL, NULL };
+	TUNNEL_T         tunnel[2];
+	OMX_VIDEO_PARAM_PORTFORMATTYPE format;
+	AVPacket         packet;
+	AVStream       * stream;
+	int              idx, tunnel_up = 0, done = 0, failed = 0;
+	int64_t          first = AV_NOPTS_VALUE, last = AV_NOPTS_VALUE, pts, start, elapsed;
+	double           headroom = -1;
+
+	memset (tunnel, 0x0, sizeof (tunnel));
+	if (avformat_open_input (&ctx, file, NULL, NULL) < 0)
+		return -1;
+	if (avformat_find_stream_info (ctx, NULL) < 0 ||
+	    (idx = av_find_best_stream (ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0)) < 0)
+		goto end;
+	stream = ctx->streams[idx];
+
+	if (ilclient_create_component (client, &decode, "video_decode", ILCLIENT_DISABLE_ALL_PORTS | ILCLIENT_ENABLE_INPUT_BUFFERS) != 0 ||
+	    ilclient_create_component (client, &sink, "null_sink", ILCLIENT_DISABLE_ALL_PORTS) != 0)
+	{
+		fprintf (stderr, "Could not create components to probe %s\n", file);
+		goto end;
+	}
+	list[0] = decode;
+	list[1] = sink;
+	set_tunnel (tunnel, decode, DECODE_OUTPUT_PORT, sink, NULL_SINK_INPUT_PORT);
+
+	ilclient_change_component_state (decode, OMX_StateIdle);
+	OMX_INIT_STRUCTURE (format);
+	format.nPortIndex         = DECODE_INPUT_PORT;
+	format.eCompressionFormat = omx_coding (stream->codec->codec_id);
+	if (OMX_SetParameter (ILC_GET_HANDLE (decode), OMX_IndexParamVideoPortFormat, &format) != OMX_ErrorNone ||
+	    ilclient_enable_port_buffers (decode, DECODE_INPUT_PORT, NULL, NULL, NULL) != 0)
+	{
+		fprintf (stderr, "Could not set up the decoder to probe %s\n", file);
+		goto end;
+	}
+	ilclient_change_component_state (decode, OMX_StateExecuting);
+
+	start = monotonic_us ();
+	if (stream->codec->extradata)
+		failed = probe_feed (decode, sink, tunnel, &tunnel_up, stream->codec->extradata, stream->codec->extradata_size,
+		                     OMX_BUFFERFLAG_CODECCONFIG | OMX_BUFFERFLAG_ENDOFFRAME);
+	av_init_packet (&packet);
+	while (!failed && !done && av_read_frame (ctx, &packet) >= 0)
+	{
+		if (packet.stream_index == idx)
+		{
+			pts = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+			if (pts != AV_NOPTS_VALUE)
+			{
+				pts = av_rescale_q (pts, stream->time_base, AV_TIME_BASE_Q);
+				if (first == AV_NOPTS_VALUE)
+					first = pts;
+				if (last == AV_NOPTS_VALUE || pts > last)
+					last = pts;
+				done = last - first >= PROBE_US;
+			}
+			failed = probe_feed (decode, sink, tunnel, &tunnel_up, packet.data, packet.size, OMX_BUFFERFLAG_ENDOFFRAME);
+		}
+		av_packet_unref (&packet);
+	}
+	// the time until the input is taken is the fallback if the sink does not report the end
+	elapsed = monotonic_us () - start;
+	if (!failed && tunnel_up &&
+	    probe_feed (decode, sink, tunnel, &tunnel_up, NULL, 0, OMX_BUFFERFLAG_EOS) == 0 &&
+	    ilclient_wait_for_event (sink, OMX_EventBufferFlag, NULL_SINK_INPUT_PORT, 0, OMX_BUFFERFLAG_EOS, 0,
+	                             ILCLIENT_BUFFER_FLAG_EOS, PROBE_EOS_TIMEOUT) == 0)
+		elapsed = monotonic_us () - start;
+	if (!failed && last > first && elapsed > 0)
+		headroom = (double) (last - first) / elapsed;
+end:
+	if (tunnel_up)
+	{
+		ilclient_disable_tunnel (tunnel);
+		ilclient_flush_tunnels  (tunnel, 0);
+	}
+	if (decode)
+		ilclient_disable_port_buffers (decode, DECODE_INPUT_PORT, NULL, NULL, NULL);
+	ilclient_teardown_tunnels   (tunnel);
+	ilclient_state_transition   (list, OMX_StateIdle);
+	ilclient_cleanup_components (list);
+	avformat_close_input (&ctx);
+	return headroom;
+}
+
+static void board_model (char* model, int size)
+{
+	FILE* f = fopen ("/proc/device-tree/model", "r");
+	int   n = f ? fread (model, 1, size - 1, f) : 0;
+	model[n] = '\0';
+	if (f)
+		fclose (f);
+	if (n == 0)
+		snprintf (model, size, "unknown");
+	// the model is a field of the cache file
+	for (n = 0; model[n]; n ++)
+		if (model[n] == '\t' || model[n] == '\n')
+			model[n] = ' ';
+}
+
+/**
+ *	Results are kept in the cache directory, one line per board model and decoding class.
+ */
+static int cached_headroom (const char* model, const char* key, double* headroom)
+{
+	char  line[512], buffer[PATH_MAX];
+	const char* path = cache_file_path (CACHE_FILE, buffer, sizeof (buffer));
+	FILE* f = path ? fopen (path, "r") : NULL;
+	int   found = 0;
+	size_t model_length = strlen (model), key_length = strlen (key);
+
+	if (!f)
+		return 0;
+	// later lines win, a board that was re-probed appends its new result
+	while (fgets (line, sizeof (line), f))
+		if (strncmp (line, model, model_length) == 0 && line[model_length] == '\t' &&
+		    strncmp (line + model_length + 1, key, key_length) == 0 && line[model_length + 1 + key_length] == '\t')
+			found = sscanf (line + model_length + key_length + 2, "%lf", headroom) == 1;
+	fclose (f);
+	return found;
+}
+
+static void store_headroom (const char* model, const char* key, double headroom)
+{
+	char        buffer[PATH_MAX];
+	const char* path = cache_file_path (CACHE_FILE, buffer, sizeof (buffer));
+	FILE* f = path ? fopen (path, "a") : NULL;
+	if (!f)
+		return;
+	fprintf (f, "%s\t%s\t%.3f\n", model, key, headroom);
+	fclose (f);
+}
+
+
+int select_rendition (ILCLIENT_T* client, const char* files[], int count, int* order, int* n_order)
+{
+	rendition_info* info = (rendition_info*) malloc (count * sizeof (rendition_info));
+	char   model[128];
+	double headroom;
+	int    i, j, n = 0, chosen;
+
+	if (!info)
+		return -1;
+	// highest pixel rate first
+	for (i = 0; i < count; i ++)
+	{
+		if (read_rendition_info (files[i], &info[i]) != 0)
+		{
+			fprintf (stderr, "Could not read rendition %s\n", files[i]);
+			continue;
+		}
+		for (j = n; j > 0 && info[order[j - 1]].pixel_rate < info[i].pixel_rate; j --)
+			order[j] = order[j - 1];
+		order[j] = i;
+		n ++;
+	}
+	board_model (model, sizeof (model));
+	for (chosen = 0; chosen < n; chosen ++)
+	{
+		rendition_info* r = &info[order[chosen]];
+		if (!cached_headroom (model, r->key, &headroom))
+		{
+			if ((headroom = probe_headroom (client, files[order[chosen]])) < 0)
+				continue;
+			store_headroom (model, r->key, headroom);
+		}
+		printf ("rendition %s (%s): decodes at %.2fx real time\n", files[order[chosen]], r->key, headroom);
+		if (headroom >= RENDITION_HEADROOM)
+			break;
+	}
+	free (info);
+	*n_order = n;
+	if (n == 0)
+		return -1;
+	return chosen < n ? chosen : n - 1;
+}
@@ -0,0 +1,453 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <libavformat/avformat.h>
+#include "rpi_mp.h"
+#include "rpi_mp_utils.h"
+
+#define SCAN_MAX_THREADS     16
+#define SCAN_NICE            10
+#define SCAN_PROBE_SIZE      (1 << 20)
+#define SCAN_ANALYZE_US      AV_TIME_BASE
+#define SCAN_CACHE_FILE      "rpi_mp_media"
+#define SCAN_CACHE_MAGIC     "RPIMPSC1"
+#define SCAN_CACHE_EXPIRY    (90 * 24 * 3600)
+#define SCAN_TOUCH_INTERVAL  (24 * 3600)
+
+/**
+ *	One file in the cache. The key is device and inode; size and modification time tell whether
+ *	the file changed. The path is not stored, a renamed file stays cached.
+ */
+typedef struct
+{
+	uint64_t          dev;
+	uint64_t          ino;
+	int64_t           size;
+	int64_t           mtime_ns;
+	int64_t           last_seen;  /* seconds, entries not seen for SCAN_CACHE_EXPIRY are dropped */
+	rpi_mp_media_info info;       /* path is not valid */
+}
+scan_record;
+
+typedef struct
+{
+	char     magic[8];
+	uint32_t record_size;  /* a cache written by another build is ignored */
+	uint32_t count;
+}
+scan_cache_header;
+
+/**
+ *	Work shared between the threads of one scan.
+ */
+typedef struct
+{
+	const char       ** paths;
+	rpi_mp_media_info * infos;
+	scan_record       * records;   /* what to store for each path */
+	char              * store;     /* records that changed */
+	int                 count;
+	int                 next;
+	const scan_record * cache;     /* sorted by key, read-only during the scan */
+	int                 n_cache;
+	int64_t             now;
+	pthread_mutex_t     mutex;
+}
+scan_queue;
+
+
+static int compare_keys (const void* a, const void* b)
+{
+	const scan_record* x = (const scan_record*) a;
+	const scan_record* y = (const scan_record*) b;
+	if (x->dev != y->dev)
+		return x->dev < y->dev ? -1 : 1;
+	return x->ino < y->ino ? -1 : x->ino > y->ino;
+}
+
+static int compare_records (const void* a, const void* b)
+{
+	const scan_record* x = (const scan_record*) a;
+	const scan_record* y = (const scan_record*) b;
+	int ret = compare_keys (a, b);
+	// newest first, so merging keeps the first of equal keys
+	return ret ? ret : x->last_seen > y->last_seen ? -1 : x->last_seen < y->last_seen;
+}
+
+/**
+ *	Loads the whole cache into a sorted array. Returns the number of records.
+ */
+static int load_cache (const char* path, scan_record** records)
+{
+	scan_cache_header header;
+	FILE* f = path ? fopen (path, "rb") : NULL;
+	int   n = 0;
+
+	*records = NULL;
+	if (!f)
+		return 0;
+	if (fread (&header, sizeof (header), 1, f) == 1 && memcmp (header.magic, SCAN_CACHE_MAGIC, sizeof (header.magic)) == 0 &&
+	    header.record_size == sizeof (scan_record) && (*records = (scan_record*) malloc (header.count * sizeof (scan_record) + 1)))
+		n = fread (*records, sizeof (scan_record), header.count, f);
+	fclose (f);
+	return n;
+}
+
+/**
+ *	Merges the records of this scan into the cache and replaces the file, so a scan running at the
+ *	same time never reads half a cache. The last writer wins.
+ */
+static void store_cache (const char* path, scan_queue* queue)
+{
+	static unsigned   stores = 0;
+	scan_cache_header header;
+	scan_record* merged;
+	char  tmp[PATH_MAX];
+	FILE* f;
+	int   i, n = 0, kept = 0;
+
+	if (!path || !(merged = (scan_record*) malloc ((queue->n_cache + queue->count) * sizeof (scan_record) + 1)))
+		return;
+	for (i = 0; i < queue->count; i ++)
+		if (queue->store[i])
+			merged[n ++] = queue->records[i];
+	for (i = 0; i < queue->n_cache; i ++)
+		if (queue->now - queue->cache[i].last_seen < SCAN_CACHE_EXPIRY)
+			merged[n ++] = queue->cache[i];
+	qsort (merged, n, sizeof (scan_record), compare_records);
+	for (i = 0; i < n; i ++)
+		if (kept == 0 || merged[i].dev != merged[kept - 1].dev || merged[i].ino != merged[kept - 1].ino)
+			merged[kept ++] = merged[i];
+
+	memcpy (header.magic, SCAN_CACHE_MAGIC, sizeof (header.magic));
+	header.record_size = sizeof (scan_record);
+	header.count       = kept;
+	// scans of this process may store at the same time too
+	snprintf (tmp, sizeof (tmp), "%s.%d.%u", path, (int) getpid (), __atomic_add_fetch (&stores, 1, __ATOMIC_RELAXED));
+	if ((f = fopen (tmp, "wb")))
+	{
+		if (fwrite (&header, sizeof (header), 1, f) != 1 || fwrite (merged, sizeof (scan_record), kept, f) != kept)
+			fprintf (stderr, "Could not write scan cache %s\n", tmp);
+		if (fclose (f) != 0 || rename (tmp, path) != 0)
+			unlink (tmp);
+	}
+	free (merged);
+}
+
+static void copy_tag (char* dst, int size, AVDictionary* container, AVDictionary* stream, const char* key)
+{
+	AVDictionaryEntry* entry = av_dict_get (container, key, NULL, AV_DICT_IGNORE_SUFFIX);
+	// Ogg and FLAC keep their tags with the audio stream
+	if (!entry && stream)
+		entry = av_dict_get (stream, key, NULL, AV_DICT_IGNORE_SUFFIX);
+	snprintf (dst, size, "%s", entry ? entry->value : "");
+}
+
+/**
+ *	Picks the main video and audio streams. Cover art is not video.
+ */
+static void pick_streams (AVFormatContext* ctx, AVStream** video, AVStream** audio)
+{
+	int i, idx;
+
+	*video = NULL;
+	for (i = 0; i < ctx->nb_streams && !*video; i ++)
+		if (ctx->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO && !(ctx->streams[i]->disposition & AV_DISPOSITION_ATTACHED_PIC))
+			*video = ctx->streams[i];
+	*audio = (idx = av_find_best_stream (ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0)) >= 0 ? ctx->streams[idx] : NULL;
+}
+
+/**
+ *	Reads the media info from the headers. Only when they leave something open, e.g. the duration
+ *	of a transport stream, are packets read, at most SCAN_PROBE_SIZE bytes or SCAN_ANALYZE_US of them.
+ */
+static int probe_file (const char* path, rpi_mp_media_info* info)
+{
+	AVFormatContext* ctx = avformat_alloc_context ();
+	AVStream       * video, * audio;
+
+	if (!ctx)
+		return 1;
+	ctx->probesize            = SCAN_PROBE_SIZE;
+	ctx->max_analyze_duration = SCAN_ANALYZE_US;
+	// frees the context on failure
+	if (avformat_open_input (&ctx, path, NULL, NULL) < 0)
+		return 1;
+
+	pick_streams (ctx, &video, &audio);
+	if (ctx->duration == AV_NOPTS_VALUE || ctx->nb_streams == 0 || (video && (!video->codec->width || !video->avg_frame_rate.num)) ||
+	    (audio && !audio->codec->sample_rate))
+	{
+		if (avformat_find_stream_info (ctx, NULL) < 0)
+		{
+			avformat_close_input (&ctx);
+			return 1;
+		}
+		pick_streams (ctx, &video, &audio);
+	}
+
+	info->duration = ctx->duration != AV_NOPTS_VALUE ? ctx->duration : -1;
+	info->bit_rate = ctx->bit_rate;
+	snprintf (info->format, sizeof (info->format), "%s", ctx->iformat->name);
+	if (video)
+	{
+		info->width  = video->codec->width;
+		info->height = video->codec->height;
+		info->fps    = video->avg_frame_rate.num > 0 && video->avg_frame_rate.den > 0 ? av_q2d (video->avg_frame_rate) :
+		               video->r_frame_rate.num   > 0 && video->r_frame_rate.den   > 0 ? av_q2d (video->r_frame_rate)   : 0;
+		snprintf (info->video_codec, sizeof (info->video_codec), "%s", avcodec_get_name (video->codec->codec_id));
+	}
+	if (audio)
+	{
+		info->sample_rate = audio->codec->sample_rate;
+		info->channels    = audio->codec->channels;
+		snprintf (info->audio_codec, sizeof (info->audio_codec), "%s", avcodec_get_name (audio->codec->codec_id));
+	}
+	copy_tag (info->title,  sizeof (info->title),  ctx->metadata, audio ? audio->metadata : NULL, "title");
+	copy_tag (info->artist, sizeof (info->artist), ctx->metadata, audio ? audio->metadata : NULL, "artist");
+	copy_tag (info->album,  sizeof (info->album),  ctx->metadata, audio ? audio->metadata : NULL, "album");
+	copy_tag (info->date,   sizeof (info->date),   ctx->metadata, audio ? audio->metadata : NULL, "date");
+	avformat_close_input (&ctx);
+	return 0;
+}
+
+static void scan_file (scan_queue* queue, int i)
+{
+	rpi_mp_media_info* info   = &queue->infos[i];
+	scan_record      * record = &queue->records[i];
+	const scan_record* hit;
+	struct stat        st;
+
+	memset (info, 0x0, sizeof (rpi_mp_media_info));
+	memset (record, 0x0, sizeof (scan_record));
+	info->path     = queue->paths[i];
+	info->status   = 1;
+	info->duration = -1;
+	if (stat (info->path, &st) != 0 || !S_ISREG (st.st_mode))
+		return;
+
+	record->dev       = st.st_dev;
+	record->ino       = st.st_ino;
+	record->size      = st.st_size;
+	record->mtime_ns  = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	record->last_seen = queue->now;
+	hit = queue->n_cache ? (const scan_record*) bsearch (record, queue->cache, queue->n_cache, sizeof (scan_record), compare_keys) : NULL;
+	if (hit && hit->size == record->size && hit->mtime_ns == record->mtime_ns)
+	{
+		*info        = hit->info;
+		info->path   = queue->paths[i];
+		info->cached = 1;
+		// only rewrite the cache now and then to keep the entry from expiring
+		if (queue->now - hit->last_seen < SCAN_TOUCH_INTERVAL)
+			return;
+	}
+	else
+		// files that are not media are cached as well, so they are not opened on every scan
+		info->status = probe_file (info->path, info);
+	record->info        = *info;
+	record->info.path   = NULL;
+	record->info.cached = 0;
+	queue->store[i]     = 1;
+}
+
+static void* scan_worker (void* arg)
+{
+	scan_queue* queue = (scan_queue*) arg;
+	int         i;
+
+	// the UI and playback come first
+	setpriority (PRIO_PROCESS, syscall (SYS_gettid), SCAN_NICE);
+	while (1)
+	{
+		pthread_mutex_lock (&queue->mutex);
+		i = queue->next < queue->count ? queue->next ++ : -1;
+		pthread_mutex_unlock (&queue->mutex);
+		if (i < 0)
+			break;
+		scan_file (queue, i);
+	}
+	return NULL;
+}
+
+
+int rpi_mp_scan (const char* paths[], int count, int threads, rpi_mp_media_info* infos)
+{
+	scan_queue   queue;
+	scan_record* cache = NULL;
+	pthread_t    workers[SCAN_MAX_THREADS];
+	char         buffer[PATH_MAX];
+	const char*  path;
+	int          i, changed = 0, read = 0;
+
+	if (!paths || count < 0 || !infos)
+		return -1;
+	// runs without rpi_mp_init
+	av_register_all ();
+
+	memset (&queue, 0x0, sizeof (queue));
+	path          = cache_file_path (SCAN_CACHE_FILE, buffer, sizeof (buffer));
+	queue.paths   = paths;
+	queue.infos   = infos;
+	queue.count   = count;
+	queue.now     = time (NULL);
+	queue.n_cache = load_cache (path, &cache);
+	queue.cache   = cache;
+	queue.records = (scan_record*) malloc (count * sizeof (scan_record) + 1);
+	queue.store   = (char*) calloc (count + 1, 1);
+	if (!queue.records || !queue.store)
+	{
+		free (queue.records);
+		free (queue.store);
+		free (cache);
+		return -1;
+	}
+	pthread_mutex_init (&queue.mutex, NULL);
+
+	if (threads <= 0)
+		threads = sysconf (_SC_NPROCESSORS_ONLN);
+	threads = threads > SCAN_MAX_THREADS ? SCAN_MAX_THREADS : threads > count ? count : threads;
+	for (i = 0; i < threads; i ++)
+		if (pthread_create (&workers[i], NULL, scan_worker, &queue) != 0)
+			break;
+	// if no thread could be started this one does the work
+	if (i == 0)
+		scan_worker (&queue);
+	while (i --)
+		pthread_join (workers[i], NULL);
+
+	for (i = 0; i < count; i ++)
+	{
+		changed |= queue.store[i];
+		read    += infos[i].status == 0;
+	}
+	if (changed)
+		store_cache (path, &queue);
+
+	pthread_mutex_destroy (&queue.mutex);
+	free (queue.records);
+	free (queue.store);
+	free (cache);
+	return read;
+}
+
+/**
+ *	A directory on the way down from where the listing started.
+ */
+typedef struct directory_id
+{
+	dev_t                       dev;
+	ino_t                       ino;
+	const struct directory_id * parent;
+}
+directory_id;
+
+/**
+ *	Appends the paths of all files below a directory, skipping hidden entries.
+ *	Symbolic links to directories are followed, except back into a directory we are in already.
+ */
+static int list_files (const char* directory, const directory_id* ancestors, char*** paths, int* count, int* size)
+{
+	DIR          * dir = opendir (directory);
+	struct dirent* entry;
+	struct stat    st;
+	char         * path;
+	size_t         length;
+
+	if (!dir)
+		return 1;
+	while ((entry = readdir (dir)))
+	{
+		length = strlen (directory) + strlen (entry->d_name) + 2;
+		if (entry->d_name[0] == '.' || !(path = (char*) malloc (length)))
+			continue;
+		snprintf (path, length, "%s/%s", directory, entry->d_name);
+		if (stat (path, &st) == 0 && S_ISDIR (st.st_mode))
+		{
+			directory_id        id = { st.st_dev, st.st_ino, ancestors };
+			const directory_id* a;
+			for (a = ancestors; a && (a->dev != st.st_dev || a->ino != st.st_ino); a = a->parent)
+				;
+			if (a)
+				fprintf (stderr, "Not scanning %s again, it links back to %s\n", path, directory);
+			else
+				list_files (path, &id, paths, count, size);
+			free (path);
+			continue;
+		}
+		if (*count == *size)
+		{
+			char** grown = (char**) realloc (*paths, (*size ? *size * 2 : 256) * sizeof (char*));
+			if (!grown)
+			{
+				free (path);
+				break;
+			}
+			*paths = grown;
+			*size  = *size ? *size * 2 : 256;
+		}
+		(*paths)[(*count) ++] = path;
+	}
+	closedir (dir);
+	return 0;
+}
+
+static int compare_paths (const void* a, const void* b)
+{
+	return strcmp (*(char* const*) a, *(char* const*) b);
+}
+
+
+int rpi_mp_scan_directory (const char* directory, int threads, rpi_mp_media_info** infos, int* count)
+{
+	char**       paths = NULL;
+	int          size = 0, ret, i;
+	struct stat  st;
+	directory_id root;
+
+	*infos = NULL;
+	*count = 0;
+	if (stat (directory, &st) != 0)
+	{
+		fprintf (stderr, "Could not read directory %s\n", directory);
+		return -1;
+	}
+	root.dev    = st.st_dev;
+	root.ino    = st.st_ino;
+	root.parent = NULL;
+	if (list_files (directory, &root, &paths, count, &size) != 0)
+	{
+		fprintf (stderr, "Could not read directory %s\n", directory);
+		return -1;
+	}
+	qsort (paths, *count, sizeof (char*), compare_paths);
+	if (!(*infos = (rpi_mp_media_info*) malloc (*count * sizeof (rpi_mp_media_info) + 1)) ||
+	    (ret = rpi_mp_scan ((const char**) paths, *count, threads, *infos)) < 0)
+	{
+		for (i = 0; i < *count; i ++)
+			free (paths[i]);
+		free (*infos);
+		*infos = NULL;
+		*count = 0;
+		ret    = -1;
+	}
+	// the paths are owned by the infos now
+	free (paths);
+	return ret;
+}
+
+
+void rpi_mp_free_scan (rpi_mp_media_info* infos, int count)
+{
+	int i;
+	for (i = 0; i < count; i ++)
+		free ((char*) infos[i].path);
+	free (infos);
+}
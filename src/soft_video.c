@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include "rpi_mp_soft_video.h"
+#include "rpi_mp_utils.h"
+
+
+int open_soft_video (soft_video* video, AVStream* stream, int threads, int64_t (*clock) (void))
+{
+	AVCodec* codec;
+	int      i;
+
+	memset (video, 0x0, sizeof (soft_video));
+	video->time_base = stream->time_base;
+	video->clock     = clock;
+	video->last_pts  = AV_NOPTS_VALUE;
+	pthread_mutex_init (&video->mutex, NULL);
+	pthread_cond_init  (&video->cond, NULL);
+
+	if (!(codec = avcodec_find_decoder (stream->codec->codec_id)))
+	{
+		fprintf (stderr, "No software decoder for %s\n", avcodec_get_name (stream->codec->codec_id));
+		return 1;
+	}
+	if (!(video->codec_ctx = avcodec_alloc_context3 (codec)) || avcodec_copy_context (video->codec_ctx, stream->codec) < 0)
+	{
+		fprintf (stderr, "Could not set up software video decoder\n");
+		close_soft_video (video);
+		return 1;
+	}
+	// frame threads keep all cores busy on any stream, slice threads add to them where slices exist
+	video->codec_ctx->thread_count      = threads > 0 ? threads : sysconf (_SC_NPROCESSORS_ONLN);
+	video->codec_ctx->thread_type       = FF_THREAD_FRAME | FF_THREAD_SLICE;
+	video->codec_ctx->refcounted_frames = 1;
+	if (avcodec_open2 (video->codec_ctx, codec, NULL) < 0)
+	{
+		fprintf (stderr, "Could not open software decoder for %s\n", codec->name);
+		close_soft_video (video);
+		return 1;
+	}
+	video->decoded = av_frame_alloc ();
+	for (i = 0; i < SOFT_VIDEO_FRAMES; i ++)
+		video->frames[i] = av_frame_alloc ();
+	return 0;
+}
+
+
+void close_soft_video (soft_video* video)
+{
+	int i;
+
+	avcodec_free_context (&video->codec_ctx);
+	av_frame_free (&video->decoded);
+	for (i = 0; i < SOFT_VIDEO_FRAMES; i ++)
+		av_frame_free (&video->frames[i]);
+	sws_freeContext (video->sws);
+	video->sws = NULL;
+	pthread_mutex_destroy (&video->mutex);
+	pthread_cond_destroy  (&video->cond);
+}
+
+/**
+ *	Moves the frame the decoder just returned into the pool, unless it is already too late to show.
+ */
+static void queue_frame (soft_video* video)
+{
+	int64_t pts = av_frame_get_best_effort_timestamp (video->decoded);
+
+	if (pts != AV_NOPTS_VALUE)
+	{
+		pts = av_rescale_q (pts, video->time_base, AV_TIME_BASE_Q);
+		video->last_pts = pts;
+	}
+	video->decoded->pts = pts;
+
+	pthread_mutex_lock (&video->mutex);
+	video->decoded_frames ++;
+	// a frame still in flight when the pool was flushed belongs to the old position
+	if (video->flush)
+	{
+		av_frame_unref (video->decoded);
+		pthread_mutex_unlock (&video->mutex);
+		return;
+	}
+	if (video->clock && pts != AV_NOPTS_VALUE && video->clock () - pts > SOFT_VIDEO_LATE_US)
+	{
+		// read by the metrics server without the lock
+		__atomic_add_fetch (&video->late, 1, __ATOMIC_RELAXED);
+		av_frame_unref (video->decoded);
+		pthread_mutex_unlock (&video->mutex);
+		return;
+	}
+	while (video->count == SOFT_VIDEO_FRAMES && !video->aborted)
+		pthread_cond_wait (&video->cond, &video->mutex);
+	if (video->aborted)
+		av_frame_unref (video->decoded);
+	else
+	{
+		// hands over the reference to the decoder's buffer, the picture itself is not copied
+		av_frame_move_ref (video->frames[(video->front + video->count) % SOFT_VIDEO_FRAMES], video->decoded);
+		video->count ++;
+		pthread_cond_broadcast (&video->cond);
+	}
+	pthread_mutex_unlock (&video->mutex);
+}
+
+
+int soft_video_decode (soft_video* video, AVPacket* packet)
+{
+	AVPacket drain;
+	int      got_frame, ret;
+	int64_t  start;
+
+	pthread_mutex_lock (&video->mutex);
+	if (video->flush)
+	{
+		video->flush = 0;
+		pthread_mutex_unlock (&video->mutex);
+		avcodec_flush_buffers (video->codec_ctx);
+		video->last_pts = AV_NOPTS_VALUE;
+	}
+	else
+		pthread_mutex_unlock (&video->mutex);
+	if (!packet->data)
+	{
+		av_init_packet (&drain);
+		drain.data = NULL;
+		drain.size = 0;
+		packet     = &drain;
+	}
+	// while the output lags behind the clock, skip the frames no other frame refers to
+	if (video->clock && video->last_pts != AV_NOPTS_VALUE)
+		video->codec_ctx->skip_frame = video->clock () - video->last_pts > SOFT_VIDEO_LATE_US ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+	do
+	{
+		start = monotonic_us ();
+		if ((ret = avcodec_decode_video2 (video->codec_ctx, video->decoded, &got_frame, packet)) < 0)
+		{
+			fprintf (stderr, "Error decoding video packet in software\n");
+			return ret;
+		}
+		video->decode_us += monotonic_us () - start;
+		video->packets   += packet->data != NULL;
+		if (got_frame)
+			queue_frame (video);
+	}
+	while (!packet->data && got_frame && !video->aborted);
+	return video->aborted;
+}
+
+
+AVFrame* soft_video_acquire (soft_video* video, int64_t* pts)
+{
+	AVFrame* frame = NULL;
+
+	pthread_mutex_lock (&video->mutex);
+	while (!video->count && !video->finished && !video->aborted)
+		pthread_cond_wait (&video->cond, &video->mutex);
+	if (video->count && !video->aborted)
+	{
+		frame                   = video->frames[video->front];
+		*pts                    = frame->pts;
+		video->in_use           = 1;
+		video->acquired_flushes = video->flushes;
+	}
+	pthread_mutex_unlock (&video->mutex);
+	return frame;
+}
+
+
+int soft_video_peek (soft_video* video, int64_t* pts)
+{
+	int queued;
+
+	pthread_mutex_lock (&video->mutex);
+	queued = video->count && !video->in_use && !video->aborted;
+	if (queued)
+		*pts = video->frames[video->front]->pts;
+	pthread_mutex_unlock (&video->mutex);
+	return queued;
+}
+
+
+int soft_video_stale (soft_video* video)
+{
+	int stale;
+
+	pthread_mutex_lock (&video->mutex);
+	stale = video->in_use && video->flushes != video->acquired_flushes;
+	pthread_mutex_unlock (&video->mutex);
+	return stale;
+}
+
+
+void soft_video_release (soft_video* video)
+{
+	pthread_mutex_lock (&video->mutex);
+	if (video->in_use)
+	{
+		av_frame_unref (video->frames[video->front]);
+		video->front  = (video->front + 1) % SOFT_VIDEO_FRAMES;
+		video->count --;
+		video->in_use = 0;
+		pthread_cond_broadcast (&video->cond);
+	}
+	pthread_mutex_unlock (&video->mutex);
+}
+
+
+int soft_video_convert (soft_video* video, const AVFrame* frame, uint8_t* buffer, int stride, int slice_height)
+{
+	uint8_t* planes[3]  = { buffer,
+	                        buffer + stride * slice_height,
+	                        buffer + stride * slice_height + stride / 2 * (slice_height / 2) };
+	int      strides[3] = { stride, stride / 2, stride / 2 };
+	int      i;
+
+	if (frame->format == AV_PIX_FMT_YUV420P || frame->format == AV_PIX_FMT_YUVJ420P)
+	{
+		for (i = 0; i < 3; i ++)
+			av_image_copy_plane (planes[i], strides[i], frame->data[i], frame->linesize[i],
+			                     i ? (frame->width + 1) / 2 : frame->width, i ? (frame->height + 1) / 2 : frame->height);
+		return 0;
+	}
+	// e.g. 10 bit HEVC or VP9 profile 2; no scaling, so the cheapest filter does
+	if (!(video->sws = sws_getCachedContext (video->sws, frame->width, frame->height, frame->format,
+	                                         frame->width, frame->height, AV_PIX_FMT_YUV420P, SWS_POINT, NULL, NULL, NULL)))
+	{
+		fprintf (stderr, "Could not convert %s frames\n", av_get_pix_fmt_name (frame->format));
+		return 1;
+	}
+	sws_scale (video->sws, (const uint8_t* const*) frame->data, frame->linesize, 0, frame->height, planes, strides);
+	return 0;
+}
+
+
+void soft_video_finish (soft_video* video)
+{
+	pthread_mutex_lock (&video->mutex);
+	video->finished = 1;
+	pthread_cond_broadcast (&video->cond);
+	pthread_mutex_unlock (&video->mutex);
+}
+
+
+void soft_video_abort (soft_video* video)
+{
+	pthread_mutex_lock (&video->mutex);
+	video->aborted = 1;
+	pthread_cond_broadcast (&video->cond);
+	pthread_mutex_unlock (&video->mutex);
+}
+
+
+void soft_video_flush (soft_video* video)
+{
+	int i, keep;
+
+	pthread_mutex_lock (&video->mutex);
+	// the frame the render side is converting stays until it is released
+	keep = video->in_use;
+	for (i = keep; i < video->count; i ++)
+		av_frame_unref (video->frames[(video->front + i) % SOFT_VIDEO_FRAMES]);
+	video->count = keep;
+	video->flush = 1;
+	video->flushes ++;
+	pthread_cond_broadcast (&video->cond);
+	pthread_mutex_unlock (&video->mutex);
+}
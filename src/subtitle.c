@@ -0,0 +1,705 @@
+#include <libavcodec/avcodec.h>
+#include <pthread.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#ifdef HAVE_LIBBCM_HOST
+#include "bcm_host.h"
+#endif
+#include "rpi_mp.h"
+#include "rpi_mp_subtitle.h"
+
+#define DEFAULT_FONT      "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf"
+#define ATLAS_SIZE        1024
+#define GLYPH_SLOTS       2048
+#define MAX_LINES         16
+#define MAX_TEXT          4096
+#define OVERLAY_PADDING   8
+#define SHADOW_OFFSET     2
+#define DISPMANX_LAYER    10
+
+
+/**
+ *	A glyph rendered once into the atlas.
+ */
+typedef struct
+{
+	uint32_t codepoint;
+	int16_t  x, y;
+	int16_t  width, height;
+	int16_t  left, top;
+	int16_t  advance;
+}
+glyph;
+
+/**
+ *	A rasterized subtitle event, positioned in video coordinates.
+ *  An event with zero width clears the screen.
+ */
+typedef struct
+{
+	int64_t   start;
+	int64_t   end;
+	int       x, y;
+	int       width, height, stride;
+	uint8_t * rgba;
+	size_t    capacity;
+}
+overlay;
+
+typedef struct
+{
+	const char * start;
+	const char * end;
+	int          width;
+}
+text_line;
+
+// Font and glyph atlas
+static FT_Library       library    = NULL;
+static FT_Face          face       = NULL;
+static char           * font_path  = NULL;
+static int              font_size  = 0;
+static int              pixel_size = 0;
+static uint8_t        * atlas      = NULL;
+static glyph            glyphs[GLYPH_SLOTS];
+static int              n_glyphs, atlas_x, atlas_y, atlas_row;
+static int              line_height, ascender;
+
+// Events rasterized ahead of time and the one on screen
+static AVCodecContext * codec      = NULL;
+static int              video_width, video_height;
+static overlay          events[SUBTITLE_EVENTS];
+static int              events_head = 0, n_events = 0;
+static overlay          shown;
+static int              visible    = 0;
+static uint32_t         sequence   = 0;
+static pthread_mutex_t  events_mutex  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t  overlay_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Dispmanx layer used when the video is not rendered to a texture, never on the host
+static int                        use_dispmanx = 0;
+#ifdef HAVE_LIBBCM_HOST
+static DISPMANX_DISPLAY_HANDLE_T  display      = DISPMANX_NO_HANDLE;
+static DISPMANX_RESOURCE_HANDLE_T resource     = DISPMANX_NO_HANDLE;
+static DISPMANX_ELEMENT_HANDLE_T  element      = DISPMANX_NO_HANDLE;
+static uint32_t                   screen_width, screen_height;
+#endif
+
+
+/**
+ *	Forgets all glyphs, they will be rendered again when needed.
+ */
+static void reset_atlas ()
+{
+	memset (glyphs, 0x0, sizeof (glyphs));
+	n_glyphs = atlas_x = atlas_y = atlas_row = 0;
+}
+
+/**
+ *	Renders a glyph with FreeType and packs it into the next free spot of the atlas.
+ */
+static glyph* rasterize_glyph (uint32_t codepoint, glyph* g)
+{
+	FT_Bitmap* bitmap;
+	int row;
+
+	g->codepoint = codepoint;
+	n_glyphs ++;
+	if (FT_Load_Char (face, codepoint, FT_LOAD_RENDER) != 0)
+	{
+		g->advance = pixel_size / 3;
+		return g;
+	}
+	bitmap = &face->glyph->bitmap;
+	if (atlas_x + bitmap->width > ATLAS_SIZE)
+	{
+		atlas_x    = 0;
+		atlas_y   += atlas_row + 1;
+		atlas_row  = 0;
+	}
+	if (atlas_y + bitmap->rows > ATLAS_SIZE)
+		return NULL;
+
+	g->x       = atlas_x;
+	g->y       = atlas_y;
+	g->width   = bitmap->width;
+	g->height  = bitmap->rows;
+	g->left    = face->glyph->bitmap_left;
+	g->top     = face->glyph->bitmap_top;
+	g->advance = face->glyph->advance.x >> 6;
+	for (row = 0; row < bitmap->rows; row ++)
+		memcpy (atlas + (atlas_y + row) * ATLAS_SIZE + atlas_x, bitmap->buffer + row * bitmap->pitch, bitmap->width);
+
+	atlas_x  += bitmap->width + 1;
+	atlas_row = bitmap->rows > atlas_row ? bitmap->rows : atlas_row;
+	return g;
+}
+
+/**
+ *	Looks up a glyph in the atlas, rasterizing it on first use.
+ *  The returned pointer is only valid until the next call.
+ */
+static const glyph* get_glyph (uint32_t codepoint)
+{
+	uint32_t slot = (codepoint * 2654435761u) & (GLYPH_SLOTS - 1);
+	glyph*   g;
+
+	while (glyphs[slot].codepoint && glyphs[slot].codepoint != codepoint)
+		slot = (slot + 1) & (GLYPH_SLOTS - 1);
+	if (glyphs[slot].codepoint == codepoint)
+		return &glyphs[slot];
+
+	// keep the table sparse and start over once the atlas is full
+	if (n_glyphs < GLYPH_SLOTS / 2 && (g = rasterize_glyph (codepoint, &glyphs[slot])) != NULL)
+		return g;
+	reset_atlas ();
+	slot = (codepoint * 2654435761u) & (GLYPH_SLOTS - 1);
+	if ((g = rasterize_glyph (codepoint, &glyphs[slot])) != NULL)
+		return g;
+	memset (&glyphs[slot], 0x0, sizeof (glyph));
+	glyphs[slot].advance = pixel_size / 3;
+	return &glyphs[slot];
+}
+
+/**
+ *	Decodes the next UTF-8 character and advances the string.
+ */
+static uint32_t next_codepoint (const char** text)
+{
+	const uint8_t* s = (const uint8_t*) *text;
+	uint32_t cp;
+	int n, i;
+
+	if      (s[0] < 0x80)           { cp = s[0];        n = 0; }
+	else if ((s[0] & 0xE0) == 0xC0) { cp = s[0] & 0x1F; n = 1; }
+	else if ((s[0] & 0xF0) == 0xE0) { cp = s[0] & 0x0F; n = 2; }
+	else if ((s[0] & 0xF8) == 0xF0) { cp = s[0] & 0x07; n = 3; }
+	else                            { cp = '?';         n = 0; }
+
+	for (i = 1; i <= n; i ++)
+	{
+		if ((s[i] & 0xC0) != 0x80)
+		{
+			*text += i;
+			return '?';
+		}
+		cp = (cp << 6) | (s[i] & 0x3F);
+	}
+	*text += n + 1;
+	return cp;
+}
+
+/**
+ *	Extracts the plain text of a text or ASS subtitle rect.
+ *  Override blocks are dropped and ASS line breaks turned into new lines.
+ */
+static void plain_text (const AVSubtitleRect* rect, char* out, int size)
+{
+	const char* s = rect->type == SUBTITLE_ASS ? rect->ass : rect->text;
+	int commas, n = 0;
+
+	if (!s)
+	{
+		out[0] = '\0';
+		return;
+	}
+	if (rect->type == SUBTITLE_ASS)
+	{
+		// old style "Dialogue: Layer,Start,End,..." has one field more than the packet format
+		commas = strncmp (s, "Dialogue:", 9) == 0 ? 9 : 8;
+		while (*s && commas)
+			if (*s ++ == ',')
+				commas --;
+	}
+	while (*s && n < size - 1)
+	{
+		if (*s == '{' && strchr (s, '}'))
+			s = strchr (s, '}') + 1;
+		else if (s[0] == '\\' && (s[1] == 'N' || s[1] == 'n'))
+		{
+			out[n ++] = '\n';
+			s += 2;
+		}
+		else if (s[0] == '\\' && s[1] == 'h')
+		{
+			out[n ++] = ' ';
+			s += 2;
+		}
+		else if (*s == '\r')
+			s ++;
+		else
+			out[n ++] = *s ++;
+	}
+	// no trailing new lines
+	while (n > 0 && out[n - 1] == '\n')
+		n --;
+	out[n] = '\0';
+}
+
+/**
+ *	Splits text into lines no wider than max_width, breaking at spaces where possible.
+ *	Returns the number of lines.
+ */
+static int layout_lines (const char* text, int max_width, text_line* lines)
+{
+	const char* p = text;
+	int n = 0;
+
+	while (*p && n < MAX_LINES)
+	{
+		const char* start = p, * space = NULL, * q;
+		int width = 0, space_width = 0, advance;
+		uint32_t cp;
+
+		while (*p && *p != '\n')
+		{
+			q  = p;
+			cp = next_codepoint (&q);
+			advance = get_glyph (cp)->advance;
+			if (width + advance > max_width && p > start)
+				break;
+			if (cp == ' ')
+			{
+				space       = p;
+				space_width = width;
+			}
+			width += advance;
+			p = q;
+		}
+		lines[n].start = start;
+		if (*p && *p != '\n' && space)
+		{
+			lines[n].end   = space;
+			lines[n].width = space_width;
+			p = space + 1;
+		}
+		else
+		{
+			lines[n].end   = p;
+			lines[n].width = width;
+			if (*p == '\n')
+				p ++;
+		}
+		n ++;
+	}
+	return n;
+}
+
+/**
+ *	Makes sure the overlay can hold width x height pixels and clears it.
+ *  Buffers only grow, so steady state rendering does not allocate.
+ */
+static int prepare_overlay (overlay* o, int width, int height)
+{
+	int    stride = (width * 4 + 31) & ~31;
+	size_t size   = (size_t) stride * height;
+
+	o->width  = width;
+	o->height = height;
+	o->stride = stride;
+	// an event that clears the screen needs no pixels
+	if (size == 0)
+		return 0;
+	if (size > o->capacity)
+	{
+		uint8_t* rgba = (uint8_t*) realloc (o->rgba, size);
+		if (!rgba)
+			return 1;
+		o->rgba     = rgba;
+		o->capacity = size;
+	}
+	memset (o->rgba, 0x0, size);
+	return 0;
+}
+
+/**
+ *	Blends a glyph from the atlas into the overlay in a single grey level.
+ */
+static void blit_glyph (overlay* o, const glyph* g, int x, int y, uint8_t color)
+{
+	int r, c;
+	for (r = 0; r < g->height; r ++)
+	{
+		const uint8_t* src = atlas + (g->y + r) * ATLAS_SIZE + g->x;
+		uint8_t*       dst;
+		if (y + r < 0 || y + r >= o->height)
+			continue;
+		dst = o->rgba + (y + r) * o->stride + x * 4;
+		for (c = 0; c < g->width; c ++, dst += 4)
+		{
+			int cov = src[c];
+			if (!cov || x + c < 0 || x + c >= o->width)
+				continue;
+			dst[0] = (dst[0] * (255 - cov) + color * cov) / 255;
+			dst[1] = (dst[1] * (255 - cov) + color * cov) / 255;
+			dst[2] = (dst[2] * (255 - cov) + color * cov) / 255;
+			dst[3] = cov > dst[3] ? cov : dst[3];
+		}
+	}
+}
+
+/**
+ *	Lays out and rasterizes the text of a subtitle, centered at the bottom of the video.
+ */
+static int render_text (overlay* o, const AVSubtitle* sub)
+{
+	static char text[MAX_TEXT];
+	text_line   lines[MAX_LINES];
+	int         n_lines = 0, width = 0, i, len = 0, pass;
+
+	if (!face)
+		return 1;
+	for (i = 0; i < sub->num_rects && len < MAX_TEXT - 1; i ++)
+	{
+		if (len > 0)
+			text[len ++] = '\n';
+		plain_text (sub->rects[i], text + len, MAX_TEXT - len);
+		len += strlen (text + len);
+	}
+	n_lines = layout_lines (text, video_width * 9 / 10, lines);
+	for (i = 0; i < n_lines; i ++)
+		width = lines[i].width > width ? lines[i].width : width;
+	if (n_lines == 0 || width == 0)
+		return prepare_overlay (o, 0, 0);
+
+	if (prepare_overlay (o, width + 2 * OVERLAY_PADDING + SHADOW_OFFSET,
+	                     n_lines * line_height + 2 * OVERLAY_PADDING + SHADOW_OFFSET) != 0)
+		return 1;
+	o->x = (video_width - o->width) / 2;
+	o->y = video_height - video_height / 20 - o->height;
+	o->x = o->x < 0 ? 0 : o->x;
+	o->y = o->y < 0 ? 0 : o->y;
+
+	for (i = 0; i < n_lines; i ++)
+	{
+		int baseline = OVERLAY_PADDING + ascender + i * line_height;
+		// shadow of the whole line first so it never covers a neighbouring glyph
+		for (pass = 0; pass < 2; pass ++)
+		{
+			const char* p = lines[i].start;
+			int         x = OVERLAY_PADDING + (width - lines[i].width) / 2 + (pass ? 0 : SHADOW_OFFSET);
+			int         y = baseline + (pass ? 0 : SHADOW_OFFSET);
+			while (p < lines[i].end)
+			{
+				const glyph* g = get_glyph (next_codepoint (&p));
+				blit_glyph (o, g, x + g->left, y - g->top, pass ? 0xFF : 0x00);
+				x += g->advance;
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ *	Converts the palettized rects of a bitmap subtitle into one RGBA overlay.
+ */
+static int render_bitmap (overlay* o, const AVSubtitle* sub)
+{
+	int i, x, y, x0 = INT_MAX, y0 = INT_MAX, x1 = 0, y1 = 0;
+
+	for (i = 0; i < sub->num_rects; i ++)
+	{
+		const AVSubtitleRect* r = sub->rects[i];
+		if (r->type != SUBTITLE_BITMAP || r->w <= 0 || r->h <= 0)
+			continue;
+		x0 = r->x < x0 ? r->x : x0;
+		y0 = r->y < y0 ? r->y : y0;
+		x1 = r->x + r->w > x1 ? r->x + r->w : x1;
+		y1 = r->y + r->h > y1 ? r->y + r->h : y1;
+	}
+	if (x1 <= x0 || y1 <= y0)
+		return prepare_overlay (o, 0, 0);
+	if (prepare_overlay (o, x1 - x0, y1 - y0) != 0)
+		return 1;
+	o->x = x0;
+	o->y = y0;
+
+	for (i = 0; i < sub->num_rects; i ++)
+	{
+		const AVSubtitleRect* r = sub->rects[i];
+		const uint32_t*       palette;
+		if (r->type != SUBTITLE_BITMAP || r->w <= 0 || r->h <= 0)
+			continue;
+		palette = (const uint32_t*) r->pict.data[1];
+		for (y = 0; y < r->h; y ++)
+		{
+			const uint8_t* src = r->pict.data[0] + y * r->pict.linesize[0];
+			uint8_t*       dst = o->rgba + (r->y - y0 + y) * o->stride + (r->x - x0) * 4;
+			for (x = 0; x < r->w; x ++, dst += 4)
+			{
+				uint32_t argb = palette[src[x]];
+				dst[0] = argb >> 16;
+				dst[1] = argb >> 8;
+				dst[2] = argb;
+				dst[3] = argb >> 24;
+			}
+		}
+	}
+	return 0;
+}
+
+#ifdef HAVE_LIBBCM_HOST
+/**
+ *	Puts the overlay on screen on top of the video, scaled like the video is by video_render.
+ */
+static void present_dispmanx ()
+{
+	DISPMANX_UPDATE_HANDLE_T   update = vc_dispmanx_update_start (0);
+	DISPMANX_RESOURCE_HANDLE_T old    = resource;
+	VC_RECT_T                  src, dst, rect;
+
+	if (element != DISPMANX_NO_HANDLE)
+		vc_dispmanx_element_remove (update, element);
+	element  = DISPMANX_NO_HANDLE;
+	resource = DISPMANX_NO_HANDLE;
+
+	if (visible)
+	{
+		VC_DISPMANX_ALPHA_T alpha = { DISPMANX_FLAGS_ALPHA_FROM_SOURCE, 255, 0 };
+		uint32_t image;
+		// video is letterboxed to the screen
+		double scale = (double) screen_width / video_width < (double) screen_height / video_height ?
+		               (double) screen_width / video_width : (double) screen_height / video_height;
+		int    left  = (screen_width  - video_width  * scale) / 2;
+		int    top   = (screen_height - video_height * scale) / 2;
+
+		resource = vc_dispmanx_resource_create (VC_IMAGE_RGBA32, shown.width, shown.height, &image);
+		vc_dispmanx_rect_set (&rect, 0, 0, shown.width, shown.height);
+		vc_dispmanx_resource_write_data (resource, VC_IMAGE_RGBA32, shown.stride, shown.rgba, &rect);
+		vc_dispmanx_rect_set (&src, 0, 0, shown.width << 16, shown.height << 16);
+		vc_dispmanx_rect_set (&dst, left + shown.x * scale, top + shown.y * scale, shown.width * scale, shown.height * scale);
+		element = vc_dispmanx_element_add (update, display, DISPMANX_LAYER, &dst, resource, &src,
+		                                   DISPMANX_PROTECTION_NONE, &alpha, NULL, DISPMANX_NO_ROTATE);
+	}
+	vc_dispmanx_update_submit_sync (update);
+	if (old != DISPMANX_NO_HANDLE)
+		vc_dispmanx_resource_delete (old);
+}
+#else
+static void present_dispmanx () { }
+#endif
+
+
+int init_subtitles (AVCodecContext* codec_ctx, int width, int height, int dispmanx)
+{
+	int size;
+
+	codec        = codec_ctx;
+	video_width  = width  > 0 ? width  : codec_ctx->width;
+	video_height = height > 0 ? height : codec_ctx->height;
+	use_dispmanx = dispmanx;
+	events_head  = n_events = visible = 0;
+	memset (events, 0x0, sizeof (events));
+	memset (&shown, 0x0, sizeof (shown));
+	reset_atlas ();
+
+	if (video_width <= 0 || video_height <= 0)
+	{
+		fprintf (stderr, "Subtitles: unknown video size\n");
+		return 1;
+	}
+	if (!(atlas = (uint8_t*) calloc (ATLAS_SIZE, ATLAS_SIZE)))
+		return 1;
+
+	// bitmap subtitles still work without a font
+	size = font_size > 0 ? font_size : video_height / 18 > 12 ? video_height / 18 : 12;
+	if (FT_Init_FreeType (&library) != 0 ||
+	    FT_New_Face (library, font_path ? font_path : DEFAULT_FONT, 0, &face) != 0 ||
+	    FT_Set_Pixel_Sizes (face, 0, size) != 0)
+	{
+		fprintf (stderr, "Subtitles: could not load font %s\n", font_path ? font_path : DEFAULT_FONT);
+		if (face)
+			FT_Done_Face (face);
+		face = NULL;
+	}
+	else
+	{
+		pixel_size  = size;
+		line_height = face->size->metrics.height >> 6;
+		ascender    = face->size->metrics.ascender >> 6;
+	}
+
+	if (use_dispmanx)
+	{
+#ifdef HAVE_LIBBCM_HOST
+		display = vc_dispmanx_display_open (0);
+		if (graphics_get_display_size (0, &screen_width, &screen_height) < 0)
+		{
+			vc_dispmanx_display_close (display);
+			display      = DISPMANX_NO_HANDLE;
+			use_dispmanx = 0;
+		}
+#else
+		use_dispmanx = 0;
+#endif
+	}
+	return 0;
+}
+
+
+void destroy_subtitles ()
+{
+	int i;
+	pthread_mutex_lock (&events_mutex);
+	pthread_mutex_lock (&overlay_mutex);
+#ifdef HAVE_LIBBCM_HOST
+	if (use_dispmanx)
+	{
+		visible = 0;
+		present_dispmanx ();
+		vc_dispmanx_display_close (display);
+		display      = DISPMANX_NO_HANDLE;
+		use_dispmanx = 0;
+	}
+#endif
+	for (i = 0; i < SUBTITLE_EVENTS; i ++)
+		free (events[i].rgba);
+	free (shown.rgba);
+	memset (events, 0x0, sizeof (events));
+	memset (&shown, 0x0, sizeof (shown));
+	events_head = n_events = visible = 0;
+
+	free (atlas);
+	atlas = NULL;
+	if (face)
+		FT_Done_Face (face);
+	if (library)
+		FT_Done_FreeType (library);
+	face    = NULL;
+	library = NULL;
+	codec   = NULL;
+	pthread_mutex_unlock (&overlay_mutex);
+	pthread_mutex_unlock (&events_mutex);
+}
+
+
+int subtitles_pending_full ()
+{
+	return n_events == SUBTITLE_EVENTS;
+}
+
+
+int decode_subtitle_packet (AVPacket* packet, int64_t pts, int64_t duration)
+{
+	AVSubtitle sub;
+	overlay*   o;
+	int        got_subtitle = 0, ret = 0;
+
+	if (avcodec_decode_subtitle2 (codec, &sub, &got_subtitle, packet) < 0)
+		return 1;
+	if (!got_subtitle)
+		return 0;
+
+	pthread_mutex_lock (&events_mutex);
+	if (n_events < SUBTITLE_EVENTS)
+	{
+		o = &events[(events_head + n_events) % SUBTITLE_EVENTS];
+		o->start = pts + sub.start_display_time * 1000LL;
+		if (sub.end_display_time > sub.start_display_time && sub.end_display_time != UINT32_MAX)
+			o->end = pts + sub.end_display_time * 1000LL;
+		else
+			o->end = duration > 0 ? pts + duration : AV_NOPTS_VALUE;
+
+		if (sub.num_rects == 0)
+			ret = prepare_overlay (o, 0, 0);
+		else if (sub.rects[0]->type == SUBTITLE_BITMAP)
+			ret = render_bitmap (o, &sub);
+		else
+			ret = render_text (o, &sub);
+		if (ret == 0)
+			n_events ++;
+	}
+	pthread_mutex_unlock (&events_mutex);
+	avsubtitle_free (&sub);
+	return ret;
+}
+
+
+void update_subtitles (int64_t media_time)
+{
+	int changed = 0;
+	pthread_mutex_lock (&events_mutex);
+	while (n_events > 0 && events[events_head].start <= media_time)
+	{
+		overlay* o = &events[events_head];
+		events_head = (events_head + 1) % SUBTITLE_EVENTS;
+		n_events --;
+		// we were late enough to miss it entirely
+		if (o->end != AV_NOPTS_VALUE && o->end <= media_time)
+			continue;
+		// swap buffers with the shown overlay, the old one is reused for a later event
+		pthread_mutex_lock (&overlay_mutex);
+		overlay tmp = shown;
+		shown    = *o;
+		*o       = tmp;
+		visible  = shown.width > 0;
+		sequence ++;
+		pthread_mutex_unlock (&overlay_mutex);
+		changed  = 1;
+	}
+	if (visible && shown.end != AV_NOPTS_VALUE && shown.end <= media_time)
+	{
+		pthread_mutex_lock (&overlay_mutex);
+		visible = 0;
+		sequence ++;
+		pthread_mutex_unlock (&overlay_mutex);
+		changed = 1;
+	}
+	if (changed && use_dispmanx)
+		present_dispmanx ();
+	pthread_mutex_unlock (&events_mutex);
+}
+
+
+void flush_subtitles ()
+{
+	pthread_mutex_lock (&events_mutex);
+	events_head = n_events = 0;
+	if (visible)
+	{
+		pthread_mutex_lock (&overlay_mutex);
+		visible = 0;
+		sequence ++;
+		pthread_mutex_unlock (&overlay_mutex);
+		if (use_dispmanx)
+			present_dispmanx ();
+	}
+	pthread_mutex_unlock (&events_mutex);
+}
+
+
+void subtitles_codec (AVCodecContext* codec_ctx)
+{
+	pthread_mutex_lock (&events_mutex);
+	codec = codec_ctx;
+	pthread_mutex_unlock (&events_mutex);
+}
+
+
+int rpi_mp_subtitle_font (const char* path, int size)
+{
+	free (font_path);
+	font_path = path ? strdup (path) : NULL;
+	font_size = size;
+	return path && !font_path;
+}
+
+
+int rpi_mp_subtitle_lock (rpi_mp_subtitle_overlay* o)
+{
+	pthread_mutex_lock (&overlay_mutex);
+	o->x        = shown.x;
+	o->y        = shown.y;
+	o->width    = visible ? shown.width  : 0;
+	o->height   = visible ? shown.height : 0;
+	o->stride   = shown.stride;
+	o->rgba     = visible ? shown.rgba : NULL;
+	o->sequence = sequence;
+	return !visible;
+}
+
+
+void rpi_mp_subtitle_unlock ()
+{
+	pthread_mutex_unlock (&overlay_mutex);
+}
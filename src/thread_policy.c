@@ -0,0 +1,191 @@
+// pthread_setaffinity_np and the CPU_SET macros
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "rpi_mp.h"
+#include "rpi_mp_alloc_debug.h"
+#include "rpi_mp_thread_policy.h"
+#include "rpi_mp_utils.h"
+
+/**
+ *	Scheduling a pipeline thread replaced, to put back when it leaves. Only one thread of each
+ *	kind runs at a time, so one slot per kind will do.
+ */
+typedef struct
+{
+	int                saved;
+	int                policy;
+	struct sched_param param;
+	int                nice;
+	cpu_set_t          cpus;
+}
+saved_policy;
+
+static const char* thread_names[PIPELINE_THREADS] = { "demux", "video", "video render", "audio", "audio submit", "subtitle", "clock", "next video" };
+
+static rpi_mp_thread_policy     policies[PIPELINE_THREADS];
+static int                      policy_set[PIPELINE_THREADS];
+static pthread_mutex_t          policy_mutex = PTHREAD_MUTEX_INITIALIZER;
+static saved_policy             saved[PIPELINE_THREADS];
+// written by their own thread only, with relaxed atomics so they can be read any time
+static rpi_mp_latency_histogram histograms[PIPELINE_THREADS];
+
+
+int thread_policy_enter (int thread)
+{
+	rpi_mp_thread_policy policy;
+	struct sched_param   param;
+	cpu_set_t            cpus;
+	pid_t                tid = syscall (SYS_gettid);
+	int                  set, i, err, ret = 0;
+
+	alloc_debug_thread (thread);
+	pthread_mutex_lock (&policy_mutex);
+	set    = policy_set[thread];
+	policy = policies[thread];
+	pthread_mutex_unlock (&policy_mutex);
+	saved[thread].saved = 0;
+	if (!set)
+		return 0;
+
+	pthread_getschedparam  (pthread_self (), &saved[thread].policy, &saved[thread].param);
+	pthread_getaffinity_np (pthread_self (), sizeof (cpu_set_t), &saved[thread].cpus);
+	saved[thread].nice  = getpriority (PRIO_PROCESS, tid);
+	saved[thread].saved = 1;
+
+	if (policy.cpus)
+	{
+		CPU_ZERO (&cpus);
+		for (i = 0; i < 32; i ++)
+			if (policy.cpus & 1u << i)
+				CPU_SET (i, &cpus);
+		if ((err = pthread_setaffinity_np (pthread_self (), sizeof (cpu_set_t), &cpus)) != 0)
+		{
+			fprintf (stderr, "Could not pin the %s thread to cores 0x%x: %s\n", thread_names[thread], policy.cpus, strerror (err));
+			ret = 1;
+		}
+	}
+	param.sched_priority = policy.policy == SCHED_OTHER ? 0 : policy.priority;
+	if ((err = pthread_setschedparam (pthread_self (), policy.policy, &param)) != 0)
+	{
+		fprintf (stderr, "Could not change scheduling of the %s thread: %s\n", thread_names[thread], strerror (err));
+		ret = 1;
+	}
+	// the nice value is per thread on Linux
+	else if (policy.policy == SCHED_OTHER && setpriority (PRIO_PROCESS, tid, policy.priority) != 0)
+	{
+		fprintf (stderr, "Could not set nice %d for the %s thread: %s\n", policy.priority, thread_names[thread], strerror (errno));
+		ret = 1;
+	}
+	return ret;
+}
+
+
+void thread_policy_leave (int thread)
+{
+	alloc_debug_thread (PIPELINE_THREADS);
+	if (!saved[thread].saved)
+		return;
+	pthread_setschedparam  (pthread_self (), saved[thread].policy, &saved[thread].param);
+	pthread_setaffinity_np (pthread_self (), sizeof (cpu_set_t), &saved[thread].cpus);
+	setpriority (PRIO_PROCESS, syscall (SYS_gettid), saved[thread].nice);
+	saved[thread].saved = 0;
+}
+
+
+void thread_sleep (int thread, int us)
+{
+	int64_t deadline = monotonic_us () + us;
+	usleep (us);
+	thread_wakeup (thread, deadline);
+}
+
+
+void thread_wakeup (int thread, int64_t deadline)
+{
+	rpi_mp_latency_histogram* histogram = &histograms[thread];
+	int64_t late   = monotonic_us () - deadline;
+	int     bucket = late > 0 ? 64 - __builtin_clzll (late) : 0;
+
+	if (late < 0)
+		late = 0;
+	if (bucket >= LATENCY_BUCKETS)
+		bucket = LATENCY_BUCKETS - 1;
+	__atomic_add_fetch (&histogram->wakeups, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch (&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch (&histogram->total_us, late, __ATOMIC_RELAXED);
+	if ((uint64_t) late > histogram->max_us)
+		__atomic_store_n (&histogram->max_us, late, __ATOMIC_RELAXED);
+}
+
+
+void thread_latency_reset ()
+{
+	int thread, i;
+	for (thread = 0; thread < PIPELINE_THREADS; thread ++)
+	{
+		__atomic_store_n (&histograms[thread].wakeups, 0, __ATOMIC_RELAXED);
+		for (i = 0; i < LATENCY_BUCKETS; i ++)
+			__atomic_store_n (&histograms[thread].buckets[i], 0, __ATOMIC_RELAXED);
+		__atomic_store_n (&histograms[thread].total_us, 0, __ATOMIC_RELAXED);
+		__atomic_store_n (&histograms[thread].max_us, 0, __ATOMIC_RELAXED);
+	}
+}
+
+
+int rpi_mp_set_thread_policy (rpi_mp_thread thread, const rpi_mp_thread_policy* policy)
+{
+	if (thread < 0 || thread >= PIPELINE_THREADS)
+		return 1;
+	if (policy)
+	{
+		if ((policy->policy == SCHED_FIFO || policy->policy == SCHED_RR) ?
+		    policy->priority < sched_get_priority_min (policy->policy) || policy->priority > sched_get_priority_max (policy->policy) :
+		    policy->policy != SCHED_OTHER || policy->priority < -20 || policy->priority > 19)
+		{
+			fprintf (stderr, "Invalid scheduling policy %d with priority %d\n", policy->policy, policy->priority);
+			return 1;
+		}
+	}
+	pthread_mutex_lock (&policy_mutex);
+	policy_set[thread] = policy != NULL;
+	if (policy)
+		policies[thread] = *policy;
+	pthread_mutex_unlock (&policy_mutex);
+	return 0;
+}
+
+
+int rpi_mp_lock_memory (int lock)
+{
+	if ((lock ? mlockall (MCL_CURRENT | MCL_FUTURE) : munlockall ()) != 0)
+	{
+		fprintf (stderr, "Could not %s memory: %s\n", lock ? "lock" : "unlock", strerror (errno));
+		return 1;
+	}
+	return 0;
+}
+
+
+void rpi_mp_thread_latency (rpi_mp_thread thread, rpi_mp_latency_histogram* histogram)
+{
+	int i;
+
+	memset (histogram, 0x0, sizeof (rpi_mp_latency_histogram));
+	if (thread < 0 || thread >= PIPELINE_THREADS)
+		return;
+	histogram->wakeups  = __atomic_load_n (&histograms[thread].wakeups, __ATOMIC_RELAXED);
+	for (i = 0; i < LATENCY_BUCKETS; i ++)
+		histogram->buckets[i] = __atomic_load_n (&histograms[thread].buckets[i], __ATOMIC_RELAXED);
+	histogram->total_us = __atomic_load_n (&histograms[thread].total_us, __ATOMIC_RELAXED);
+	histogram->max_us   = __atomic_load_n (&histograms[thread].max_us, __ATOMIC_RELAXED);
+}
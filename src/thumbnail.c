@@ -0,0 +1,477 @@
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "rpi_mp.h"
+#include "rpi_mp_player.h"
+
+#define THUMBNAIL_MAX_WORKERS  2
+#define THUMBNAIL_NICE         10
+#define THUMBNAIL_MAX_PACKETS  64
+#define THUMBNAIL_CACHE_SIZE   64
+
+
+/**
+ *	A single keyframe to decode. Several requested positions may share one job.
+ */
+typedef struct
+{
+	int64_t          target;
+	int              frame_width;
+	int              frame_height;
+	rpi_mp_thumbnail result;
+}
+thumbnail_job;
+
+/**
+ *	Work shared between the worker threads of one request.
+ */
+typedef struct
+{
+	const char      * source;
+	time_t            mtime;
+	off_t             size;
+	thumbnail_job   * jobs;
+	int               n_jobs;
+	int               next_job;
+	int               width;
+	int               height;
+	int               n_workers;
+	pthread_mutex_t   mutex;
+}
+thumbnail_queue;
+
+/**
+ *	A decoded keyframe. A file replaced under the same name has another mtime or size, so
+ *	its keyframes are not taken for those of the old one.
+ */
+typedef struct
+{
+	char            * source;
+	time_t            mtime;
+	off_t             size;
+	int64_t           target;
+	int               frame_width;
+	int               frame_height;
+	uint64_t          last_used;
+	rpi_mp_thumbnail  thumbnail;
+}
+cache_entry;
+
+static cache_entry     cache[THUMBNAIL_CACHE_SIZE];
+static uint64_t        cache_clock = 0;
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ *	Copies a thumbnail including its pixel data.
+ */
+static int copy_thumbnail (rpi_mp_thumbnail* dst, const rpi_mp_thumbnail* src)
+{
+	*dst = *src;
+	if (!src->rgb)
+		return 1;
+	if (!(dst->rgb = (uint8_t*) malloc (src->stride * src->height)))
+		return 1;
+	memcpy (dst->rgb, src->rgb, src->stride * src->height);
+	return 0;
+}
+
+/**
+ *	Height of a thumbnail of the given width, keeping the aspect ratio of the frame when height is 0.
+ */
+static int thumbnail_height (int width, int height, int frame_width, int frame_height)
+{
+	return height > 0 ? height : ((int64_t) width * frame_height / frame_width) & ~1;
+}
+
+/**
+ *	Looks up a decoded keyframe of the source of the queue in the cache and copies it to thumbnail.
+ *	Returns 0 on a hit.
+ */
+static int cache_lookup (const thumbnail_queue* queue, int64_t target, rpi_mp_thumbnail* thumbnail)
+{
+	int i, ret = 1;
+	pthread_mutex_lock (&cache_mutex);
+	for (i = 0; i < THUMBNAIL_CACHE_SIZE; i ++)
+	{
+		cache_entry* e = &cache[i];
+		if (e->source && e->target == target && e->mtime == queue->mtime && e->size == queue->size &&
+		    e->thumbnail.width == queue->width &&
+		    e->thumbnail.height == thumbnail_height (queue->width, queue->height, e->frame_width, e->frame_height) &&
+		    strcmp (e->source, queue->source) == 0)
+		{
+			e->last_used = ++ cache_clock;
+			ret = copy_thumbnail (thumbnail, &e->thumbnail);
+			break;
+		}
+	}
+	pthread_mutex_unlock (&cache_mutex);
+	return ret;
+}
+
+/**
+ *	Stores a copy of a decoded keyframe, evicting the least recently used entry.
+ */
+static void cache_insert (const thumbnail_queue* queue, const thumbnail_job* job)
+{
+	int i, lru = 0;
+	pthread_mutex_lock (&cache_mutex);
+	for (i = 1; i < THUMBNAIL_CACHE_SIZE; i ++)
+		if (cache[i].last_used < cache[lru].last_used)
+			lru = i;
+
+	free (cache[lru].source);
+	free (cache[lru].thumbnail.rgb);
+	memset (&cache[lru], 0x0, sizeof (cache_entry));
+	if (copy_thumbnail (&cache[lru].thumbnail, &job->result) == 0)
+	{
+		cache[lru].source       = strdup (queue->source);
+		cache[lru].mtime        = queue->mtime;
+		cache[lru].size         = queue->size;
+		cache[lru].target       = job->target;
+		cache[lru].frame_width  = job->frame_width;
+		cache[lru].frame_height = job->frame_height;
+		cache[lru].last_used    = ++ cache_clock;
+	}
+	pthread_mutex_unlock (&cache_mutex);
+}
+
+/**
+ *	Moves the calling worker out of the way of playback: lowers its priority and,
+ *	on multi-core boards, pins it to one of the upper half of the cores.
+ */
+static void leave_playback_cores (int worker)
+{
+	int ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+	setpriority (PRIO_PROCESS, syscall (SYS_gettid), THUMBNAIL_NICE);
+
+	if (ncpu > 1)
+	{
+		cpu_set_t set;
+		CPU_ZERO (&set);
+		CPU_SET (ncpu - 1 - worker % (ncpu / 2), &set);
+		pthread_setaffinity_np (pthread_self (), sizeof (cpu_set_t), &set);
+	}
+}
+
+/**
+ *	Seeks to the keyframe of the job and decodes it into a scaled RGB24 image.
+ *	@return int 0 on success, non-zero on failure
+ */
+static int decode_keyframe (AVFormatContext* ctx, AVCodecContext* codec_ctx, int stream_idx, AVFrame* frame,
+                            struct SwsContext** sws, thumbnail_queue* queue, thumbnail_job* job)
+{
+	AVStream* stream = ctx->streams[stream_idx];
+	AVPacket  packet;
+	int64_t   start  = ctx->start_time != AV_NOPTS_VALUE ? ctx->start_time : 0;
+	int64_t   ts     = av_rescale_q (job->target + start, AV_TIME_BASE_Q, stream->time_base);
+	int       got_frame = 0, n_packets = 0;
+	int       width  = queue->width;
+	int       height;
+
+	if (av_seek_frame (ctx, stream_idx, ts, AVSEEK_FLAG_BACKWARD) < 0)
+		return 1;
+	avcodec_flush_buffers (codec_ctx);
+
+	av_init_packet (&packet);
+	while (!got_frame && n_packets < THUMBNAIL_MAX_PACKETS && av_read_frame (ctx, &packet) >= 0)
+	{
+		if (packet.stream_index == stream_idx)
+		{
+			n_packets ++;
+			if (avcodec_decode_video2 (codec_ctx, frame, &got_frame, &packet) < 0)
+				got_frame = 0;
+		}
+		av_packet_unref (&packet);
+	}
+	// decoders with a reordering delay only return the keyframe when drained
+	if (!got_frame)
+	{
+		packet.data = NULL;
+		packet.size = 0;
+		avcodec_decode_video2 (codec_ctx, frame, &got_frame, &packet);
+	}
+	if (!got_frame || frame->width <= 0 || frame->height <= 0)
+		return 1;
+
+	height = thumbnail_height (width, queue->height, frame->width, frame->height);
+
+	if (!(*sws = sws_getCachedContext (*sws, frame->width, frame->height, frame->format,
+	                                   width, height, AV_PIX_FMT_RGB24, SWS_FAST_BILINEAR, NULL, NULL, NULL)))
+		return 1;
+
+	job->frame_width   = frame->width;
+	job->frame_height  = frame->height;
+	job->result.width  = width;
+	job->result.height = height;
+	job->result.stride = width * 3;
+	if (!(job->result.rgb = (uint8_t*) malloc (job->result.stride * height)))
+		return 1;
+
+	sws_scale (*sws, (const uint8_t* const*) frame->data, frame->linesize, 0, frame->height,
+	           &job->result.rgb, &job->result.stride);
+
+	ts = av_frame_get_best_effort_timestamp (frame);
+	job->result.pts = ts != AV_NOPTS_VALUE ? av_rescale_q (ts, stream->time_base, AV_TIME_BASE_Q) - start : job->target;
+	return 0;
+}
+
+/**
+ *	Worker thread: opens its own demuxer and decoder and takes jobs until the queue is empty.
+ */
+static void* thumbnail_worker (void* arg)
+{
+	thumbnail_queue    * queue     = (thumbnail_queue*) arg;
+	AVFormatContext    * ctx       = NULL;
+	AVCodecContext     * codec_ctx = NULL;
+	AVCodec            * codec     = NULL;
+	AVFrame            * frame     = NULL;
+	struct SwsContext  * sws       = NULL;
+	int                  stream_idx, worker, i;
+
+	pthread_mutex_lock (&queue->mutex);
+	worker = queue->n_workers ++;
+	pthread_mutex_unlock (&queue->mutex);
+	leave_playback_cores (worker);
+
+	if (avformat_open_input (&ctx, queue->source, NULL, NULL) < 0)
+	{
+		fprintf (stderr, "Thumbnails: could not open source %s\n", queue->source);
+		return NULL;
+	}
+	if (avformat_find_stream_info (ctx, NULL) < 0 ||
+	    (stream_idx = av_find_best_stream (ctx, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0)) < 0)
+	{
+		fprintf (stderr, "Thumbnails: could not find video stream in %s\n", queue->source);
+		goto end;
+	}
+	// don't waste time demuxing anything but video
+	for (i = 0; i < ctx->nb_streams; i ++)
+		if (i != stream_idx)
+			ctx->streams[i]->discard = AVDISCARD_ALL;
+
+	codec_ctx = avcodec_alloc_context3 (codec);
+	if (!codec_ctx || avcodec_copy_context (codec_ctx, ctx->streams[stream_idx]->codec) < 0)
+		goto end;
+	// keyframes only, the thumbnail is too small to show the deblocking
+	codec_ctx->thread_count     = 1;
+	codec_ctx->skip_frame       = AVDISCARD_NONKEY;
+	codec_ctx->skip_loop_filter = AVDISCARD_ALL;
+	if (avcodec_open2 (codec_ctx, codec, NULL) < 0 || !(frame = av_frame_alloc ()))
+	{
+		fprintf (stderr, "Thumbnails: could not open decoder\n");
+		goto end;
+	}
+
+	while (1)
+	{
+		thumbnail_job* job = NULL;
+		pthread_mutex_lock (&queue->mutex);
+		if (queue->next_job < queue->n_jobs)
+			job = &queue->jobs[queue->next_job ++];
+		pthread_mutex_unlock (&queue->mutex);
+		if (!job)
+			break;
+
+		if (decode_keyframe (ctx, codec_ctx, stream_idx, frame, &sws, queue, job) == 0)
+			cache_insert (queue, job);
+	}
+
+end:
+	sws_freeContext (sws);
+	av_frame_free (&frame);
+	if (codec_ctx)
+	{
+		avcodec_close (codec_ctx);
+		avcodec_free_context (&codec_ctx);
+	}
+	avformat_close_input (&ctx);
+	return NULL;
+}
+
+/**
+ *	Snaps a position to the keyframe at or before it.
+ */
+static int64_t snap_to_keyframe (int64_t position, const int64_t* keyframes, int n_keyframes)
+{
+	int lo = 0, hi = n_keyframes - 1, mid;
+	if (n_keyframes == 0 || position < keyframes[0])
+		return position;
+	while (lo < hi)
+	{
+		mid = (lo + hi + 1) / 2;
+		if (keyframes[mid] <= position)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return keyframes[lo];
+}
+
+static int compare_int64 (const void* a, const void* b)
+{
+	int64_t x = *(const int64_t*) a, y = *(const int64_t*) b;
+	return x < y ? -1 : x > y;
+}
+
+
+int rpi_mp_thumbnails (const char* source, const int64_t* timestamps, int count, int width, int height, rpi_mp_thumbnail* thumbnails)
+{
+	thumbnail_queue  queue;
+	struct stat      st;
+	pthread_t        workers[THUMBNAIL_MAX_WORKERS];
+	int64_t        * keyframes   = NULL;
+	int64_t        * targets     = NULL;
+	int              n_keyframes = 0, n_workers, i, j, generated = 0;
+
+	if (!source || count <= 0 || width <= 0 || !thumbnails)
+		return -1;
+	// runs without rpi_mp_init
+	av_register_all ();
+
+	memset (&queue, 0x0, sizeof (queue));
+	memset (thumbnails, 0x0, count * sizeof (rpi_mp_thumbnail));
+	queue.source = source;
+	queue.width  = width & ~1;
+	queue.height = height & ~1;
+	// URLs have neither, their keyframes are cached by name alone
+	if (stat (source, &st) == 0)
+	{
+		queue.mtime = st.st_mtime;
+		queue.size  = st.st_size;
+	}
+
+	// reuse the index of the demuxer if we are playing this file
+	n_keyframes = player_keyframe_index (source, &keyframes);
+
+	// several positions may fall on the same keyframe, decode each one only once
+	targets = (int64_t*) malloc (count * sizeof (int64_t));
+	queue.jobs = (thumbnail_job*) malloc (count * sizeof (thumbnail_job));
+	pthread_mutex_init (&queue.mutex, NULL);
+	if (!targets || !queue.jobs)
+	{
+		generated = -1;
+		goto end;
+	}
+	for (i = 0; i < count; i ++)
+	{
+		thumbnails[i].timestamp = timestamps[i];
+		targets[i] = snap_to_keyframe (timestamps[i], keyframes, n_keyframes);
+	}
+	qsort (targets, count, sizeof (int64_t), compare_int64);
+	for (i = 0; i < count; i ++)
+	{
+		rpi_mp_thumbnail cached;
+		if (i > 0 && targets[i] == targets[i - 1])
+			continue;
+		if (cache_lookup (&queue, targets[i], &cached) == 0)
+		{
+			free (cached.rgb);
+			continue;
+		}
+		memset (&queue.jobs[queue.n_jobs], 0x0, sizeof (thumbnail_job));
+		queue.jobs[queue.n_jobs ++].target = targets[i];
+	}
+
+	// decode in time order, each worker seeks forward through the file
+	n_workers = sysconf (_SC_NPROCESSORS_ONLN) / 2;
+	n_workers = n_workers < 1 ? 1 : n_workers > THUMBNAIL_MAX_WORKERS ? THUMBNAIL_MAX_WORKERS : n_workers;
+	n_workers = n_workers > queue.n_jobs ? queue.n_jobs : n_workers;
+	for (i = 0; i < n_workers; i ++)
+		pthread_create (&workers[i], NULL, thumbnail_worker, &queue);
+	for (i = 0; i < n_workers; i ++)
+		pthread_join (workers[i], NULL);
+
+	// every decoded keyframe is in the cache now
+	for (i = 0; i < count; i ++)
+	{
+		int64_t target = snap_to_keyframe (thumbnails[i].timestamp, keyframes, n_keyframes);
+		if (cache_lookup (&queue, target, &thumbnails[i]) == 0)
+		{
+			thumbnails[i].timestamp = timestamps[i];
+			generated ++;
+			continue;
+		}
+		// cache was too small for this request, look for the job instead
+		for (j = 0; j < queue.n_jobs; j ++)
+			if (queue.jobs[j].target == target && queue.jobs[j].result.rgb)
+			{
+				copy_thumbnail (&thumbnails[i], &queue.jobs[j].result);
+				thumbnails[i].timestamp = timestamps[i];
+				generated ++;
+				break;
+			}
+	}
+
+end:
+	if (queue.jobs)
+		for (i = 0; i < queue.n_jobs; i ++)
+			free (queue.jobs[i].result.rgb);
+	pthread_mutex_destroy (&queue.mutex);
+	free (queue.jobs);
+	free (targets);
+	free (keyframes);
+	return generated;
+}
+
+
+int rpi_mp_thumbnails_interval (const char* source, int64_t interval, int width, int height, rpi_mp_thumbnail** thumbnails, int* count)
+{
+	AVFormatContext * ctx = NULL;
+	int64_t         * timestamps;
+	int               i, ret;
+
+	*thumbnails = NULL;
+	*count      = 0;
+	if (interval <= 0)
+		return -1;
+	av_register_all ();
+	// the container header is enough to know the duration
+	if (avformat_open_input (&ctx, source, NULL, NULL) < 0)
+	{
+		fprintf (stderr, "Thumbnails: could not open source %s\n", source);
+		return -1;
+	}
+	if (ctx->duration == AV_NOPTS_VALUE)
+		avformat_find_stream_info (ctx, NULL);
+	if (ctx->duration > 0)
+		*count = (ctx->duration + interval - 1) / interval;
+	avformat_close_input (&ctx);
+
+	if (*count == 0)
+		return -1;
+
+	timestamps  = (int64_t*) malloc (*count * sizeof (int64_t));
+	*thumbnails = (rpi_mp_thumbnail*) malloc (*count * sizeof (rpi_mp_thumbnail));
+	if (!timestamps || !*thumbnails)
+	{
+		free (timestamps);
+		free (*thumbnails);
+		*thumbnails = NULL;
+		*count      = 0;
+		return -1;
+	}
+	for (i = 0; i < *count; i ++)
+		timestamps[i] = i * interval;
+
+	ret = rpi_mp_thumbnails (source, timestamps, *count, width, height, *thumbnails);
+	free (timestamps);
+	return ret;
+}
+
+
+void rpi_mp_free_thumbnails (rpi_mp_thumbnail* thumbnails, int count)
+{
+	int i;
+	for (i = 0; i < count; i ++)
+	{
+		free (thumbnails[i].rgb);
+		thumbnails[i].rgb = NULL;
+	}
+}
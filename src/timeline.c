@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rpi_mp_timeline.h"
+
+
+static void init_stream (timeline* t, timeline_stream* s)
+{
+	s->wrap_offset = 0;
+	s->last_raw    = AV_NOPTS_VALUE;
+	s->offset      = t->offset;
+	s->next_dts    = AV_NOPTS_VALUE;
+	s->last_dts    = AV_NOPTS_VALUE;
+	s->last_pts    = AV_NOPTS_VALUE;
+	s->reorders    = -1;
+}
+
+
+/**
+ *	State of a stream, for streams that appeared after the header (MPEG-TS) the array grows.
+ */
+static timeline_stream* get_stream (timeline* t, int index)
+{
+	timeline_stream* streams;
+	int              i;
+
+	if (index >= t->n_streams)
+	{
+		if (!(streams = (timeline_stream*) realloc (t->streams, (index + 1) * sizeof (timeline_stream))))
+			return NULL;
+		t->streams = streams;
+		for (i = t->n_streams; i <= index; i ++)
+			init_stream (t, &streams[i]);
+		t->n_streams = index + 1;
+	}
+	return &t->streams[index];
+}
+
+
+/**
+ *	Brings a timestamp next to a reference, by whole wrap periods.
+ */
+static int64_t unwrap (int64_t ts, int64_t reference, int bits)
+{
+	int64_t period = 1LL << bits;
+	while (ts < reference - period / 2)
+		ts += period;
+	while (ts > reference + period / 2)
+		ts -= period;
+	return ts;
+}
+
+
+void init_timeline (timeline* t, AVFormatContext* fmt_ctx)
+{
+	memset (t, 0x0, sizeof (timeline));
+	t->check_gaps = fmt_ctx->iformat && fmt_ctx->iformat->flags & AVFMT_TS_DISCONT;
+	get_stream (t, fmt_ctx->nb_streams > 0 ? fmt_ctx->nb_streams - 1 : 0);
+}
+
+
+void destroy_timeline (timeline* t)
+{
+	free (t->streams);
+	t->streams   = NULL;
+	t->n_streams = 0;
+}
+
+
+void timeline_packet (timeline* t, AVFormatContext* fmt_ctx, AVPacket* packet)
+{
+	AVStream*        stream = fmt_ctx->streams[packet->stream_index];
+	timeline_stream* s      = get_stream (t, packet->stream_index);
+	int              bits   = stream->pts_wrap_bits;
+	int64_t          raw, ts, expected;
+
+	if (!s)
+	{
+		// out of memory, at least the units are right
+		if (packet->pts != AV_NOPTS_VALUE)
+			packet->pts = av_rescale_q (packet->pts, stream->time_base, AV_TIME_BASE_Q);
+		if (packet->dts != AV_NOPTS_VALUE)
+			packet->dts = av_rescale_q (packet->dts, stream->time_base, AV_TIME_BASE_Q);
+		packet->duration = av_rescale_q (packet->duration, stream->time_base, AV_TIME_BASE_Q);
+		return;
+	}
+	if (s->reorders < 0)
+		s->reorders = stream->codec->has_b_frames > 0;
+
+	// unwrap in the stream's time base, the dts against the previous packet and the pts against the dts
+	if (bits > 0 && bits < 63)
+	{
+		raw = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+		if (raw != AV_NOPTS_VALUE && s->last_raw != AV_NOPTS_VALUE)
+		{
+			ts = unwrap (raw + s->wrap_offset, s->last_raw, bits);
+			if (ts != raw + s->wrap_offset)
+			{
+				s->wrap_offset = ts - raw;
+				t->wraps ++;
+			}
+		}
+		if (packet->dts != AV_NOPTS_VALUE)
+			packet->dts += s->wrap_offset;
+		if (packet->pts != AV_NOPTS_VALUE)
+			packet->pts = packet->dts != AV_NOPTS_VALUE ? unwrap (packet->pts + s->wrap_offset, packet->dts, bits) :
+			                                               packet->pts + s->wrap_offset;
+		if (raw != AV_NOPTS_VALUE)
+			s->last_raw = raw + s->wrap_offset;
+	}
+
+	if (packet->pts != AV_NOPTS_VALUE)
+		packet->pts = av_rescale_q (packet->pts, stream->time_base, AV_TIME_BASE_Q);
+	if (packet->dts != AV_NOPTS_VALUE)
+		packet->dts = av_rescale_q (packet->dts, stream->time_base, AV_TIME_BASE_Q);
+	packet->duration = av_rescale_q (packet->duration, stream->time_base, AV_TIME_BASE_Q);
+
+	// without reordering the timestamps are interchangeable
+	if (!s->reorders)
+	{
+		if (packet->pts == AV_NOPTS_VALUE)
+			packet->pts = packet->dts;
+		else if (packet->dts == AV_NOPTS_VALUE)
+			packet->dts = packet->pts;
+	}
+
+	ts = packet->dts;
+	if (ts != AV_NOPTS_VALUE)
+	{
+		expected = s->next_dts;
+		if (t->check_gaps && expected != AV_NOPTS_VALUE &&
+		    (ts + s->offset < expected - TIMELINE_MAX_BACKWARD_US || ts + s->offset > expected + TIMELINE_MAX_GAP_US))
+		{
+			// another stream got to the new segment first
+			if (ts + t->offset >= expected - TIMELINE_MAX_BACKWARD_US && ts + t->offset <= expected + TIMELINE_MAX_GAP_US)
+				s->offset = t->offset;
+			else
+			{
+				t->offset = s->offset = expected - ts;
+				t->discontinuities ++;
+				printf ("timestamp discontinuity in stream %d, rebasing by %lld us\n", packet->stream_index, s->offset);
+			}
+		}
+		packet->dts += s->offset;
+		if (s->last_dts != AV_NOPTS_VALUE && packet->dts < s->last_dts)
+			packet->dts = s->last_dts;
+		s->last_dts = packet->dts;
+		s->next_dts = packet->dts + (packet->duration > 0 ? packet->duration : 0);
+	}
+	else if (s->next_dts != AV_NOPTS_VALUE && packet->duration > 0)
+		s->next_dts += packet->duration;
+
+	if (packet->pts != AV_NOPTS_VALUE)
+	{
+		packet->pts += s->offset;
+		if (!s->reorders && s->last_pts != AV_NOPTS_VALUE && packet->pts < s->last_pts)
+			packet->pts = s->last_pts;
+		s->last_pts = packet->pts;
+	}
+}
+
+
+void timeline_reset (timeline* t)
+{
+	int i;
+	t->offset = 0;
+	for (i = 0; i < t->n_streams; i ++)
+		init_stream (t, &t->streams[i]);
+}
+
+
+void timeline_shift (timeline* t, int64_t offset)
+{
+	timeline_stream* s;
+	int              i;
+
+	t->offset += offset;
+	for (i = 0; i < t->n_streams; i ++)
+	{
+		s = &t->streams[i];
+		s->offset += offset;
+		if (s->next_dts != AV_NOPTS_VALUE)
+			s->next_dts += offset;
+		if (s->last_dts != AV_NOPTS_VALUE)
+			s->last_dts += offset;
+		if (s->last_pts != AV_NOPTS_VALUE)
+			s->last_pts += offset;
+	}
+}
+
+
+int timeline_rebased (const timeline* t)
+{
+	int i;
+	if (t->offset != 0)
+		return 1;
+	for (i = 0; i < t->n_streams; i ++)
+		if (t->streams[i].wrap_offset != 0 || t->streams[i].offset != 0)
+			return 1;
+	return 0;
+}
+
+
+void timeline_ticks (int64_t us, uint32_t* low, uint32_t* high)
+{
+	*low  = (uint32_t) us;
+	*high = (uint32_t) ((uint64_t) us >> 32);
+}
+
+
+int64_t timeline_ticks_us (uint32_t low, uint32_t high)
+{
+	return (int64_t) ((uint64_t) low | (uint64_t) high << 32);
+}
@@ -0,0 +1,383 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "rpi_mp.h"
+#include "rpi_mp_packet_buffer.h"
+#include "rpi_mp_pcm_ring.h"
+#include "rpi_mp_audio_decode.h"
+#include "rpi_mp_timeline.h"
+#include "rpi_mp_transition.h"
+#include "rpi_mp_utils.h"
+
+#define FIFO_SLEEPY_TIME 10000
+#define WEIGHT_ONE       (1LL << 32)
+
+
+static int64_t process_cpu_us ()
+{
+	struct timespec t;
+	clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &t);
+	return (int64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+
+static size_t resident_bytes ()
+{
+	unsigned long pages, resident = 0;
+	FILE*         statm;
+
+	if ((statm = fopen ("/proc/self/statm", "r")))
+	{
+		if (fscanf (statm, "%lu %lu", &pages, &resident) != 2)
+			resident = 0;
+		fclose (statm);
+	}
+	return (size_t) resident * sysconf (_SC_PAGESIZE);
+}
+
+
+static inline int stopping (transition* t)
+{
+	return __atomic_load_n (&t->stop, __ATOMIC_ACQUIRE);
+}
+
+
+static void* demux_thread (void* arg)
+{
+	transition*    t = (transition*) arg;
+	packet_buffer* fifo;
+	AVPacket       packet;
+	size_t         rss;
+	int            ret;
+
+	while (!stopping (t) && av_read_frame (t->fmt_ctx, &packet) >= 0)
+	{
+		if (t->has_video && packet.stream_index == t->video_idx)
+			fifo = &t->video_fifo;
+		else if (t->mix && packet.stream_index == t->audio_idx)
+			fifo = &t->audio_fifo;
+		else
+		{
+			av_packet_unref (&packet);
+			continue;
+		}
+		timeline_packet (&t->packet_timeline, t->fmt_ctx, &packet);
+		// full FIFOs are what holds a prepared clip back
+		while ((ret = push_packet (fifo, packet)) != 0 && !stopping (t))
+			usleep (FIFO_SLEEPY_TIME);
+		// the pipeline taking the clip over queues it
+		if (ret != 0)
+		{
+			t->held     = packet;
+			t->has_held = 1;
+			break;
+		}
+		// a frame at a time is often enough to catch the peak of the overlap
+		if (fifo == &t->video_fifo && __atomic_load_n (&t->started, __ATOMIC_ACQUIRE) && (rss = resident_bytes ()) > t->rss_peak)
+			t->rss_peak = rss;
+	}
+	__atomic_store_n (&t->done_reading, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+
+/**
+ *	Decodes the audio with the stage the pipeline decodes with, which goes on with it after the handover.
+ */
+static void* audio_thread (void* arg)
+{
+	transition* t = (transition*) arg;
+	AVPacket    packet, pending;
+	int         finished;
+
+	while (!stopping (t))
+	{
+		finished = __atomic_load_n (&t->done_reading, __ATOMIC_ACQUIRE);
+		if (pop_packet (&t->audio_fifo, &packet) != 0)
+		{
+			if (finished)
+				break;
+			usleep (FIFO_SLEEPY_TIME);
+			continue;
+		}
+		pending = packet;
+		audio_decode_packet (&t->decoder, &pending, t->pcm);
+		av_packet_unref (&packet);
+	}
+	// detached, the pipeline goes on writing the ring
+	if (!stopping (t))
+		pcm_ring_finish (t->pcm);
+	return NULL;
+}
+
+
+int open_transition (transition* t, const char* source, pcm_ring* pcm, int sample_rate, int channels)
+{
+	AVCodec* codec;
+	int      i;
+
+	memset (t, 0x0, sizeof (transition));
+	t->pcm         = pcm;
+	t->channels    = channels;
+	t->block_align = channels * 2;
+	t->sample_rate = sample_rate;
+	if (avformat_open_input (&t->fmt_ctx, source, NULL, NULL) < 0 || avformat_find_stream_info (t->fmt_ctx, NULL) < 0)
+	{
+		fprintf (stderr, "Could not open %s to fade into\n", source);
+		avformat_close_input (&t->fmt_ctx);
+		return 1;
+	}
+	t->start_time = t->fmt_ctx->start_time != AV_NOPTS_VALUE ? t->fmt_ctx->start_time : 0;
+	init_timeline (&t->packet_timeline, t->fmt_ctx);
+	init_packet_buffer (&t->video_fifo, TRANSITION_FIFO_SIZE);
+	init_packet_buffer (&t->audio_fifo, TRANSITION_FIFO_SIZE);
+
+	// the player decodes the video
+	t->video_idx = av_find_best_stream (t->fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+	t->has_video = t->video_idx >= 0;
+	// audio that would need resampling is not decoded at all
+	t->audio_idx = av_find_best_stream (t->fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+	if (t->audio_idx >= 0 && pcm)
+	{
+		t->audio_ctx = t->fmt_ctx->streams[t->audio_idx]->codec;
+		if (t->audio_ctx->sample_rate == sample_rate && t->audio_ctx->channels == channels &&
+		    (codec = avcodec_find_decoder (t->audio_ctx->codec_id)) && avcodec_open2 (t->audio_ctx, codec, NULL) == 0)
+		{
+			if (!(t->mix = init_audio_decoder (&t->decoder, t->audio_ctx) == 0))
+				avcodec_close (t->audio_ctx);
+		}
+		else
+			printf ("the audio of %s is not mixed in, it differs from the audio playing\n", source);
+	}
+	if (!t->has_video)
+	{
+		fprintf (stderr, "No video in %s to fade into\n", source);
+		close_transition (t);
+		return 1;
+	}
+	for (i = 0; i < (int) t->fmt_ctx->nb_streams; i ++)
+		t->fmt_ctx->streams[i]->discard = i == t->video_idx || (t->mix && i == t->audio_idx) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+
+	pthread_create (&t->threads[t->n_threads ++], NULL, demux_thread, t);
+	if (t->mix)
+		pthread_create (&t->threads[t->n_threads ++], NULL, audio_thread, t);
+	return 0;
+}
+
+
+void close_transition (transition* t)
+{
+	int i;
+
+	__atomic_store_n (&t->stop, 1, __ATOMIC_RELEASE);
+	if (t->mix && t->pcm)
+		pcm_ring_abort (t->pcm);
+	for (i = 0; i < t->n_threads; i ++)
+		pthread_join (t->threads[i], NULL);
+	t->n_threads = 0;
+
+	destroy_packet_buffer (&t->video_fifo);
+	destroy_packet_buffer (&t->audio_fifo);
+	if (t->has_held)
+		av_packet_unref (&t->held);
+	// unless the pipeline took them over
+	if (t->mix && t->audio_ctx)
+		avcodec_close (t->audio_ctx);
+	destroy_audio_decoder (&t->decoder);
+	t->has_held = t->has_video = t->mix = 0;
+	free (t->mix_buffer);
+	t->mix_buffer = NULL;
+	destroy_timeline (&t->packet_timeline);
+	avformat_close_input (&t->fmt_ctx);
+}
+
+
+void transition_detach (transition* t)
+{
+	int i;
+
+	__atomic_store_n (&t->stop, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < t->n_threads; i ++)
+		pthread_join (t->threads[i], NULL);
+	t->n_threads = 0;
+}
+
+
+/**
+ *	Puts a packet of the clip on the outgoing timeline.
+ */
+static void shift_packet (transition* t, AVPacket* packet)
+{
+	if (packet->pts != AV_NOPTS_VALUE)
+		packet->pts += t->shift;
+	if (packet->dts != AV_NOPTS_VALUE)
+		packet->dts += t->shift;
+}
+
+
+int transition_video_packet (transition* t, AVPacket* packet)
+{
+	int finished = __atomic_load_n (&t->done_reading, __ATOMIC_ACQUIRE);
+
+	if (pop_packet (&t->video_fifo, packet) != 0)
+		return finished ? -1 : 1;
+	shift_packet (t, packet);
+	return 0;
+}
+
+
+/**
+ *	Moves the packets of one FIFO, NULL drops them.
+ */
+static int take_fifo (transition* t, packet_buffer* from, packet_buffer* to)
+{
+	AVPacket packet;
+	int      dropped = 0;
+
+	while (pop_packet (from, &packet) == 0)
+	{
+		shift_packet (t, &packet);
+		if (!to || push_packet (to, packet) != 0)
+		{
+			dropped += to != NULL;
+			av_packet_unref (&packet);
+		}
+	}
+	return dropped;
+}
+
+
+int transition_take_packets (transition* t, packet_buffer* video, packet_buffer* audio)
+{
+	packet_buffer* to;
+	int            dropped = take_fifo (t, &t->video_fifo, video) + take_fifo (t, &t->audio_fifo, audio);
+
+	// the one the demuxer was waiting to queue comes after those
+	if (t->has_held)
+	{
+		to = t->held.stream_index == t->video_idx ? video : audio;
+		shift_packet (t, &t->held);
+		if (!to || push_packet (to, t->held) != 0)
+		{
+			dropped += to != NULL;
+			av_packet_unref (&t->held);
+		}
+		t->has_held = 0;
+	}
+	return dropped > 0;
+}
+
+
+void transition_start (transition* t, int64_t duration, int64_t media_now)
+{
+	t->duration        = duration > 0 ? duration : 0;
+	t->media_start     = media_now;
+	t->shift           = media_now - t->start_time;
+	t->cpu_start       = process_cpu_us ();
+	t->decode_us_start = t->decoder.decode_us;
+	// the audio decoded ahead and still to come
+	if (t->mix)
+		pcm_ring_shift (t->pcm, t->shift, t->shift);
+	t->rss_start       = t->rss_peak = resident_bytes ();
+	__atomic_store_n (&t->started, monotonic_us (), __ATOMIC_RELEASE);
+}
+
+
+float transition_blend (const transition* t)
+{
+	int64_t started = __atomic_load_n (&t->started, __ATOMIC_ACQUIRE), elapsed;
+
+	if (!started)
+		return 0.f;
+	elapsed = monotonic_us () - started;
+	return elapsed >= t->duration ? 1.f : (float) elapsed / t->duration;
+}
+
+
+/**
+ *	Drops the audio of the next clip that would have been heard before the buffer the mix is at:
+ *	the outgoing buffers the renderer held when the crossfade started are not mixed.
+ *	If the decoder has not got that far yet, the rest is dropped with the next buffer.
+ */
+static void align_audio (transition* t, int64_t position)
+{
+	int64_t pts;
+	size_t  skip, n;
+
+	if (pcm_ring_fill (t->pcm) < (size_t) t->block_align)
+		return;
+	pcm_ring_read (t->pcm, t->mix_buffer, t->block_align, &pts);
+	if (pts != AV_NOPTS_VALUE && pts < position)
+	{
+		skip = (size_t) ((position - pts) * t->sample_rate / AV_TIME_BASE) * t->block_align;
+		while (skip > 0 && (n = pcm_ring_read (t->pcm, t->mix_buffer, skip < t->mix_size ? skip : t->mix_size, &pts)) > 0)
+			skip -= n;
+		if (skip > 0)
+			return;
+	}
+	t->aligned = 1;
+}
+
+
+void transition_mix (transition* t, int16_t* samples, int frames, int64_t pts)
+{
+	int64_t  started = __atomic_load_n (&t->started, __ATOMIC_ACQUIRE), elapsed, weight, step, in_pts;
+	size_t   size = (size_t) frames * t->block_align, got = 0, n_in, s;
+	uint8_t* buffer;
+	int16_t* in;
+	int      w, i, ch;
+
+	if (!started || pts == AV_NOPTS_VALUE || frames <= 0 || (elapsed = pts - t->media_start) < 0)
+		return;
+	if (t->mix)
+	{
+		if (size > t->mix_size)
+		{
+			if (!(buffer = (uint8_t*) realloc (t->mix_buffer, size)))
+				return;
+			t->mix_buffer = buffer;
+			t->mix_size   = size;
+		}
+		if (!t->aligned)
+			align_audio (t, pts);
+		if (t->aligned && (got = pcm_ring_read (t->pcm, t->mix_buffer, size, &in_pts)) < size)
+			t->aligned = 0;
+	}
+	// weight of the next clip in 32 bit fixed point, ramping up sample by sample
+	if (elapsed >= t->duration)
+	{
+		weight = WEIGHT_ONE;
+		step   = 0;
+	}
+	else
+	{
+		weight = (elapsed << 32) / t->duration;
+		step   = ((int64_t) AV_TIME_BASE << 32) / (t->duration * t->sample_rate);
+	}
+	in   = (int16_t*) t->mix_buffer;
+	n_in = got / 2;
+	for (i = 0, s = 0; i < frames; i ++, weight += step)
+	{
+		w = weight < WEIGHT_ONE ? (int) (weight >> 16) : 65536;
+		for (ch = 0; ch < t->channels; ch ++, s ++)
+			samples[s] = (int16_t) ((samples[s] * (65536 - w) + (s < n_in ? in[s] : 0) * w) >> 16);
+	}
+}
+
+
+void transition_stats (transition* t, rpi_mp_overlap_stats* stats)
+{
+	int64_t  started = __atomic_load_n (&t->started, __ATOMIC_ACQUIRE);
+	int64_t  overlap = started ? monotonic_us () - started : 0;
+	size_t   rss     = started ? resident_bytes () : 0;
+
+	stats->duration_us    = t->duration;
+	stats->overlap_us     = overlap;
+	stats->decoder_load   = overlap > 0 ? (double) (t->decoder.decode_us - t->decode_us_start) / overlap : 0.0;
+	stats->cpu_load       = overlap > 0 ? (double) (process_cpu_us () - t->cpu_start) / overlap : 0.0;
+	stats->rss_start      = t->rss_start;
+	stats->rss_peak       = rss > t->rss_peak ? rss : t->rss_peak;
+	stats->audio_mixed    = t->mix;
+}
@@ -0,0 +1,171 @@
+/** ----------------------------------------------------------------------------------
+ * File: subtitle_bench.c
+ * Description: Rasterization throughput of the subtitle renderer, built with `make host` so
+ *              it runs on x86 as well as on the Pi. Without a file, feeds synthetic SubRip
+ *              events of one to three lines through the decoder, glyph atlas and overlay as
+ *              fast as it can. With a file, does the same with the packets of its first
+ *              subtitle stream, so PGS and DVB bitmaps can be measured too. The first events
+ *              fill the atlas and are reported apart from the steady state.
+ * ----------------------------------------------------------------------------------- */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libavformat/avformat.h>
+#include "rpi_mp.h"
+#include "rpi_mp_subtitle.h"
+
+#define EVENTS      20000
+#define COLD_EVENTS 32
+#define EVENT_US    2000000
+
+static const char* lines[] =
+{
+	"The quick brown fox jumps over the lazy dog.",
+	"Pack my box with five dozen liquor jugs!",
+	"\"How vexingly quick daft zebras jump,\" she said.",
+	"<i>Voix ambiguë d'un cœur qui, au zéphyr, préfère les jattes de kiwis.</i>",
+	"Falsches Üben von Xylophonmusik quält jeden größeren Zwerg.",
+	"0123456789 - 12:34:56,789 --> (bracketed) [sound of rain]",
+};
+#define N_LINES (sizeof (lines) / sizeof (lines[0]))
+
+
+static int64_t thread_cpu_us ()
+{
+	struct timespec t;
+	clock_gettime (CLOCK_THREAD_CPUTIME_ID, &t);
+	return (int64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+/**
+ *	Rasterizes one event and shows it, the way the subtitle thread does once its time has come.
+ *	Returns the CPU time it took in microseconds, negative on error.
+ */
+static int64_t rasterize (AVPacket* packet, int64_t pts)
+{
+	int64_t start = thread_cpu_us ();
+	if (decode_subtitle_packet (packet, pts, EVENT_US) != 0)
+		return -1;
+	update_subtitles (pts);
+	return thread_cpu_us () - start;
+}
+
+static void report (const char* what, int n, int64_t us)
+{
+	if (n > 0)
+		printf ("%-12s %6d events %10.1f us per event, %8.0f events/s\n", what, n, (double) us / n, us ? 1e6 * n / us : 0.0);
+}
+
+
+int main (int argc, char** argv)
+{
+	AVFormatContext* fmt_ctx = NULL;
+	AVCodecContext * codec_ctx;
+	AVCodec        * codec;
+	AVPacket         packet;
+	char             text[512];
+	int              stream = -1, width = 1920, height = 1080, n = 0, errors = 0, video;
+	int64_t          cold_us = 0, steady_us = 0, us;
+
+	av_register_all ();
+	if (argc > 2 && rpi_mp_subtitle_font (argv[2], 0) != 0)
+		return 1;
+
+	if (argc > 1 && strcmp (argv[1], "-") != 0)
+	{
+		if (avformat_open_input (&fmt_ctx, argv[1], NULL, NULL) < 0 || avformat_find_stream_info (fmt_ctx, NULL) < 0)
+		{
+			fprintf (stderr, "Could not open %s\n", argv[1]);
+			return 1;
+		}
+		if ((stream = av_find_best_stream (fmt_ctx, AVMEDIA_TYPE_SUBTITLE, -1, -1, &codec, 0)) < 0)
+		{
+			fprintf (stderr, "No subtitle stream in %s\n", argv[1]);
+			return 1;
+		}
+		// bitmaps are positioned in the video
+		if ((video = av_find_best_stream (fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0)) >= 0)
+		{
+			width  = fmt_ctx->streams[video]->codec->width;
+			height = fmt_ctx->streams[video]->codec->height;
+		}
+		codec_ctx = fmt_ctx->streams[stream]->codec;
+	}
+	else
+	{
+		codec     = avcodec_find_decoder (AV_CODEC_ID_SUBRIP);
+		codec_ctx = codec ? avcodec_alloc_context3 (codec) : NULL;
+	}
+	if (!codec || !codec_ctx || avcodec_open2 (codec_ctx, codec, NULL) < 0)
+	{
+		fprintf (stderr, "Could not open the subtitle decoder\n");
+		return 1;
+	}
+	if (init_subtitles (codec_ctx, width, height, 0) != 0)
+		return 1;
+
+	av_init_packet (&packet);
+	if (fmt_ctx)
+	{
+		AVRational time_base = fmt_ctx->streams[stream]->time_base;
+		// loop over the file until we have enough events
+		while (n + errors < EVENTS)
+		{
+			if (av_read_frame (fmt_ctx, &packet) < 0)
+			{
+				if (n == 0 || av_seek_frame (fmt_ctx, stream, 0, AVSEEK_FLAG_BACKWARD) < 0)
+					break;
+				continue;
+			}
+			if (packet.stream_index == stream)
+			{
+				us = rasterize (&packet, av_rescale_q (packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts,
+				                                       time_base, AV_TIME_BASE_Q));
+				if (us < 0)
+					errors ++;
+				else if (n ++ < COLD_EVENTS)
+					cold_us += us;
+				else
+					steady_us += us;
+			}
+			av_packet_unref (&packet);
+		}
+	}
+	else
+	{
+		for (n = 0; n < EVENTS; n ++)
+		{
+			// one to three lines, the longer ones wrap
+			int len = snprintf (text, sizeof (text), "%s", lines[n % N_LINES]);
+			if (n % 3 > 0)
+				len += snprintf (text + len, sizeof (text) - len, "\n%s", lines[(n / 3) % N_LINES]);
+			if (n % 3 > 1)
+				len += snprintf (text + len, sizeof (text) - len, " %s %s", lines[(n / 7) % N_LINES], lines[(n / 11) % N_LINES]);
+			packet.data = (uint8_t*) text;
+			packet.size = len;
+			packet.pts  = (int64_t) n * EVENT_US;
+			us = rasterize (&packet, packet.pts);
+			if (us < 0)
+				errors ++;
+			else if (n < COLD_EVENTS)
+				cold_us += us;
+			else
+				steady_us += us;
+		}
+	}
+
+	printf ("%s subtitles on %dx%d video, %d errors\n", fmt_ctx ? argv[1] : "synthetic SubRip", width, height, errors);
+	report ("filling atlas", n < COLD_EVENTS ? n : COLD_EVENTS, cold_us);
+	report ("steady state", n - COLD_EVENTS, steady_us);
+
+	destroy_subtitles ();
+	if (fmt_ctx)
+	{
+		avcodec_close (codec_ctx);
+		avformat_close_input (&fmt_ctx);
+	}
+	else
+		avcodec_free_context (&codec_ctx);
+	return errors > 0;
+}
@@ -0,0 +1,277 @@
+/** ----------------------------------------------------------------------------------
+ * File: timeline_test.c
+ * Description: Unit test of the packet timeline, built with `make host` so it runs on x86 as
+ *              well as on the Pi. Feeds hand made packet timestamps through timeline_packet
+ *              the way the demux loop does and checks what comes out: 33-bit wraps of MPEG-TS,
+ *              gaps and discontinuities with audio and video spliced together, missing pts and
+ *              dts, decoding timestamps that go backwards, a timeline moved to follow another
+ *              source, and the OMX ticks the player hands to the components.
+ * ----------------------------------------------------------------------------------- */
+#include <stdio.h>
+#include <string.h>
+#include <libavformat/avformat.h>
+#include "rpi_mp_timeline.h"
+
+#define VIDEO     0
+#define AUDIO     1
+#define WRAP_BITS 33
+#define WRAP      (1LL << WRAP_BITS)
+#define FRAME     3600   // 25 fps in 90 kHz
+#define FRAME_US  40000
+#define NONE      AV_NOPTS_VALUE
+
+/**
+ *	A demuxer with a video and an audio stream in 90 kHz, like MPEG-TS.
+ */
+typedef struct
+{
+	AVInputFormat    format;
+	AVCodecContext   codecs[2];
+	AVStream         streams[2];
+	AVStream       * stream_list[2];
+	AVFormatContext  fmt_ctx;
+	timeline         t;
+}
+source;
+
+static int failures = 0;
+
+
+static void check (const char* name, int ok)
+{
+	printf ("%s %s\n", ok ? "ok  " : "FAIL", name);
+	if (!ok)
+		failures ++;
+}
+
+/**
+ *	Starts a source, with the discontinuities of MPEG-TS or without, like MP4.
+ */
+static void open_source (source* s, int discontinuities, int b_frames)
+{
+	int i;
+	memset (s, 0x0, sizeof (source));
+	s->format.name  = discontinuities ? "mpegts" : "mp4";
+	s->format.flags = discontinuities ? AVFMT_TS_DISCONT : 0;
+	for (i = 0; i < 2; i ++)
+	{
+		s->streams[i].index         = i;
+		s->streams[i].codec         = &s->codecs[i];
+		s->streams[i].time_base     = (AVRational) { 1, 90000 };
+		s->streams[i].pts_wrap_bits = discontinuities ? WRAP_BITS : 64;
+		s->stream_list[i]           = &s->streams[i];
+	}
+	s->codecs[VIDEO].has_b_frames = b_frames;
+	s->fmt_ctx.iformat    = &s->format;
+	s->fmt_ctx.streams    = s->stream_list;
+	s->fmt_ctx.nb_streams = 2;
+	init_timeline (&s->t, &s->fmt_ctx);
+}
+
+/**
+ *	Puts a packet with the given timestamps in 90 kHz through the timeline, returns it in microseconds.
+ */
+static AVPacket demux (source* s, int stream, int64_t pts, int64_t dts, int duration)
+{
+	AVPacket packet;
+	memset (&packet, 0x0, sizeof (packet));
+	packet.stream_index = stream;
+	packet.pts          = pts;
+	packet.dts          = dts;
+	packet.duration     = duration;
+	timeline_packet (&s->t, &s->fmt_ctx, &packet);
+	return packet;
+}
+
+
+/**
+ *	The 33-bit timestamps of MPEG-TS wrap after 26.5 hours, playback must not notice.
+ */
+static void test_wrap ()
+{
+	source   s;
+	AVPacket p, first;
+	int64_t  dts = WRAP - 50 * FRAME;
+	int      i, steady = 1, b_frame_delay = 1;
+
+	open_source (&s, 1, 1);
+	first = demux (&s, VIDEO, dts + 2 * FRAME, dts, FRAME);
+	for (i = 1; i < 100; i ++)
+	{
+		dts = (dts + FRAME) % WRAP;
+		// the pts runs ahead and wraps first
+		p   = demux (&s, VIDEO, (dts + 2 * FRAME) % WRAP, dts, FRAME);
+		steady        &= p.dts == first.dts + (int64_t) i * FRAME_US;
+		b_frame_delay &= p.pts - p.dts == 2 * FRAME_US;
+	}
+	check ("wrap: dts continues across the wrap", steady);
+	check ("wrap: pts unwrapped against the dts", b_frame_delay);
+	check ("wrap: counted once", s.t.wraps == 1);
+	check ("wrap: not a discontinuity", s.t.discontinuities == 0);
+	check ("wrap: timeline rebased", timeline_rebased (&s.t));
+	timeline_reset (&s.t);
+	check ("wrap: reset takes the timestamps as they are", !timeline_rebased (&s.t));
+	destroy_timeline (&s.t);
+}
+
+/**
+ *	Missing data is a gap the clock plays through; a jump of the timestamps (a splice, a
+ *	restarted encoder) is rebased so both streams continue where they were expected, together.
+ */
+static void test_gaps ()
+{
+	source   s;
+	AVPacket v, a;
+	int64_t  dts = 0;
+	int      i;
+
+	open_source (&s, 1, 0);
+	for (i = 0; i < 10; i ++, dts += FRAME)
+	{
+		v = demux (&s, VIDEO, dts, dts, FRAME);
+		a = demux (&s, AUDIO, dts, dts, FRAME);
+	}
+	// two seconds of lost packets
+	dts += 2 * 90000;
+	v = demux (&s, VIDEO, dts, dts, FRAME);
+	check ("gap: two seconds missing are kept", v.dts == 10 * FRAME_US + 2000000 && s.t.discontinuities == 0);
+
+	// the source jumps an hour ahead, video gets there first
+	a   = demux (&s, AUDIO, dts, dts, FRAME);
+	dts = dts + FRAME;
+	v   = demux (&s, VIDEO, dts + 3600 * 90000LL, dts + 3600 * 90000LL, FRAME);
+	check ("gap: a jump ahead is rebased", v.dts == a.dts + FRAME_US && s.t.discontinuities == 1);
+	a   = demux (&s, AUDIO, dts + 3600 * 90000LL, dts + 3600 * 90000LL, FRAME);
+	check ("gap: audio takes the offset of video", a.dts == v.dts && s.t.discontinuities == 1);
+
+	// and back to zero
+	v = demux (&s, VIDEO, 0, 0, FRAME);
+	a = demux (&s, AUDIO, 0, 0, FRAME);
+	check ("gap: a jump back is rebased", v.dts == a.dts && v.pts == v.dts && s.t.discontinuities == 2);
+	for (i = 1; i < 10; i ++)
+	{
+		v = demux (&s, VIDEO, i * FRAME, i * FRAME, FRAME);
+		a = demux (&s, AUDIO, i * FRAME, i * FRAME, FRAME);
+	}
+	check ("gap: both streams continue together", v.dts == a.dts && s.t.discontinuities == 2);
+	destroy_timeline (&s.t);
+
+	// MP4 has no discontinuities, a jump is what the file says
+	open_source (&s, 0, 0);
+	demux (&s, VIDEO, 0, 0, FRAME);
+	v = demux (&s, VIDEO, 3600 * 90000LL, 3600 * 90000LL, FRAME);
+	check ("gap: kept in a container without discontinuities", v.dts == 3600 * 1000000LL && s.t.discontinuities == 0);
+	destroy_timeline (&s.t);
+}
+
+/**
+ *	A missing pts is taken from the dts only when nothing is reordered, a missing dts always.
+ */
+static void test_missing_pts ()
+{
+	source   s;
+	AVPacket p;
+
+	open_source (&s, 1, 0);
+	p = demux (&s, VIDEO, NONE, 0, FRAME);
+	check ("missing pts: taken from the dts", p.pts == p.dts && p.pts != NONE);
+	p = demux (&s, VIDEO, FRAME, NONE, FRAME);
+	check ("missing dts: taken from the pts", p.dts == FRAME_US && p.pts == FRAME_US);
+	p = demux (&s, VIDEO, NONE, NONE, FRAME);
+	check ("missing both: stay unknown", p.pts == NONE && p.dts == NONE);
+	p = demux (&s, VIDEO, 3 * FRAME, 3 * FRAME, FRAME);
+	check ("missing both: the next packet is not a discontinuity", p.dts == 3 * FRAME_US && s.t.discontinuities == 0);
+	destroy_timeline (&s.t);
+
+	open_source (&s, 1, 1);
+	demux (&s, VIDEO, 2 * FRAME, 0, FRAME);
+	p = demux (&s, VIDEO, NONE, FRAME, FRAME);
+	check ("missing pts with b-frames: stays unknown", p.pts == NONE && p.dts == FRAME_US);
+	destroy_timeline (&s.t);
+}
+
+/**
+ *	A timeline moved to go on where another source left off keeps its timestamps continuous, and a
+ *	jump of the source is still rebased to where it was expected.
+ */
+static void test_shift ()
+{
+	source   s;
+	AVPacket v, a;
+	int64_t  dts = 0, shift = 90 * 1000000LL;
+	int      i;
+
+	open_source (&s, 1, 0);
+	for (i = 0; i < 10; i ++, dts += FRAME)
+	{
+		v = demux (&s, VIDEO, dts, dts, FRAME);
+		a = demux (&s, AUDIO, dts, dts, FRAME);
+	}
+	timeline_shift (&s.t, shift);
+	v = demux (&s, VIDEO, dts, dts, FRAME);
+	a = demux (&s, AUDIO, dts, dts, FRAME);
+	check ("shift: both streams moved", v.dts == shift + 10 * FRAME_US && a.dts == v.dts);
+	check ("shift: not a discontinuity", s.t.discontinuities == 0);
+	dts += FRAME;
+	v = demux (&s, VIDEO, dts + 3600 * 90000LL, dts + 3600 * 90000LL, FRAME);
+	check ("shift: a jump is rebased onto the moved timeline", v.dts == shift + 11 * FRAME_US && s.t.discontinuities == 1);
+	destroy_timeline (&s.t);
+}
+
+/**
+ *	Decoding timestamps handed out never go backwards, and the OMX ticks made of them keep their order.
+ */
+static void test_monotonic ()
+{
+	source   s;
+	AVPacket p;
+	int64_t  dts, last = NONE, us;
+	uint32_t low, high, last_low = 0, last_high = 0;
+	int      i, monotonic = 1, ordered = 1, round_trip = 1;
+
+	open_source (&s, 1, 0);
+	for (i = 0; i < 200; i ++)
+	{
+		// every tenth packet jitters 100 ms back
+		dts = i * FRAME - (i % 10 == 9 ? 9000 : 0);
+		p   = demux (&s, VIDEO, dts, dts, FRAME);
+		if (last != NONE && p.dts < last)
+			monotonic = 0;
+		last = p.dts;
+	}
+	check ("monotonic: jitter backwards is clamped", monotonic && s.t.discontinuities == 0);
+	destroy_timeline (&s.t);
+
+	// around zero (pre-roll), across the low half overflowing after 71 minutes, and far out
+	for (us = -3 * FRAME_US; us < 3 * FRAME_US; us += 1000)
+	{
+		timeline_ticks (us, &low, &high);
+		round_trip &= timeline_ticks_us (low, high) == us;
+	}
+	for (i = 0, us = 0xFFFFFFFFLL - 10 * FRAME_US; i < 20; i ++, us += FRAME_US)
+	{
+		timeline_ticks (us, &low, &high);
+		round_trip &= timeline_ticks_us (low, high) == us;
+		if (i > 0 && (high < last_high || (high == last_high && low <= last_low)))
+			ordered = 0;
+		last_low  = low;
+		last_high = high;
+	}
+	timeline_ticks (30 * 3600 * 1000000LL, &low, &high);
+	round_trip &= timeline_ticks_us (low, high) == 30 * 3600 * 1000000LL;
+	check ("omx ticks: round trip", round_trip);
+	check ("omx ticks: in order across the low half", ordered);
+}
+
+
+int main (int argc, char** argv)
+{
+	test_wrap ();
+	test_gaps ();
+	test_missing_pts ();
+	test_shift ();
+	test_monotonic ();
+
+	printf ("%d failures\n", failures);
+	return failures > 0;
+}